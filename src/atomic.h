@@ -12,7 +12,7 @@ inline int AtomicLockAndExchange(volatile i32 * dest, i32 value)
 #elif defined __linux__
 inline int AtomicLockAndExchange(volatile i32 * dest, i32 value)
 {
-    return __sync_lock_test_and_set ((volatile long *)dest, value);
+    return __atomic_exchange_n(dest, value, __ATOMIC_SEQ_CST);
 }
 #else
 #error Unsupported OS
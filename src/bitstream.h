@@ -0,0 +1,355 @@
+#ifndef UDP_BITSTREAM_H
+#define UDP_BITSTREAM_H
+
+#include "platform.h"
+#include "math.h"
+#include <string.h>
+
+/*
+ * Bit packed streams for message payloads
+ *
+ * Three streams share the same interface so a message is described once:
+ *
+ *   template <typename stream> b32
+ *   Serialize(stream & s, my_message & msg)
+ *   {
+ *       SerializeInt(s, msg.health, 0, 100);
+ *       SerializeBool(s, msg.alive);
+ *       return SerializeOk(s);
+ *   }
+ *
+ * and the compiler stamps out the write, read and measure versions of it.
+ * Ranges are part of the schema, a value in [min, max] takes
+ * BitsRequired(min, max) bits. Readers validate every range and length,
+ * anything out of it (or reading past the end) flags the stream as failed.
+ *
+ * Bits go into a 64 bit scratch and out to memory 32 bits at a time,
+ * little endian.
+ */
+
+constexpr u32
+BitsRequired(u32 range)
+{
+    return (range == 0) ? 0 : 1 + BitsRequired(range >> 1);
+}
+
+constexpr u32
+BitsRequired(i32 min, i32 max)
+{
+    return BitsRequired((u32)((i64)max - (i64)min));
+}
+
+struct write_stream
+{
+    enum { IsWriting = 1, IsReading = 0 };
+
+    u8 * data;
+    u32 capacity_bits;
+    u32 bits_written;
+    u32 bytes_flushed;
+    u64 scratch;
+    u32 scratch_bits;
+    b32 failed;
+
+    inline void
+    SerializeBits(u32 & value, u32 bits)
+    {
+        Assert(bits <= 32);
+        if (failed || (bits_written + bits) > capacity_bits)
+        {
+            failed = true;
+            return;
+        }
+
+        u64 mask = ((u64)1 << bits) - 1;
+        scratch |= ((u64)value & mask) << scratch_bits;
+        scratch_bits += bits;
+        bits_written += bits;
+
+        if (scratch_bits >= 32)
+        {
+            u32 word = (u32)scratch;
+            memcpy(data + bytes_flushed, &word, sizeof(word));
+            bytes_flushed += 4;
+            scratch >>= 32;
+            scratch_bits -= 32;
+        }
+    }
+
+    inline void
+    SerializeBytes(u8 * bytes, u32 count)
+    {
+        for (u32 i = 0; i < count; ++i)
+        {
+            u32 value = bytes[i];
+            SerializeBits(value, 8);
+        }
+    }
+
+    /* writes what is left in scratch, returns total bytes */
+    inline u32
+    Flush()
+    {
+        u32 tail_bytes = (scratch_bits + 7) / 8;
+        u32 word = (u32)scratch;
+        memcpy(data + bytes_flushed, &word, tail_bytes);
+        bytes_flushed += tail_bytes;
+        scratch = 0;
+        scratch_bits = 0;
+
+        return bytes_flushed;
+    }
+};
+
+struct read_stream
+{
+    enum { IsWriting = 0, IsReading = 1 };
+
+    const u8 * data;
+    u32 size_bytes;
+    u32 bits_read;
+    u32 bytes_loaded;
+    u64 scratch;
+    u32 scratch_bits;
+    b32 failed;
+
+    inline void
+    SerializeBits(u32 & value, u32 bits)
+    {
+        Assert(bits <= 32);
+        if (failed || (bits_read + bits) > size_bytes * 8)
+        {
+            failed = true;
+            value = 0;
+            return;
+        }
+
+        if (scratch_bits < bits)
+        {
+            u32 word = 0;
+            u32 load_bytes = min(size_bytes - bytes_loaded, (u32)sizeof(word));
+            memcpy(&word, data + bytes_loaded, load_bytes);
+            bytes_loaded += load_bytes;
+            scratch |= (u64)word << scratch_bits;
+            scratch_bits += 32;
+        }
+
+        u64 mask = ((u64)1 << bits) - 1;
+        value = (u32)(scratch & mask);
+        scratch >>= bits;
+        scratch_bits -= bits;
+        bits_read += bits;
+    }
+
+    inline void
+    SerializeBytes(u8 * bytes, u32 count)
+    {
+        for (u32 i = 0; i < count; ++i)
+        {
+            u32 value = 0;
+            SerializeBits(value, 8);
+            bytes[i] = (u8)value;
+        }
+    }
+};
+
+struct measure_stream
+{
+    enum { IsWriting = 1, IsReading = 0 };
+
+    u32 bits;
+    b32 failed;
+
+    inline void
+    SerializeBits(u32 & value, u32 value_bits)
+    {
+        bits += value_bits;
+    }
+
+    inline void
+    SerializeBytes(u8 * bytes, u32 count)
+    {
+        bits += count * 8;
+    }
+};
+
+inline write_stream
+WriteStream(u8 * data, u32 capacity)
+{
+    write_stream s = {};
+    s.data = data;
+    s.capacity_bits = capacity * 8;
+
+    return s;
+}
+
+inline read_stream
+ReadStream(const u8 * data, u32 size)
+{
+    read_stream s = {};
+    s.data = data;
+    s.size_bytes = size;
+
+    return s;
+}
+
+/* PRIMITIVES */
+
+template <typename stream> inline b32
+SerializeOk(stream & s)
+{
+    return !s.failed;
+}
+
+template <typename stream> inline void
+SerializeUnsigned(stream & s, u32 & value, u32 min, u32 max)
+{
+    Assert(min <= max);
+    u32 bits = BitsRequired(max - min);
+    u32 offset = 0;
+
+    if (stream::IsWriting)
+    {
+        Assert(value >= min && value <= max);
+        offset = value - min;
+    }
+
+    s.SerializeBits(offset, bits);
+
+    if (stream::IsReading)
+    {
+        value = min + offset;
+        s.failed |= (offset > (max - min));
+    }
+}
+
+template <typename stream> inline void
+SerializeInt(stream & s, i32 & value, i32 min, i32 max)
+{
+    Assert(min <= max);
+    u32 bits = BitsRequired(min, max);
+    u32 offset = 0;
+
+    if (stream::IsWriting)
+    {
+        Assert(value >= min && value <= max);
+        offset = (u32)((i64)value - (i64)min);
+    }
+
+    s.SerializeBits(offset, bits);
+
+    if (stream::IsReading)
+    {
+        s.failed |= (offset > (u32)((i64)max - (i64)min));
+        value = s.failed ? min : (i32)((i64)min + (i64)offset);
+    }
+}
+
+/* full 64 bits, low word first */
+template <typename stream> inline void
+SerializeU64(stream & s, u64 & value)
+{
+    u32 low = (u32)value;
+    u32 high = (u32)(value >> 32);
+    s.SerializeBits(low, 32);
+    s.SerializeBits(high, 32);
+
+    if (stream::IsReading)
+    {
+        value = ((u64)high << 32) | low;
+    }
+}
+
+template <typename stream> inline void
+SerializeBool(stream & s, b32 & value)
+{
+    u32 bit = value ? 1 : 0;
+    s.SerializeBits(bit, 1);
+    value = (b32)bit;
+}
+
+template <typename stream> inline void
+SerializeFloat(stream & s, r32 & value)
+{
+    u32 bits = 0;
+    memcpy(&bits, &value, sizeof(bits));
+    s.SerializeBits(bits, 32);
+    memcpy(&value, &bits, sizeof(bits));
+}
+
+/* zero terminated string in a char[buffer_size], at most buffer_size - 1 chars go on the wire */
+template <typename stream> inline void
+SerializeString(stream & s, char * str, u32 buffer_size)
+{
+    Assert(buffer_size > 0);
+    u32 max_length = buffer_size - 1;
+    u32 length = 0;
+
+    if (stream::IsWriting)
+    {
+        while (length < max_length && str[length])
+        {
+            length += 1;
+        }
+    }
+
+    SerializeUnsigned(s, length, 0, max_length);
+    if (!SerializeOk(s))
+    {
+        return;
+    }
+
+    s.SerializeBytes((u8 *)str, length);
+
+    if (stream::IsReading)
+    {
+        str[length] = 0;
+    }
+}
+
+/* items[0..count), count in [0, max_count], each item through its own Serialize */
+template <typename stream, typename T> inline void
+SerializeArray(stream & s, T * items, u32 & count, u32 max_count)
+{
+    SerializeUnsigned(s, count, 0, max_count);
+
+    for (u32 i = 0; i < count && SerializeOk(s); ++i)
+    {
+        Serialize(s, items[i]);
+    }
+}
+
+/* WHOLE MESSAGES */
+
+/* returns bytes written, 0 if it didn't fit */
+template <typename T> inline u32
+WriteMessage(T & value, u8 * data, u32 capacity)
+{
+    write_stream s = WriteStream(data, capacity);
+    Serialize(s, value);
+
+    u32 size = SerializeOk(s) ? s.Flush() : 0;
+
+    return size;
+}
+
+template <typename T> inline b32
+ReadMessage(T & value, const u8 * data, u32 size)
+{
+    read_stream s = ReadStream(data, size);
+    Serialize(s, value);
+
+    return SerializeOk(s);
+}
+
+/* bytes WriteMessage would take */
+template <typename T> inline u32
+MeasureMessage(T & value)
+{
+    measure_stream s = {};
+    Serialize(s, value);
+
+    return (s.bits + 7) / 8;
+}
+
+#endif
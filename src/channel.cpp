@@ -0,0 +1,716 @@
+#include "channel.h"
+#include "serialize.h"
+#include "math.h"
+#include <string.h>
+
+#define QUEUE_SIZE(queue) ArrayCount((queue)->messages)
+
+inline package_type
+GetMessageType(message * msg)
+{
+    package_type result = (package_type)((int)msg->header.message_type & MESSAGE_TYPE_MASK);
+
+    return result;
+}
+
+inline channel_id
+GetMessageChannel(message * msg)
+{
+    channel_id result = (channel_id)((int)msg->header.message_type >> MESSAGE_CHANNEL_SHIFT);
+
+    return result;
+}
+
+inline i32
+IsReliableChannel(channel_id channel)
+{
+    i32 is_reliable = (channel != channel_unreliable);
+
+    return is_reliable;
+}
+
+void
+ChannelsInit(message_channels * channels)
+{
+    memset(channels, 0, sizeof(message_channels));
+}
+
+/* seq of the packet occupying bit_index, given the latest seq sent */
+inline u32
+SeqFromBitIndex(u32 latest_seq, u32 bit_index)
+{
+    u32 seq = latest_seq - ((latest_seq - bit_index) & 31);
+
+    return seq;
+}
+
+u32
+CountFreeMessages(queue_message * queue)
+{
+    u32 count = 0;
+    for (u32 i = 0; i < QUEUE_SIZE(queue); ++i)
+    {
+        count += (queue->state[i] == message_state_free);
+    }
+
+    return count;
+}
+
+struct message *
+GetNextAvailableMessageInQueue(struct queue_message * queue, r32 priority)
+{
+    for (u32 n = 0; n < QUEUE_SIZE(queue); ++n)
+    {
+        u32 index = (queue->next + n) & (QUEUE_SIZE(queue) - 1);
+        if (queue->state[index] == message_state_free)
+        {
+            queue->next = (index + 1) & (QUEUE_SIZE(queue) - 1);
+            queue->state[index] = message_state_pending;
+            queue->priority[index] = priority;
+            queue->accumulated_priority[index] = priority;
+            // a late ack of the last message in the slot must not match this one
+            queue->sent_in_seq[index] = 0;
+            queue->copies[index] = 0;
+            queue->timed_out[index] = false;
+            memset(queue->copy_seq[index], 0, sizeof(queue->copy_seq[index]));
+            return queue->messages + index;
+        }
+    }
+
+    return 0;
+}
+
+/* returns false if the queue can't hold all the messages, nothing is queued then */
+b32
+CreatePackages(message_channels * channels, channel_id channel, enum package_type packet_type, const void * data, u32 size, r32 priority)
+{
+    queue_message * queue = channels->send_queue + channel;
+    u32 msg_data_size = sizeof(queue->messages[0].data);
+    b32 needs_buffer_msg = (size > msg_data_size);
+    u32 msg_required = (size + msg_data_size - 1) / msg_data_size + (needs_buffer_msg ? 1 : 0);
+
+    if (CountFreeMessages(queue) < msg_required)
+    {
+        return false;
+    }
+
+    i32 order = 0;
+    u8 channel_mask = (u8)(channel << MESSAGE_CHANNEL_SHIFT);
+
+    // create a header package so peer knows needs to create buffer
+    if (needs_buffer_msg)
+    {
+        struct message * msg = GetNextAvailableMessageInQueue(queue, priority);
+        msg->header.id = (u8)queue->last_id++;
+        msg->header.order = order;
+        msg->header.message_type = package_type_buffer | channel_mask;
+
+        udp_buffer buffer_msg = { size };
+        msg->header.len = (u8)WriteMessage(buffer_msg, msg->data, sizeof(msg->data));
+
+        order += 1;
+    }
+
+    const u8 * src = (const u8 *)data;
+    while (size > 0)
+    {
+        u32 used_size = min(size, msg_data_size);
+
+        struct message * msg = GetNextAvailableMessageInQueue(queue, priority);
+
+        msg->header.id = (u8)queue->last_id++;
+        msg->header.order = order;
+        msg->header.message_type = packet_type | channel_mask;
+        msg->header.len = used_size;
+
+        memcpy(msg->data, src, used_size);
+
+        src += used_size;
+        size -= used_size;
+        order += 1;
+    }
+
+    return true;
+}
+
+struct pack_candidate
+{
+    r32 accumulated_priority;
+    u8 channel;
+    u8 index;
+};
+
+/* one wire entry, a single message or a run of merged ones */
+#define PACK_RECORD_MAX_MEMBERS 32
+struct pack_record
+{
+    u8 channel;
+    u8 message_type;
+    u8 first_id;
+    // of the first member, a fragment starts no run (its order goes on the wire)
+    u8 first_order;
+    u8 member_count;
+    u8 members[PACK_RECORD_MAX_MEMBERS];
+    // payload bytes of the record (without message_header)
+    u32 payload_size;
+};
+
+/*
+ * Runs of messages with consecutive ids, same channel and type,
+ * that are not fragments of a bigger one (order 0) go under one header:
+ *   header.message_type |= MESSAGE_MERGED_FLAG
+ *   header.id = id of the first one
+ *   header.order = count of merged messages
+ *   payload = [u8 len][data] * count
+ */
+inline b32
+CanMergeIntoRecord(pack_record * record, message * msg, u8 channel)
+{
+    b32 can_merge = 
+        (record->channel == channel) &&
+        (record->message_type == GetMessageType(msg)) &&
+        (record->first_order == 0) &&
+        (msg->header.order == 0) &&
+        (record->member_count < PACK_RECORD_MAX_MEMBERS) &&
+        (msg->header.id == (u8)(record->first_id + record->member_count) ||
+         msg->header.id == (u8)(record->first_id - 1));
+
+    return can_merge;
+}
+
+inline u32
+MergedPayloadSize(pack_record * record, message * msg)
+{
+    // single messages have no length prefix yet
+    u32 current = record->payload_size + (record->member_count == 1 ? 1 : 0);
+    u32 size = current + 1 + msg->header.len;
+
+    return size;
+}
+
+/*
+ * Packs pending messages into the packet seq, up to budget bytes at data.
+ *  1) pending messages sorted by accumulated priority
+ *  2) selection: highest priority first while the total fits the budget,
+ *     merging into an already selected run when it can (1 byte instead of a header)
+ *  3) records written in the order they were selected
+ * Reliable messages stay in flight tagged with seq, unreliable are released.
+ * Messages that didn't make it keep their accumulated priority.
+ * Returns bytes used.
+ */
+u32
+ChannelsPackPacket(message_channels * channels, u32 seq, u8 * data, u32 budget, u16 * message_count, b32 * has_reliable)
+{
+    pack_candidate candidates[channel_count * ArrayCount(channels->send_queue[0].messages)];
+    u32 candidate_count = 0;
+
+    for (u32 channel = 0; channel < channel_count; ++channel)
+    {
+        queue_message * queue = channels->send_queue + channel;
+
+        for (u32 n = 0; n < QUEUE_SIZE(queue); ++n)
+        {
+            // oldest first so ties keep queue order
+            u32 i = (queue->next + n) & (QUEUE_SIZE(queue) - 1);
+            if (queue->state[i] != message_state_pending)
+            {
+                continue;
+            }
+
+            queue->accumulated_priority[i] += queue->priority[i];
+
+            // insertion sort, descending and stable
+            pack_candidate candidate = { queue->accumulated_priority[i], (u8)channel, (u8)i };
+            u32 insert_at = candidate_count++;
+            while (insert_at > 0 && 
+                   candidates[insert_at - 1].accumulated_priority < candidate.accumulated_priority)
+            {
+                candidates[insert_at] = candidates[insert_at - 1];
+                insert_at -= 1;
+            }
+            candidates[insert_at] = candidate;
+        }
+    }
+
+    /* SELECTION */
+    pack_record records[ArrayCount(candidates)];
+    u32 record_count = 0;
+    u32 selected_size = 0;
+
+    for (u32 candidate_index = 0; candidate_index < candidate_count; ++candidate_index)
+    {
+        pack_candidate * candidate = candidates + candidate_index;
+        queue_message * queue = channels->send_queue + candidate->channel;
+        message * msg = queue->messages + candidate->index;
+
+        b32 merged = false;
+        if (msg->header.order == 0)
+        {
+            for (u32 record_index = 0; record_index < record_count; ++record_index)
+            {
+                pack_record * record = records + record_index;
+                if (!CanMergeIntoRecord(record, msg, candidate->channel))
+                {
+                    continue;
+                }
+
+                u32 merged_payload = MergedPayloadSize(record, msg);
+                u32 extra = merged_payload - record->payload_size;
+                if (merged_payload > 255 || (selected_size + extra) > budget)
+                {
+                    continue;
+                }
+
+                if (msg->header.id == (u8)(record->first_id - 1))
+                {
+                    memmove(record->members + 1, record->members, record->member_count);
+                    record->members[0] = candidate->index;
+                    record->first_id = msg->header.id;
+                }
+                else
+                {
+                    record->members[record->member_count] = candidate->index;
+                }
+
+                record->member_count += 1;
+                record->payload_size = merged_payload;
+                selected_size += extra;
+                merged = true;
+                break;
+            }
+        }
+
+        if (!merged)
+        {
+            u32 msg_size = sizeof(message_header) + msg->header.len;
+            // doesn't fit, smaller ones further down still might
+            if ((selected_size + msg_size) > budget)
+            {
+                continue;
+            }
+
+            pack_record * record = records + record_count++;
+            record->channel = candidate->channel;
+            record->message_type = GetMessageType(msg);
+            record->first_id = msg->header.id;
+            record->first_order = msg->header.order;
+            record->member_count = 1;
+            record->members[0] = candidate->index;
+            record->payload_size = msg->header.len;
+            selected_size += msg_size;
+        }
+    }
+
+    u8 * dst = data;
+    for (u32 record_index = 0; record_index < record_count; ++record_index)
+    {
+        pack_record * record = records + record_index;
+        queue_message * queue = channels->send_queue + record->channel;
+
+        message_header * header = (message_header *)dst;
+        header->len = (u8)record->payload_size;
+        header->message_type = record->message_type | (u8)(record->channel << MESSAGE_CHANNEL_SHIFT);
+        header->id = record->first_id;
+        // keeps fragment order
+        header->order = record->first_order;
+        dst += sizeof(message_header);
+
+        if (record->member_count > 1)
+        {
+            header->message_type |= MESSAGE_MERGED_FLAG;
+            header->order = record->member_count;
+        }
+
+        for (u32 member_index = 0; member_index < record->member_count; ++member_index)
+        {
+            u32 i = record->members[member_index];
+            message * msg = queue->messages + i;
+
+            if (record->member_count > 1)
+            {
+                *dst++ = msg->header.len;
+            }
+            memcpy(dst, msg->data, msg->header.len);
+            dst += msg->header.len;
+
+            queue->accumulated_priority[i] = 0.0f;
+            queue->copies[i] = 0;
+            queue->timed_out[i] = false;
+
+            if (IsReliableChannel((channel_id)record->channel))
+            {
+                queue->state[i] = message_state_in_flight;
+                queue->sent_in_seq[i] = seq;
+                *has_reliable = true;
+            }
+            else
+            {
+                queue->state[i] = message_state_free;
+            }
+        }
+    }
+    *message_count += (u16)record_count;
+
+    u32 used = (u32)(dst - data);
+    Assert(used == selected_size);
+
+    return used;
+}
+
+b32
+ChannelsHasPending(message_channels * channels)
+{
+    for (u32 channel = 0; channel < channel_count; ++channel)
+    {
+        queue_message * queue = channels->send_queue + channel;
+        for (u32 i = 0; i < QUEUE_SIZE(queue); ++i)
+        {
+            if (queue->state[i] == message_state_pending)
+            {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+/* copies of recent messages each packet should carry */
+inline u32
+RedundancyDepth(r32 loss_rate)
+{
+    u32 depth = 0;
+    if (loss_rate >= 0.15f)
+    {
+        depth = 3;
+    }
+    else if (loss_rate >= 0.05f)
+    {
+        depth = 2;
+    }
+    else if (loss_rate >= 0.01f)
+    {
+        depth = 1;
+    }
+
+    Assert(depth <= MESSAGE_MAX_COPIES);
+
+    return depth;
+}
+
+/*
+ * Fills up to room bytes at data with copies of in flight reliable messages,
+ * most recently sent first, each one at most depth times.
+ * Returns bytes used.
+ */
+u32
+ChannelsPackRedundant(message_channels * channels, u32 seq, u8 * data, u32 room, u32 depth, u16 * message_count)
+{
+    if (depth == 0)
+    {
+        return 0;
+    }
+
+    pack_candidate candidates[channel_count * ArrayCount(channels->send_queue[0].messages)];
+    u32 candidate_count = 0;
+
+    for (u32 channel = 0; channel < channel_count; ++channel)
+    {
+        if (!IsReliableChannel((channel_id)channel))
+        {
+            continue;
+        }
+
+        queue_message * queue = channels->send_queue + channel;
+        for (u32 i = 0; i < QUEUE_SIZE(queue); ++i)
+        {
+            if (queue->state[i] != message_state_in_flight ||
+                queue->priority[i] < REDUNDANT_MIN_PRIORITY ||
+                queue->messages[i].header.len > REDUNDANT_MAX_SIZE ||
+                queue->copies[i] >= depth ||
+                queue->sent_in_seq[i] == seq)
+            {
+                continue;
+            }
+
+            // age in packets, youngest first
+            pack_candidate candidate = { (r32)(seq - queue->sent_in_seq[i]), (u8)channel, (u8)i };
+            u32 insert_at = candidate_count++;
+            while (insert_at > 0 && 
+                   candidates[insert_at - 1].accumulated_priority > candidate.accumulated_priority)
+            {
+                candidates[insert_at] = candidates[insert_at - 1];
+                insert_at -= 1;
+            }
+            candidates[insert_at] = candidate;
+        }
+    }
+
+    u32 used = 0;
+    for (u32 candidate_index = 0; candidate_index < candidate_count; ++candidate_index)
+    {
+        pack_candidate * candidate = candidates + candidate_index;
+        queue_message * queue = channels->send_queue + candidate->channel;
+        message * msg = queue->messages + candidate->index;
+
+        u32 msg_size = sizeof(message_header) + msg->header.len;
+        if ((used + msg_size) > room)
+        {
+            continue;
+        }
+
+        memcpy(data + used, msg, msg_size);
+        used += msg_size;
+        *message_count += 1;
+
+        queue->copy_seq[candidate->index][queue->copies[candidate->index]++] = seq;
+    }
+
+    channels->redundant_bytes_sent += used;
+
+    return used;
+}
+
+inline b32
+IsCopySeq(queue_message * queue, u32 i, u32 seq)
+{
+    for (u32 copy = 0; copy < queue->copies[i]; ++copy)
+    {
+        if (queue->copy_seq[i][copy] == seq)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void
+ChannelsOnPacketAcked(message_channels * channels, u32 seq)
+{
+    for (u32 channel = 0; channel < channel_count; ++channel)
+    {
+        queue_message * queue = channels->send_queue + channel;
+        for (u32 i = 0; i < QUEUE_SIZE(queue); ++i)
+        {
+            u8 state = queue->state[i];
+            if ((state == message_state_in_flight || state == message_state_delivered) && 
+                queue->sent_in_seq[i] == seq)
+            {
+                queue->state[i] = message_state_free;
+            }
+            else if (state == message_state_in_flight && IsCopySeq(queue, i, seq))
+            {
+                // keep the slot until the original packet is acked or lost
+                queue->state[i] = message_state_delivered;
+            }
+            else if (state == message_state_pending && queue->timed_out[i] && queue->sent_in_seq[i] == seq)
+            {
+                // ack came after the retransmit timeout, no need to send it again
+                queue->state[i] = message_state_free;
+            }
+            else if (state == message_state_pending && queue->timed_out[i] && IsCopySeq(queue, i, seq))
+            {
+                // original already lost and waiting to be resent
+                queue->state[i] = message_state_free;
+                channels->retransmits_avoided += 1;
+            }
+        }
+    }
+}
+
+/* returns how many messages have to be sent again */
+u32
+ChannelsOnPacketLost(message_channels * channels, u32 seq)
+{
+    u32 resend_count = 0;
+    for (u32 channel = 0; channel < channel_count; ++channel)
+    {
+        queue_message * queue = channels->send_queue + channel;
+        for (u32 i = 0; i < QUEUE_SIZE(queue); ++i)
+        {
+            if (queue->sent_in_seq[i] != seq)
+            {
+                continue;
+            }
+
+            if (queue->state[i] == message_state_in_flight)
+            {
+                queue->state[i] = message_state_pending;
+                queue->timed_out[i] = true;
+                resend_count += 1;
+            }
+            else if (queue->state[i] == message_state_delivered)
+            {
+                // a copy made it
+                queue->state[i] = message_state_free;
+                channels->retransmits_avoided += 1;
+            }
+        }
+    }
+
+    return resend_count;
+}
+
+b32 ChannelReceiveMessage(message_channels * channels, message * msg, message * delivered, u32 * delivered_count);
+
+/*
+ * Runs a received wire entry through its channel, merged runs are
+ * split back into single messages first.
+ * False if the record is malformed or delivered is full, the rest of the
+ * packet has to be dropped and the packet not acked: what didn't make it
+ * comes again and what did is dropped by id.
+ */
+b32
+ChannelReceiveRecord(message_channels * channels, message * record, message * delivered, u32 * delivered_count)
+{
+    if ((record->header.message_type & MESSAGE_MERGED_FLAG) == 0)
+    {
+        return ChannelReceiveMessage(channels, record, delivered, delivered_count);
+    }
+
+    // every member takes at least its length byte
+    u32 member_count = record->header.order;
+    if (member_count > record->header.len)
+    {
+        channels->records_malformed += 1;
+        return false;
+    }
+
+    // no more than delivered can still take, the packet is refused without going through the rest
+    u32 room = CHANNEL_MAX_DELIVERED - *delivered_count;
+    if (member_count > room)
+    {
+        member_count = room;
+    }
+
+    u8 * at = (u8 *)record->data;
+    u8 * end = at + record->header.len;
+    message msg;
+
+    for (u32 member_index = 0; member_index < member_count; ++member_index)
+    {
+        // crafted or corrupted
+        if (at >= end || (at + 1 + *at) > end)
+        {
+            channels->records_malformed += 1;
+            return false;
+        }
+
+        msg.header.len = *at++;
+        msg.header.message_type = record->header.message_type & ~MESSAGE_MERGED_FLAG;
+        msg.header.id = (u8)(record->header.id + member_index);
+        msg.header.order = 0;
+        memcpy(msg.data, at, min((u32)msg.header.len, (u32)sizeof(msg.data)));
+        at += msg.header.len;
+
+        if (!ChannelReceiveMessage(channels, &msg, delivered, delivered_count))
+        {
+            return false;
+        }
+    }
+
+    if (member_count < record->header.order)
+    {
+        channels->delivered_full += 1;
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Runs a received message through its channel.
+ * Messages ready for the application are copied into delivered, up to
+ * CHANNEL_MAX_DELIVERED. False when it is full (msg is left as if it never
+ * got here) or msg is malformed.
+ */
+b32
+ChannelReceiveMessage(message_channels * channels, message * msg, message * delivered, u32 * delivered_count)
+{
+    channel_id channel = GetMessageChannel(msg);
+    // crafted or corrupted
+    if (channel >= channel_count || msg->header.len > sizeof(msg->data))
+    {
+        channels->records_malformed += 1;
+        return false;
+    }
+
+    channel_receiver * receiver = channels->receive + channel;
+    u32 msg_size = sizeof(message_header) + msg->header.len;
+    u8 id = msg->header.id;
+
+    switch (channel)
+    {
+        case channel_unreliable:
+            {
+                if (*delivered_count >= CHANNEL_MAX_DELIVERED)
+                {
+                    channels->delivered_full += 1;
+                    return false;
+                }
+                memcpy(delivered + (*delivered_count)++, msg, msg_size);
+            } break;
+        case channel_reliable_unordered:
+            {
+                u32 id_mask = ((u32)1 << (id & 31));
+                if ((receiver->received_id_bit[id >> 5] & id_mask) == 0)
+                {
+                    // not marked seen, the resend gets it through
+                    if (*delivered_count >= CHANNEL_MAX_DELIVERED)
+                    {
+                        channels->delivered_full += 1;
+                        return false;
+                    }
+                    receiver->received_id_bit[id >> 5] |= id_mask;
+
+                    // forget ids half the window away so they can be seen again after wrap
+                    u8 old_id = (u8)(id + 128);
+                    receiver->received_id_bit[old_id >> 5] &= ~((u32)1 << (old_id & 31));
+
+                    memcpy(delivered + (*delivered_count)++, msg, msg_size);
+                }
+            } break;
+        case channel_reliable_ordered:
+            {
+                u8 distance = (u8)(id - receiver->next_id);
+
+                // behind us (duplicate) or beyond the reorder window (will be resent)
+                if (distance >= CHANNEL_REORDER_SIZE)
+                {
+                    break;
+                }
+
+                u32 slot = id & (CHANNEL_REORDER_SIZE - 1);
+                memcpy(receiver->reorder_buffer + slot, msg, msg_size);
+                receiver->reorder_valid_bit |= ((u32)1 << slot);
+
+                for (;;)
+                {
+                    u32 next_slot = receiver->next_id & (CHANNEL_REORDER_SIZE - 1);
+                    u32 next_mask = ((u32)1 << next_slot);
+                    if ((receiver->reorder_valid_bit & next_mask) == 0)
+                    {
+                        break;
+                    }
+
+                    // the rest wait in the reorder buffer for the next packet
+                    if (*delivered_count >= CHANNEL_MAX_DELIVERED)
+                    {
+                        channels->delivered_full += 1;
+                        return false;
+                    }
+                    message * ready = receiver->reorder_buffer + next_slot;
+                    memcpy(delivered + (*delivered_count)++, ready, sizeof(message_header) + ready->header.len);
+
+                    receiver->reorder_valid_bit &= ~next_mask;
+                    receiver->next_id += 1;
+                }
+            } break;
+        default:
+            {
+            } break;
+    }
+
+    return true;
+}
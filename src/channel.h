@@ -0,0 +1,71 @@
+#ifndef UDP_CHANNEL_H
+#define UDP_CHANNEL_H
+
+#include "protocol.h"
+
+/*
+ * Delivery channels
+ *
+ * Every peer has one send queue per channel. Acks are per packet,
+ * each reliable message remembers the seq of the packet it went in:
+ *  - packet ack    -> message slot is free
+ *  - packet lost   -> message is pending again and gets repacked
+ * Unreliable messages are freed as soon as they are packed.
+ *
+ * On the receiving side message id is the sequence within the channel:
+ *  - unreliable: delivered as is
+ *  - reliable unordered: delivered on arrival, duplicates dropped by id
+ *  - reliable ordered: delivered in id order, early arrivals wait in a reorder buffer
+ * Channels don't share any state so loss on one never delays the others.
+ *
+ * Packing doesn't follow queue order. Every pending message adds its priority
+ * to an accumulator each time a packet is packed, the packet is filled
+ * highest accumulated priority first within the byte budget and the
+ * accumulator of messages sent goes back to 0. Under bandwidth pressure
+ * important messages get through first and the rest still can't starve.
+ * The selected messages are merged in runs under one header when possible.
+ *
+ * Space left in a packet can carry copies of the most recent in flight
+ * reliable messages that are small and high priority (inputs, casts...).
+ * An ack of any packet with a copy counts as delivered, so a lost packet
+ * doesn't cost a retransmit. Receivers drop the duplicates by id.
+ * How many copies of each message depends on the loss rate.
+ */
+
+#define CHANNEL_REORDER_SIZE 32
+#define CHANNEL_MAX_DELIVERED 128
+
+#define MESSAGE_PRIORITY_LOW 0.25f
+#define MESSAGE_PRIORITY_NORMAL 1.0f
+#define MESSAGE_PRIORITY_HIGH 4.0f
+
+// what is worth a redundant copy
+#define REDUNDANT_MIN_PRIORITY MESSAGE_PRIORITY_HIGH
+#define REDUNDANT_MAX_SIZE 64
+
+struct channel_receiver
+{
+    // reliable unordered: ids seen, 256 bits indexed by id
+    u32 received_id_bit[8];
+
+    // reliable ordered: next id to deliver
+    u8 next_id;
+    u32 reorder_valid_bit;
+    message reorder_buffer[CHANNEL_REORDER_SIZE];
+};
+
+struct message_channels
+{
+    queue_message send_queue[channel_count];
+    channel_receiver receive[channel_count];
+
+    // redundant copies stats
+    u32 redundant_bytes_sent;
+    u32 retransmits_avoided;
+
+    // receive stats, packets dropped for them
+    u32 records_malformed;
+    u32 delivered_full;
+};
+
+#endif
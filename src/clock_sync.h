@@ -0,0 +1,293 @@
+#ifndef UDP_CLOCK_SYNC_H
+#define UDP_CLOCK_SYNC_H
+
+#include "protocol.h"
+#include "serialize.h"
+
+/*
+ * Server clock on the client, NTP style
+ *
+ * Client packets carry a udp_time_request with the client clock when they
+ * were packed (t0). The server notes when it read it (t1) and answers in its
+ * next data packet with a udp_time_reply, stamped when that one is packed
+ * (t2). The client reads the reply at t3:
+ *   offset = ((t1 - t0) + (t2 - t3)) / 2    server clock - client clock
+ *   rtt    = (t3 - t0) - (t2 - t1)          time on the wire and in socket queues
+ * A sample is off by at most half the difference between the way there and
+ * the way back, which is under rtt / 2. Time a datagram waits in a socket
+ * before it is read adds to one way only, so samples are filtered by rtt:
+ * every CLOCK_SYNC_WINDOW samples the one with the smallest rtt becomes a
+ * point. Over the last CLOCK_SYNC_POINTS points, those within
+ * CLOCK_SYNC_RTT_SLACK of the best rtt are fit to a line, offset against
+ * client time: its slope is the drift between the two clocks.
+ *
+ * t1 and t3 come from the kernel receive stamps when the socket has them
+ * (SetSocketReceiveTimestamps), then the estimate is within a ms on loopback.
+ * Without them (win32) they are taken when the 60 Hz loops read the socket
+ * and the wait in it goes in too: the filtering keeps the error under half
+ * a loop, about 4.4 ms on loopback in test_clock_sync.
+ *
+ * The reply also tells the newest world tick and when it started on the
+ * server clock, snapshots carry the tick they were taken at: with the tick
+ * rate from the auth reply any tick maps to server time and on to client
+ * time.
+ *
+ * Requests and replies are records outside the send queue, on the unreliable
+ * channel, like snapshots. A lost one is a sample less.
+ */
+
+#define CLOCK_SYNC_WINDOW 8
+#define CLOCK_SYNC_POINTS 16
+// points with rtt up to twice the best plus this are fit
+#define CLOCK_SYNC_RTT_SLACK_NS (100 * 1000ull)
+// drift beyond this is a bad fit, crystals are within a few hundred ppm
+#define CLOCK_SYNC_MAX_DRIFT 0.0005
+// requests go with a packet at most this often, faster until there are points to fit
+#define CLOCK_SYNC_INTERVAL_NS (250 * NS_PER_MS)
+#define CLOCK_SYNC_FAST_INTERVAL_NS (50 * NS_PER_MS)
+// the server doesn't answer requests older than this
+#define CLOCK_SYNC_MAX_HOLD_NS (1000 * NS_PER_MS)
+
+struct clock_sync_sample
+{
+    // client time the reply got in
+    real_time local_time;
+    i64 offset_ns;
+    u64 rtt_ns;
+};
+
+struct clock_sync
+{
+    // smallest rtt of the window being filled
+    clock_sync_sample window_best;
+    u32 window_count;
+    clock_sync_sample points[CLOCK_SYNC_POINTS];
+    u32 point_count;
+    u32 point_next;
+
+    // server = local + reference_offset + drift * (local - reference_local)
+    b32 synced;
+    real_time reference_local;
+    i64 reference_offset_ns;
+    r64 drift;
+    // best rtt the estimate stands on, it is off by less than half of it
+    u64 rtt_ns;
+
+    // newest tick the server told about, server time it started
+    u32 tick;
+    real_time tick_server_time;
+    u64 tick_ns;
+
+    real_time next_request;
+    u32 samples;
+    u32 samples_rejected;
+};
+
+inline void
+ClockSyncInit(clock_sync * sync)
+{
+    *sync = {};
+}
+
+inline void
+ClockSyncFit(clock_sync * sync)
+{
+    clock_sync_sample candidates[CLOCK_SYNC_POINTS + 1];
+    u32 candidate_count = 0;
+    for (u32 point = 0; point < sync->point_count; ++point)
+    {
+        candidates[candidate_count++] = sync->points[point];
+    }
+    if (sync->window_count)
+    {
+        candidates[candidate_count++] = sync->window_best;
+    }
+    if (candidate_count == 0)
+    {
+        return;
+    }
+
+    u64 best_rtt_ns = candidates[0].rtt_ns;
+    for (u32 candidate = 1; candidate < candidate_count; ++candidate)
+    {
+        best_rtt_ns = min(best_rtt_ns, candidates[candidate].rtt_ns);
+    }
+    u64 max_rtt_ns = 2 * best_rtt_ns + CLOCK_SYNC_RTT_SLACK_NS;
+
+    // means first, relative to the first point used so the sums stay small
+    real_time origin = 0;
+    r64 sum_x = 0.0;
+    r64 sum_y = 0.0;
+    u32 used = 0;
+    for (u32 candidate = 0; candidate < candidate_count; ++candidate)
+    {
+        clock_sync_sample * sample = candidates + candidate;
+        if (sample->rtt_ns > max_rtt_ns)
+        {
+            continue;
+        }
+        if (used == 0)
+        {
+            origin = sample->local_time;
+        }
+        sum_x += (r64)(i64)(sample->local_time - origin);
+        sum_y += (r64)sample->offset_ns;
+        used += 1;
+    }
+
+    r64 mean_x = sum_x / (r64)used;
+    r64 mean_y = sum_y / (r64)used;
+
+    r64 sum_xx = 0.0;
+    r64 sum_xy = 0.0;
+    for (u32 candidate = 0; candidate < candidate_count; ++candidate)
+    {
+        clock_sync_sample * sample = candidates + candidate;
+        if (sample->rtt_ns > max_rtt_ns)
+        {
+            continue;
+        }
+        r64 x = (r64)(i64)(sample->local_time - origin) - mean_x;
+        sum_xx += x * x;
+        sum_xy += x * ((r64)sample->offset_ns - mean_y);
+    }
+
+    // points spread less than half a second say more about their rtt than the drift
+    r64 drift = 0.0;
+    if (used > 1 && sum_xx > (r64)used * 0.25e18)
+    {
+        drift = sum_xy / sum_xx;
+        drift = min(max(drift, -CLOCK_SYNC_MAX_DRIFT), CLOCK_SYNC_MAX_DRIFT);
+    }
+
+    sync->synced = true;
+    sync->reference_local = origin + (i64)mean_x;
+    sync->reference_offset_ns = (i64)mean_y;
+    sync->drift = drift;
+    sync->rtt_ns = best_rtt_ns;
+}
+
+/* t0 client sent, t1 server received, t2 server sent, t3 client received */
+inline b32
+ClockSyncAddSample(clock_sync * sync, real_time t0, real_time t1, real_time t2, real_time t3)
+{
+    // the server can't have held it longer than the round trip took
+    if (t3 < t0 || t2 < t1 || t2 - t1 > t3 - t0)
+    {
+        sync->samples_rejected += 1;
+        return false;
+    }
+
+    clock_sync_sample sample;
+    sample.local_time = t3;
+    sample.offset_ns = (((i64)t1 - (i64)t0) + ((i64)t2 - (i64)t3)) / 2;
+    sample.rtt_ns = (t3 - t0) - (t2 - t1);
+
+    if (sync->window_count == 0 || sample.rtt_ns < sync->window_best.rtt_ns)
+    {
+        sync->window_best = sample;
+    }
+    sync->window_count += 1;
+    sync->samples += 1;
+
+    if (sync->window_count == CLOCK_SYNC_WINDOW)
+    {
+        sync->points[sync->point_next] = sync->window_best;
+        sync->point_next = (sync->point_next + 1) % CLOCK_SYNC_POINTS;
+        sync->point_count = min(sync->point_count + 1, (u32)CLOCK_SYNC_POINTS);
+        sync->window_count = 0;
+    }
+
+    ClockSyncFit(sync);
+
+    return true;
+}
+
+inline real_time
+ClockSyncServerTime(clock_sync * sync, real_time local)
+{
+    i64 since_reference = (i64)(local - sync->reference_local);
+    i64 offset_ns = sync->reference_offset_ns + (i64)(sync->drift * (r64)since_reference);
+
+    return (real_time)((i64)local + offset_ns);
+}
+
+inline real_time
+ClockSyncLocalTime(clock_sync * sync, real_time server)
+{
+    // drift is tiny, one step from the reference offset is exact to well under a ns a second
+    real_time local = (real_time)((i64)server - sync->reference_offset_ns);
+    i64 since_reference = (i64)(local - sync->reference_local);
+    i64 offset_ns = sync->reference_offset_ns + (i64)(sync->drift * (r64)since_reference);
+
+    return (real_time)((i64)server - offset_ns);
+}
+
+/* client time world tick started on the server, tick_ns has to be known */
+inline real_time
+ClockSyncTickLocalTime(clock_sync * sync, u32 tick)
+{
+    i64 ticks_after = (i32)(tick - sync->tick);
+    real_time server = (real_time)((i64)sync->tick_server_time + ticks_after * (i64)sync->tick_ns);
+
+    return ClockSyncLocalTime(sync, server);
+}
+
+inline b32
+ClockSyncRequestDue(clock_sync * sync, real_time now)
+{
+    return now >= sync->next_request;
+}
+
+inline void
+ClockSyncRequestSent(clock_sync * sync, real_time now)
+{
+    u64 interval_ns = sync->point_count < 2 ? CLOCK_SYNC_FAST_INTERVAL_NS : CLOCK_SYNC_INTERVAL_NS;
+    sync->next_request = now + interval_ns;
+}
+
+/* reply read at local client time */
+inline void
+ClockSyncOnReply(clock_sync * sync, udp_time_reply * reply, real_time local)
+{
+    real_time server_sent = reply->server_receive_time + reply->server_hold_ns;
+    if (!ClockSyncAddSample(sync, reply->client_time, reply->server_receive_time, server_sent, local))
+    {
+        return;
+    }
+
+    // replies can come out of order, the tick only goes forward
+    real_time tick_server_time = server_sent - reply->since_tick_ns;
+    if (sync->tick_server_time == 0 || (i32)(reply->tick - sync->tick) > 0)
+    {
+        sync->tick = reply->tick;
+        sync->tick_server_time = tick_server_time;
+    }
+}
+
+/* msg as a time sync record at data, returns bytes written, 0 if it doesn't fit */
+template <typename T> inline u32
+ClockSyncWriteRecord(T & msg, u8 * data, u32 capacity, u16 * message_count)
+{
+    if (capacity <= sizeof(message_header))
+    {
+        return 0;
+    }
+
+    u32 size = WriteMessage(msg, data + sizeof(message_header), capacity - (u32)sizeof(message_header));
+    if (size == 0)
+    {
+        return 0;
+    }
+
+    message_header * header = (message_header *)data;
+    header->len = (u8)size;
+    header->message_type = (u8)(package_type_time_sync | (channel_unreliable << MESSAGE_CHANNEL_SHIFT));
+    header->id = 0;
+    header->order = 0;
+    *message_count += 1;
+
+    return (u32)sizeof(message_header) + size;
+}
+
+#endif
@@ -0,0 +1,411 @@
+#include "compress.h"
+#include "packet_header.h"
+#include "compress_dictionary.h"
+#include "range_coder.cpp"
+#include <string.h>
+
+// trained dictionary every packet is compressed against, CompressInit
+static compress_dictionary compress_packet_dictionary;
+
+inline u32
+CompressHash(const u8 * at, u32 bits)
+{
+    u32 value;
+    memcpy(&value, at, sizeof(value));
+
+    return (value * 2654435761u) >> (32 - bits);
+}
+
+void
+CompressDictionaryInit(compress_dictionary * dict, const u8 * data, u32 size)
+{
+    Assert(size <= COMPRESS_MAX_DICTIONARY_SIZE);
+
+    memset(dict, 0, sizeof(compress_dictionary));
+    dict->data = data;
+    dict->size = size;
+
+    // later positions win, they are the closest to the packet
+    for (u32 at = 0; at + COMPRESS_MIN_MATCH <= size; ++at)
+    {
+        dict->table[CompressHash(data + at, COMPRESS_DICTIONARY_HASH_BITS)] = (u16)(at + 1);
+    }
+}
+
+void
+CompressInit()
+{
+    CompressDictionaryInit(&compress_packet_dictionary, compress_dictionary_data, sizeof(compress_dictionary_data));
+    RangeCoderInit();
+}
+
+/* ENCODER */
+
+inline u32
+CompressMatchLength(const u8 * a, const u8 * b, u32 max_length)
+{
+    u32 length = 0;
+    while (length < max_length && a[length] == b[length])
+    {
+        length += 1;
+    }
+
+    return length;
+}
+
+/* 15 and up in the token, the rest as bytes of 255. False if out is full */
+inline b32
+CompressWriteLength(u32 length, u8 * out, u32 * at, u32 capacity)
+{
+    for (;;)
+    {
+        if (*at >= capacity)
+        {
+            return false;
+        }
+
+        u32 part = min(length, (u32)255);
+        out[(*at)++] = (u8)part;
+        length -= part;
+        if (part < 255)
+        {
+            return true;
+        }
+    }
+}
+
+inline b32
+CompressWriteSequence(const u8 * literals, u32 literal_length, u32 offset, u32 match_length,
+                      u8 * out, u32 * at, u32 capacity)
+{
+    if (*at >= capacity)
+    {
+        return false;
+    }
+
+    u32 match_code = match_length ? match_length - COMPRESS_MIN_MATCH : 0;
+    out[(*at)++] = (u8)((min(literal_length, (u32)15) << 4) | min(match_code, (u32)15));
+
+    if (literal_length >= 15 && !CompressWriteLength(literal_length - 15, out, at, capacity))
+    {
+        return false;
+    }
+
+    if (*at + literal_length > capacity)
+    {
+        return false;
+    }
+    memcpy(out + *at, literals, literal_length);
+    *at += literal_length;
+
+    if (match_length)
+    {
+        if (*at + 2 > capacity)
+        {
+            return false;
+        }
+        out[(*at)++] = (u8)offset;
+        out[(*at)++] = (u8)(offset >> 8);
+
+        if (match_code >= 15 && !CompressWriteLength(match_code - 15, out, at, capacity))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * in against dict (can be 0) into out.
+ * Returns compressed size, 0 if it doesn't fit in capacity
+ */
+u32
+Compress(const compress_dictionary * dict, const u8 * in, u32 in_size, u8 * out, u32 capacity)
+{
+    u32 dict_size = dict ? dict->size : 0;
+    Assert(dict_size + in_size <= 0xFFFF);
+
+    // position + 1 within in
+    u16 table[1 << COMPRESS_INPUT_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    u32 at = 0;
+    u32 anchor = 0;
+    u32 ip = 0;
+    // positions without a match in a row, the step grows with them
+    u32 misses = 0;
+
+    while (ip + COMPRESS_MIN_MATCH <= in_size)
+    {
+        u32 best_length = 0;
+        u32 best_offset = 0;
+
+        u32 input_hash = CompressHash(in + ip, COMPRESS_INPUT_HASH_BITS);
+        u32 candidate = table[input_hash];
+        table[input_hash] = (u16)(ip + 1);
+
+        if (candidate)
+        {
+            u32 candidate_at = candidate - 1;
+            u32 length = CompressMatchLength(in + candidate_at, in + ip, in_size - ip);
+            if (length >= COMPRESS_MIN_MATCH)
+            {
+                best_length = length;
+                best_offset = ip - candidate_at;
+            }
+        }
+
+        if (dict_size)
+        {
+            u32 dict_candidate = dict->table[CompressHash(in + ip, COMPRESS_DICTIONARY_HASH_BITS)];
+            if (dict_candidate)
+            {
+                u32 dict_at = dict_candidate - 1;
+                u32 length = CompressMatchLength(dict->data + dict_at, in + ip,
+                                                 min(dict_size - dict_at, in_size - ip));
+                if (length >= COMPRESS_MIN_MATCH && length > best_length)
+                {
+                    best_length = length;
+                    best_offset = ip + dict_size - dict_at;
+                }
+            }
+        }
+
+        if (best_length == 0)
+        {
+            ip += 1 + (misses++ >> COMPRESS_SKIP_SHIFT);
+            continue;
+        }
+        misses = 0;
+
+        if (!CompressWriteSequence(in + anchor, ip - anchor, best_offset, best_length, out, &at, capacity))
+        {
+            return 0;
+        }
+
+        // positions inside the match can start the next one
+        u32 match_end = ip + best_length;
+        for (ip += 1; ip < match_end && ip + COMPRESS_MIN_MATCH <= in_size; ip += 2)
+        {
+            table[CompressHash(in + ip, COMPRESS_INPUT_HASH_BITS)] = (u16)(ip + 1);
+        }
+        ip = match_end;
+        anchor = ip;
+    }
+
+    if (!CompressWriteSequence(in + anchor, in_size - anchor, 0, 0, out, &at, capacity))
+    {
+        return 0;
+    }
+
+    return at;
+}
+
+/* DECODER */
+
+inline b32
+DecompressReadLength(const u8 * in, u32 in_size, u32 * ip, u32 * length)
+{
+    for (;;)
+    {
+        if (*ip >= in_size)
+        {
+            return false;
+        }
+
+        u32 part = in[(*ip)++];
+        *length += part;
+        if (part < 255)
+        {
+            return true;
+        }
+    }
+}
+
+/*
+ * in comes off the network, every length and offset is checked.
+ * Returns false if it isn't a valid block or doesn't fit in capacity
+ */
+b32
+Decompress(const compress_dictionary * dict, const u8 * in, u32 in_size, u8 * out, u32 capacity, u32 * out_size)
+{
+    u32 dict_size = dict ? dict->size : 0;
+    u32 ip = 0;
+    u32 op = 0;
+
+    while (ip < in_size)
+    {
+        u32 token = in[ip++];
+
+        u32 literal_length = token >> 4;
+        if (literal_length == 15 && !DecompressReadLength(in, in_size, &ip, &literal_length))
+        {
+            return false;
+        }
+        if (literal_length > in_size - ip || literal_length > capacity - op)
+        {
+            return false;
+        }
+        memcpy(out + op, in + ip, literal_length);
+        ip += literal_length;
+        op += literal_length;
+
+        if (ip == in_size)
+        {
+            // last sequence
+            break;
+        }
+
+        if (ip + 2 > in_size)
+        {
+            return false;
+        }
+        u32 offset = (u32)in[ip] | ((u32)in[ip + 1] << 8);
+        ip += 2;
+
+        u32 match_length = token & 15;
+        if (match_length == 15 && !DecompressReadLength(in, in_size, &ip, &match_length))
+        {
+            return false;
+        }
+        match_length += COMPRESS_MIN_MATCH;
+
+        if (offset == 0 || offset > op + dict_size || match_length > capacity - op)
+        {
+            return false;
+        }
+
+        // from the dictionary as long as the match starts before the packet
+        i32 from = (i32)op - (i32)offset;
+        for (u32 i = 0; i < match_length; ++i, ++from)
+        {
+            out[op++] = (from < 0) ? dict->data[(i32)dict_size + from] : out[from];
+        }
+    }
+
+    *out_size = op;
+
+    return true;
+}
+
+/* PACKET STAGE */
+
+/*
+ * PacketToWire with the payload through the compression stage. When it gets
+ * smaller the datagram is built in wire_buffer (PACKET_WIRE_BUFFER_SIZE)
+ * with the header flagged, otherwise it is p as PacketToWire leaves it.
+ * p keeps the raw payload either way. Returns the datagram
+ */
+u8 *
+PacketToWireCompressed(packet * p, u32 payload_size, u32 peer_acked_seq,
+                       u8 * wire_buffer, u32 * datagram_size, compress_stats * stats)
+{
+    u8 * payload = wire_buffer + PACKET_HEADER_MAX_WIRE_SIZE;
+    u32 compressed_size = 0;
+    if (payload_size >= COMPRESS_MIN_PAYLOAD_SIZE)
+    {
+        // codec byte plus block has to save at least a byte
+        u32 capacity = payload_size - 2;
+        compressed_size = RangeEncodePayload(range_packet_models, (u8 *)p->data, payload_size, p->header.messages,
+                                             payload + 1, capacity);
+        payload[0] = compress_codec_range;
+
+        // lz wins on repeated runs only, it only has to beat the range coder
+        u8 lz[PACKET_MAX_PAYLOAD_SIZE];
+        u32 lz_capacity = compressed_size ? compressed_size - 1 : capacity;
+        u32 lz_size = lz_capacity ? Compress(&compress_packet_dictionary, (u8 *)p->data, payload_size, lz, lz_capacity) : 0;
+        if (lz_size)
+        {
+            payload[0] = compress_codec_lz;
+            memcpy(payload + 1, lz, lz_size);
+            compressed_size = lz_size;
+        }
+
+        compressed_size += (compressed_size > 0);
+    }
+
+    stats->packets += 1;
+    stats->raw_bytes += payload_size;
+
+    u32 header_size = 0;
+    u8 * wire = 0;
+    if (compressed_size)
+    {
+        u8 wire_header[PACKET_HEADER_MAX_WIRE_SIZE];
+        header_size = PacketHeaderWrite(&p->header, peer_acked_seq, wire_header);
+        wire_header[1] |= PACKET_HEADER_COMPRESSED;
+
+        wire = payload - header_size;
+        memcpy(wire, wire_header, header_size);
+        *datagram_size = header_size + compressed_size;
+
+        stats->packets_compressed += 1;
+        stats->wire_bytes += compressed_size;
+    }
+    else
+    {
+        wire = PacketToWire(p, peer_acked_seq, &header_size);
+        *datagram_size = header_size + payload_size;
+
+        stats->wire_bytes += payload_size;
+    }
+
+    return wire;
+}
+
+/*
+ * Datagram in wire that passed PacketHeaderWireSize: a compressed payload is
+ * decompressed in place, the flag cleared and datagram_size updated.
+ * False if the payload doesn't decompress and the datagram has to go
+ */
+b32
+PacketDecompressWire(u8 * wire, u32 header_size, i32 * datagram_size, compress_stats * stats)
+{
+    if ((wire[1] & PACKET_HEADER_COMPRESSED) == 0)
+    {
+        stats->packets += 1;
+        stats->raw_bytes += (u32)*datagram_size - header_size;
+        stats->wire_bytes += (u32)*datagram_size - header_size;
+        return true;
+    }
+
+    u32 compressed_size = (u32)*datagram_size - header_size;
+    u8 compressed[PACKET_MAX_PAYLOAD_SIZE];
+    if (compressed_size < 2 || compressed_size > sizeof(compressed))
+    {
+        return false;
+    }
+    memcpy(compressed, wire + header_size, compressed_size);
+
+    u32 payload_size = 0;
+    b32 decoded = false;
+    if (compressed[0] == compress_codec_lz)
+    {
+        decoded = Decompress(&compress_packet_dictionary, compressed + 1, compressed_size - 1,
+                             wire + header_size, PACKET_MAX_PAYLOAD_SIZE, &payload_size);
+    }
+    else if (compressed[0] == compress_codec_range)
+    {
+        // records to decode come from the header
+        packet_header header;
+        PacketHeaderRead(wire, 0, 0, &header);
+        decoded = RangeDecodePayload(range_packet_models, compressed + 1, compressed_size - 1, header.messages,
+                                     wire + header_size, PACKET_MAX_PAYLOAD_SIZE, &payload_size);
+    }
+
+    if (!decoded)
+    {
+        return false;
+    }
+
+    wire[1] &= ~PACKET_HEADER_COMPRESSED;
+    *datagram_size = (i32)(header_size + payload_size);
+
+    stats->packets += 1;
+    stats->packets_compressed += 1;
+    stats->raw_bytes += payload_size;
+    stats->wire_bytes += compressed_size;
+
+    return true;
+}
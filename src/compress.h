@@ -0,0 +1,67 @@
+#ifndef UDP_COMPRESS_H
+#define UDP_COMPRESS_H
+
+#include "protocol.h"
+
+/*
+ * Payload compression with a static dictionary
+ *
+ * LZ77 in the LZ4 block layout, made for packets:
+ *   sequence  token: literal length << 4 | (match length - 4), 15 = more
+ *             length follows as bytes of 255 until one below it
+ *             literals
+ *             u16 offset back from the current position, then match length
+ *             bytes if any. The last sequence is literals only.
+ * Matches reach back past the start of the packet into the dictionary, as
+ * if it were sent right before every packet. Each packet stands on its own,
+ * lost or reordered packets don't matter.
+ *
+ * The dictionary is trained offline on captured traffic (test_compress
+ * train) and built into compress_dictionary.h. Its hash table is made once
+ * at start, per packet only a small table for the packet itself is cleared.
+ *
+ * The packet stage runs between packing and SendPackage: the payload is
+ * sent compressed only when that makes it smaller, byte 1 bit 7 of the wire
+ * header says so (packet_header.h). The receiver decompresses it before
+ * anything else looks at the datagram.
+ *
+ * A compressed payload starts with a compress_codec byte. Bit packed
+ * snapshots have few repeats for LZ to find, the range coder (range_coder.h)
+ * codes them byte by byte with trained static models instead. The stage
+ * sends whichever comes out smaller.
+ */
+
+#define COMPRESS_MIN_MATCH 4
+// dictionary plus packet has to fit u16 positions
+#define COMPRESS_MAX_DICTIONARY_SIZE 16384
+#define COMPRESS_DICTIONARY_HASH_BITS 12
+#define COMPRESS_INPUT_HASH_BITS 9
+// bits that don't compress are skipped faster and faster, one more byte per step every 2^shift misses
+#define COMPRESS_SKIP_SHIFT 4
+// payloads smaller than this go as they are
+#define COMPRESS_MIN_PAYLOAD_SIZE 16
+
+enum compress_codec
+{
+    compress_codec_lz = 0,
+    compress_codec_range = 1
+};
+
+struct compress_dictionary
+{
+    const u8 * data;
+    u32 size;
+    // position + 1 of the last 4 bytes with that hash, 0 = none
+    u16 table[1 << COMPRESS_DICTIONARY_HASH_BITS];
+};
+
+struct compress_stats
+{
+    u32 packets;
+    u32 packets_compressed;
+    // payload bytes before and after the stage
+    u64 raw_bytes;
+    u64 wire_bytes;
+};
+
+#endif
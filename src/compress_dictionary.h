@@ -0,0 +1,75 @@
+#ifndef UDP_COMPRESS_DICTIONARY_H
+#define UDP_COMPRESS_DICTIONARY_H
+
+#include "platform.h"
+
+// generated by test_compress train, don't edit
+static const u8 compress_dictionary_data[1024] = 
+{
+    0x2f, 0x32, 0xc8, 0xf7, 0x6d, 0x32, 0xb8, 0xb6, 0xad, 0x32, 0xb8, 0xd7, 0xed, 0x32, 0x08, 0x37,
+    0x30, 0x33, 0xe8, 0x37, 0x71, 0x33, 0xb8, 0xb8, 0xad, 0x33, 0x58, 0xb8, 0xf0, 0x33, 0x68, 0x97,
+    0x2f, 0x32, 0xc8, 0x78, 0x72, 0x32, 0xf8, 0x36, 0xb2, 0x32, 0x18, 0x98, 0xf0, 0x32, 0x48, 0x57,
+    0x30, 0x13, 0xa8, 0xb7, 0x19, 0x14, 0x8c, 0xd7, 0x19, 0x6c, 0x6b, 0xf8, 0x19, 0xa4, 0x7b, 0x07,
+    0x40, 0x04, 0x00, 0x00, 0x21, 0x30, 0xf8, 0x76, 0x6d, 0x30, 0xc8, 0x77, 0xae, 0x30, 0xe8, 0x36,
+    0xf1, 0x30, 0xe8, 0x38, 0x31, 0x31, 0x38, 0xd8, 0x6e, 0x31, 0x98, 0x17, 0xb0, 0x31, 0x28, 0x97,
+    0x71, 0x30, 0xd8, 0x18, 0xb2, 0x30, 0xf8, 0x56, 0xee, 0x30, 0x88, 0xd7, 0x30, 0x31, 0x08, 0xf9,
+    0x71, 0x31, 0x88, 0x57, 0xb1, 0x31, 0x18, 0xd9, 0xef, 0x31, 0xe8, 0xd6, 0x2e, 0x32, 0xe8, 0x56,
+    0x40, 0x04, 0x00, 0x00, 0x21, 0x30, 0xc8, 0x78, 0x6e, 0x30, 0x08, 0xd9, 0xb1, 0x30, 0xe8, 0x96,
+    0xf1, 0x30, 0x98, 0x18, 0x31, 0x31, 0xc8, 0x17, 0x6f, 0x31, 0x08, 0x18, 0xb2, 0x31, 0x28, 0x38,
+    0x2e, 0x32, 0xc8, 0x96, 0x6e, 0x32, 0x08, 0xb9, 0xb1, 0x32, 0xa8, 0x38, 0xee, 0x32, 0x08, 0x58,
+    0x2f, 0x33, 0x48, 0xd7, 0x70, 0x33, 0x28, 0x58, 0xb0, 0x23, 0x68, 0xf8, 0x19, 0x94, 0x1c, 0x08,
+    0xee, 0x30, 0xb8, 0x37, 0x30, 0x31, 0xa8, 0x18, 0x71, 0x31, 0xd8, 0x18, 0xaf, 0x31, 0xb8, 0x56,
+    0xf0, 0x31, 0x38, 0x98, 0x2f, 0x32, 0x78, 0x57, 0x71, 0x32, 0x48, 0x98, 0xaf, 0x32, 0x48, 0x77,
+    0xdd, 0x0f, 0x00, 0xa1, 0x0f, 0xfa, 0xa0, 0x6f, 0x00, 0x01, 0xec, 0x8f, 0xec, 0xf4, 0x1f, 0x72,
+    0x1f, 0xac, 0x42, 0x00, 0x84, 0x3e, 0xe8, 0x83, 0x3e, 0x01, 0x04, 0xb0, 0x10, 0xb2, 0xd7, 0x7f,
+    0x40, 0x04, 0x00, 0x00, 0x21, 0x30, 0xf8, 0x56, 0x70, 0x30, 0xd8, 0x76, 0xaf, 0x30, 0x48, 0xb8,
+    0xf1, 0x30, 0x08, 0x19, 0x30, 0x31, 0xb8, 0x56, 0x70, 0x31, 0xf8, 0x98, 0xaf, 0x31, 0x48, 0x37,
+    0x40, 0x04, 0x00, 0x00, 0x21, 0x30, 0x68, 0x57, 0x71, 0x30, 0xc8, 0xf6, 0xae, 0x30, 0x68, 0x98,
+    0xf0, 0x30, 0xa8, 0x18, 0x2e, 0x11, 0xc8, 0xb7, 0x18, 0x44, 0x4c, 0xd8, 0x18, 0x94, 0x2b, 0xf7,
+    0x04, 0x00, 0x00, 0x21, 0x30, 0xb8, 0x56, 0x72, 0x30, 0xd8, 0xf7, 0xb0, 0x30, 0xc8, 0x36, 0xf2,
+    0x30, 0x18, 0x79, 0x32, 0x31, 0x08, 0x37, 0x71, 0x31, 0xf8, 0x76, 0xae, 0x31, 0x38, 0xd8, 0xef,
+    0x41, 0x04, 0x00, 0x00, 0x21, 0x30, 0x98, 0x17, 0x71, 0x30, 0x98, 0x78, 0xae, 0x30, 0x38, 0x18,
+    0xee, 0x30, 0x08, 0x38, 0x32, 0x31, 0x98, 0xf7, 0x70, 0x31, 0x68, 0x18, 0xb0, 0x31, 0x18, 0x77,
+    0x04, 0x00, 0x00, 0x21, 0x30, 0xd8, 0x76, 0x71, 0x30, 0xa8, 0x17, 0xb1, 0x30, 0x88, 0xf8, 0xee,
+    0x30, 0x98, 0x97, 0x30, 0x31, 0x38, 0xb7, 0x6f, 0x31, 0x38, 0x77, 0xb0, 0x21, 0x18, 0xf8, 0x18,
+    0x04, 0x00, 0x00, 0x21, 0x30, 0xc8, 0x77, 0x6e, 0x30, 0xc8, 0x58, 0xb1, 0x30, 0xf8, 0x18, 0xf2,
+    0x30, 0x18, 0xd9, 0x2f, 0x31, 0x18, 0x98, 0x6e, 0x31, 0x98, 0xd8, 0xae, 0x31, 0xd8, 0xd6, 0xef,
+    0xfe, 0x1d, 0x1c, 0x72, 0xcf, 0x03, 0x40, 0xe8, 0x83, 0x3e, 0xe8, 0x13, 0x40, 0x00, 0x63, 0x20,
+    0x7b, 0xfb, 0xc7, 0x53, 0xe8, 0xfb, 0x0f, 0x00, 0xa1, 0x0f, 0xfa, 0xa0, 0x4f, 0x00, 0x01, 0xd4,
+    0x31, 0x32, 0x68, 0x97, 0x70, 0x32, 0x38, 0x98, 0xaf, 0x32, 0x28, 0x98, 0xf1, 0x32, 0xc8, 0xb6,
+    0x2d, 0x33, 0x68, 0xb8, 0x6d, 0x33, 0xe8, 0xd8, 0xae, 0x33, 0xf8, 0x76, 0xee, 0x33, 0x78, 0xf8,
+    0x40, 0x04, 0x00, 0x00, 0x21, 0x30, 0x18, 0xf7, 0x6d, 0x30, 0x28, 0x78, 0xb2, 0x30, 0x18, 0xd8,
+    0xf1, 0x30, 0x08, 0x19, 0x30, 0x31, 0x28, 0x38, 0x6e, 0x21, 0xa8, 0xd7, 0x18, 0x3c, 0x8c, 0xf8,
+    0x40, 0x04, 0x00, 0x00, 0x21, 0x30, 0x88, 0x57, 0x70, 0x30, 0x88, 0xd8, 0xad, 0x30, 0x88, 0x38,
+    0xf2, 0x30, 0x18, 0x38, 0x2e, 0x31, 0xd8, 0xd6, 0x6f, 0x31, 0x98, 0x58, 0xaf, 0x31, 0x58, 0xf7,
+    0x1c, 0x78, 0x18, 0x74, 0x7b, 0x98, 0x18, 0x74, 0xbc, 0xb7, 0x18, 0x04, 0x4c, 0xd8, 0x18, 0x9c,
+    0x5b, 0xf7, 0x18, 0xdc, 0x7b, 0x17, 0x19, 0x9c, 0x0b, 0x38, 0x19, 0x04, 0xbc, 0x58, 0x19, 0x5c,
+    0x40, 0x04, 0x00, 0x00, 0x21, 0x30, 0x18, 0x59, 0x6e, 0x30, 0x88, 0xd8, 0xae, 0x30, 0xa8, 0xd8,
+    0xee, 0x30, 0xd8, 0xd7, 0x2d, 0x31, 0x78, 0x37, 0x72, 0x31, 0xf8, 0xb8, 0xb1, 0x31, 0xc8, 0x16,
+    0x41, 0x04, 0x00, 0x00, 0x21, 0x30, 0x28, 0x78, 0x6d, 0x30, 0x68, 0xb8, 0xad, 0x30, 0x28, 0xd9,
+    0xef, 0x30, 0x98, 0x97, 0x2d, 0x31, 0x98, 0x78, 0x70, 0x31, 0x18, 0xf7, 0xae, 0x31, 0xd8, 0xf7,
+    0x41, 0x04, 0x00, 0x00, 0x21, 0x30, 0x48, 0xb8, 0x6e, 0x30, 0xb8, 0x57, 0xaf, 0x30, 0x88, 0xd8,
+    0xf0, 0x30, 0xc8, 0xb8, 0x31, 0x31, 0x88, 0x18, 0x6e, 0x31, 0xc8, 0x96, 0xad, 0x31, 0xd8, 0x57,
+    0x04, 0x00, 0x00, 0x21, 0x30, 0xa8, 0xd8, 0x6e, 0x30, 0x28, 0x77, 0xaf, 0x30, 0x48, 0x57, 0xf0,
+    0x30, 0xf8, 0x58, 0x32, 0x31, 0xf8, 0x56, 0x71, 0x31, 0xf8, 0xf8, 0xae, 0x31, 0x78, 0xd7, 0xef,
+    0x04, 0x00, 0x00, 0x21, 0x30, 0x68, 0xf8, 0x71, 0x30, 0xe8, 0x77, 0xb1, 0x10, 0xd8, 0x76, 0x18,
+    0x8c, 0x1b, 0x98, 0x18, 0xa4, 0x4b, 0xb8, 0x18, 0xa4, 0x3b, 0xd8, 0x18, 0xa4, 0x0b, 0xf9, 0x18,
+    0x31, 0xd8, 0x16, 0xf1, 0x31, 0xc8, 0xb8, 0x2f, 0x32, 0xd8, 0xb6, 0x6f, 0x32, 0x58, 0xd8, 0xad,
+    0x32, 0x18, 0x98, 0xf0, 0x32, 0xd8, 0x58, 0x2f, 0x33, 0x48, 0x77, 0x6f, 0x23, 0xd8, 0xd6, 0x19,
+    0x40, 0x04, 0x00, 0x00, 0x21, 0x30, 0xa8, 0xd8, 0x71, 0x30, 0xe8, 0xf8, 0xb0, 0x30, 0x08, 0x37,
+    0xf1, 0x30, 0x78, 0x57, 0x2f, 0x31, 0x98, 0x18, 0x72, 0x31, 0x98, 0x17, 0xb0, 0x31, 0xf8, 0x36,
+    0x30, 0x28, 0x57, 0xf0, 0x30, 0xb8, 0x38, 0x2f, 0x31, 0x18, 0x39, 0x6e, 0x31, 0xf8, 0x58, 0xaf,
+    0x31, 0x48, 0xb8, 0xf0, 0x31, 0x68, 0x17, 0x30, 0x32, 0xb8, 0x77, 0x70, 0x32, 0xa8, 0x18, 0xb2,
+    0xf9, 0x30, 0x32, 0xd8, 0xd7, 0x6d, 0x32, 0x28, 0x78, 0xae, 0x32, 0xd8, 0xd6, 0xf1, 0x32, 0x88,
+    0xf7, 0x2e, 0x33, 0xd8, 0x18, 0x72, 0x33, 0x68, 0xf7, 0xad, 0x33, 0x18, 0x78, 0xef, 0x33, 0x78,
+    0x41, 0x04, 0x00, 0x00, 0x21, 0x30, 0x88, 0x17, 0x70, 0x30, 0xd8, 0x98, 0xad, 0x30, 0xf8, 0x58,
+    0xf1, 0x30, 0x48, 0x97, 0x31, 0x31, 0x28, 0xb7, 0x71, 0x31, 0x68, 0xd8, 0xaf, 0x31, 0x98, 0xb7,
+    0x5a, 0x3f, 0x00, 0x84, 0x3e, 0xe8, 0x83, 0xbe, 0x01, 0x04, 0xb0, 0x5e, 0xb2, 0x9f, 0x7f, 0x8c,
+    0x7d, 0xaa, 0x01, 0x01, 0x10, 0xfa, 0xa0, 0x0f, 0xfa, 0x06, 0x10, 0xc0, 0x29, 0xc8, 0x8e, 0xfe,
+    0x7f, 0x12, 0x79, 0x72, 0xf3, 0x00, 0x10, 0xfa, 0xa0, 0x0f, 0xfa, 0x06, 0x10, 0x40, 0xb2, 0xc8,
+    0x5e, 0xfd, 0xc9, 0x01, 0x9a, 0xea, 0x03, 0x40, 0xe8, 0x83, 0x3e, 0xe8, 0x1b, 0x40, 0x00, 0xe9,
+    0x10, 0x00, 0xa1, 0x0f, 0xfa, 0xa0, 0x6f, 0x00, 0x01, 0x3c, 0x90, 0x6c, 0x35, 0x04, 0x01, 0x00,
+    0x63, 0xff, 0x97, 0x2d, 0xe8, 0x58, 0x10, 0x00, 0xa1, 0x0f, 0xfa, 0xa0, 0x6f, 0x00, 0x01, 0x24,
+};
+
+#endif
@@ -0,0 +1,293 @@
+#ifndef UDP_CONGESTION_H
+#define UDP_CONGESTION_H
+
+#include "platform.h"
+#include "math.h"
+
+/*
+ * Per peer delay based congestion control (AIMD over a byte rate)
+ *
+ * Fed by the ack stream:
+ *  - every packet newly ack by the peer gives a rtt sample
+ *  - a packet still not ack once CONGESTION_LOSS_THRESHOLD newer ones are is a
+ *    loss (ack_bit gaps, reordering up to the threshold isn't taken as loss)
+ *  - one not ack when its bit slot is reused (32 packets later) and not found
+ *    lost by the gaps before, i.e. when nothing newer got ack either, is a loss
+ *
+ * Acks are piggybacked on the peer packets so a single rtt sample carries
+ * up to the peer send interval of extra delay. Only the smallest sample of
+ * every round is used: queueing delay = round min rtt - base (lowest seen) rtt
+ *
+ * Every round the byte rate backs off multiplicatively if there was loss or the
+ * queueing delay went over the threshold and grows additively otherwise.
+ * The byte rate is spent first keeping the packet rate at max and shrinking
+ * the bytes per packet down to CONGESTION_MIN_BYTES_PER_SEND,
+ * after that the packet rate itself goes down.
+ */
+
+// feedback events (ack + lost) to close a round
+#define CONGESTION_ROUND_EVENTS 8
+// newer packets ack before an unacked one is lost
+#define CONGESTION_LOSS_THRESHOLD 3
+#define CONGESTION_MIN_BYTES_PER_SEND 128
+#define CONGESTION_DELAY_THRESHOLD_MS 20.0f
+#define CONGESTION_BACKOFF 0.75f
+#define CONGESTION_MIN_RTO_MS 100.0f
+#define CONGESTION_MAX_RTO_MS 1000.0f
+
+struct congestion_control
+{
+    r32 min_packets_per_second;
+    r32 max_packets_per_second;
+    r32 max_bytes_per_send;
+
+    // control variable
+    r32 bytes_per_second;
+
+    // output: what the send loop has to honour
+    r32 packets_per_second;
+    r32 send_interval_ms;
+    u32 bytes_per_send;
+
+    // rtt estimation
+    r32 srtt_ms;
+    r32 rttvar_ms;
+    r32 base_rtt_ms;
+    r32 round_min_rtt_ms;
+
+    // current round
+    u32 round_acked;
+    u32 round_lost;
+    // bit per seq & 31 of the last 32 sent, already counted lost
+    u32 lost_bit;
+
+    // exponential moving avg of lost / (lost + acked)
+    r32 loss_rate;
+    r32 queue_delay_ms;
+    u32 backoff_count;
+};
+
+inline void
+CongestionApplyRate(congestion_control * cc)
+{
+    r32 min_bytes_per_second = cc->min_packets_per_second * CONGESTION_MIN_BYTES_PER_SEND;
+    r32 max_bytes_per_second = cc->max_packets_per_second * cc->max_bytes_per_send;
+
+    cc->bytes_per_second = min(max(cc->bytes_per_second, min_bytes_per_second), max_bytes_per_second);
+
+    r32 pps = cc->max_packets_per_second;
+    r32 bytes_per_send = cc->bytes_per_second / pps;
+
+    if (bytes_per_send < CONGESTION_MIN_BYTES_PER_SEND)
+    {
+        bytes_per_send = CONGESTION_MIN_BYTES_PER_SEND;
+        pps = max(cc->bytes_per_second / bytes_per_send, cc->min_packets_per_second);
+    }
+
+    cc->packets_per_second = pps;
+    cc->send_interval_ms = 1000.0f / pps;
+    cc->bytes_per_send = (u32)min(bytes_per_send, cc->max_bytes_per_send);
+}
+
+inline void
+CongestionInit(congestion_control * cc, r32 min_packets_per_second, r32 max_packets_per_second, u32 max_bytes_per_send)
+{
+    Assert(min_packets_per_second > 0.0f);
+    Assert(max_packets_per_second >= min_packets_per_second);
+
+    cc->min_packets_per_second = min_packets_per_second;
+    cc->max_packets_per_second = max_packets_per_second;
+    cc->max_bytes_per_send = (r32)max_bytes_per_send;
+
+    // start optimistic, loss/delay will bring it down
+    cc->bytes_per_second = max_packets_per_second * (r32)max_bytes_per_send;
+
+    cc->srtt_ms = 0.0f;
+    cc->rttvar_ms = 0.0f;
+    cc->base_rtt_ms = 0.0f;
+    cc->round_min_rtt_ms = 0.0f;
+    cc->round_acked = 0;
+    cc->round_lost = 0;
+    cc->lost_bit = 0;
+    cc->loss_rate = 0.0f;
+    cc->queue_delay_ms = 0.0f;
+    cc->backoff_count = 0;
+
+    CongestionApplyRate(cc);
+}
+
+inline void
+CongestionOnPacketAcked(congestion_control * cc, r32 rtt_ms)
+{
+    if (rtt_ms < 0.0f) return;
+
+    // RFC 6298
+    if (cc->srtt_ms == 0.0f)
+    {
+        cc->srtt_ms = rtt_ms;
+        cc->rttvar_ms = rtt_ms * 0.5f;
+        cc->base_rtt_ms = rtt_ms;
+    }
+    else
+    {
+        r32 err = cc->srtt_ms - rtt_ms;
+        cc->rttvar_ms = 0.75f * cc->rttvar_ms + 0.25f * (err < 0.0f ? -err : err);
+        cc->srtt_ms = 0.875f * cc->srtt_ms + 0.125f * rtt_ms;
+    }
+
+    if (cc->round_acked == 0 || rtt_ms < cc->round_min_rtt_ms)
+    {
+        cc->round_min_rtt_ms = rtt_ms;
+    }
+
+    cc->round_acked += 1;
+}
+
+inline void
+CongestionOnPacketLost(congestion_control * cc)
+{
+    cc->round_lost += 1;
+}
+
+/*
+ * Call after the acks of a packet are in. acked_bit has a bit per seq & 31 of
+ * the last 32 sent, newest_seq the last one: unacked ones with
+ * CONGESTION_LOSS_THRESHOLD newer acked are lost. Returns how many were new.
+ */
+inline u32
+CongestionDetectLosses(congestion_control * cc, u32 newest_seq, u32 acked_bit)
+{
+    u32 lost_count = 0;
+    u32 acked_newer = 0;
+    for (u32 age = 0; age < 32; ++age)
+    {
+        u32 slot_bit = (u32)1 << ((newest_seq - age) & 31);
+        if (acked_bit & slot_bit)
+        {
+            acked_newer += 1;
+        }
+        else if (acked_newer >= CONGESTION_LOSS_THRESHOLD && !(cc->lost_bit & slot_bit))
+        {
+            cc->lost_bit |= slot_bit;
+            CongestionOnPacketLost(cc);
+            lost_count += 1;
+        }
+    }
+
+    return lost_count;
+}
+
+/* seq is sent in the slot of the one 32 before, lost if it was never acked nor found lost */
+inline void
+CongestionOnPacketSent(congestion_control * cc, u32 seq, u32 acked_bit)
+{
+    u32 slot_bit = (u32)1 << (seq & 31);
+    if (!(acked_bit & slot_bit) && !(cc->lost_bit & slot_bit))
+    {
+        CongestionOnPacketLost(cc);
+    }
+    cc->lost_bit &= ~slot_bit;
+}
+
+/* path MTU changed */
+inline void
+CongestionSetMaxBytesPerSend(congestion_control * cc, u32 max_bytes_per_send)
+{
+    r32 old_max_bytes_per_second = cc->max_packets_per_second * cc->max_bytes_per_send;
+    r32 new_max_bytes_per_send = (r32)max_bytes_per_send;
+
+    // a rate that wasn't limited by the network before keeps not being limited
+    if (new_max_bytes_per_send > cc->max_bytes_per_send && cc->bytes_per_second >= old_max_bytes_per_second)
+    {
+        cc->bytes_per_second *= new_max_bytes_per_send / cc->max_bytes_per_send;
+    }
+
+    cc->max_bytes_per_send = new_max_bytes_per_send;
+
+    CongestionApplyRate(cc);
+}
+
+/* rate cap of the peer changed, the byte rate follows it when the cap was what held it */
+inline void
+CongestionSetMaxPacketsPerSecond(congestion_control * cc, r32 max_packets_per_second)
+{
+    Assert(max_packets_per_second >= cc->min_packets_per_second);
+
+    r32 old_max_bytes_per_second = cc->max_packets_per_second * cc->max_bytes_per_send;
+    if (cc->bytes_per_second >= old_max_bytes_per_second)
+    {
+        cc->bytes_per_second = max_packets_per_second * cc->max_bytes_per_send;
+    }
+
+    cc->max_packets_per_second = max_packets_per_second;
+
+    CongestionApplyRate(cc);
+}
+
+/* a packet unacked for longer than this is taken as lost for resending its messages */
+inline r32
+CongestionRetransmitTimeoutMs(congestion_control * cc)
+{
+    r32 rto_ms = CONGESTION_MAX_RTO_MS;
+    if (cc->srtt_ms > 0.0f)
+    {
+        rto_ms = cc->srtt_ms + 4.0f * cc->rttvar_ms;
+    }
+
+    rto_ms = min(max(rto_ms, CONGESTION_MIN_RTO_MS), CONGESTION_MAX_RTO_MS);
+
+    return rto_ms;
+}
+
+/* call once per send, closes the round when enough feedback was collected */
+inline void
+CongestionUpdate(congestion_control * cc)
+{
+    u32 round_events = cc->round_acked + cc->round_lost;
+
+    if (round_events < CONGESTION_ROUND_EVENTS)
+    {
+        return;
+    }
+
+    r32 round_loss = (r32)cc->round_lost / (r32)round_events;
+    cc->loss_rate = 0.875f * cc->loss_rate + 0.125f * round_loss;
+
+    b32 congested = (cc->round_lost > 0);
+
+    if (cc->round_acked > 0)
+    {
+        if (cc->round_min_rtt_ms < cc->base_rtt_ms)
+        {
+            cc->base_rtt_ms = cc->round_min_rtt_ms;
+        }
+        else
+        {
+            // let base rtt follow route changes slowly
+            cc->base_rtt_ms += (cc->round_min_rtt_ms - cc->base_rtt_ms) * (1.0f / 64.0f);
+        }
+
+        cc->queue_delay_ms = cc->round_min_rtt_ms - cc->base_rtt_ms;
+        r32 delay_threshold = max(CONGESTION_DELAY_THRESHOLD_MS, cc->base_rtt_ms * 0.25f);
+
+        congested = congested || (cc->queue_delay_ms > delay_threshold);
+    }
+
+    if (congested)
+    {
+        cc->bytes_per_second *= CONGESTION_BACKOFF;
+        cc->backoff_count += 1;
+    }
+    else
+    {
+        // one minimum packet per second more every round
+        cc->bytes_per_second += CONGESTION_MIN_BYTES_PER_SEND;
+    }
+
+    CongestionApplyRate(cc);
+
+    cc->round_acked = 0;
+    cc->round_lost = 0;
+}
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef PLATFORM_CPU_H
+#define PLATFORM_CPU_H
+
+#include "platform.h"
+
+/*
+ * Runtime cpu feature detection so SIMD paths can be picked at startup
+ * without compiling everything for the newest cpu.
+ * Functions using extensions beyond the baseline are tagged with TARGET(...)
+ */
+
+#ifdef _WIN32
+#include <intrin.h>
+#define TARGET(ext)
+
+inline void
+CpuId(i32 leaf, i32 subleaf, i32 * regs)
+{
+    __cpuidex(regs, leaf, subleaf);
+}
+
+inline u64
+XGetBv()
+{
+    return _xgetbv(0);
+}
+
+#elif defined __linux__
+#include <cpuid.h>
+#include <immintrin.h>
+#define TARGET(ext) __attribute__((target(ext)))
+
+inline void
+CpuId(i32 leaf, i32 subleaf, i32 * regs)
+{
+    u32 a = 0, b = 0, c = 0, d = 0;
+    __cpuid_count(leaf, subleaf, a, b, c, d);
+    regs[0] = (i32)a; regs[1] = (i32)b; regs[2] = (i32)c; regs[3] = (i32)d;
+}
+
+inline u64
+XGetBv()
+{
+    u32 lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((u64)hi << 32) | lo;
+}
+
+#else
+#error Unsupported OS
+#endif
+
+struct cpu_features
+{
+    b32 ssse3;
+    b32 sse42;
+    b32 avx2;
+    // AES-NI and carry-less multiply
+    b32 aes;
+    b32 pclmul;
+    // TSC ticks at the same rate in every power state and on every core
+    b32 invariant_tsc;
+};
+
+inline cpu_features
+GetCpuFeatures()
+{
+    cpu_features features = {};
+    i32 regs[4];
+
+    CpuId(1, 0, regs);
+    u32 ecx = (u32)regs[2];
+
+    features.ssse3 = (ecx >> 9) & 1;
+    features.sse42 = (ecx >> 20) & 1;
+    features.aes = (ecx >> 25) & 1;
+    features.pclmul = (ecx >> 1) & 1;
+
+    // AVX2 needs the OS to save ymm registers as well
+    b32 osxsave = (ecx >> 27) & 1;
+    b32 avx = (ecx >> 28) & 1;
+    if (osxsave && avx && (XGetBv() & 0x6) == 0x6)
+    {
+        CpuId(7, 0, regs);
+        features.avx2 = ((u32)regs[1] >> 5) & 1;
+    }
+
+    CpuId((i32)0x80000000, 0, regs);
+    if ((u32)regs[0] >= 0x80000007)
+    {
+        CpuId((i32)0x80000007, 0, regs);
+        features.invariant_tsc = ((u32)regs[3] >> 8) & 1;
+    }
+
+    return features;
+}
+
+#endif
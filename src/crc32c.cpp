@@ -0,0 +1,179 @@
+#include "crc32c.h"
+#include "cpu.h"
+#include <string.h>
+
+// crc32c_table[k][b]: crc of byte b followed by k zero bytes
+static u32 crc32c_table[8][256];
+static b32 crc32c_use_sse42;
+
+void
+Crc32cInit()
+{
+    for (u32 b = 0; b < 256; ++b)
+    {
+        u32 crc = b;
+        for (u32 bit = 0; bit < 8; ++bit)
+        {
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLYNOMIAL : 0);
+        }
+        crc32c_table[0][b] = crc;
+    }
+
+    for (u32 b = 0; b < 256; ++b)
+    {
+        u32 crc = crc32c_table[0][b];
+        for (u32 k = 1; k < 8; ++k)
+        {
+            crc = crc32c_table[0][crc & 0xFF] ^ (crc >> 8);
+            crc32c_table[k][b] = crc;
+        }
+    }
+
+    crc32c_use_sse42 = GetCpuFeatures().sse42;
+}
+
+/* CHECKSUM */
+
+u32
+Crc32cSoftware(u32 crc, const u8 * data, u32 size)
+{
+    crc = ~crc;
+
+    u32 i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        u32 lo, hi;
+        memcpy(&lo, data + i, sizeof(lo));
+        memcpy(&hi, data + i + 4, sizeof(hi));
+        lo ^= crc;
+        crc = crc32c_table[7][lo & 0xFF] ^ crc32c_table[6][(lo >> 8) & 0xFF] ^
+              crc32c_table[5][(lo >> 16) & 0xFF] ^ crc32c_table[4][lo >> 24] ^
+              crc32c_table[3][hi & 0xFF] ^ crc32c_table[2][(hi >> 8) & 0xFF] ^
+              crc32c_table[1][(hi >> 16) & 0xFF] ^ crc32c_table[0][hi >> 24];
+    }
+    for (; i < size; ++i)
+    {
+        crc = crc32c_table[0][(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+TARGET("sse4.2") u32
+Crc32cSSE42(u32 crc, const u8 * data, u32 size)
+{
+    u64 crc64 = ~crc;
+
+    u32 i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        u64 value;
+        memcpy(&value, data + i, sizeof(value));
+        crc64 = _mm_crc32_u64(crc64, value);
+    }
+
+    u32 crc32 = (u32)crc64;
+    for (; i < size; ++i)
+    {
+        crc32 = _mm_crc32_u8(crc32, data[i]);
+    }
+
+    return ~crc32;
+}
+
+/* crc of data following the bytes crc was the crc of, 0 to start */
+u32
+Crc32c(u32 crc, const u8 * data, u32 size)
+{
+    if (crc32c_use_sse42)
+    {
+        return Crc32cSSE42(crc, data, size);
+    }
+
+    return Crc32cSoftware(crc, data, size);
+}
+
+/* PACKET STAGE */
+
+/* a salt for a new session from the OS CSPRNG, false if it has none */
+b32
+PacketNewSalt(u32 * salt)
+{
+    return GetOsRandom(salt, sizeof(*salt));
+}
+
+inline u32
+PacketCrc(const u8 * datagram, u32 size, u32 salt)
+{
+    u8 salt_bytes[PACKET_SALT_SIZE];
+    memcpy(salt_bytes, &salt, sizeof(salt_bytes));
+    u32 crc = Crc32c(0, salt_bytes, sizeof(salt_bytes));
+
+    return Crc32c(crc, datagram, size);
+}
+
+/*
+ * Appends the trailer to the datagram of size bytes, with_salt puts the
+ * salt on the wire as well (client to server). Returns the new size
+ */
+u32
+PacketSeal(u8 * datagram, u32 size, u32 salt, b32 with_salt)
+{
+    if (with_salt)
+    {
+        memcpy(datagram + size, &salt, PACKET_SALT_SIZE);
+        size += PACKET_SALT_SIZE;
+    }
+
+    u32 crc = PacketCrc(datagram, size, salt);
+    memcpy(datagram + size, &crc, PACKET_CHECK_SIZE);
+
+    return size + PACKET_CHECK_SIZE;
+}
+
+/*
+ * Datagram of size bytes sealed with salt: false if it doesn't check,
+ * otherwise size drops the trailer
+ */
+b32
+PacketCheck(const u8 * datagram, i32 * size, u32 salt)
+{
+    if (*size < PACKET_CHECK_SIZE)
+    {
+        return false;
+    }
+
+    u32 body = (u32)*size - PACKET_CHECK_SIZE;
+    u32 crc;
+    memcpy(&crc, datagram + body, sizeof(crc));
+    if (crc != PacketCrc(datagram, body, salt))
+    {
+        return false;
+    }
+
+    *size = (i32)body;
+
+    return true;
+}
+
+/* PacketCheck for a datagram that carries its salt, it goes in salt */
+b32
+PacketCheckSalted(const u8 * datagram, i32 * size, u32 * salt)
+{
+    if (*size < PACKET_SALT_SIZE + PACKET_CHECK_SIZE)
+    {
+        return false;
+    }
+
+    u32 wire_salt;
+    memcpy(&wire_salt, datagram + *size - PACKET_CHECK_SIZE - PACKET_SALT_SIZE, sizeof(wire_salt));
+    if (!PacketCheck(datagram, size, wire_salt))
+    {
+        return false;
+    }
+
+    *size -= PACKET_SALT_SIZE;
+    *salt = wire_salt;
+
+    return true;
+}
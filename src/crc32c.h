@@ -0,0 +1,33 @@
+#ifndef UDP_CRC32C_H
+#define UDP_CRC32C_H
+
+#include "protocol.h"
+
+/*
+ * Datagram integrity check
+ *
+ * UDP's own checksum is 16 bits and optional, so every datagram ends in a
+ * trailer of its own:
+ *   client to server  u32 session salt, u32 crc
+ *   server to client  u32 crc
+ * crc is CRC32C (Castagnoli) of the salt followed by every byte before it:
+ * header and payload as they went on the wire, compressed or not.
+ *
+ * The client picks a new random salt every time it starts and the server
+ * keeps the one a client came in with. It only tells sessions apart, keys
+ * come from the key exchange (crypto.h). A datagram is checked before anything looks
+ * at its header, so corrupted or foreign ones never reach ack state, and
+ * one carrying another salt from the same addr:port is a stale one from an
+ * earlier session. A restarted client is let in once its old session times
+ * out on the server.
+ *
+ * SSE4.2 has a crc32 instruction for this polynomial, 8 bytes at a time.
+ * Without it a slicing-by-8 table does the same.
+ */
+
+#define CRC32C_POLYNOMIAL 0x82F63B78
+
+#define PACKET_SALT_SIZE 4
+#define PACKET_CHECK_SIZE 4
+
+#endif
@@ -0,0 +1,1573 @@
+#include "crypto.h"
+#include "cpu.h"
+#include "packet_header.h"
+#include <string.h>
+
+static b32 crypto_use_avx2;
+static b32 crypto_use_aesni;
+
+// packets in a batch below this go one by one, eight lanes cost the same as eight packets
+#define CRYPTO_AVX2_MIN_BATCH 2
+
+void AesInit();
+
+void
+CryptoInit()
+{
+    cpu_features cpu = GetCpuFeatures();
+    crypto_use_avx2 = cpu.avx2;
+    crypto_use_aesni = cpu.aes && cpu.pclmul && cpu.ssse3;
+
+    AesInit();
+}
+
+inline u32
+LoadU32(const u8 * at)
+{
+    u32 value;
+    memcpy(&value, at, sizeof(value));
+
+    return value;
+}
+
+inline void
+StoreU32(u8 * at, u32 value)
+{
+    memcpy(at, &value, sizeof(value));
+}
+
+/* zeroes secrets on the stack, the compiler can't drop the stores */
+inline void
+CryptoWipe(void * secret, u32 size)
+{
+    volatile u8 * at = (volatile u8 *)secret;
+    for (u32 i = 0; i < size; ++i)
+    {
+        at[i] = 0;
+    }
+}
+
+inline void
+StoreU32BE(u8 * at, u32 value)
+{
+    at[0] = (u8)(value >> 24);
+    at[1] = (u8)(value >> 16);
+    at[2] = (u8)(value >> 8);
+    at[3] = (u8)value;
+}
+
+inline u64
+LoadU64BE(const u8 * at)
+{
+    u64 value = 0;
+    for (u32 i = 0; i < 8; ++i)
+    {
+        value = (value << 8) | at[i];
+    }
+
+    return value;
+}
+
+inline void
+StoreU64BE(u8 * at, u64 value)
+{
+    for (u32 i = 0; i < 8; ++i)
+    {
+        at[i] = (u8)(value >> (56 - 8 * i));
+    }
+}
+
+/* CHACHA20 */
+
+inline u32
+Rotl32(u32 value, u32 bits)
+{
+    return (value << bits) | (value >> (32 - bits));
+}
+
+#define CHACHA_QUARTER(a, b, c, d) \
+    a += b; d = Rotl32(d ^ a, 16); \
+    c += d; b = Rotl32(b ^ c, 12); \
+    a += b; d = Rotl32(d ^ a, 8);  \
+    c += d; b = Rotl32(b ^ c, 7);
+
+inline void
+ChaCha20State(u32 * state, const u8 * key, const u8 * nonce, u32 counter)
+{
+    // "expand 32-byte k"
+    state[0] = 0x61707865;
+    state[1] = 0x3320646e;
+    state[2] = 0x79622d32;
+    state[3] = 0x6b206574;
+    for (u32 i = 0; i < 8; ++i)
+    {
+        state[4 + i] = LoadU32(key + 4 * i);
+    }
+    state[12] = counter;
+    for (u32 i = 0; i < 3; ++i)
+    {
+        state[13 + i] = LoadU32(nonce + 4 * i);
+    }
+}
+
+inline void
+ChaCha20Rounds(u32 * x)
+{
+    for (u32 round = 0; round < 10; ++round)
+    {
+        CHACHA_QUARTER(x[0], x[4], x[8],  x[12]);
+        CHACHA_QUARTER(x[1], x[5], x[9],  x[13]);
+        CHACHA_QUARTER(x[2], x[6], x[10], x[14]);
+        CHACHA_QUARTER(x[3], x[7], x[11], x[15]);
+        CHACHA_QUARTER(x[0], x[5], x[10], x[15]);
+        CHACHA_QUARTER(x[1], x[6], x[11], x[12]);
+        CHACHA_QUARTER(x[2], x[7], x[8],  x[13]);
+        CHACHA_QUARTER(x[3], x[4], x[9],  x[14]);
+    }
+}
+
+void
+ChaCha20Block(const u8 * key, const u8 * nonce, u32 counter, u8 * out)
+{
+    u32 state[16];
+    ChaCha20State(state, key, nonce, counter);
+
+    u32 x[16];
+    memcpy(x, state, sizeof(x));
+    ChaCha20Rounds(x);
+
+    for (u32 i = 0; i < 16; ++i)
+    {
+        StoreU32(out + 4 * i, x[i] + state[i]);
+    }
+}
+
+/* data ^= keystream from block counter on */
+void
+ChaCha20Xor(const u8 * key, const u8 * nonce, u32 counter, u8 * data, u32 size)
+{
+    u8 block[64];
+    for (u32 at = 0; at < size; at += 64, ++counter)
+    {
+        ChaCha20Block(key, nonce, counter, block);
+        u32 block_size = min(size - at, (u32)64);
+        for (u32 i = 0; i < block_size; ++i)
+        {
+            data[at + i] ^= block[i];
+        }
+    }
+}
+
+/* 32 byte key from key and 16 bytes of input, no output feed forward */
+void
+HChaCha20(const u8 * key, const u8 * in, u8 * out)
+{
+    u32 x[16];
+    ChaCha20State(x, key, in + 4, LoadU32(in));
+    ChaCha20Rounds(x);
+
+    for (u32 i = 0; i < 4; ++i)
+    {
+        StoreU32(out + 4 * i, x[i]);
+        StoreU32(out + 16 + 4 * i, x[12 + i]);
+    }
+}
+
+/* POLY1305 */
+
+// 26 bit limbs, products fit u64 on any compiler
+struct poly1305
+{
+    u32 r[5];
+    u32 h[5];
+    u32 pad[4];
+};
+
+void
+Poly1305Init(poly1305 * p, const u8 * key)
+{
+    p->r[0] = (LoadU32(key + 0)) & 0x3ffffff;
+    p->r[1] = (LoadU32(key + 3) >> 2) & 0x3ffff03;
+    p->r[2] = (LoadU32(key + 6) >> 4) & 0x3ffc0ff;
+    p->r[3] = (LoadU32(key + 9) >> 6) & 0x3f03fff;
+    p->r[4] = (LoadU32(key + 12) >> 8) & 0x00fffff;
+
+    for (u32 i = 0; i < 5; ++i)
+    {
+        p->h[i] = 0;
+    }
+    for (u32 i = 0; i < 4; ++i)
+    {
+        p->pad[i] = LoadU32(key + 16 + 4 * i);
+    }
+}
+
+/* whole 16 byte blocks, hibit 0 for a last short one padded with a 1 */
+void
+Poly1305Blocks(poly1305 * p, const u8 * m, u32 size, u32 hibit = 1 << 24)
+{
+    u32 r0 = p->r[0], r1 = p->r[1], r2 = p->r[2], r3 = p->r[3], r4 = p->r[4];
+    u32 s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+    u32 h0 = p->h[0], h1 = p->h[1], h2 = p->h[2], h3 = p->h[3], h4 = p->h[4];
+
+    for (; size >= 16; size -= 16, m += 16)
+    {
+        h0 += (LoadU32(m + 0)) & 0x3ffffff;
+        h1 += (LoadU32(m + 3) >> 2) & 0x3ffffff;
+        h2 += (LoadU32(m + 6) >> 4) & 0x3ffffff;
+        h3 += (LoadU32(m + 9) >> 6) & 0x3ffffff;
+        h4 += (LoadU32(m + 12) >> 8) | hibit;
+
+        u64 d0 = (u64)h0 * r0 + (u64)h1 * s4 + (u64)h2 * s3 + (u64)h3 * s2 + (u64)h4 * s1;
+        u64 d1 = (u64)h0 * r1 + (u64)h1 * r0 + (u64)h2 * s4 + (u64)h3 * s3 + (u64)h4 * s2;
+        u64 d2 = (u64)h0 * r2 + (u64)h1 * r1 + (u64)h2 * r0 + (u64)h3 * s4 + (u64)h4 * s3;
+        u64 d3 = (u64)h0 * r3 + (u64)h1 * r2 + (u64)h2 * r1 + (u64)h3 * r0 + (u64)h4 * s4;
+        u64 d4 = (u64)h0 * r4 + (u64)h1 * r3 + (u64)h2 * r2 + (u64)h3 * r1 + (u64)h4 * r0;
+
+        u32 c;
+        c = (u32)(d0 >> 26); h0 = (u32)d0 & 0x3ffffff;
+        d1 += c; c = (u32)(d1 >> 26); h1 = (u32)d1 & 0x3ffffff;
+        d2 += c; c = (u32)(d2 >> 26); h2 = (u32)d2 & 0x3ffffff;
+        d3 += c; c = (u32)(d3 >> 26); h3 = (u32)d3 & 0x3ffffff;
+        d4 += c; c = (u32)(d4 >> 26); h4 = (u32)d4 & 0x3ffffff;
+        h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+        h1 += c;
+    }
+
+    p->h[0] = h0; p->h[1] = h1; p->h[2] = h2; p->h[3] = h3; p->h[4] = h4;
+}
+
+/* m zero padded to 16 bytes, the AEAD layout */
+void
+Poly1305Padded(poly1305 * p, const u8 * m, u32 size)
+{
+    u32 whole = size & ~15u;
+    Poly1305Blocks(p, m, whole);
+
+    if (whole < size)
+    {
+        u8 block[16] = {};
+        memcpy(block, m + whole, size - whole);
+        Poly1305Blocks(p, block, 16);
+    }
+}
+
+void
+Poly1305Finish(poly1305 * p, u8 * tag)
+{
+    u32 h0 = p->h[0], h1 = p->h[1], h2 = p->h[2], h3 = p->h[3], h4 = p->h[4];
+
+    u32 c;
+    c = h1 >> 26; h1 &= 0x3ffffff;
+    h2 += c; c = h2 >> 26; h2 &= 0x3ffffff;
+    h3 += c; c = h3 >> 26; h3 &= 0x3ffffff;
+    h4 += c; c = h4 >> 26; h4 &= 0x3ffffff;
+    h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+    h1 += c;
+
+    // h - p, kept if h >= p
+    u32 g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+    u32 g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+    u32 g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+    u32 g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+    u32 g4 = h4 + c - (1 << 26);
+
+    u32 mask = (g4 >> 31) - 1;
+    h0 = (h0 & ~mask) | (g0 & mask);
+    h1 = (h1 & ~mask) | (g1 & mask);
+    h2 = (h2 & ~mask) | (g2 & mask);
+    h3 = (h3 & ~mask) | (g3 & mask);
+    h4 = (h4 & ~mask) | (g4 & mask);
+
+    // to 4 words mod 2^128, plus the pad
+    u32 words[4];
+    words[0] = h0 | (h1 << 26);
+    words[1] = (h1 >> 6) | (h2 << 20);
+    words[2] = (h2 >> 12) | (h3 << 14);
+    words[3] = (h3 >> 18) | (h4 << 8);
+
+    u64 f = 0;
+    for (u32 i = 0; i < 4; ++i)
+    {
+        f = (u64)words[i] + p->pad[i] + (f >> 32);
+        StoreU32(tag + 4 * i, (u32)f);
+    }
+}
+
+/* AEAD tag of job with its one time key, data is ciphertext */
+void
+CryptoTag(const crypto_job * job, const u8 * poly_key, u8 * tag)
+{
+    poly1305 p;
+    Poly1305Init(&p, poly_key);
+    Poly1305Padded(&p, job->aad, job->aad_size);
+    Poly1305Padded(&p, job->data, job->size);
+
+    u8 lengths[16];
+    u64 aad_size = job->aad_size;
+    u64 size = job->size;
+    memcpy(lengths, &aad_size, 8);
+    memcpy(lengths + 8, &size, 8);
+    Poly1305Blocks(&p, lengths, 16);
+
+    Poly1305Finish(&p, tag);
+}
+
+inline b32
+CryptoTagEqual(const u8 * a, const u8 * b)
+{
+    u8 diff = 0;
+    for (u32 i = 0; i < CRYPTO_TAG_SIZE; ++i)
+    {
+        diff |= a[i] ^ b[i];
+    }
+
+    return diff == 0;
+}
+
+/* BATCHES */
+
+/*
+ * Per job: block 0 into poly_keys if there are any, data ^= blocks 1 on
+ * if xor_data and the job is ok
+ */
+void
+ChaCha20Jobs(const crypto_job * jobs, u32 count, u8 (*poly_keys)[32], b32 xor_data)
+{
+    for (u32 job_index = 0; job_index < count; ++job_index)
+    {
+        const crypto_job * job = jobs + job_index;
+        if (poly_keys)
+        {
+            u8 block[64];
+            ChaCha20Block(job->key->chacha, job->nonce, 0, block);
+            memcpy(poly_keys[job_index], block, 32);
+        }
+        if (xor_data && job->ok)
+        {
+            ChaCha20Xor(job->key->chacha, job->nonce, 1, job->data, job->size);
+        }
+    }
+}
+
+#define CHACHA_ROTL_AVX2(v, bits) _mm256_or_si256(_mm256_slli_epi32(v, bits), _mm256_srli_epi32(v, 32 - bits))
+
+#define CHACHA_QUARTER_AVX2(a, b, c, d) \
+    a = _mm256_add_epi32(a, b); d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rot16); \
+    c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = CHACHA_ROTL_AVX2(b, 12); \
+    a = _mm256_add_epi32(a, b); d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rot8); \
+    c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = CHACHA_ROTL_AVX2(b, 7);
+
+/* ChaCha20Jobs for up to 8 jobs, one per lane: lane l runs block n of job l */
+TARGET("avx2") void
+ChaCha20JobsAVX2(const crypto_job * jobs, u32 count, u8 (*poly_keys)[32], b32 xor_data)
+{
+    Assert(count <= 8);
+
+    const __m256i rot16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+                                           2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    const __m256i rot8 = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+                                          3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+
+    // state word i of every lane, lanes past count repeat job 0
+    u32 words[16][8];
+    u32 blocks = 0;
+    for (u32 lane = 0; lane < 8; ++lane)
+    {
+        const crypto_job * job = jobs + ((lane < count) ? lane : 0);
+        u32 state[16];
+        ChaCha20State(state, job->key->chacha, job->nonce, 0);
+        for (u32 i = 0; i < 16; ++i)
+        {
+            words[i][lane] = state[i];
+        }
+        blocks = max(blocks, (job->size + 63) / 64);
+    }
+
+    __m256i initial[16];
+    for (u32 i = 0; i < 16; ++i)
+    {
+        initial[i] = _mm256_loadu_si256((const __m256i *)words[i]);
+    }
+
+    u32 first = poly_keys ? 0 : 1;
+    u32 last = xor_data ? blocks : 0;
+    for (u32 block = first; block <= last; ++block)
+    {
+        initial[12] = _mm256_set1_epi32((i32)block);
+
+        __m256i x[16];
+        for (u32 i = 0; i < 16; ++i)
+        {
+            x[i] = initial[i];
+        }
+
+        for (u32 round = 0; round < 10; ++round)
+        {
+            CHACHA_QUARTER_AVX2(x[0], x[4], x[8],  x[12]);
+            CHACHA_QUARTER_AVX2(x[1], x[5], x[9],  x[13]);
+            CHACHA_QUARTER_AVX2(x[2], x[6], x[10], x[14]);
+            CHACHA_QUARTER_AVX2(x[3], x[7], x[11], x[15]);
+            CHACHA_QUARTER_AVX2(x[0], x[5], x[10], x[15]);
+            CHACHA_QUARTER_AVX2(x[1], x[6], x[11], x[12]);
+            CHACHA_QUARTER_AVX2(x[2], x[7], x[8],  x[13]);
+            CHACHA_QUARTER_AVX2(x[3], x[4], x[9],  x[14]);
+        }
+
+        for (u32 i = 0; i < 16; ++i)
+        {
+            _mm256_storeu_si256((__m256i *)words[i], _mm256_add_epi32(x[i], initial[i]));
+        }
+
+        for (u32 lane = 0; lane < count; ++lane)
+        {
+            const crypto_job * job = jobs + lane;
+            u8 keystream[64];
+            for (u32 i = 0; i < 16; ++i)
+            {
+                StoreU32(keystream + 4 * i, words[i][lane]);
+            }
+
+            if (block == 0)
+            {
+                memcpy(poly_keys[lane], keystream, 32);
+                continue;
+            }
+
+            u32 at = (block - 1) * 64;
+            if (at >= job->size || !job->ok)
+            {
+                continue;
+            }
+
+            u32 block_size = min(job->size - at, (u32)64);
+            u8 * data = job->data + at;
+            if (block_size == 64)
+            {
+                for (u32 i = 0; i < 64; i += 32)
+                {
+                    __m256i d = _mm256_loadu_si256((const __m256i *)(data + i));
+                    __m256i k = _mm256_loadu_si256((const __m256i *)(keystream + i));
+                    _mm256_storeu_si256((__m256i *)(data + i), _mm256_xor_si256(d, k));
+                }
+            }
+            else
+            {
+                for (u32 i = 0; i < block_size; ++i)
+                {
+                    data[i] ^= keystream[i];
+                }
+            }
+        }
+    }
+}
+
+inline void
+ChaCha20Batch(const crypto_job * jobs, u32 count, u8 (*poly_keys)[32], b32 xor_data)
+{
+    if (crypto_use_avx2 && count >= CRYPTO_AVX2_MIN_BATCH)
+    {
+        ChaCha20JobsAVX2(jobs, count, poly_keys, xor_data);
+    }
+    else
+    {
+        ChaCha20Jobs(jobs, count, poly_keys, xor_data);
+    }
+}
+
+/* ChaCha20-Poly1305 of up to a batch of jobs */
+void
+ChaChaPolySeal(crypto_job * jobs, u32 count)
+{
+    for (u32 job_index = 0; job_index < count; ++job_index)
+    {
+        jobs[job_index].ok = true;
+    }
+
+    u8 poly_keys[CRYPTO_BATCH_SIZE][32];
+    ChaCha20Batch(jobs, count, poly_keys, true);
+
+    for (u32 job_index = 0; job_index < count; ++job_index)
+    {
+        crypto_job * job = jobs + job_index;
+        CryptoTag(job, poly_keys[job_index], job->tag);
+    }
+}
+
+void
+ChaChaPolyOpen(crypto_job * jobs, u32 count)
+{
+    u8 poly_keys[CRYPTO_BATCH_SIZE][32];
+    ChaCha20Batch(jobs, count, poly_keys, false);
+
+    for (u32 job_index = 0; job_index < count; ++job_index)
+    {
+        crypto_job * job = jobs + job_index;
+        u8 tag[CRYPTO_TAG_SIZE];
+        CryptoTag(job, poly_keys[job_index], tag);
+        job->ok = CryptoTagEqual(tag, job->tag);
+    }
+
+    ChaCha20Batch(jobs, count, 0, true);
+}
+
+/* AES-GCM */
+
+// filled by AesInit
+static u8 aes_sbox[256];
+// MixColumns of a SubBytes output s, one column as a little endian word: 2s s s 3s
+static u32 aes_te[256];
+// x^128 + x^7 + x^2 + x + 1 reduction of the 4 bits shifted out of GHASH
+static const u16 ghash_last4[16] =
+{
+    0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+    0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+inline u8
+AesXtime(u8 x)
+{
+    return (u8)((x << 1) ^ ((x & 0x80) ? 0x1B : 0));
+}
+
+inline u8
+Rotl8(u8 value, u32 bits)
+{
+    return (u8)((value << bits) | (value >> (8 - bits)));
+}
+
+void
+AesInit()
+{
+    // p runs through every non zero byte multiplying by 3, q by its inverse
+    u8 p = 1;
+    u8 q = 1;
+    do
+    {
+        p = p ^ AesXtime(p);
+        q = (u8)(q ^ (q << 1));
+        q = (u8)(q ^ (q << 2));
+        q = (u8)(q ^ (q << 4));
+        if (q & 0x80)
+        {
+            q ^= 0x09;
+        }
+        aes_sbox[p] = q ^ Rotl8(q, 1) ^ Rotl8(q, 2) ^ Rotl8(q, 3) ^ Rotl8(q, 4) ^ 0x63;
+    } while (p != 1);
+    aes_sbox[0] = 0x63;
+
+    for (u32 i = 0; i < 256; ++i)
+    {
+        u32 s = aes_sbox[i];
+        u32 s2 = AesXtime((u8)s);
+        aes_te[i] = s2 | (s << 8) | (s << 16) | ((s2 ^ s) << 24);
+    }
+}
+
+#define AES_COLUMN(a, b, c, d) \
+    (aes_te[(a) & 0xFF] ^ Rotl32(aes_te[((b) >> 8) & 0xFF], 8) ^ \
+     Rotl32(aes_te[((c) >> 16) & 0xFF], 16) ^ Rotl32(aes_te[(d) >> 24], 24))
+
+#define AES_LAST_COLUMN(a, b, c, d) \
+    ((u32)aes_sbox[(a) & 0xFF] | ((u32)aes_sbox[((b) >> 8) & 0xFF] << 8) | \
+     ((u32)aes_sbox[((c) >> 16) & 0xFF] << 16) | ((u32)aes_sbox[(d) >> 24] << 24))
+
+void
+AesEncryptBlockSoftware(const crypto_key * key, const u8 * in, u8 * out)
+{
+    const u8 * round_key = key->aes_round_keys;
+    u32 s0 = LoadU32(in + 0) ^ LoadU32(round_key + 0);
+    u32 s1 = LoadU32(in + 4) ^ LoadU32(round_key + 4);
+    u32 s2 = LoadU32(in + 8) ^ LoadU32(round_key + 8);
+    u32 s3 = LoadU32(in + 12) ^ LoadU32(round_key + 12);
+
+    for (u32 round = 1; round < AES_ROUNDS; ++round)
+    {
+        round_key += 16;
+        u32 t0 = AES_COLUMN(s0, s1, s2, s3) ^ LoadU32(round_key + 0);
+        u32 t1 = AES_COLUMN(s1, s2, s3, s0) ^ LoadU32(round_key + 4);
+        u32 t2 = AES_COLUMN(s2, s3, s0, s1) ^ LoadU32(round_key + 8);
+        u32 t3 = AES_COLUMN(s3, s0, s1, s2) ^ LoadU32(round_key + 12);
+        s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+    }
+
+    round_key += 16;
+    StoreU32(out + 0, AES_LAST_COLUMN(s0, s1, s2, s3) ^ LoadU32(round_key + 0));
+    StoreU32(out + 4, AES_LAST_COLUMN(s1, s2, s3, s0) ^ LoadU32(round_key + 4));
+    StoreU32(out + 8, AES_LAST_COLUMN(s2, s3, s0, s1) ^ LoadU32(round_key + 8));
+    StoreU32(out + 12, AES_LAST_COLUMN(s3, s0, s1, s2) ^ LoadU32(round_key + 12));
+}
+
+/* x *= H */
+void
+GHashMultiplySoftware(const crypto_key * key, u8 * x)
+{
+    u32 nibble = x[15] & 0xF;
+    u64 hi = key->ghash_hi[nibble];
+    u64 lo = key->ghash_lo[nibble];
+
+    for (i32 i = 15; i >= 0; --i)
+    {
+        if (i != 15)
+        {
+            nibble = x[i] & 0xF;
+            u32 rem = (u32)(lo & 0xF);
+            lo = (hi << 60) | (lo >> 4);
+            hi = (hi >> 4) ^ ((u64)ghash_last4[rem] << 48);
+            hi ^= key->ghash_hi[nibble];
+            lo ^= key->ghash_lo[nibble];
+        }
+
+        nibble = x[i] >> 4;
+        u32 rem = (u32)(lo & 0xF);
+        lo = (hi << 60) | (lo >> 4);
+        hi = (hi >> 4) ^ ((u64)ghash_last4[rem] << 48);
+        hi ^= key->ghash_hi[nibble];
+        lo ^= key->ghash_lo[nibble];
+    }
+
+    StoreU64BE(x, hi);
+    StoreU64BE(x + 8, lo);
+}
+
+/* AES-256 key schedule, H to H^4 and the GHASH table */
+void
+AesGcmKeyInit(crypto_key * key, const u8 * secret)
+{
+    u8 * w = key->aes_round_keys;
+    memcpy(w, secret, 32);
+
+    u8 rcon = 1;
+    for (u32 i = 8; i < 4 * (AES_ROUNDS + 1); ++i)
+    {
+        u8 t[4];
+        memcpy(t, w + 4 * (i - 1), 4);
+        if (i % 8 == 0)
+        {
+            u8 first = t[0];
+            t[0] = aes_sbox[t[1]] ^ rcon;
+            t[1] = aes_sbox[t[2]];
+            t[2] = aes_sbox[t[3]];
+            t[3] = aes_sbox[first];
+            rcon = AesXtime(rcon);
+        }
+        else if (i % 8 == 4)
+        {
+            for (u32 k = 0; k < 4; ++k)
+            {
+                t[k] = aes_sbox[t[k]];
+            }
+        }
+        for (u32 k = 0; k < 4; ++k)
+        {
+            w[4 * i + k] = w[4 * (i - 8) + k] ^ t[k];
+        }
+    }
+
+    u8 zero[16] = {};
+    AesEncryptBlockSoftware(key, zero, key->ghash_h[0]);
+
+    // multiples of H by every 4 bit value, bits reflected as GHASH has them
+    u64 hi = LoadU64BE(key->ghash_h[0]);
+    u64 lo = LoadU64BE(key->ghash_h[0] + 8);
+    key->ghash_hi[0] = 0;
+    key->ghash_lo[0] = 0;
+    key->ghash_hi[8] = hi;
+    key->ghash_lo[8] = lo;
+    for (u32 i = 4; i > 0; i >>= 1)
+    {
+        u64 reduce = (lo & 1) ? ((u64)0xe1000000 << 32) : 0;
+        lo = (hi << 63) | (lo >> 1);
+        hi = (hi >> 1) ^ reduce;
+        key->ghash_hi[i] = hi;
+        key->ghash_lo[i] = lo;
+    }
+    for (u32 i = 2; i <= 8; i *= 2)
+    {
+        for (u32 j = 1; j < i; ++j)
+        {
+            key->ghash_hi[i + j] = key->ghash_hi[i] ^ key->ghash_hi[j];
+            key->ghash_lo[i + j] = key->ghash_lo[i] ^ key->ghash_lo[j];
+        }
+    }
+
+    for (u32 power = 1; power < 4; ++power)
+    {
+        memcpy(key->ghash_h[power], key->ghash_h[power - 1], 16);
+        GHashMultiplySoftware(key, key->ghash_h[power]);
+    }
+}
+
+/* GHASH of m zero padded to 16 bytes into x */
+void
+GHashSoftware(const crypto_key * key, u8 * x, const u8 * m, u32 size)
+{
+    for (u32 at = 0; at < size; at += 16)
+    {
+        u32 block_size = min(size - at, (u32)16);
+        for (u32 i = 0; i < block_size; ++i)
+        {
+            x[i] ^= m[at + i];
+        }
+        GHashMultiplySoftware(key, x);
+    }
+}
+
+/* data ^= AES-CTR keystream from counter block nonce | counter */
+void
+AesCtrSoftware(const crypto_key * key, const u8 * nonce, u32 counter, u8 * data, u32 size)
+{
+    u8 block[16];
+    u8 keystream[16];
+    memcpy(block, nonce, CRYPTO_NONCE_SIZE);
+    for (u32 at = 0; at < size; at += 16, ++counter)
+    {
+        StoreU32BE(block + 12, counter);
+        AesEncryptBlockSoftware(key, block, keystream);
+        u32 block_size = min(size - at, (u32)16);
+        for (u32 i = 0; i < block_size; ++i)
+        {
+            data[at + i] ^= keystream[i];
+        }
+    }
+}
+
+void
+AesGcmTagSoftware(const crypto_job * job, u8 * tag)
+{
+    u8 x[16] = {};
+    GHashSoftware(job->key, x, job->aad, job->aad_size);
+    GHashSoftware(job->key, x, job->data, job->size);
+
+    u8 lengths[16];
+    StoreU64BE(lengths, (u64)job->aad_size * 8);
+    StoreU64BE(lengths + 8, (u64)job->size * 8);
+    GHashSoftware(job->key, x, lengths, 16);
+
+    // tag is GHASH xor the first counter block
+    u8 block[16];
+    memcpy(block, job->nonce, CRYPTO_NONCE_SIZE);
+    StoreU32BE(block + 12, 1);
+    AesEncryptBlockSoftware(job->key, block, tag);
+    for (u32 i = 0; i < 16; ++i)
+    {
+        tag[i] ^= x[i];
+    }
+}
+
+/* a * b unreduced into lo:hi, both bit reflected (Intel's carry-less multiplication paper) */
+TARGET("pclmul") inline void
+GHashClmulPCLMUL(__m128i a, __m128i b, __m128i * lo, __m128i * hi)
+{
+    __m128i mid = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10), _mm_clmulepi64_si128(a, b, 0x01));
+    *lo = _mm_xor_si128(*lo, _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x00), _mm_slli_si128(mid, 8)));
+    *hi = _mm_xor_si128(*hi, _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x11), _mm_srli_si128(mid, 8)));
+}
+
+/* lo:hi modulo x^128 + x^7 + x^2 + x + 1, same paper, algorithm 5 */
+TARGET("pclmul") inline __m128i
+GHashReducePCLMUL(__m128i lo, __m128i hi)
+{
+    // 256 bit product one bit left, the reflection is off by one
+    __m128i lo_carry = _mm_srli_epi32(lo, 31);
+    __m128i hi_carry = _mm_srli_epi32(hi, 31);
+    lo = _mm_slli_epi32(lo, 1);
+    hi = _mm_slli_epi32(hi, 1);
+    __m128i cross = _mm_srli_si128(lo_carry, 12);
+    hi_carry = _mm_slli_si128(hi_carry, 4);
+    lo_carry = _mm_slli_si128(lo_carry, 4);
+    lo = _mm_or_si128(lo, lo_carry);
+    hi = _mm_or_si128(hi, hi_carry);
+    hi = _mm_or_si128(hi, cross);
+
+    __m128i a1 = _mm_slli_epi32(lo, 31);
+    __m128i a2 = _mm_slli_epi32(lo, 30);
+    __m128i a3 = _mm_slli_epi32(lo, 25);
+    a1 = _mm_xor_si128(a1, _mm_xor_si128(a2, a3));
+    __m128i spill = _mm_srli_si128(a1, 4);
+    a1 = _mm_slli_si128(a1, 12);
+    lo = _mm_xor_si128(lo, a1);
+
+    __m128i b1 = _mm_srli_epi32(lo, 1);
+    __m128i b2 = _mm_srli_epi32(lo, 2);
+    __m128i b3 = _mm_srli_epi32(lo, 7);
+    b1 = _mm_xor_si128(b1, _mm_xor_si128(b2, b3));
+    b1 = _mm_xor_si128(b1, spill);
+    lo = _mm_xor_si128(lo, b1);
+
+    return _mm_xor_si128(hi, lo);
+}
+
+/* GHASH of m zero padded into x, h holds H to H^4 byte reversed. Four blocks, one reduction */
+TARGET("pclmul,ssse3") inline __m128i
+GHashPCLMUL(__m128i x, const __m128i * h, const u8 * m, u32 size)
+{
+    const __m128i swap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    u32 at = 0;
+    for (; at + 64 <= size; at += 64)
+    {
+        __m128i lo = _mm_setzero_si128();
+        __m128i hi = _mm_setzero_si128();
+        for (u32 i = 0; i < 4; ++i)
+        {
+            __m128i block = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(m + at + 16 * i)), swap);
+            if (i == 0)
+            {
+                block = _mm_xor_si128(block, x);
+            }
+            GHashClmulPCLMUL(block, h[3 - i], &lo, &hi);
+        }
+        x = GHashReducePCLMUL(lo, hi);
+    }
+
+    for (; at < size; at += 16)
+    {
+        __m128i block;
+        if (size - at >= 16)
+        {
+            block = _mm_loadu_si128((const __m128i *)(m + at));
+        }
+        else
+        {
+            u8 padded[16] = {};
+            memcpy(padded, m + at, size - at);
+            block = _mm_loadu_si128((const __m128i *)padded);
+        }
+        __m128i lo = _mm_setzero_si128();
+        __m128i hi = _mm_setzero_si128();
+        GHashClmulPCLMUL(_mm_xor_si128(x, _mm_shuffle_epi8(block, swap)), h[0], &lo, &hi);
+        x = GHashReducePCLMUL(lo, hi);
+    }
+
+    return x;
+}
+
+TARGET("aes") inline __m128i
+AesEncryptAESNI(const __m128i * round_keys, __m128i block)
+{
+    block = _mm_xor_si128(block, round_keys[0]);
+    for (u32 round = 1; round < AES_ROUNDS; ++round)
+    {
+        block = _mm_aesenc_si128(block, round_keys[round]);
+    }
+
+    return _mm_aesenclast_si128(block, round_keys[AES_ROUNDS]);
+}
+
+/* AesCtrSoftware, four blocks in flight */
+TARGET("aes,ssse3") void
+AesCtrAESNI(const crypto_key * key, const u8 * nonce, u32 counter, u8 * data, u32 size)
+{
+    __m128i round_keys[AES_ROUNDS + 1];
+    for (u32 round = 0; round <= AES_ROUNDS; ++round)
+    {
+        round_keys[round] = _mm_loadu_si128((const __m128i *)(key->aes_round_keys + 16 * round));
+    }
+
+    // counter block byte reversed, the big endian counter is lane 0 then
+    const __m128i swap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+    u8 first[16];
+    memcpy(first, nonce, CRYPTO_NONCE_SIZE);
+    StoreU32BE(first + 12, counter);
+    __m128i reversed = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)first), swap);
+
+    u32 at = 0;
+    for (; at + 64 <= size; at += 64)
+    {
+        __m128i b[4];
+        for (u32 i = 0; i < 4; ++i)
+        {
+            b[i] = _mm_xor_si128(_mm_shuffle_epi8(reversed, swap), round_keys[0]);
+            reversed = _mm_add_epi32(reversed, one);
+        }
+        for (u32 round = 1; round < AES_ROUNDS; ++round)
+        {
+            for (u32 i = 0; i < 4; ++i)
+            {
+                b[i] = _mm_aesenc_si128(b[i], round_keys[round]);
+            }
+        }
+        for (u32 i = 0; i < 4; ++i)
+        {
+            b[i] = _mm_aesenclast_si128(b[i], round_keys[AES_ROUNDS]);
+            __m128i d = _mm_loadu_si128((const __m128i *)(data + at + 16 * i));
+            _mm_storeu_si128((__m128i *)(data + at + 16 * i), _mm_xor_si128(d, b[i]));
+        }
+    }
+
+    for (; at < size; at += 16)
+    {
+        __m128i keystream = AesEncryptAESNI(round_keys, _mm_shuffle_epi8(reversed, swap));
+        reversed = _mm_add_epi32(reversed, one);
+        if (size - at >= 16)
+        {
+            __m128i d = _mm_loadu_si128((const __m128i *)(data + at));
+            _mm_storeu_si128((__m128i *)(data + at), _mm_xor_si128(d, keystream));
+        }
+        else
+        {
+            u8 bytes[16];
+            _mm_storeu_si128((__m128i *)bytes, keystream);
+            for (u32 i = 0; i < size - at; ++i)
+            {
+                data[at + i] ^= bytes[i];
+            }
+        }
+    }
+}
+
+TARGET("aes,pclmul,ssse3") void
+AesGcmTagAESNI(const crypto_job * job, u8 * tag)
+{
+    const __m128i swap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m128i h[4];
+    for (u32 power = 0; power < 4; ++power)
+    {
+        h[power] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)job->key->ghash_h[power]), swap);
+    }
+
+    __m128i x = _mm_setzero_si128();
+    x = GHashPCLMUL(x, h, job->aad, job->aad_size);
+    x = GHashPCLMUL(x, h, job->data, job->size);
+
+    u8 lengths[16];
+    StoreU64BE(lengths, (u64)job->aad_size * 8);
+    StoreU64BE(lengths + 8, (u64)job->size * 8);
+    x = GHashPCLMUL(x, h, lengths, 16);
+
+    __m128i round_keys[AES_ROUNDS + 1];
+    for (u32 round = 0; round <= AES_ROUNDS; ++round)
+    {
+        round_keys[round] = _mm_loadu_si128((const __m128i *)(job->key->aes_round_keys + 16 * round));
+    }
+    u8 block[16];
+    memcpy(block, job->nonce, CRYPTO_NONCE_SIZE);
+    StoreU32BE(block + 12, 1);
+    __m128i mask = AesEncryptAESNI(round_keys, _mm_loadu_si128((const __m128i *)block));
+
+    _mm_storeu_si128((__m128i *)tag, _mm_xor_si128(_mm_shuffle_epi8(x, swap), mask));
+}
+
+void
+AesGcmSeal(crypto_job * job)
+{
+    if (crypto_use_aesni)
+    {
+        AesCtrAESNI(job->key, job->nonce, 2, job->data, job->size);
+        AesGcmTagAESNI(job, job->tag);
+    }
+    else
+    {
+        AesCtrSoftware(job->key, job->nonce, 2, job->data, job->size);
+        AesGcmTagSoftware(job, job->tag);
+    }
+    job->ok = true;
+}
+
+void
+AesGcmOpen(crypto_job * job)
+{
+    u8 tag[CRYPTO_TAG_SIZE];
+    if (crypto_use_aesni)
+    {
+        AesGcmTagAESNI(job, tag);
+    }
+    else
+    {
+        AesGcmTagSoftware(job, tag);
+    }
+
+    job->ok = CryptoTagEqual(tag, job->tag);
+    if (job->ok)
+    {
+        if (crypto_use_aesni)
+        {
+            AesCtrAESNI(job->key, job->nonce, 2, job->data, job->size);
+        }
+        else
+        {
+            AesCtrSoftware(job->key, job->nonce, 2, job->data, job->size);
+        }
+    }
+}
+
+/* JOBS */
+
+/* jobs in runs of the same cipher, ChaCha20 ones up to a batch at a time */
+inline u32
+CryptoRun(const crypto_job * jobs, u32 count)
+{
+    u32 run = 1;
+    while (run < count && run < CRYPTO_BATCH_SIZE && jobs[run].cipher == jobs[0].cipher)
+    {
+        ++run;
+    }
+
+    return run;
+}
+
+/* encrypts every job in place and writes its tag */
+void
+CryptoSealBatch(crypto_job * jobs, u32 count)
+{
+    for (u32 first = 0; first < count;)
+    {
+        u32 run = CryptoRun(jobs + first, count - first);
+        for (u32 job_index = first; job_index < first + run; ++job_index)
+        {
+            Assert(jobs[job_index].cipher < packet_cipher_count);
+        }
+
+        if (jobs[first].cipher == packet_cipher_aes256_gcm)
+        {
+            for (u32 job_index = first; job_index < first + run; ++job_index)
+            {
+                AesGcmSeal(jobs + job_index);
+            }
+        }
+        else
+        {
+            ChaChaPolySeal(jobs + first, run);
+        }
+
+        first += run;
+    }
+}
+
+void
+CryptoOpenRuns(crypto_job * jobs, u32 count)
+{
+    for (u32 first = 0; first < count;)
+    {
+        u32 run = CryptoRun(jobs + first, count - first);
+        if (jobs[first].cipher == packet_cipher_aes256_gcm)
+        {
+            for (u32 job_index = first; job_index < first + run; ++job_index)
+            {
+                AesGcmOpen(jobs + job_index);
+            }
+        }
+        else
+        {
+            ChaChaPolyOpen(jobs + first, run);
+        }
+
+        first += run;
+    }
+}
+
+/* checks every job's tag, decrypts it in place when it matches */
+void
+CryptoOpenBatch(crypto_job * jobs, u32 count)
+{
+    CryptoOpenRuns(jobs, count);
+
+    // a peer switching ciphers has packets of the old one in flight
+    for (u32 job_index = 0; job_index < count; ++job_index)
+    {
+        crypto_job * job = jobs + job_index;
+        u32 others = job->fallback_ciphers & ~(1u << job->cipher);
+        for (u32 cipher = 0; !job->ok && cipher < packet_cipher_count; ++cipher)
+        {
+            if (others & (1u << cipher))
+            {
+                job->cipher = cipher;
+                CryptoOpenRuns(job, 1);
+            }
+        }
+    }
+}
+
+/* cipher for a peer that offered ciphers (packet_cipher bits), the fastest here */
+u32
+CryptoPickCipher(u32 ciphers)
+{
+    if (crypto_use_aesni && (ciphers & (1u << packet_cipher_aes256_gcm)))
+    {
+        return packet_cipher_aes256_gcm;
+    }
+
+    return packet_cipher_chacha20_poly1305;
+}
+
+/* X25519 */
+
+/*
+ * RFC 7748 on GF(2^255 - 19), ten signed limbs of 26 and 25 bits alternating
+ * (limb i starts at bit ceil(25.5 i)): products of two carried limbs times 38
+ * summed ten times stay under 2^63, no 128 bit type needed. Every operation
+ * leaves its result carried. The ladder runs the same steps whatever the
+ * scalar, swaps are masks.
+ */
+struct field25519
+{
+    i64 limb[10];
+};
+
+static const u32 field25519_bits[10] = { 26, 25, 26, 25, 26, 25, 26, 25, 26, 25 };
+static const u32 field25519_offset[10] = { 0, 26, 51, 77, 102, 128, 153, 179, 204, 230 };
+
+static const u8 x25519_base_point[CRYPTO_PUBLIC_KEY_SIZE] = { 9 };
+
+inline void
+FieldCarry(field25519 * h)
+{
+    for (u32 i = 0; i < 10; ++i)
+    {
+        u32 bits = field25519_bits[i];
+        // arithmetic shift, floor for negative limbs
+        i64 carry = h->limb[i] >> bits;
+        h->limb[i] -= carry * ((i64)1 << bits);
+        if (i < 9)
+        {
+            h->limb[i + 1] += carry;
+        }
+        else
+        {
+            // 2^255 is 19
+            h->limb[0] += carry * 19;
+        }
+    }
+    i64 carry = h->limb[0] >> 26;
+    h->limb[0] -= carry * ((i64)1 << 26);
+    h->limb[1] += carry;
+}
+
+inline void
+FieldSet(field25519 * h, i64 value)
+{
+    memset(h, 0, sizeof(field25519));
+    h->limb[0] = value;
+}
+
+inline void
+FieldAdd(field25519 * h, const field25519 * f, const field25519 * g)
+{
+    for (u32 i = 0; i < 10; ++i)
+    {
+        h->limb[i] = f->limb[i] + g->limb[i];
+    }
+    FieldCarry(h);
+}
+
+inline void
+FieldSub(field25519 * h, const field25519 * f, const field25519 * g)
+{
+    for (u32 i = 0; i < 10; ++i)
+    {
+        h->limb[i] = f->limb[i] - g->limb[i];
+    }
+    FieldCarry(h);
+}
+
+/* h may be f or g */
+void
+FieldMul(field25519 * h, const field25519 * f, const field25519 * g)
+{
+    // two odd limbs start half a bit late each, their product counts twice.
+    // Past the top it wraps to the bottom times 19
+    i64 g_odd[10], g19[10], g19_odd[10];
+    for (u32 j = 0; j < 10; ++j)
+    {
+        i64 twice = 1 + (j & 1);
+        g_odd[j] = g->limb[j] * twice;
+        g19[j] = g->limb[j] * 19;
+        g19_odd[j] = g19[j] * twice;
+    }
+
+    i64 sum[10] = {};
+    for (u32 i = 0; i < 10; ++i)
+    {
+        i64 fi = f->limb[i];
+        const i64 * low = (i & 1) ? g_odd : g->limb;
+        const i64 * high = (i & 1) ? g19_odd : g19;
+        for (u32 j = 0; j < 10 - i; ++j)
+        {
+            sum[i + j] += fi * low[j];
+        }
+        for (u32 j = 10 - i; j < 10; ++j)
+        {
+            sum[i + j - 10] += fi * high[j];
+        }
+    }
+    memcpy(h->limb, sum, sizeof(sum));
+    FieldCarry(h);
+}
+
+inline void
+FieldMulSmall(field25519 * h, const field25519 * f, i64 c)
+{
+    for (u32 i = 0; i < 10; ++i)
+    {
+        h->limb[i] = f->limb[i] * c;
+    }
+    FieldCarry(h);
+}
+
+/* z^(p - 2), p - 2 = 2^255 - 21 has every bit but 2 and 4 set */
+void
+FieldInvert(field25519 * h, const field25519 * z)
+{
+    field25519 t = *z;
+    for (i32 bit = 253; bit >= 0; --bit)
+    {
+        FieldMul(&t, &t, &t);
+        if (bit != 2 && bit != 4)
+        {
+            FieldMul(&t, &t, z);
+        }
+    }
+    *h = t;
+}
+
+/* swaps f and g if swap is 1, the same work if it isn't */
+inline void
+FieldSwap(field25519 * f, field25519 * g, u32 swap)
+{
+    i64 mask = -(i64)swap;
+    for (u32 i = 0; i < 10; ++i)
+    {
+        i64 x = mask & (f->limb[i] ^ g->limb[i]);
+        f->limb[i] ^= x;
+        g->limb[i] ^= x;
+    }
+}
+
+/* little endian, the top bit is ignored */
+void
+FieldFromBytes(field25519 * h, const u8 * s)
+{
+    // a limb is read as 8 bytes from where it starts
+    u8 padded[CRYPTO_PUBLIC_KEY_SIZE + 8] = {};
+    memcpy(padded, s, CRYPTO_PUBLIC_KEY_SIZE);
+    padded[31] &= 0x7f;
+
+    for (u32 i = 0; i < 10; ++i)
+    {
+        u32 offset = field25519_offset[i];
+        u64 bits = (u64)LoadU32(padded + offset / 8) | ((u64)LoadU32(padded + offset / 8 + 4) << 32);
+        h->limb[i] = (i64)((bits >> (offset % 8)) & (((u64)1 << field25519_bits[i]) - 1));
+    }
+}
+
+/* fully reduced, ref10's fe_tobytes */
+void
+FieldToBytes(u8 * s, const field25519 * f)
+{
+    field25519 h = *f;
+    FieldCarry(&h);
+
+    // 1 if h >= p
+    i64 q = (19 * h.limb[9] + ((i64)1 << 24)) >> 25;
+    for (u32 i = 0; i < 10; ++i)
+    {
+        q = (h.limb[i] + q) >> field25519_bits[i];
+    }
+    h.limb[0] += 19 * q;
+
+    for (u32 i = 0; i < 9; ++i)
+    {
+        i64 carry = h.limb[i] >> field25519_bits[i];
+        h.limb[i] -= carry * ((i64)1 << field25519_bits[i]);
+        h.limb[i + 1] += carry;
+    }
+    // bit 255 is the q * 2^255 taken away
+    h.limb[9] &= ((i64)1 << 25) - 1;
+
+    u64 bits = 0;
+    u32 bit_count = 0;
+    u32 at = 0;
+    for (u32 i = 0; i < 10; ++i)
+    {
+        bits |= (u64)h.limb[i] << bit_count;
+        bit_count += field25519_bits[i];
+        for (; bit_count >= 8; bit_count -= 8)
+        {
+            s[at++] = (u8)bits;
+            bits >>= 8;
+        }
+    }
+    s[at] = (u8)bits;
+}
+
+/* out = scalar * point, u coordinates of 32 bytes; the scalar is clamped */
+void
+X25519(u8 * out, const u8 * scalar, const u8 * point)
+{
+    u8 k[CRYPTO_PUBLIC_KEY_SIZE];
+    memcpy(k, scalar, sizeof(k));
+    k[0] &= 248;
+    k[31] &= 127;
+    k[31] |= 64;
+
+    field25519 x1, x2, z2, x3, z3;
+    FieldFromBytes(&x1, point);
+    FieldSet(&x2, 1);
+    FieldSet(&z2, 0);
+    x3 = x1;
+    FieldSet(&z3, 1);
+
+    u32 swap = 0;
+    for (i32 t = 254; t >= 0; --t)
+    {
+        u32 bit = (k[t >> 3] >> (t & 7)) & 1;
+        swap ^= bit;
+        FieldSwap(&x2, &x3, swap);
+        FieldSwap(&z2, &z3, swap);
+        swap = bit;
+
+        field25519 a, aa, b, bb, e, c, d, da, cb;
+        FieldAdd(&a, &x2, &z2);
+        FieldMul(&aa, &a, &a);
+        FieldSub(&b, &x2, &z2);
+        FieldMul(&bb, &b, &b);
+        FieldSub(&e, &aa, &bb);
+        FieldAdd(&c, &x3, &z3);
+        FieldSub(&d, &x3, &z3);
+        FieldMul(&da, &d, &a);
+        FieldMul(&cb, &c, &b);
+
+        FieldAdd(&x3, &da, &cb);
+        FieldMul(&x3, &x3, &x3);
+        FieldSub(&z3, &da, &cb);
+        FieldMul(&z3, &z3, &z3);
+        FieldMul(&z3, &z3, &x1);
+        FieldMul(&x2, &aa, &bb);
+        // a24 = (486662 - 2) / 4
+        FieldMulSmall(&z2, &e, 121665);
+        FieldAdd(&z2, &z2, &aa);
+        FieldMul(&z2, &z2, &e);
+    }
+    FieldSwap(&x2, &x3, swap);
+    FieldSwap(&z2, &z3, swap);
+
+    FieldInvert(&z2, &z2);
+    FieldMul(&x2, &x2, &z2);
+    FieldToBytes(out, &x2);
+
+    CryptoWipe(k, sizeof(k));
+}
+
+/* PACKET STAGE */
+
+/* a new ephemeral key pair, false if the OS has no random bytes to give */
+b32
+CryptoNewKeyPair(crypto_key_pair * pair)
+{
+    if (!GetOsRandom(pair->private_key, sizeof(pair->private_key)))
+    {
+        return false;
+    }
+    X25519(pair->public_key, pair->private_key, x25519_base_point);
+
+    return true;
+}
+
+/*
+ * Keys of the session between own and peer_public, is_client tells which
+ * end is calling. False if the peer's key is one of the low order points
+ * that give an all zero secret.
+ */
+b32
+CryptoSessionKey(const crypto_key_pair * own, const u8 * peer_public, b32 is_client, crypto_key * key)
+{
+    const u8 * client_public = is_client ? own->public_key : peer_public;
+    const u8 * server_public = is_client ? peer_public : own->public_key;
+    u8 secret[CRYPTO_KEY_SIZE];
+    X25519(secret, own->private_key, peer_public);
+
+    u8 zero = 0;
+    for (u32 i = 0; i < sizeof(secret); ++i)
+    {
+        zero |= secret[i];
+    }
+    if (zero == 0)
+    {
+        return false;
+    }
+
+    // HChaCha20 keyed with the secret, chained over both public keys 16 bytes at a time
+    u8 transcript[2 * CRYPTO_PUBLIC_KEY_SIZE];
+    memcpy(transcript, client_public, CRYPTO_PUBLIC_KEY_SIZE);
+    memcpy(transcript + CRYPTO_PUBLIC_KEY_SIZE, server_public, CRYPTO_PUBLIC_KEY_SIZE);
+    for (u32 at = 0; at < sizeof(transcript); at += 16)
+    {
+        u8 next[CRYPTO_KEY_SIZE];
+        HChaCha20(secret, transcript + at, next);
+        memcpy(secret, next, sizeof(secret));
+        CryptoWipe(next, sizeof(next));
+    }
+
+    u8 in[16] = { 's', 'e', 's', 's', 'i', 'o', 'n', ' ', 'k', 'e', 'y', ' ' };
+    HChaCha20(secret, in, key->chacha);
+
+    u8 aes_in[16] = { 'a', 'e', 's', '-', 'g', 'c', 'm', ' ', 'k', 'e', 'y', ' ' };
+    u8 aes_key[CRYPTO_KEY_SIZE];
+    HChaCha20(secret, aes_in, aes_key);
+    AesGcmKeyInit(key, aes_key);
+
+    CryptoWipe(secret, sizeof(secret));
+    CryptoWipe(aes_key, sizeof(aes_key));
+
+    return true;
+}
+
+/* key exchange datagram of type with public_key into out, returns its size */
+u32
+CryptoHandshakeWrite(u8 * out, u32 type, const u8 * public_key)
+{
+    out[0] = (u8)type;
+    out[1] = (u8)(PROTOCOL_HANDSHAKE_ID << PACKET_HEADER_PROTOCOL_SHIFT);
+    memcpy(out + 2, public_key, CRYPTO_PUBLIC_KEY_SIZE);
+
+    return CRYPTO_HANDSHAKE_SIZE;
+}
+
+/* in is a key exchange datagram of type, its key goes in public_key */
+b32
+CryptoHandshakeRead(const u8 * in, u32 size, u32 type, u8 * public_key)
+{
+    if (size != CRYPTO_HANDSHAKE_SIZE || in[0] != type ||
+        in[1] != (u8)(PROTOCOL_HANDSHAKE_ID << PACKET_HEADER_PROTOCOL_SHIFT))
+    {
+        return false;
+    }
+    memcpy(public_key, in + 2, CRYPTO_PUBLIC_KEY_SIZE);
+
+    return true;
+}
+
+inline void
+CryptoNonce(u8 * nonce, u32 seq, u32 counter, u32 direction)
+{
+    memset(nonce, 0, CRYPTO_NONCE_SIZE);
+    StoreU32(nonce, seq);
+    StoreU32(nonce + 4, counter);
+    nonce[8] = (u8)direction;
+}
+
+/*
+ * Job sealing the datagram in wire: header_size bytes of header as on the
+ * wire, then payload_size bytes, with room for the counter and tag after
+ * them. counter is the session's, packets with flags take the next one.
+ * cipher is a packet_cipher.
+ * Returns the datagram size once the job has run
+ */
+u32
+PacketSealJob(crypto_job * job, const crypto_key * key, u32 cipher, u32 direction, const packet_header * header,
+              u8 * wire, u32 header_size, u32 payload_size, u32 * counter)
+{
+    u8 * end = wire + header_size + payload_size;
+    u32 seq = header->seq;
+    u32 packet_counter = 0;
+    if (header->flags)
+    {
+        *counter += 1;
+        packet_counter = *counter;
+        seq = 0;
+        StoreU32(end, packet_counter);
+        end += CRYPTO_COUNTER_SIZE;
+    }
+
+    job->key = key;
+    job->cipher = cipher;
+    job->fallback_ciphers = 0;
+    CryptoNonce(job->nonce, seq, packet_counter, direction);
+    job->aad = wire;
+    job->aad_size = header_size;
+    job->data = wire + header_size;
+    job->size = payload_size;
+    job->tag = end;
+    job->ok = false;
+
+    return (u32)(end - wire) + CRYPTO_TAG_SIZE;
+}
+
+/*
+ * Job opening the datagram of size bytes in wire, header as decoded from
+ * its header_size bytes, tried with cipher and then fallback_ciphers. False
+ * if it can't be one of ours, otherwise size drops the counter and tag, for
+ * when the job comes out ok
+ */
+b32
+PacketOpenJob(crypto_job * job, const crypto_key * key, u32 cipher, u32 fallback_ciphers,
+              u32 direction, const packet_header * header,
+              u8 * wire, u32 header_size, i32 * size)
+{
+    u32 trailer = CRYPTO_TAG_SIZE + (header->flags ? CRYPTO_COUNTER_SIZE : 0);
+    if ((u32)*size < header_size + trailer)
+    {
+        return false;
+    }
+
+    u32 payload_size = (u32)*size - header_size - trailer;
+    u32 seq = header->seq;
+    u32 packet_counter = 0;
+    if (header->flags)
+    {
+        packet_counter = LoadU32(wire + header_size + payload_size);
+        seq = 0;
+        if (packet_counter == 0)
+        {
+            return false;
+        }
+    }
+
+    job->key = key;
+    job->cipher = cipher;
+    job->fallback_ciphers = fallback_ciphers;
+    CryptoNonce(job->nonce, seq, packet_counter, direction);
+    job->aad = wire;
+    job->aad_size = header_size;
+    job->data = wire + header_size;
+    job->size = payload_size;
+    job->tag = wire + *size - CRYPTO_TAG_SIZE;
+    job->ok = false;
+
+    *size = (i32)(header_size + payload_size);
+
+    return true;
+}
+
+/* one datagram sealed right away, same arguments as PacketSealJob */
+u32
+PacketEncrypt(const crypto_key * key, u32 cipher, u32 direction, const packet_header * header,
+              u8 * wire, u32 header_size, u32 payload_size, u32 * counter)
+{
+    crypto_job job;
+    u32 sealed_size = PacketSealJob(&job, key, cipher, direction, header, wire, header_size, payload_size, counter);
+    CryptoSealBatch(&job, 1);
+
+    return sealed_size;
+}
+
+/*
+ * One datagram that passed PacketHeaderWireSize opened right away, seqs as
+ * for PacketHeaderRead. False if it doesn't, otherwise size drops the
+ * counter and tag
+ */
+b32
+PacketDecrypt(const crypto_key * key, u32 cipher, u32 fallback_ciphers, u32 direction,
+              u8 * wire, u32 header_size, i32 * size, u32 remote_seq, u32 local_seq)
+{
+    packet_header header;
+    PacketHeaderRead(wire, remote_seq, local_seq, &header);
+
+    crypto_job job;
+    i32 opened_size = *size;
+    if (!PacketOpenJob(&job, key, cipher, fallback_ciphers, direction, &header, wire, header_size, &opened_size))
+    {
+        return false;
+    }
+
+    CryptoOpenBatch(&job, 1);
+    if (!job.ok)
+    {
+        return false;
+    }
+
+    *size = opened_size;
+
+    return true;
+}
@@ -0,0 +1,109 @@
+#ifndef UDP_CRYPTO_H
+#define UDP_CRYPTO_H
+
+#include "protocol.h"
+
+/*
+ * Packet encryption, ChaCha20-Poly1305 (RFC 8439) or AES-256-GCM
+ * (SP 800-38D), both with a 12 byte nonce and 16 byte tag
+ *
+ * The payload is encrypted in place and the wire header is authenticated
+ * with it, the tag follows:
+ *   header  payload  [u32 counter]  tag  | salt crc (crc32c.h)
+ * Nonce: u32 seq, u32 counter, u8 direction, 3 zero bytes.
+ * Data packets take seq, which is new for every one of them, and counter 0.
+ * Ack only, repair and probe packets go out with the seq of the last data
+ * packet, they take a counter of their own instead and send it.
+ * direction tells the two ends apart, they share the session key.
+ *
+ * The session key comes from an ephemeral X25519 exchange (RFC 7748), both
+ * private keys straight from the OS CSPRNG and new every session:
+ *   client  hello  its public key, until a reply gets in
+ *   server  reply  its public key, a new pair for each client; a repeated
+ *                  hello gets the same reply again
+ * Both are key exchange datagrams, not packets: byte 0 the type, byte 1
+ * PROTOCOL_HANDSHAKE_ID where a packet has PROTOCOL_ID, then the key, in the
+ * clear with the usual trailer (crc32c.h). The reply is never bigger than the
+ * hello. Nothing is encrypted before the exchange and the server opens no
+ * packet of an addr:port that hasn't done one.
+ * The shared secret keys HChaCha20 chained over client then server public
+ * key, 16 bytes at a time, and that keys HChaCha20 once more for each
+ * cipher's key. The public keys are 256 bits of fresh randomness each, no
+ * two sessions share a key so seq and counter never repeat a nonce under
+ * one. Nothing authenticates the server: someone in the path can sit in the
+ * middle of the exchange, one watching it learns nothing.
+ *
+ * The cipher is agreed on in the auth exchange: the client offers all it
+ * has (udp_auth.ciphers) and starts with ChaCha20-Poly1305, the server
+ * picks the fastest on its cpu (udp_auth_reply.cipher) and switches right
+ * away. Packets of the old one are still in flight, so a tag that doesn't
+ * match is tried with the other ciphers the session allows.
+ * AES-GCM runs on AES-NI and PCLMULQDQ when the cpu has them, otherwise on
+ * T-table AES and a 4 bit GHASH table: portable but not constant time. The
+ * server only picks AES-GCM with the instructions, a client without them
+ * pays for it in one session.
+ *
+ * Jobs are run in batches: with AVX2 eight ChaCha20 packets at once, one
+ * block of each per lane. Poly1305 and AES-GCM are per packet. The server
+ * seals a pacing slot's sends together and opens what it drains from the
+ * socket together.
+ */
+
+#define CRYPTO_KEY_SIZE 32
+#define CRYPTO_PUBLIC_KEY_SIZE 32
+#define CRYPTO_NONCE_SIZE 12
+#define CRYPTO_TAG_SIZE 16
+#define CRYPTO_COUNTER_SIZE 4
+#define CRYPTO_BATCH_SIZE 8
+
+#define CRYPTO_CLIENT_TO_SERVER 0
+#define CRYPTO_SERVER_TO_CLIENT 1
+
+// key exchange datagrams, type, protocol, public key
+#define CRYPTO_HANDSHAKE_HELLO 1
+#define CRYPTO_HANDSHAKE_REPLY 2
+#define CRYPTO_HANDSHAKE_SIZE (2 + CRYPTO_PUBLIC_KEY_SIZE)
+
+#define AES_ROUNDS 14
+
+/* X25519, one per session and side */
+struct crypto_key_pair
+{
+    u8 private_key[CRYPTO_KEY_SIZE];
+    u8 public_key[CRYPTO_PUBLIC_KEY_SIZE];
+};
+
+/* a session's keys, every cipher's */
+struct crypto_key
+{
+    u8 chacha[CRYPTO_KEY_SIZE];
+    // AES-256 round keys as FIPS-197 lays them out, AES-NI takes them as they are
+    u8 aes_round_keys[(AES_ROUNDS + 1) * 16];
+    // GHASH key H = AES(0) and H^2 to H^4 for four blocks at a time, its 4 bit
+    // multiples for the table version
+    u8 ghash_h[4][16];
+    u64 ghash_hi[16];
+    u64 ghash_lo[16];
+};
+
+struct crypto_job
+{
+    const crypto_key * key;
+    // packet_cipher, open: the one that matched
+    u32 cipher;
+    // open: packet_cipher bits to try when cipher doesn't match
+    u32 fallback_ciphers;
+    u8 nonce[CRYPTO_NONCE_SIZE];
+    // authenticated, not encrypted
+    const u8 * aad;
+    u32 aad_size;
+    // encrypted or decrypted in place
+    u8 * data;
+    u32 size;
+    // seal writes it, open checks it
+    u8 * tag;
+    // open: tag matched, data is plaintext. Left as it was if not
+    b32 ok;
+};
+
+#endif
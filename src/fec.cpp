@@ -0,0 +1,547 @@
+#include "fec.h"
+#include "cpu.h"
+#include "math.h"
+#include <string.h>
+
+/* GF(256) TABLES */
+
+// x^8 + x^4 + x^3 + x^2 + 1, 2 is a generator
+#define GF_POLYNOMIAL 0x11D
+
+static u8 gf_exp[512];
+static u8 gf_log[256];
+// c * low nibble, c * high nibble. 16 entries each so PSHUFB can look them up
+static u8 gf_mul_lo[256][16];
+static u8 gf_mul_hi[256][16];
+static b32 gf_use_ssse3;
+
+inline u8
+GfMul(u8 a, u8 b)
+{
+    u8 result = 0;
+    if (a && b)
+    {
+        result = gf_exp[gf_log[a] + gf_log[b]];
+    }
+
+    return result;
+}
+
+inline u8
+GfInv(u8 a)
+{
+    Assert(a != 0);
+    u8 result = gf_exp[255 - gf_log[a]];
+
+    return result;
+}
+
+/* coefficient of the packet at index i of the group in Q */
+inline u8
+GfPow2(u32 i)
+{
+    u8 result = gf_exp[i % 255];
+
+    return result;
+}
+
+void
+FecInit()
+{
+    u32 x = 1;
+    for (u32 i = 0; i < 255; ++i)
+    {
+        gf_exp[i] = (u8)x;
+        gf_exp[i + 255] = (u8)x;
+        gf_log[x] = (u8)i;
+        x <<= 1;
+        if (x & 0x100)
+        {
+            x ^= GF_POLYNOMIAL;
+        }
+    }
+    gf_exp[510] = gf_exp[0];
+    gf_exp[511] = gf_exp[1];
+
+    for (u32 c = 0; c < 256; ++c)
+    {
+        for (u32 nibble = 0; nibble < 16; ++nibble)
+        {
+            gf_mul_lo[c][nibble] = GfMul((u8)c, (u8)nibble);
+            gf_mul_hi[c][nibble] = GfMul((u8)c, (u8)(nibble << 4));
+        }
+    }
+
+    gf_use_ssse3 = GetCpuFeatures().ssse3;
+}
+
+/* REGION OPERATIONS */
+
+void
+FecXorRegion(u8 * dst, const u8 * src, u32 size)
+{
+    u32 i = 0;
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(d, s));
+    }
+    for (; i < size; ++i)
+    {
+        dst[i] ^= src[i];
+    }
+}
+
+TARGET("ssse3") void
+FecMulAddRegionSSSE3(u8 * dst, const u8 * src, u8 c, u32 size)
+{
+    // c * b == c * (b & 0x0F) ^ c * (b & 0xF0), each half is a 16 entry lookup
+    __m128i table_lo = _mm_loadu_si128((const __m128i *)gf_mul_lo[c]);
+    __m128i table_hi = _mm_loadu_si128((const __m128i *)gf_mul_hi[c]);
+    __m128i nibble_mask = _mm_set1_epi8(0x0F);
+
+    u32 i = 0;
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i lo = _mm_and_si128(s, nibble_mask);
+        __m128i hi = _mm_and_si128(_mm_srli_epi64(s, 4), nibble_mask);
+        __m128i product = _mm_xor_si128(_mm_shuffle_epi8(table_lo, lo),
+                                        _mm_shuffle_epi8(table_hi, hi));
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(d, product));
+    }
+    for (; i < size; ++i)
+    {
+        dst[i] ^= gf_mul_lo[c][src[i] & 0x0F] ^ gf_mul_hi[c][src[i] >> 4];
+    }
+}
+
+/* dst += c * src */
+void
+FecMulAddRegion(u8 * dst, const u8 * src, u8 c, u32 size)
+{
+    if (c == 0)
+    {
+        return;
+    }
+
+    if (c == 1)
+    {
+        FecXorRegion(dst, src, size);
+    }
+    else if (gf_use_ssse3)
+    {
+        FecMulAddRegionSSSE3(dst, src, c, size);
+    }
+    else
+    {
+        for (u32 i = 0; i < size; ++i)
+        {
+            dst[i] ^= gf_mul_lo[c][src[i] & 0x0F] ^ gf_mul_hi[c][src[i] >> 4];
+        }
+    }
+}
+
+/* SYMBOLS */
+
+/* size of the message records in payload, false if they don't add up */
+b32
+FecPayloadSize(const u8 * payload, u32 messages, u32 max_size, u32 * size)
+{
+    u32 offset = 0;
+    for (u32 msg_index = 0; msg_index < messages; ++msg_index)
+    {
+        if ((offset + sizeof(message_header)) > max_size)
+        {
+            return false;
+        }
+
+        const message_header * header = (const message_header *)(payload + offset);
+        offset += sizeof(message_header) + header->len;
+
+        if (offset > max_size)
+        {
+            return false;
+        }
+    }
+
+    *size = offset;
+
+    return true;
+}
+
+/* repair_capacity is the payload a packet can take on the path */
+inline b32
+FecSymbolFits(u32 payload_size, u32 repair_capacity)
+{
+    u32 max_symbol_size = min((u32)FEC_MAX_SYMBOL_SIZE, repair_capacity - (u32)sizeof(fec_repair_header));
+    b32 fits = (FEC_SYMBOL_HEADER_SIZE + payload_size) <= max_symbol_size;
+
+    return fits;
+}
+
+inline u32
+FecWriteSymbol(u8 * symbol, u16 messages, const u8 * payload, u32 payload_size)
+{
+    u16 size = (u16)payload_size;
+    memcpy(symbol, &messages, sizeof(messages));
+    memcpy(symbol + 2, &size, sizeof(size));
+    memcpy(symbol + FEC_SYMBOL_HEADER_SIZE, payload, payload_size);
+
+    return FEC_SYMBOL_HEADER_SIZE + payload_size;
+}
+
+/* ENCODER */
+
+void
+FecEncoderInit(fec_encoder * enc)
+{
+    memset(enc, 0, sizeof(fec_encoder));
+}
+
+void
+FecEncoderConfigure(fec_encoder * enc, r32 loss_rate)
+{
+    if (loss_rate < FEC_MIN_LOSS_RATE)
+    {
+        enc->group_size = 0;
+        enc->use_q = false;
+    }
+    else if (loss_rate < FEC_Q_LOSS_RATE)
+    {
+        enc->group_size = 8;
+        enc->use_q = false;
+    }
+    else if (loss_rate < 0.15f)
+    {
+        enc->group_size = 8;
+        enc->use_q = true;
+    }
+    else
+    {
+        enc->group_size = 4;
+        enc->use_q = true;
+    }
+
+    Assert(enc->group_size <= FEC_MAX_GROUP_SIZE);
+}
+
+/* payload left for a packet on a path taking capacity, room kept for its repair while fec is on */
+inline u32
+FecPayloadBudget(r32 loss_rate, u32 capacity)
+{
+    u32 budget = capacity;
+    if (loss_rate >= FEC_MIN_LOSS_RATE)
+    {
+        budget -= FEC_PACKET_OVERHEAD;
+    }
+
+    return budget;
+}
+
+/*
+ * Adds a packet just sent to the current group, repair_capacity is the
+ * payload a packet can take on the path (PmtuPayloadCapacity).
+ * Returns true when the group is closed and its repairs should go out now,
+ * FecEncoderRepairCount tells how many (0 if nothing worth protecting).
+ */
+b32
+FecEncoderAddPacket(fec_encoder * enc, r32 loss_rate, u32 repair_capacity, u32 seq,
+                    u16 messages, const u8 * payload, u32 payload_size, b32 has_reliable)
+{
+    if (enc->count == 0)
+    {
+        FecEncoderConfigure(enc, loss_rate);
+        enc->base_seq = seq;
+        enc->symbol_size = 0;
+        enc->has_reliable = false;
+    }
+
+    if (enc->group_size == 0)
+    {
+        return false;
+    }
+
+    // group must be consecutive, close it and leave this one unprotected
+    if (!FecSymbolFits(payload_size, repair_capacity))
+    {
+        enc->packets_unprotected += 1;
+        return (enc->count > 0);
+    }
+    if (seq != enc->base_seq + enc->count)
+    {
+        return (enc->count > 0);
+    }
+
+    u8 symbol[FEC_MAX_SYMBOL_SIZE];
+    u32 symbol_size = FecWriteSymbol(symbol, messages, payload, payload_size);
+
+    if (enc->count == 0)
+    {
+        memcpy(enc->p, symbol, symbol_size);
+        memset(enc->q, 0, sizeof(enc->q));
+    }
+    else
+    {
+        if (symbol_size > enc->symbol_size)
+        {
+            memset(enc->p + enc->symbol_size, 0, symbol_size - enc->symbol_size);
+        }
+        FecXorRegion(enc->p, symbol, symbol_size);
+    }
+
+    if (enc->use_q)
+    {
+        FecMulAddRegion(enc->q, symbol, GfPow2(enc->count), symbol_size);
+    }
+
+    enc->symbol_size = max(enc->symbol_size, symbol_size);
+    enc->has_reliable |= has_reliable;
+    enc->count += 1;
+
+    return (enc->count == enc->group_size);
+}
+
+inline u32
+FecEncoderRepairCount(fec_encoder * enc)
+{
+    u32 count = 0;
+    if (enc->count > 0 && enc->has_reliable)
+    {
+        count = enc->use_q ? 2 : 1;
+    }
+
+    return count;
+}
+
+/* returns bytes written to data, which must hold PACKET_MAX_PAYLOAD_SIZE */
+u32
+FecEncoderWriteRepair(fec_encoder * enc, u32 repair_index, u8 * data)
+{
+    Assert(repair_index < FecEncoderRepairCount(enc));
+
+    fec_repair_header header;
+    header.base_seq = enc->base_seq;
+    header.count = (u8)enc->count;
+    header.repair_index = (u8)repair_index;
+    header.symbol_size = (u16)enc->symbol_size;
+
+    memcpy(data, &header, sizeof(header));
+    memcpy(data + sizeof(header), (repair_index == FEC_REPAIR_P) ? enc->p : enc->q, enc->symbol_size);
+
+    u32 size = sizeof(header) + enc->symbol_size;
+    enc->repair_bytes_sent += size;
+
+    return size;
+}
+
+/* next packet added starts a new group */
+inline void
+FecEncoderCloseGroup(fec_encoder * enc)
+{
+    enc->groups_sent += (FecEncoderRepairCount(enc) > 0);
+    enc->count = 0;
+}
+
+/* DECODER */
+
+void
+FecDecoderInit(fec_decoder * dec)
+{
+    dec->valid_bit = 0;
+    dec->repair.received_bit = 0;
+    dec->packets_recovered = 0;
+}
+
+inline b32
+FecDecoderHasPacket(fec_decoder * dec, u32 seq)
+{
+    u32 slot = seq & (FEC_WINDOW - 1);
+    b32 has = ((dec->valid_bit >> slot) & 1) && (dec->seq[slot] == seq);
+
+    return has;
+}
+
+void
+FecDecoderAddPacket(fec_decoder * dec, u32 seq, u16 messages, const u8 * payload, u32 payload_size)
+{
+    u32 slot = seq & (FEC_WINDOW - 1);
+
+    if (!FecSymbolFits(payload_size, PACKET_MAX_PAYLOAD_SIZE))
+    {
+        dec->valid_bit &= ~((u32)1 << slot);
+        return;
+    }
+
+    dec->seq[slot] = seq;
+    dec->symbol_size[slot] = (u16)FecWriteSymbol(dec->symbols[slot], messages, payload, payload_size);
+    dec->valid_bit |= ((u32)1 << slot);
+}
+
+/* rebuilt symbol in slot is trusted only if its records add up */
+b32
+FecDecoderAcceptSymbol(fec_decoder * dec, u32 seq, u32 symbol_size, fec_recovered * recovered)
+{
+    u32 slot = seq & (FEC_WINDOW - 1);
+    u8 * symbol = dec->symbols[slot];
+
+    u16 messages, payload_size;
+    memcpy(&messages, symbol, sizeof(messages));
+    memcpy(&payload_size, symbol + 2, sizeof(payload_size));
+
+    u32 records_size = 0;
+    if ((FEC_SYMBOL_HEADER_SIZE + (u32)payload_size) > symbol_size ||
+        !FecPayloadSize(symbol + FEC_SYMBOL_HEADER_SIZE, messages, payload_size, &records_size) ||
+        records_size != payload_size)
+    {
+        return false;
+    }
+
+    dec->seq[slot] = seq;
+    dec->symbol_size[slot] = (u16)(FEC_SYMBOL_HEADER_SIZE + payload_size);
+    dec->valid_bit |= ((u32)1 << slot);
+    dec->packets_recovered += 1;
+
+    recovered->seq = seq;
+    recovered->messages = messages;
+    recovered->size = payload_size;
+    recovered->payload = symbol + FEC_SYMBOL_HEADER_SIZE;
+
+    return true;
+}
+
+/*
+ * Feeds a repair packet payload, returns how many packets were rebuilt (0 to 2).
+ * recovered payloads point into the decoder and are valid until the next call.
+ */
+u32
+FecDecoderAddRepair(fec_decoder * dec, const u8 * data, u32 size, fec_recovered * recovered)
+{
+    fec_repair_header header;
+    if (size < sizeof(header))
+    {
+        return 0;
+    }
+    memcpy(&header, data, sizeof(header));
+
+    if (header.count == 0 || header.count > FEC_MAX_GROUP_SIZE ||
+        header.repair_index > FEC_REPAIR_Q ||
+        header.symbol_size > FEC_MAX_SYMBOL_SIZE ||
+        (sizeof(header) + header.symbol_size) > size)
+    {
+        return 0;
+    }
+
+    fec_repair * repair = &dec->repair;
+    if (repair->base_seq != header.base_seq || repair->count != header.count ||
+        repair->symbol_size != header.symbol_size)
+    {
+        repair->base_seq = header.base_seq;
+        repair->count = header.count;
+        repair->symbol_size = header.symbol_size;
+        repair->received_bit = 0;
+    }
+
+    memcpy(repair->data[header.repair_index], data + sizeof(header), header.symbol_size);
+    repair->received_bit |= ((u32)1 << header.repair_index);
+
+    u32 missing[FEC_MAX_GROUP_SIZE];
+    u32 missing_count = 0;
+    for (u32 i = 0; i < repair->count; ++i)
+    {
+        if (!FecDecoderHasPacket(dec, repair->base_seq + i))
+        {
+            missing[missing_count++] = i;
+        }
+    }
+
+    b32 has_p = (repair->received_bit >> FEC_REPAIR_P) & 1;
+    b32 has_q = (repair->received_bit >> FEC_REPAIR_Q) & 1;
+
+    if (missing_count == 0 || missing_count > 2 || (missing_count == 2 && !(has_p && has_q)))
+    {
+        return 0;
+    }
+
+    u32 symbol_size = repair->symbol_size;
+
+    // take the packets we have out of the repairs
+    u8 p[FEC_MAX_SYMBOL_SIZE];
+    u8 q[FEC_MAX_SYMBOL_SIZE];
+    memcpy(p, repair->data[FEC_REPAIR_P], symbol_size);
+    memcpy(q, repair->data[FEC_REPAIR_Q], symbol_size);
+
+    for (u32 i = 0; i < repair->count; ++i)
+    {
+        u32 seq = repair->base_seq + i;
+        if (!FecDecoderHasPacket(dec, seq))
+        {
+            continue;
+        }
+
+        u32 slot = seq & (FEC_WINDOW - 1);
+        u32 present_size = min((u32)dec->symbol_size[slot], symbol_size);
+        if (has_p)
+        {
+            FecXorRegion(p, dec->symbols[slot], present_size);
+        }
+        if (has_q)
+        {
+            FecMulAddRegion(q, dec->symbols[slot], GfPow2(i), present_size);
+        }
+    }
+
+    // slots of the missing packets may still hold packets from 32 seqs ago
+    for (u32 missing_index = 0; missing_index < missing_count; ++missing_index)
+    {
+        dec->valid_bit &= ~((u32)1 << ((repair->base_seq + missing[missing_index]) & (FEC_WINDOW - 1)));
+    }
+
+    u32 x = missing[0];
+    u8 * dx = dec->symbols[(repair->base_seq + x) & (FEC_WINDOW - 1)];
+    u32 recovered_count = 0;
+
+    if (missing_count == 1)
+    {
+        if (has_p)
+        {
+            // p = dx
+            memcpy(dx, p, symbol_size);
+        }
+        else
+        {
+            // q = g^x * dx
+            memset(dx, 0, symbol_size);
+            FecMulAddRegion(dx, q, GfInv(GfPow2(x)), symbol_size);
+        }
+
+        recovered_count += FecDecoderAcceptSymbol(dec, repair->base_seq + x, symbol_size, recovered + recovered_count);
+    }
+    else
+    {
+        // p = dx + dy, q = g^x * dx + g^y * dy
+        // dx = (g^y * p + q) / (g^x + g^y), dy = p + dx
+        u32 y = missing[1];
+        u8 * dy = dec->symbols[(repair->base_seq + y) & (FEC_WINDOW - 1)];
+
+        u8 gx = GfPow2(x);
+        u8 gy = GfPow2(y);
+        u8 inv_denominator = GfInv(gx ^ gy);
+
+        memset(dx, 0, symbol_size);
+        FecMulAddRegion(dx, p, GfMul(gy, inv_denominator), symbol_size);
+        FecMulAddRegion(dx, q, inv_denominator, symbol_size);
+
+        memcpy(dy, p, symbol_size);
+        FecXorRegion(dy, dx, symbol_size);
+
+        recovered_count += FecDecoderAcceptSymbol(dec, repair->base_seq + x, symbol_size, recovered + recovered_count);
+        recovered_count += FecDecoderAcceptSymbol(dec, repair->base_seq + y, symbol_size, recovered + recovered_count);
+    }
+
+    repair->received_bit = 0;
+
+    return recovered_count;
+}
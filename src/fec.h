@@ -0,0 +1,106 @@
+#ifndef UDP_FEC_H
+#define UDP_FEC_H
+
+#include "protocol.h"
+
+/*
+ * Forward error correction
+ *
+ * Consecutive packets sent to a peer form a group. When the group closes
+ * and at least one of them carried reliable messages, repair packets follow:
+ *  - P: xor of every packet in the group, rebuilds any 1 missing packet
+ *  - Q: sum of g^i * packet_i over GF(256), together with P rebuilds any 2
+ * (RAID-6 style, the same math as a 2 parity Reed-Solomon code).
+ * The receiver keeps the last 32 packets it got and rebuilds what is missing
+ * as soon as the repair arrives, no round trip needed.
+ *
+ * Each packet is encoded as a symbol [u16 messages][u16 size][payload],
+ * shorter symbols count as zero padded up to the longest in the group.
+ * A repair is the longest symbol plus fec_repair_header, FEC_PACKET_OVERHEAD
+ * more than the packet, and has to fit the path like any other packet
+ * (PmtuPayloadCapacity, up to PACKET_MAX_PAYLOAD_SIZE once MTU discovery
+ * confirmed it). Senders keep the overhead out of the packet budget while
+ * FEC is on; packets that still don't fit are sent unprotected and counted.
+ *
+ * Group size follows the loss rate seen by congestion control:
+ * low loss -> long groups with P only, high loss -> short groups with P + Q.
+ */
+
+#define FEC_MAX_GROUP_SIZE 16
+#define FEC_WINDOW 32
+
+// loss rate below it: no repair packets
+#define FEC_MIN_LOSS_RATE 0.01f
+// loss rate above it: Q repair as well
+#define FEC_Q_LOSS_RATE 0.05f
+
+#define FEC_REPAIR_P 0
+#define FEC_REPAIR_Q 1
+
+struct fec_repair_header
+{
+    u32 base_seq;
+    u8 count;
+    u8 repair_index;
+    u16 symbol_size;
+};
+
+#define FEC_SYMBOL_HEADER_SIZE 4
+#define FEC_MAX_SYMBOL_SIZE (PACKET_MAX_PAYLOAD_SIZE - sizeof(fec_repair_header))
+// a repair is this much bigger than the biggest packet of its group
+#define FEC_PACKET_OVERHEAD (sizeof(fec_repair_header) + FEC_SYMBOL_HEADER_SIZE)
+
+struct fec_encoder
+{
+    u32 group_size;
+    b32 use_q;
+
+    u32 base_seq;
+    u32 count;
+    u32 symbol_size;
+    b32 has_reliable;
+
+    u8 p[FEC_MAX_SYMBOL_SIZE];
+    u8 q[FEC_MAX_SYMBOL_SIZE];
+
+    // stats
+    u32 groups_sent;
+    u32 repair_bytes_sent;
+    // too big for a repair on the path while fec was on
+    u32 packets_unprotected;
+};
+
+struct fec_repair
+{
+    u32 base_seq;
+    u32 count;
+    u32 symbol_size;
+    // bit per repair_index received
+    u32 received_bit;
+    u8 data[2][FEC_MAX_SYMBOL_SIZE];
+};
+
+struct fec_decoder
+{
+    // last packets received, by seq & (FEC_WINDOW - 1)
+    u32 seq[FEC_WINDOW];
+    u32 valid_bit;
+    u16 symbol_size[FEC_WINDOW];
+    u8 symbols[FEC_WINDOW][FEC_MAX_SYMBOL_SIZE];
+
+    // repairs of the most recent group
+    fec_repair repair;
+
+    // stats
+    u32 packets_recovered;
+};
+
+struct fec_recovered
+{
+    u32 seq;
+    u16 messages;
+    u16 size;
+    u8 * payload;
+};
+
+#endif
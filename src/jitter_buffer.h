@@ -0,0 +1,288 @@
+#ifndef UDP_JITTER_BUFFER_H
+#define UDP_JITTER_BUFFER_H
+
+#include <string.h>
+#include "platform.h"
+#include "math.h"
+#include "snapshot.h"
+
+/*
+ * Client jitter buffer for world snapshots
+ *
+ * Snapshots are decoded as their packet gets in, the baselines they delta
+ * against live in the receive history (snapshot.h), then held here by the
+ * world tick they were taken at and played out in tick order a fixed time
+ * after the tick: what the wire does to the spacing of packets doesn't show.
+ *
+ * Every arrival is a transit sample, arrival - tick * tick_ns. It is the one
+ * way delay plus a constant nobody knows (the clocks don't have to be in
+ * sync), so only differences mean anything: transit minus the smallest of
+ * the window is the jitter of a packet. A tick plays at
+ *   tick * tick_ns + playout_transit
+ * with playout_transit sized to the JITTER_BUFFER_PERCENTILE transit of the
+ * last JITTER_BUFFER_WINDOW arrivals plus a margin. More jitter and it goes up
+ * at once, playout holds until packets are on time again. Less, by more than
+ * the margin, and it comes down 1/JITTER_BUFFER_SHRINK of the time that
+ * passes, playout runs that much faster until it's there.
+ *
+ * Reordered packets are put in their place. A tick that shows up after a
+ * newer one played is late and dropped, as are duplicates, but its transit
+ * still counts so the delay grows to cover it. Ticks missing (lost, or not
+ * sent at the client's rate) are stepped over.
+ */
+
+// power of 2, how many ticks ahead of playout can be held
+#define JITTER_BUFFER_SLOTS 64
+#define JITTER_BUFFER_WINDOW 128
+#define JITTER_BUFFER_PERCENTILE 95
+#define JITTER_BUFFER_MARGIN_NS (1 * NS_PER_MS)
+#define JITTER_BUFFER_MAX_DELAY_NS (500 * NS_PER_MS)
+#define JITTER_BUFFER_SHRINK 20
+// ticks this far from playout either way are a new server, start over
+#define JITTER_BUFFER_RESET_NS (2 * NS_PER_SECOND)
+
+struct jitter_buffer_entry
+{
+    u32 tick;
+    real_time arrival;
+    world_snapshot snapshot;
+};
+
+struct jitter_buffer
+{
+    u64 tick_ns;
+
+    // by tick & (JITTER_BUFFER_SLOTS - 1)
+    jitter_buffer_entry entries[JITTER_BUFFER_SLOTS];
+    u64 present_bit;
+
+    // ticks count from the first one seen, transit is relative to it
+    b32 has_base;
+    u32 base_tick;
+    u32 newest_tick;
+
+    i64 transit[JITTER_BUFFER_WINDOW];
+    u32 transit_count;
+    u32 transit_next;
+    i64 transit_min;
+    i64 transit_target;
+    i64 playout_transit;
+    real_time last_update;
+
+    // newest tick played
+    b32 playing;
+    u32 played_tick;
+
+    // jitter percentiles of the window, ns above the fastest packet
+    u64 jitter_p50_ns;
+    u64 jitter_p95_ns;
+    u64 jitter_p99_ns;
+
+    // stats
+    u32 pushed;
+    u32 played;
+    u32 late;
+    u32 reordered;
+    u32 duplicates;
+    u32 resets;
+};
+
+inline void
+JitterBufferInit(jitter_buffer * buffer, u64 tick_ns)
+{
+    memset(buffer, 0, sizeof(jitter_buffer));
+    buffer->tick_ns = tick_ns;
+}
+
+/* ns after the base tick that tick started, server side */
+inline i64
+JitterBufferTickTime(jitter_buffer * buffer, u32 tick)
+{
+    return (i64)(i32)(tick - buffer->base_tick) * (i64)buffer->tick_ns;
+}
+
+inline void
+JitterBufferReset(jitter_buffer * buffer, u32 tick)
+{
+    buffer->present_bit = 0;
+    buffer->base_tick = tick;
+    buffer->newest_tick = tick;
+    buffer->transit_count = 0;
+    buffer->transit_next = 0;
+    buffer->playing = false;
+    buffer->resets += 1;
+}
+
+inline void
+JitterBufferAddTransit(jitter_buffer * buffer, i64 transit)
+{
+    buffer->transit[buffer->transit_next] = transit;
+    buffer->transit_next = (buffer->transit_next + 1) % JITTER_BUFFER_WINDOW;
+    buffer->transit_count = min(buffer->transit_count + 1, (u32)JITTER_BUFFER_WINDOW);
+
+    // a push a frame at most, the window is small enough to sort
+    i64 sorted[JITTER_BUFFER_WINDOW];
+    u32 count = buffer->transit_count;
+    for (u32 i = 0; i < count; ++i)
+    {
+        i64 value = buffer->transit[i];
+        u32 at = i;
+        for (; at > 0 && sorted[at - 1] > value; --at)
+        {
+            sorted[at] = sorted[at - 1];
+        }
+        sorted[at] = value;
+    }
+
+    i64 fastest = sorted[0];
+    buffer->transit_min = fastest;
+    buffer->jitter_p50_ns = (u64)(sorted[(count - 1) * 50 / 100] - fastest);
+    buffer->jitter_p95_ns = (u64)(sorted[(count - 1) * 95 / 100] - fastest);
+    buffer->jitter_p99_ns = (u64)(sorted[(count - 1) * 99 / 100] - fastest);
+
+    i64 delay = sorted[(count - 1) * JITTER_BUFFER_PERCENTILE / 100] - fastest + (i64)JITTER_BUFFER_MARGIN_NS;
+    buffer->transit_target = fastest + min(delay, (i64)JITTER_BUFFER_MAX_DELAY_NS);
+}
+
+/* snapshot of tick got in at arrival, false if it came too late to play or was there already */
+inline b32
+JitterBufferPush(jitter_buffer * buffer, u32 tick, const world_snapshot * snapshot, real_time arrival)
+{
+    if (!buffer->has_base)
+    {
+        buffer->has_base = true;
+        buffer->base_tick = tick;
+        buffer->newest_tick = tick;
+    }
+
+    u32 reference_tick = buffer->playing ? buffer->played_tick : buffer->newest_tick;
+    i64 from_reference_ns = (i64)(i32)(tick - reference_tick) * (i64)buffer->tick_ns;
+    if (from_reference_ns > (i64)JITTER_BUFFER_RESET_NS || from_reference_ns < -(i64)JITTER_BUFFER_RESET_NS)
+    {
+        JitterBufferReset(buffer, tick);
+    }
+
+    buffer->pushed += 1;
+    JitterBufferAddTransit(buffer, (i64)arrival - JitterBufferTickTime(buffer, tick));
+
+    u32 slot = tick & (JITTER_BUFFER_SLOTS - 1);
+    u64 slot_bit = ((u64)1 << slot);
+    jitter_buffer_entry * entry = buffer->entries + slot;
+
+    if (buffer->playing && (i32)(tick - buffer->played_tick) <= 0)
+    {
+        if (tick == buffer->played_tick)
+        {
+            buffer->duplicates += 1;
+        }
+        else
+        {
+            buffer->late += 1;
+        }
+        return false;
+    }
+
+    if ((buffer->present_bit & slot_bit) && entry->tick == tick)
+    {
+        buffer->duplicates += 1;
+        return false;
+    }
+
+    if ((i32)(tick - buffer->newest_tick) < 0)
+    {
+        buffer->reordered += 1;
+    }
+    else
+    {
+        buffer->newest_tick = tick;
+    }
+
+    // the slot still holds a tick JITTER_BUFFER_SLOTS back, playout fell that far behind
+    if ((buffer->present_bit & slot_bit) && (i32)(tick - entry->tick) > 0)
+    {
+        buffer->late += 1;
+    }
+
+    entry->tick = tick;
+    entry->arrival = arrival;
+    entry->snapshot = *snapshot;
+    buffer->present_bit |= slot_bit;
+
+    return true;
+}
+
+/* once a frame, moves the playout delay towards what the jitter asks for */
+inline void
+JitterBufferUpdate(jitter_buffer * buffer, real_time now)
+{
+    u64 elapsed = buffer->last_update ? now - buffer->last_update : 0;
+    buffer->last_update = now;
+
+    if (buffer->transit_count == 0)
+    {
+        return;
+    }
+
+    if (!buffer->playing || buffer->transit_target > buffer->playout_transit)
+    {
+        buffer->playout_transit = buffer->transit_target;
+    }
+    else if (buffer->playout_transit - buffer->transit_target > (i64)JITTER_BUFFER_MARGIN_NS)
+    {
+        // within a margin it stays, every change moves a tick across a frame now and then
+        i64 step = (i64)(elapsed / JITTER_BUFFER_SHRINK);
+        buffer->playout_transit = max(buffer->transit_target, buffer->playout_transit - step);
+    }
+}
+
+/* oldest tick due to play at now, 0 when none is; call until it is */
+inline const jitter_buffer_entry *
+JitterBufferPop(jitter_buffer * buffer, real_time now)
+{
+    const jitter_buffer_entry * oldest = 0;
+    for (u32 slot = 0; slot < JITTER_BUFFER_SLOTS; ++slot)
+    {
+        const jitter_buffer_entry * entry = buffer->entries + slot;
+        if ((buffer->present_bit & ((u64)1 << slot)) == 0)
+        {
+            continue;
+        }
+        if (!oldest || (i32)(entry->tick - oldest->tick) < 0)
+        {
+            oldest = entry;
+        }
+    }
+
+    if (!oldest || JitterBufferTickTime(buffer, oldest->tick) + buffer->playout_transit > (i64)now)
+    {
+        return 0;
+    }
+
+    buffer->present_bit &= ~((u64)1 << (oldest->tick & (JITTER_BUFFER_SLOTS - 1)));
+    buffer->playing = true;
+    buffer->played_tick = oldest->tick;
+    buffer->played += 1;
+
+    return oldest;
+}
+
+/* how long the fastest packet waits before it plays */
+inline u64
+JitterBufferDelayNs(jitter_buffer * buffer)
+{
+    return buffer->transit_count ? (u64)(buffer->playout_transit - buffer->transit_min) : 0;
+}
+
+inline u32
+JitterBufferCount(jitter_buffer * buffer)
+{
+    u32 count = 0;
+    for (u64 bits = buffer->present_bit; bits; bits &= bits - 1)
+    {
+        count += 1;
+    }
+
+    return count;
+}
+
+#endif
@@ -0,0 +1,243 @@
+#include "multithread.h"
+#include "math.h"
+#include <sched.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <x86intrin.h>
+
+/*
+ * Same queue as win32_multithread.cpp, one producer and any number of
+ * workers. The C++11 memory model through the gcc __atomic builtins on the
+ * fields the Win32 side uses Interlocked* on:
+ *  - an entry is written before CurrentWrite is published with release,
+ *    workers read CurrentWrite with acquire
+ *  - ThingsDone goes up with release once a handler is done, CompleteWorkQueue
+ *    reads it with acquire so the results are there when it returns
+ * Workers with nothing to do sleep on a futex of their own instead of a
+ * semaphore: Asleep goes to 1, Sleepers up, and the queue is looked at once
+ * more before waiting. An add publishes CurrentWrite and then looks at
+ * Sleepers, both seq_cst, so either the worker sees the work or the add sees
+ * it asleep. The add takes one sleeper's Asleep back to 0 and wakes that one,
+ * adds after it find nobody left to take and make no syscall.
+ */
+
+// pauses waiting on the workers before giving the core up
+#define COMPLETE_QUEUE_SPINS 256
+
+inline b32
+CompareAndExchangeIfMatches(volatile u32 * This, u32 UpdateTo, u32 IfMatchesThis)
+{
+    b32 Result =
+        __atomic_compare_exchange_n(This, &IfMatchesThis, UpdateTo, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+
+    return Result;
+}
+
+/* sleeps while *Address is Expected */
+inline void
+FutexWait(volatile u32 * Address, u32 Expected)
+{
+    syscall(SYS_futex, Address, FUTEX_WAIT_PRIVATE, Expected, 0, 0, 0);
+}
+
+inline void
+FutexWake(volatile u32 * Address, i32 Count)
+{
+    syscall(SYS_futex, Address, FUTEX_WAKE_PRIVATE, Count, 0, 0, 0);
+}
+
+b32
+DoWorkOnQueue(thread_work_queue * Queue)
+{
+    b32 GoToSleep = false;
+
+    u32 CurrentRead = __atomic_load_n(&Queue->CurrentRead, __ATOMIC_RELAXED);
+    u32 NextReadEntry = (CurrentRead + 1) % ArrayCount(Queue->Entries);
+
+    if (CurrentRead != __atomic_load_n(&Queue->CurrentWrite, __ATOMIC_ACQUIRE))
+    {
+        // copied before it is claimed, once claimed the producer may write the slot again
+        thread_work_queue_entry Entry = Queue->Entries[CurrentRead];
+        if (CompareAndExchangeIfMatches(&Queue->CurrentRead, NextReadEntry, CurrentRead))
+        {
+            Entry.Handler(Queue, Entry.Data);
+            __atomic_add_fetch(&Queue->ThingsDone, 1, __ATOMIC_RELEASE);
+        }
+    }
+    else
+    {
+        GoToSleep = true;
+    }
+
+
+    return GoToSleep;
+}
+
+THREAD_COMPLETE_QUEUE(CompleteWorkQueue)
+{
+    u32 Spins = 0;
+    while (Queue->ThingsToDo != __atomic_load_n(&Queue->ThingsDone, __ATOMIC_ACQUIRE))
+    {
+        if (DoWorkOnQueue(Queue))
+        {
+            // the last ones are running on the workers, a while and they may be waiting for our core
+            if (++Spins < COMPLETE_QUEUE_SPINS)
+            {
+                _mm_pause();
+            }
+            else
+            {
+                sched_yield();
+            }
+        }
+    }
+    Queue->ThingsToDo = 0;
+    __atomic_store_n(&Queue->ThingsDone, 0, __ATOMIC_RELAXED);
+}
+
+THREAD_ADD_WORK_TO_QUEUE(AddWorkToQueue)
+{
+    u32 NextWriteEntry = (Queue->CurrentWrite + 1) % ArrayCount(Queue->Entries);
+    Assert(NextWriteEntry != __atomic_load_n(&Queue->CurrentRead, __ATOMIC_ACQUIRE));
+
+    thread_work_queue_entry * Entry = (Queue->Entries + Queue->CurrentWrite);
+    Entry->Handler = Handler;
+    Entry->Data = Data;
+
+    // seq_cst, not just release: it goes against the sleeper count
+    __atomic_store_n(&Queue->CurrentWrite, NextWriteEntry, __ATOMIC_SEQ_CST);
+    ++Queue->ThingsToDo;
+
+    if (__atomic_load_n(&Queue->Sleepers, __ATOMIC_SEQ_CST))
+    {
+        for (u32 ThreadIndex = 0;
+                    ThreadIndex < Queue->ThreadCount;
+                    ++ThreadIndex)
+        {
+            if (CompareAndExchangeIfMatches(Queue->Asleep + ThreadIndex, 0, 1))
+            {
+                FutexWake(Queue->Asleep + ThreadIndex, 1);
+                break;
+            }
+        }
+    }
+}
+
+void *
+WorkQueueThreadLoop(void * Parameter)
+{
+    thread_work_queue * Queue = (thread_work_queue *)Parameter;
+    u32 ThreadIndex = __atomic_fetch_add(&Queue->ThreadsStarted, 1, __ATOMIC_RELAXED);
+    volatile u32 * Asleep = Queue->Asleep + ThreadIndex;
+    for (;;)
+    {
+        if (DoWorkOnQueue(Queue))
+        {
+            if (__atomic_load_n(&Queue->Quit, __ATOMIC_ACQUIRE))
+            {
+                break;
+            }
+
+            __atomic_store_n(Asleep, 1, __ATOMIC_SEQ_CST);
+            __atomic_add_fetch(&Queue->Sleepers, 1, __ATOMIC_SEQ_CST);
+            // an add from before Sleepers went up didn't see us
+            b32 NothingToDo =
+                __atomic_load_n(&Queue->CurrentRead, __ATOMIC_SEQ_CST) == __atomic_load_n(&Queue->CurrentWrite, __ATOMIC_SEQ_CST) &&
+                !__atomic_load_n(&Queue->Quit, __ATOMIC_SEQ_CST);
+            if (NothingToDo)
+            {
+                FutexWait(Asleep, 1);
+            }
+            // woken by nobody (spurious, or didn't wait) it takes itself back
+            CompareAndExchangeIfMatches(Asleep, 0, 1);
+            __atomic_sub_fetch(&Queue->Sleepers, 1, __ATOMIC_SEQ_CST);
+        }
+    }
+
+    return 0;
+}
+
+THREAD_CORE_COUNT(GetCoreCount)
+{
+    cpu_set_t Cores;
+    u32 Count = 0;
+    if (sched_getaffinity(0, sizeof(Cores), &Cores) == 0)
+    {
+        Count = (u32)CPU_COUNT(&Cores);
+    }
+    else
+    {
+        Count = (u32)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+
+    return max(Count, (u32)1);
+}
+
+/* workers are told to quit and joined, the queue has to be complete */
+void
+CleanWorkQueue(thread_work_queue * Queue)
+{
+    if (Queue->ThreadCount)
+    {
+        __atomic_store_n(&Queue->Quit, 1, __ATOMIC_SEQ_CST);
+        for (u32 ThreadIndex = 0;
+                    ThreadIndex < Queue->ThreadCount;
+                    ++ThreadIndex)
+        {
+            __atomic_store_n(Queue->Asleep + ThreadIndex, 0, __ATOMIC_SEQ_CST);
+            FutexWake(Queue->Asleep + ThreadIndex, 1);
+        }
+        for (u32 ThreadIndex = 0;
+                    ThreadIndex < Queue->ThreadCount;
+                    ++ThreadIndex)
+        {
+            pthread_join(Queue->Threads[ThreadIndex], 0);
+        }
+        Queue->ThreadCount = 0;
+    }
+    Queue->Quit = 0;
+    Queue->Sleepers = 0;
+    Queue->ThreadsStarted = 0;
+    for (u32 ThreadIndex = 0;
+                ThreadIndex < THREAD_MAX_WORKERS;
+                ++ThreadIndex)
+    {
+        Queue->Asleep[ThreadIndex] = 0;
+    }
+
+    Queue->CurrentWrite = 0;
+    Queue->CurrentRead = 0;
+
+    Queue->ThingsDone = 0;
+    Queue->ThingsToDo = 0;
+}
+
+/* CountThreads 0 is a worker per core but the one calling CompleteWorkQueue */
+void
+CreateWorkQueue(thread_work_queue * Queue, u32 CountThreads)
+{
+    CleanWorkQueue(Queue);
+
+    if (CountThreads == 0)
+    {
+        CountThreads = max(GetCoreCount() - 1, (u32)1);
+    }
+    CountThreads = min(CountThreads, (u32)THREAD_MAX_WORKERS);
+
+    pthread_attr_t Attributes;
+    pthread_attr_init(&Attributes);
+    pthread_attr_setstacksize(&Attributes, Megabytes(1));
+
+    void * ThreadParam = (void *)Queue;
+    for (u32 ThreadIndex = 0;
+                ThreadIndex < CountThreads;
+                ++ThreadIndex)
+    {
+        int Result = pthread_create(Queue->Threads + ThreadIndex, &Attributes, WorkQueueThreadLoop, ThreadParam);
+        Assert(Result == 0);
+        Queue->ThreadCount += 1;
+    }
+
+    pthread_attr_destroy(&Attributes);
+}
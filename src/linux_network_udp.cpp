@@ -1,5 +1,8 @@
 #include <fcntl.h>
 #include <string.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
 #include "platform.h"
 #include "network_udp.h"
 #include <unistd.h> // sysconf
@@ -26,6 +29,52 @@ SET_SOCKET_NON_BLOCKING(SetSocketNonBlocking)
     return result;
 }
 
+SET_SOCKET_DONT_FRAGMENT(SetSocketDontFragment)
+{
+    int mtu_discover = IP_PMTUDISC_PROBE;
+
+    int result = setsockopt( handle, IPPROTO_IP, IP_MTU_DISCOVER, &mtu_discover, sizeof(mtu_discover) );
+
+    return result;
+}
+
+SET_SOCKET_RECEIVE_TIMESTAMPS(SetSocketReceiveTimestamps)
+{
+    // the first SIOCGSTAMPNS turns stamping on, nothing is stamped yet so ENOENT.
+    // Not SO_TIMESTAMPNS: with it the stamp only goes to recvmsg control data
+    timespec stamp;
+    int result = ioctl( handle, SIOCGSTAMPNS, &stamp );
+    if (result != 0 && errno == ENOENT)
+    {
+        result = 0;
+    }
+
+    return result;
+}
+
+GET_SOCKET_RECEIVE_TIME(GetSocketReceiveTime)
+{
+    // stamped on CLOCK_REALTIME, moved over by how long ago it was
+    timespec stamp;
+    timespec realtime;
+    if (ioctl( handle, SIOCGSTAMPNS, &stamp ) != 0 ||
+        clock_gettime( CLOCK_REALTIME, &realtime ) != 0)
+    {
+        return now;
+    }
+
+    i64 ago_ns = ((i64)realtime.tv_sec - (i64)stamp.tv_sec) * (i64)NS_PER_SECOND + 
+                 ((i64)realtime.tv_nsec - (i64)stamp.tv_nsec);
+
+    // a realtime clock step in between, or a stamp from long before
+    if (ago_ns < 0 || (u64)ago_ns > NS_PER_SECOND)
+    {
+        return now;
+    }
+
+    return now - (u64)ago_ns;
+}
+
 CREATE_SOCKET_UDP(CreateSocketUdp)
 {
     *handle = socket( AF_INET, SOCK_DGRAM, IPPROTO_UDP );
@@ -1,35 +1,102 @@
 #include "platform.h"
+#include "cpu.h"
 #include <errno.h>
+#include <sys/random.h>
     
-GET_REAL_TIME(GetRealTime)
+/*
+ * CLOCK_MONOTONIC, or the TSC scaled to it: ns = ns_base + (tsc - tsc_base) * ns_per_tick
+ * with ns_per_tick in 32.32 fixed point, measured against CLOCK_MONOTONIC in TimeInit
+ */
+#define TIME_TSC_CALIBRATION_MS 50
+
+static b32 time_use_tsc;
+static u64 time_tsc_base;
+static u64 time_ns_base;
+static u64 time_ns_per_tick;
+
+inline u64
+MonotonicNs()
+{
+    timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return (u64)time.tv_sec * NS_PER_SECOND + (u64)time.tv_nsec;
+}
+
+/* CLOCK_MONOTONIC and the TSC read together, the closest pair of a few */
+void
+SampleTscAndNs(u64 * tsc, u64 * ns)
+{
+    u64 best_gap = ~0ull;
+    for (u32 sample = 0; sample < 16; ++sample)
+    {
+        u64 before = __rdtsc();
+        u64 now = MonotonicNs();
+        u64 after = __rdtsc();
+        if (after - before < best_gap)
+        {
+            best_gap = after - before;
+            *tsc = before + (after - before) / 2;
+            *ns = now;
+        }
+    }
+}
+
+TIME_INIT(TimeInit)
+{
+    time_use_tsc = false;
+    if (!allow_tsc || !GetCpuFeatures().invariant_tsc)
+    {
+        return;
+    }
+
+    u64 tsc_start, ns_start;
+    u64 tsc_end, ns_end;
+    SampleTscAndNs(&tsc_start, &ns_start);
+    msleep(TIME_TSC_CALIBRATION_MS);
+    SampleTscAndNs(&tsc_end, &ns_end);
+
+    // slower than 1 GHz doesn't fit 32.32
+    u64 ticks = tsc_end - tsc_start;
+    u64 ns = ns_end - ns_start;
+    if (ticks <= ns)
+    {
+        return;
+    }
+
+    time_ns_per_tick = (ns << 32) / ticks;
+    time_tsc_base = tsc_end;
+    time_ns_base = ns_end;
+    time_use_tsc = true;
+}
+
+TIME_USES_TSC(TimeUsesTsc)
 {
-    real_time time;
+    return time_use_tsc;
+}
 
-    clock_gettime(CLOCK_REALTIME,&time);
+GET_REAL_TIME(GetRealTime)
+{
+    if (time_use_tsc)
+    {
+        u64 ticks = __rdtsc() - time_tsc_base;
+        u64 ns = (ticks >> 32) * time_ns_per_tick + (((ticks & 0xFFFFFFFF) * time_ns_per_tick) >> 32);
+        return time_ns_base + ns;
+    }
 
-    return time;
+    return MonotonicNs();
 }
 
 
 GET_CLOCK_RESOLUTION(GetClockResolution)
 {
-    real_time perf_freq;
-    clock_getres(CLOCK_REALTIME,&perf_freq); 
-    return perf_freq;
+    return NS_PER_SECOND;
 }
 
-/* Returns milliseconds */
 GET_TIME_DIFF(GetTimeDiff)
 {
-  delta_time dt = 
-    (TimeEnd.tv_sec - TimeStart.tv_sec) * 1000.0 
-    + 
-    (
-      (TimeEnd.tv_nsec - TimeStart.tv_nsec) / 
-      1000000.0
-    );
-
-  return dt;
+    // end before start comes out negative
+    return (delta_time)((r64)(i64)(TimeEnd - TimeStart) * 1000.0 / (r64)ClockFreq);
 }
 
 MS_SLEEP(msleep)
@@ -53,5 +120,48 @@ MS_SLEEP(msleep)
   return res;
 }
 
+SLEEP_UNTIL(SleepUntil)
+{
+    // the TSC clock is a few ppm off CLOCK_MONOTONIC, its deadline is moved over
+    u64 target = deadline;
+    if (time_use_tsc)
+    {
+        real_time now = GetRealTime();
+        if (deadline <= now)
+        {
+            return;
+        }
+        target = MonotonicNs() + (deadline - now);
+    }
+
+    timespec ts;
+    ts.tv_sec = (time_t)(target / NS_PER_SECOND);
+    ts.tv_nsec = (long)(target % NS_PER_SECOND);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0) == EINTR)
+    {
+    }
+}
+
 HIGH_DEFINITION_TIME_BEGIN(HighDefinitionTimeBegin) {};
 HIGH_DEFINITION_TIME_END(HighDefinitionTimeEnd) {};
+
+GET_OS_RANDOM(GetOsRandom)
+{
+    u8 * at = (u8 *)out;
+    while (size > 0)
+    {
+        ssize_t got = getrandom(at, size, 0);
+        if (got < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        at += got;
+        size -= (u32)got;
+    }
+
+    return true;
+}
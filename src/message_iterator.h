@@ -0,0 +1,78 @@
+#ifndef UDP_MESSAGE_ITERATOR_H
+#define UDP_MESSAGE_ITERATOR_H
+
+#include "protocol.h"
+
+/*
+ * Walks the message records of a received payload in place
+ *
+ *   record   message_header, then header.len bytes of data
+ *
+ * Records are checked against the bytes received before they are handed
+ * out, one pass front to back, nothing is copied. A record returned is a
+ * message * into the payload whose data has header.len bytes, which can be
+ * more than sizeof(message::data) for merged runs and snapshots.
+ * A header or data that goes past the end stops the walk and marks it
+ * malformed, the records before it were whole. Bytes after the last record
+ * (probes, padding) aren't looked at.
+ *
+ *   message_iterator it = MessageIterator(payload, size, header.messages);
+ *   for (message * record = MessageNext(&it); record; record = MessageNext(&it))
+ */
+
+struct message_iterator
+{
+    u8 * at;
+    u8 * end;
+    // records still to come
+    u32 remaining;
+    b32 malformed;
+};
+
+inline message_iterator
+MessageIterator(void * payload, u32 size, u32 messages)
+{
+    message_iterator it;
+    it.at = (u8 *)payload;
+    it.end = it.at + size;
+    it.remaining = messages;
+    it.malformed = false;
+
+    return it;
+}
+
+/* next whole record, 0 when done or at the first truncated or overlong one */
+inline message *
+MessageNext(message_iterator * it)
+{
+    if (it->remaining == 0)
+    {
+        return 0;
+    }
+
+    u32 left = (u32)(it->end - it->at);
+    message * record = (message *)it->at;
+    if (left < sizeof(message_header) ||
+        (sizeof(message_header) + record->header.len) > left)
+    {
+        it->remaining = 0;
+        it->malformed = true;
+        return 0;
+    }
+
+    it->at += sizeof(message_header) + record->header.len;
+    it->remaining -= 1;
+
+    return record;
+}
+
+/* every record was there and whole */
+inline b32
+MessageIteratorOk(message_iterator * it)
+{
+    b32 ok = (it->remaining == 0) && !it->malformed;
+
+    return ok;
+}
+
+#endif
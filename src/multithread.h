@@ -1,10 +1,20 @@
-
 #ifndef PLATFORM_MULTITHREAD_H
 #define PLATFORM_MULTITHREAD_H
 
 #include "platform.h"
 
+#ifdef _WIN32
 #define COMPILER_DONOT_REORDER_BARRIER  __faststorefence()
+#elif defined __linux__
+#include <pthread.h>
+#define COMPILER_DONOT_REORDER_BARRIER  __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#else
+#error Unsupported OS
+#endif
+
+// workers a queue can have, CreateWorkQueue with 0 threads sizes it to the cores
+#define THREAD_MAX_WORKERS 64
+
 struct thread_work_queue;
 
 #define THREAD_WORK_HANDLER(name) void name(thread_work_queue * Queue, void * Data)
@@ -16,6 +26,10 @@ typedef THREAD_ADD_WORK_TO_QUEUE(thread_add_work_to_queue);
 #define THREAD_COMPLETE_QUEUE(name) void name(thread_work_queue * Queue)
 typedef THREAD_COMPLETE_QUEUE(thread_complete_queue);
 
+/* logical cores the process can run on */
+#define THREAD_CORE_COUNT(name) u32 name()
+typedef THREAD_CORE_COUNT(thread_core_count);
+
 struct thread_work_queue_entry
 {
     thread_work_handler * Handler;
@@ -24,7 +38,19 @@ struct thread_work_queue_entry
 
 struct thread_work_queue
 {
+#ifdef _WIN32
     void * Semaphore;
+#else
+    // per worker futex word, 1 while it sleeps and nobody has woken it
+    volatile u32 Asleep[THREAD_MAX_WORKERS];
+    // adds don't look at Asleep while nobody sleeps
+    volatile u32 Sleepers;
+    volatile u32 Quit;
+
+    volatile u32 ThreadsStarted;
+    u32 ThreadCount;
+    pthread_t Threads[THREAD_MAX_WORKERS];
+#endif
 
     volatile u32 ThingsToDo;
     volatile u32 ThingsDone;
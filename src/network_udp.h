@@ -41,6 +41,24 @@ void ShutdownSockets();
 typedef SET_SOCKET_NON_BLOCKING(set_socket_non_blocking);
 SET_SOCKET_NON_BLOCKING(SetSocketNonBlocking);
 
+// sends with DF set and no fragmentation, sizes are only limited by the interface MTU
+// so path MTU probes above what the kernel believes still go out
+#define SET_SOCKET_DONT_FRAGMENT(name) int name(socket_handle handle)
+typedef SET_SOCKET_DONT_FRAGMENT(set_socket_dont_fragment);
+SET_SOCKET_DONT_FRAGMENT(SetSocketDontFragment);
+
+// the kernel stamps datagrams when they get in, GetSocketReceiveTime reads it.
+// SOCKET_ERROR where it can't (always on win32): datagrams are stamped when read
+#define SET_SOCKET_RECEIVE_TIMESTAMPS(name) int name(socket_handle handle)
+typedef SET_SOCKET_RECEIVE_TIMESTAMPS(set_socket_receive_timestamps);
+SET_SOCKET_RECEIVE_TIMESTAMPS(SetSocketReceiveTimestamps);
+
+// when the last datagram read from handle got in, on the GetRealTime clock.
+// now if the kernel didn't stamp it: time spent in the socket queue can't be told apart
+#define GET_SOCKET_RECEIVE_TIME(name) real_time name(socket_handle handle, real_time now)
+typedef GET_SOCKET_RECEIVE_TIME(get_socket_receive_time);
+GET_SOCKET_RECEIVE_TIME(GetSocketReceiveTime);
+
 #define CREATE_SOCKET_UDP(name) int name(socket_handle * handle)
 typedef CREATE_SOCKET_UDP(create_socket_udp);
 CREATE_SOCKET_UDP(CreateSocketUdp);
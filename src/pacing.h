@@ -0,0 +1,73 @@
+#ifndef UDP_PACING_H
+#define UDP_PACING_H
+
+#include "platform.h"
+
+/*
+ * Intra frame pacing
+ *
+ * If every client is due at the top of the frame the send loop fires
+ * all datagrams back to back and overflows socket/nic queues.
+ * The frame is split in slot_count slots and every client is given
+ * one slot for its whole life (least loaded slot at connection time).
+ * The send loop waits for the slot offset before sending to the clients in it
+ * so the burst size is at most clients / slot_count.
+ */
+
+#define PACING_MAX_SLOTS 64
+#define PACING_NO_SLOT UINT_MAX
+
+struct pacing_scheduler
+{
+    u32 slot_count;
+    u32 clients_in_slot[PACING_MAX_SLOTS];
+};
+
+inline void
+PacingInit(pacing_scheduler * pacing, u32 slot_count)
+{
+    Assert(slot_count > 0 && slot_count <= PACING_MAX_SLOTS);
+
+    pacing->slot_count = slot_count;
+    for (u32 slot = 0; slot < PACING_MAX_SLOTS; ++slot)
+    {
+        pacing->clients_in_slot[slot] = 0;
+    }
+}
+
+inline u32
+PacingAssignSlot(pacing_scheduler * pacing)
+{
+    u32 best_slot = 0;
+    for (u32 slot = 1; slot < pacing->slot_count; ++slot)
+    {
+        if (pacing->clients_in_slot[slot] < pacing->clients_in_slot[best_slot])
+        {
+            best_slot = slot;
+        }
+    }
+
+    pacing->clients_in_slot[best_slot] += 1;
+
+    return best_slot;
+}
+
+inline void
+PacingReleaseSlot(pacing_scheduler * pacing, u32 slot)
+{
+    Assert(slot < pacing->slot_count);
+    Assert(pacing->clients_in_slot[slot] > 0);
+
+    pacing->clients_in_slot[slot] -= 1;
+}
+
+/* ms since beginning of the frame at which slot has to be sent */
+inline r32
+PacingSlotOffsetMs(pacing_scheduler * pacing, u32 slot, r32 frame_ms)
+{
+    r32 offset_ms = frame_ms * ((r32)slot / (r32)pacing->slot_count);
+
+    return offset_ms;
+}
+
+#endif
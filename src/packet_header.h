@@ -0,0 +1,216 @@
+#ifndef UDP_PACKET_HEADER_H
+#define UDP_PACKET_HEADER_H
+
+#include "protocol.h"
+#include "math.h"
+#include <string.h>
+
+/*
+ * Compact wire encoding of packet_header
+ *
+ *   byte 0   bits 0-2 PACKET_FLAG_*
+ *            bits 3-4 seq size: 0, 1, 2 or 4 bytes
+ *            bits 5-7 messages, 7 = 7 or more, the rest follows as a varint
+ *   byte 1   bits 0-3 ack_bit bytes on the wire, the others are 0xFF
+ *            bits 4-6 PROTOCOL_ID
+ *            bit 7    payload is compressed (compress.h)
+ *   seq      low bytes of seq, rebuilt as the closest to the receiver's remote seq
+ *   ack      low 16 bits of ack, rebuilt as the closest at or below the receiver's own seq
+ *   ack_bit  bytes that aren't all ones
+ *   messages varint of messages - 7, if any
+ *
+ * The sender picks the seq size from how far seq is from the newest seq the
+ * peer acked, the peer's remote seq can't be behind that one.
+ * Packets with PACKET_FLAG_* set don't take a seq and send none.
+ * A data packet with every recent packet received is 5 bytes, an ack only 4.
+ */
+
+#define PACKET_HEADER_FLAGS_MASK 0x07
+#define PACKET_HEADER_SEQ_SHIFT 3
+#define PACKET_HEADER_MESSAGES_SHIFT 5
+#define PACKET_HEADER_MESSAGES_INLINE 7
+#define PACKET_HEADER_PROTOCOL_SHIFT 4
+#define PACKET_HEADER_PROTOCOL_MASK 0x07
+#define PACKET_HEADER_COMPRESSED 0x80
+
+static const u8 PacketHeaderSeqSize[4] = { 0, 1, 2, 4 };
+// sign extends the delta of the low bytes received
+static const u8 PacketHeaderSeqShift[4] = { 0, 24, 16, 0 };
+
+/* returns bytes written to out, at most PACKET_HEADER_MAX_WIRE_SIZE */
+inline u32
+PacketHeaderWrite(packet_header * header, u32 peer_acked_seq, u8 * out)
+{
+    Assert(header->protocol == PROTOCOL_ID);
+    Assert((header->flags & ~PACKET_HEADER_FLAGS_MASK) == 0);
+
+    u32 seq_code = 0;
+    if (header->flags == 0)
+    {
+        u32 distance = header->seq - peer_acked_seq;
+        seq_code = (distance < 0x80) ? 1 : (distance < 0x8000) ? 2 : 3;
+    }
+    u32 messages_inline = min((u32)header->messages, (u32)PACKET_HEADER_MESSAGES_INLINE);
+
+    u32 at = 2;
+
+    memcpy(out + at, &header->seq, sizeof(header->seq));
+    at += PacketHeaderSeqSize[seq_code];
+
+    u16 ack = (u16)header->ack;
+    memcpy(out + at, &ack, sizeof(ack));
+    at += sizeof(ack);
+
+    u32 ack_bytes = 0;
+    for (u32 byte_index = 0; byte_index < 4; ++byte_index)
+    {
+        u8 ack_byte = (u8)(header->ack_bit >> (byte_index * 8));
+        u32 on_wire = (ack_byte != 0xFF);
+        out[at] = ack_byte;
+        at += on_wire;
+        ack_bytes |= on_wire << byte_index;
+    }
+
+    if (messages_inline == PACKET_HEADER_MESSAGES_INLINE)
+    {
+        u32 rest = header->messages - PACKET_HEADER_MESSAGES_INLINE;
+        Assert(rest < (1 << 14));
+        out[at] = (u8)(rest | ((rest >= 0x80) ? 0x80 : 0));
+        at += 1;
+        out[at] = (u8)(rest >> 7);
+        at += (rest >= 0x80);
+    }
+
+    out[0] = (u8)(header->flags |
+                  (seq_code << PACKET_HEADER_SEQ_SHIFT) |
+                  (messages_inline << PACKET_HEADER_MESSAGES_SHIFT));
+    out[1] = (u8)(ack_bytes | (PROTOCOL_ID << PACKET_HEADER_PROTOCOL_SHIFT));
+
+    Assert(at <= PACKET_HEADER_MAX_WIRE_SIZE);
+
+    return at;
+}
+
+/* size of the header at the start of the datagram, 0 if it isn't one of ours or is cut short */
+inline u32
+PacketHeaderWireSize(const u8 * in, u32 size)
+{
+    if (size < 4 || ((in[1] >> PACKET_HEADER_PROTOCOL_SHIFT) & PACKET_HEADER_PROTOCOL_MASK) != PROTOCOL_ID)
+    {
+        return 0;
+    }
+
+    u32 ack_bytes = in[1] & 0x0F;
+    u32 header_size =
+        2 +
+        PacketHeaderSeqSize[(in[0] >> PACKET_HEADER_SEQ_SHIFT) & 3] +
+        sizeof(u16) +
+        (ack_bytes & 1) + ((ack_bytes >> 1) & 1) + ((ack_bytes >> 2) & 1) + (ack_bytes >> 3);
+
+    if ((in[0] >> PACKET_HEADER_MESSAGES_SHIFT) == PACKET_HEADER_MESSAGES_INLINE)
+    {
+        header_size += 1;
+        if (header_size <= size && (in[header_size - 1] & 0x80))
+        {
+            header_size += 1;
+        }
+    }
+
+    return (header_size <= size) ? header_size : 0;
+}
+
+/*
+ * in must have passed PacketHeaderWireSize
+ * remote_seq: newest seq received from the peer
+ * local_seq: newest seq sent to the peer
+ */
+inline void
+PacketHeaderRead(const u8 * in, u32 remote_seq, u32 local_seq, packet_header * header)
+{
+    u32 seq_code = (in[0] >> PACKET_HEADER_SEQ_SHIFT) & 3;
+    u32 ack_bytes = in[1] & 0x0F;
+    u32 at = 2;
+
+    // low bytes over the remote seq, the delta is in the low bytes only
+    u32 seq = remote_seq;
+    memcpy(&seq, in + at, PacketHeaderSeqSize[seq_code]);
+    at += PacketHeaderSeqSize[seq_code];
+    u32 shift = PacketHeaderSeqShift[seq_code];
+    i32 seq_delta = (i32)((seq - remote_seq) << shift) >> shift;
+
+    u16 ack = 0;
+    memcpy(&ack, in + at, sizeof(ack));
+    at += sizeof(ack);
+
+    u32 ack_bit = 0;
+    for (u32 byte_index = 0; byte_index < 4; ++byte_index)
+    {
+        u32 on_wire = (ack_bytes >> byte_index) & 1;
+        u32 ack_byte = on_wire ? in[at] : 0xFF;
+        at += on_wire;
+        ack_bit |= ack_byte << (byte_index * 8);
+    }
+
+    u32 messages = in[0] >> PACKET_HEADER_MESSAGES_SHIFT;
+    if (messages == PACKET_HEADER_MESSAGES_INLINE)
+    {
+        u32 rest = in[at] & 0x7F;
+        if (in[at] & 0x80)
+        {
+            rest |= (u32)in[at + 1] << 7;
+        }
+        messages += rest;
+    }
+
+    header->protocol = PROTOCOL_ID;
+    header->flags = in[0] & PACKET_HEADER_FLAGS_MASK;
+    header->messages = (u16)messages;
+    header->seq = remote_seq + (u32)seq_delta;
+    header->ack = local_seq - (u16)((u16)local_seq - ack);
+    header->ack_bit = ack_bit;
+}
+
+/* PACKETS */
+
+/*
+ * Writes the compact header right before p->data, the datagram is
+ * header_size + payload bytes from the returned pointer. p->header is untouched
+ */
+inline u8 *
+PacketToWire(packet * p, u32 peer_acked_seq, u32 * header_size)
+{
+    u8 wire_header[PACKET_HEADER_MAX_WIRE_SIZE];
+    *header_size = PacketHeaderWrite(&p->header, peer_acked_seq, wire_header);
+
+    u8 * wire = (u8 *)p->data - *header_size;
+    memcpy(wire, wire_header, *header_size);
+
+    return wire;
+}
+
+/* where recvfrom writes a datagram into p */
+inline u8 *
+PacketWireBuffer(packet * p)
+{
+    return p->wire_header;
+}
+
+#define PACKET_WIRE_BUFFER_SIZE (PACKET_HEADER_MAX_WIRE_SIZE + PACKET_MAX_PAYLOAD_SIZE)
+
+/*
+ * Datagram received in PacketWireBuffer(p) that passed PacketHeaderWireSize,
+ * decodes its header into p->header and moves the payload to p->data.
+ * Returns payload size
+ */
+inline u32
+PacketFromWire(packet * p, u32 datagram_size, u32 header_size, u32 remote_seq, u32 local_seq)
+{
+    PacketHeaderRead(p->wire_header, remote_seq, local_seq, &p->header);
+
+    u32 payload_size = datagram_size - header_size;
+    memmove(p->data, p->wire_header + header_size, payload_size);
+
+    return payload_size;
+}
+
+#endif
@@ -6,12 +6,6 @@
 #include <windows.h>
 #define API _declspec( dllexport )
 
-// Time
-#define real_time LARGE_INTEGER
-#define clock_resolution LARGE_INTEGER
-#define delta_time r32 
-#define ZeroTime(rt) rt.QuadPart = 0
-
 
 // IO
 #define OpenFile(fd, file, mode) fopen_s(&fd, file, mode)
@@ -29,10 +23,6 @@
 
 // Time
 #include <time.h>
-#define real_time timespec 
-#define clock_resolution timespec
-#define delta_time r32
-#define ZeroTime(rt) memset(&rt, 0, sizeof(rt));
 
 // IO
 #define OpenFile(fd, file, mode) fd = fopen(file, mode)
@@ -73,6 +63,8 @@ typedef unsigned char u8;
 typedef int BOOL;
 
 typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int64_t i64;
 typedef int32_t i32;
 typedef int32_t b32;
 
@@ -83,14 +75,44 @@ typedef float r32;
 typedef double r64;
 
 
+/*
+ * Time: monotonic nanoseconds as u64, never goes back with NTP steps.
+ * Compare and subtract them as integers, GetTimeDiff is for reporting
+ */
+#define real_time u64
+#define clock_resolution u64
+#define delta_time r32
+#define ZeroTime(rt) rt = 0
+#define NS_PER_MS 1000000ull
+#define NS_PER_SECOND 1000000000ull
+#define MsToNs(ms) ((u64)((ms) * 1000000.0))
+
+inline r32
+NsToMs(u64 ns)
+{
+    return (r32)((r64)ns * (1.0 / 1000000.0));
+}
+
+/* picks the clock, the TSC if allowed and it ticks at a constant rate. Before any GetRealTime */
+#define TIME_INIT(name) void name(b32 allow_tsc)
+typedef TIME_INIT(time_init);
+API TIME_INIT(TimeInit);
+
+/* the clock TimeInit picked is the TSC */
+#define TIME_USES_TSC(name) b32 name()
+typedef TIME_USES_TSC(time_uses_tsc);
+API TIME_USES_TSC(TimeUsesTsc);
+
 #define GET_REAL_TIME(name) real_time name()
 typedef GET_REAL_TIME(get_real_time);
 API GET_REAL_TIME(GetRealTime);
 
+/* ticks of real_time per second */
 #define GET_CLOCK_RESOLUTION(name) real_time name()
 typedef GET_CLOCK_RESOLUTION(get_clock_resolution);
 API GET_CLOCK_RESOLUTION(GetClockResolution);
 
+/* milliseconds */
 #define GET_TIME_DIFF(name) delta_time name(real_time TimeEnd,real_time TimeStart,real_time ClockFreq)
 typedef GET_TIME_DIFF(get_time_diff);
 API GET_TIME_DIFF(GetTimeDiff);
@@ -107,6 +129,16 @@ API HIGH_DEFINITION_TIME_END(HighDefinitionTimeEnd);
 typedef MS_SLEEP(ms_sleep);
 API MS_SLEEP(msleep);
 
+/* sleeps until GetRealTime reaches deadline, give or take the OS wake up latency */
+#define SLEEP_UNTIL(name) void name(real_time deadline)
+typedef SLEEP_UNTIL(sleep_until);
+API SLEEP_UNTIL(SleepUntil);
+
+/* size bytes from the OS CSPRNG, false if it can't give them */
+#define GET_OS_RANDOM(name) b32 name(void * out, u32 size)
+typedef GET_OS_RANDOM(get_os_random);
+API GET_OS_RANDOM(GetOsRandom);
+
 #define Kilobytes(x) 1024 * x
 #define Megabytes(x) 1024 * Kilobytes(x)
 #define Gigabytes(x) 1024 * Megabytes(x)
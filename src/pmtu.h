@@ -0,0 +1,178 @@
+#ifndef UDP_PMTU_H
+#define UDP_PMTU_H
+
+#include "protocol.h"
+
+/*
+ * Packetization layer path MTU discovery (RFC 8899 style), per peer
+ *
+ * Datagrams go out with DF set. Every peer starts at the safe
+ * UDP_DATAGRAM_PAYLOAD_MAX_SIZE and a probe (header + zero padding, flag
+ * PACKET_FLAG_PMTU_PROBE) is sent at the size being tried. The peer echoes the
+ * size of every probe it got as a package_type_pmtu_probe message.
+ *  - echo: size confirmed, packets to this peer can be that big
+ *  - no echo in PMTU_PROBE_TIMEOUT_MS: probe again, PMTU_PROBE_TRIES times
+ * Binary search between the confirmed size and UDP_DATAGRAM_PMTU_MAX_SIZE,
+ * starting at the max since LAN/datacenter paths take it at once.
+ *
+ * Routes change and ICMP gets filtered: if PMTU_BLACKHOLE_LOSSES packets bigger
+ * than the safe size are lost in a row, the peer goes back to the safe size
+ * and the search starts over after PMTU_REPROBE_MS.
+ */
+
+#define PMTU_PROBE_TIMEOUT_MS 1500.0f
+#define PMTU_PROBE_TRIES 2
+#define PMTU_SEARCH_GRANULARITY 16
+#define PMTU_BLACKHOLE_LOSSES 3
+#define PMTU_REPROBE_MS 60000.0f
+
+struct pmtu_discovery
+{
+    // datagram sizes, packet header included
+    u32 confirmed_size;
+    u32 search_lo;
+    u32 search_hi;
+
+    // 0 if no probe is waiting for echo
+    u32 probe_size;
+    u32 probe_tries;
+
+    b32 search_done;
+    u32 large_losses;
+
+    // stats
+    u32 probes_sent;
+    u32 blackholes;
+};
+
+inline void
+PmtuStartSearch(pmtu_discovery * pmtu)
+{
+    pmtu->search_lo = pmtu->confirmed_size;
+    pmtu->search_hi = UDP_DATAGRAM_PMTU_MAX_SIZE;
+    pmtu->probe_size = 0;
+    pmtu->probe_tries = 0;
+    pmtu->search_done = (pmtu->search_hi - pmtu->search_lo) < PMTU_SEARCH_GRANULARITY;
+}
+
+inline void
+PmtuInit(pmtu_discovery * pmtu)
+{
+    pmtu->confirmed_size = UDP_DATAGRAM_PAYLOAD_MAX_SIZE;
+    pmtu->large_losses = 0;
+    pmtu->probes_sent = 0;
+    pmtu->blackholes = 0;
+
+    PmtuStartSearch(pmtu);
+}
+
+inline u32
+PmtuPayloadCapacity(pmtu_discovery * pmtu)
+{
+    u32 capacity = pmtu->confirmed_size - sizeof(packet_header) - PACKET_TRAILER_MAX_SIZE;
+
+    return capacity;
+}
+
+/* size of the next probe to send, 0 if nothing to probe */
+inline u32
+PmtuNextProbeSize(pmtu_discovery * pmtu)
+{
+    if (pmtu->search_done)
+    {
+        return 0;
+    }
+
+    if (pmtu->probe_size == 0)
+    {
+        // first probe goes for the max, then halves the remaining range
+        pmtu->probe_size = (pmtu->search_hi == UDP_DATAGRAM_PMTU_MAX_SIZE && pmtu->search_lo == pmtu->confirmed_size) ?
+                           pmtu->search_hi :
+                           (pmtu->search_lo + pmtu->search_hi + 1) / 2;
+        pmtu->probe_tries = 0;
+    }
+
+    return pmtu->probe_size;
+}
+
+inline void
+PmtuOnProbeSent(pmtu_discovery * pmtu)
+{
+    pmtu->probe_tries += 1;
+    pmtu->probes_sent += 1;
+}
+
+inline void
+PmtuCheckSearchDone(pmtu_discovery * pmtu)
+{
+    pmtu->probe_size = 0;
+    pmtu->search_done = (pmtu->search_hi - pmtu->search_lo) < PMTU_SEARCH_GRANULARITY;
+}
+
+/* probe went unanswered for PMTU_PROBE_TIMEOUT_MS */
+inline void
+PmtuOnProbeTimeout(pmtu_discovery * pmtu)
+{
+    if (pmtu->probe_size == 0 || pmtu->probe_tries < PMTU_PROBE_TRIES)
+    {
+        return;
+    }
+
+    pmtu->search_hi = pmtu->probe_size - 1;
+    PmtuCheckSearchDone(pmtu);
+}
+
+/* returns true if the confirmed size went up */
+inline b32
+PmtuOnProbeAck(pmtu_discovery * pmtu, u32 size)
+{
+    if (size != pmtu->probe_size || size <= pmtu->confirmed_size)
+    {
+        // late echo of an old probe or crafted
+        return false;
+    }
+
+    pmtu->confirmed_size = size;
+    pmtu->search_lo = size;
+    pmtu->large_losses = 0;
+    PmtuCheckSearchDone(pmtu);
+
+    return true;
+}
+
+inline void
+PmtuOnPacketAcked(pmtu_discovery * pmtu, u32 size)
+{
+    if (size > UDP_DATAGRAM_PAYLOAD_MAX_SIZE)
+    {
+        pmtu->large_losses = 0;
+    }
+}
+
+/* returns true if the path went back to the safe size */
+inline b32
+PmtuOnPacketLost(pmtu_discovery * pmtu, u32 size)
+{
+    if (size <= UDP_DATAGRAM_PAYLOAD_MAX_SIZE)
+    {
+        return false;
+    }
+
+    pmtu->large_losses += 1;
+    if (pmtu->large_losses < PMTU_BLACKHOLE_LOSSES)
+    {
+        return false;
+    }
+
+    pmtu->confirmed_size = UDP_DATAGRAM_PAYLOAD_MAX_SIZE;
+    pmtu->large_losses = 0;
+    pmtu->blackholes += 1;
+    // caller starts the search again after PMTU_REPROBE_MS
+    pmtu->search_lo = pmtu->search_hi = pmtu->confirmed_size;
+    pmtu->probe_size = 0;
+    pmtu->search_done = true;
+
+    return true;
+}
+
+#endif
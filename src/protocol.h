@@ -3,7 +3,10 @@
 
 #include "platform.h"
 
-#define PROTOCOL_ID 0b1000
+// 3 bits on the wire
+#define PROTOCOL_ID 0b101
+// key exchange datagrams (crypto.h) in the same bits
+#define PROTOCOL_HANDSHAKE_ID 0b110
 
 enum client_status
 {
@@ -13,19 +16,33 @@ enum client_status
     client_status_in_game
 };
 
+// payload is a fec repair, seq is the one of the last packet of its group
+#define PACKET_FLAG_FEC_REPAIR 0x01
+// header only, seq is the last one sent and not a new one
+#define PACKET_FLAG_ACK_ONLY 0x02
+// path MTU probe, seq is the last one sent, payload is zero padding after the probe size
+#define PACKET_FLAG_PMTU_PROBE 0x04
+
 struct packet_header
 {
-    u16 protocol;
+    u8 protocol;
+    // PACKET_FLAG_*
+    u8 flags;
     u16 messages;
     u32 seq; // you can get down to u16, the seq will circle every ~1.5h
     u32 ack;
     u32 ack_bit;
 };
 
+// the compact encoding on the wire (packet_header.h) is never bigger than in memory
+#define PACKET_HEADER_MAX_WIRE_SIZE sizeof(packet_header)
+
 struct packet
 {
-    // 4 + 4 + 4 + 4 = 16 overhead
+    // 4 + 4 + 4 + 4 = 16 in memory, 4 to 14 on the wire
     packet_header header;
+    // the wire header is written right before data, datagrams start in here
+    u8 wire_header[PACKET_HEADER_MAX_WIRE_SIZE];
 
     // UDP payload should be restricted by:
     // 576-60-8=508 bytes
@@ -37,15 +54,24 @@ struct packet
     // lets round down to 32 bit boundaries from 492
     // 32 * 7 = 480
 #define UDP_DATAGRAM_PAYLOAD_MAX_SIZE 508
-#define PACKET_PAYLOAD_SIZE UDP_DATAGRAM_PAYLOAD_MAX_SIZE - sizeof(packet_header)
-    char data[PACKET_PAYLOAD_SIZE];
+    // encryption counter + tag (crypto.h), session salt + crc32c (crc32c.h)
+    // at the end of every datagram
+#define PACKET_TRAILER_MAX_SIZE 28
+#define PACKET_PAYLOAD_SIZE (UDP_DATAGRAM_PAYLOAD_MAX_SIZE - sizeof(packet_header) - PACKET_TRAILER_MAX_SIZE)
+
+    // paths confirmed by MTU discovery (pmtu.h) take bigger packets, up to
+    // 1500 ethernet MTU - 20 ip header - 8 udp header = 1472
+#define UDP_DATAGRAM_PMTU_MAX_SIZE 1472
+#define PACKET_MAX_PAYLOAD_SIZE (UDP_DATAGRAM_PMTU_MAX_SIZE - sizeof(packet_header))
+    char data[PACKET_MAX_PAYLOAD_SIZE];
 };
 
 struct message_header
 {
     u8 len;
-    // 8 bit is a signal if critical message (must be ack)
+    // bits 0-4 package_type, bit 5 merged run, bits 6-7 channel_id
     u8 message_type;
+    // sequence of the message within its channel
     u8 id;
     // 256 (max index) * 96 b/msg * (1 / 1024 * kb/b) = 23 kb
     // if use 16 bits you can send messages of up to 6 Mb
@@ -75,35 +101,138 @@ struct message
     u8 data[96];
 };
 
+enum message_state
+{
+    message_state_free,
+    // waiting to be packed
+    message_state_pending,
+    // sent in packet sent_in_seq, waiting for ack (reliable channels)
+    message_state_in_flight,
+    // a redundant copy got acked, waiting to know what happened to sent_in_seq
+    message_state_delivered
+};
+
+#define MESSAGE_MAX_COPIES 3
+
 struct queue_message
 {
     message messages[32];
-    i32 msg_sent_in_package_bit_index[32];
-    u32 begin;
+    u8 state[32];
+    u32 sent_in_seq[32];
+    // how important the message is, added to accumulated_priority
+    // every time the message is left out of a packet
+    r32 priority[32];
+    r32 accumulated_priority[32];
+    // redundant copies piggybacked on later packets since last packed
+    u8 copies[32];
+    u32 copy_seq[32][MESSAGE_MAX_COPIES];
+    // pending again because sent_in_seq was taken as lost, an ack of it still counts
+    u8 timed_out[32];
+    // search for free slots starts here, oldest messages are right after it
     u32 next;
     i32 last_id;
 };
 
+enum channel_id
+{
+    // never retransmitted, i.e. positional updates
+    channel_unreliable = 0,
+    // retransmitted until ack, delivered on arrival
+    channel_reliable_unordered = 1,
+    // retransmitted until ack, delivered in id order
+    channel_reliable_ordered = 2,
+
+    channel_count
+};
+
+#define MESSAGE_TYPE_MASK 0x1F
+#define MESSAGE_MERGED_FLAG 0x20
+#define MESSAGE_CHANNEL_SHIFT 6
 
 enum package_type
 {
     package_type_buffer = 1,
-    package_type_auth = 2
-    // should only go up to 127, we use last bit as signal for
-    // critical type
+    package_type_auth = 2,
+    package_type_pmtu_probe = 3,
+    // world state, snapshot.h
+    package_type_snapshot = 4,
+    // udp_time_request to the server, udp_time_reply back, clock_sync.h
+    package_type_time_sync = 5
+    // should only go up to 31, last 3 bits are merged flag and channel id
+};
+
+/*
+ * Message payloads are bit packed by their schema in serialize.h,
+ * these are only the in memory layout
+ */
+
+// payload ciphers (crypto.h), every peer has ChaCha20-Poly1305
+enum packet_cipher
+{
+    packet_cipher_chacha20_poly1305 = 0,
+    packet_cipher_aes256_gcm = 1,
+    packet_cipher_count
+};
+#define PACKET_CIPHERS_ALL ((1 << packet_cipher_count) - 1)
+
+// what the client is there for, caps the rate the server sends to it at
+enum client_class
+{
+    client_class_player = 0,
+    client_class_spectator = 1,
+    client_class_low_bandwidth = 2,
+    client_class_count
 };
 
 struct udp_auth
 {
     char user[16];
     char pwd[16];
+    // bit per packet_cipher the client has
+    u32 ciphers;
+    u32 client_class;
+};
+
+struct udp_auth_reply
+{
+    char text[32];
+    // the one the server picked, both ways from now on
+    u32 cipher;
+    // world ticks a second, snapshots carry the tick
+    u32 tick_hz;
+};
+
+// clock ns, real_time
+struct udp_time_request
+{
+    // when the packet was packed
+    u64 client_time;
 };
 
+struct udp_time_reply
+{
+    // of the request
+    u64 client_time;
+    // request read, reply packed server_hold_ns later
+    u64 server_receive_time;
+    u32 server_hold_ns;
+    // newest world tick, started since_tick_ns before the reply was packed
+    u32 tick;
+    u32 since_tick_ns;
+};
 
+// fragments are numbered by message_header.order
+#define UDP_BUFFER_MAX_SIZE (256 * 96)
 struct udp_buffer
 {
     u32 size;
 };
 
+// echo of a path MTU probe
+struct udp_pmtu_probe
+{
+    u32 size;
+};
+
 
 #endif
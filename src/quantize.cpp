@@ -0,0 +1,179 @@
+#include "quantize.h"
+
+/* BATCHES */
+
+inline __m128
+Select4(__m128 mask, __m128 a, __m128 b)
+{
+    __m128 result = _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+
+    return result;
+}
+
+void
+QuantizeFloatBatch(const float_quantizer * q, const r32 * in, u32 * out, u32 count)
+{
+    __m128 min = _mm_set1_ps(q->min);
+    __m128 max = _mm_set1_ps(q->max);
+    __m128 inv_precision = _mm_set1_ps(q->inv_precision);
+    __m128 half = _mm_set1_ps(0.5f);
+    __m128 zero = _mm_setzero_ps();
+    __m128 max_value = _mm_set1_ps((r32)q->max_value);
+
+    u32 i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 value = _mm_loadu_ps(in + i);
+        // operands in the order of ClampFloat so NaN ends up the same
+        value = _mm_min_ps(_mm_max_ps(value, min), max);
+        __m128 scaled = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(value, min), inv_precision), half);
+        scaled = _mm_min_ps(_mm_max_ps(scaled, zero), max_value);
+        _mm_storeu_si128((__m128i *)(out + i), _mm_cvttps_epi32(scaled));
+    }
+
+    for (; i < count; ++i)
+    {
+        out[i] = QuantizeFloat(q, in[i]);
+    }
+}
+
+void
+DequantizeFloatBatch(const float_quantizer * q, const u32 * in, r32 * out, u32 count)
+{
+    __m128 min = _mm_set1_ps(q->min);
+    __m128 precision = _mm_set1_ps(q->precision);
+
+    u32 i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 value = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(in + i)));
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_mul_ps(value, precision), min));
+    }
+
+    for (; i < count; ++i)
+    {
+        out[i] = DequantizeFloat(q, in[i]);
+    }
+}
+
+/* components of quaternion i are xs[i], ys[i], zs[i], ws[i] */
+void
+QuantizeQuatBatch(const r32 * xs, const r32 * ys, const r32 * zs, const r32 * ws, u32 * out, u32 count, u32 bits)
+{
+    Assert(bits <= QUAT_MAX_COMPONENT_BITS);
+
+    __m128 sign_bit = _mm_set1_ps(-0.0f);
+    __m128 zero = _mm_setzero_ps();
+    __m128 half = _mm_set1_ps(0.5f);
+    __m128 sqrt1_2 = _mm_set1_ps(QUAT_SQRT1_2);
+    r32 max_step = (r32)((1u << bits) - 1);
+    __m128 max_steps = _mm_set1_ps(max_step);
+    __m128 scale = _mm_set1_ps(max_step / (2.0f * QUAT_SQRT1_2));
+    __m128i shift_a = _mm_cvtsi32_si128(2);
+    __m128i shift_b = _mm_cvtsi32_si128(2 + bits);
+    __m128i shift_c = _mm_cvtsi32_si128(2 + 2 * bits);
+
+    u32 i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 qx = _mm_loadu_ps(xs + i);
+        __m128 qy = _mm_loadu_ps(ys + i);
+        __m128 qz = _mm_loadu_ps(zs + i);
+        __m128 qw = _mm_loadu_ps(ws + i);
+
+        __m128 ax = _mm_andnot_ps(sign_bit, qx);
+        __m128 ay = _mm_andnot_ps(sign_bit, qy);
+        __m128 az = _mm_andnot_ps(sign_bit, qz);
+        __m128 aw = _mm_andnot_ps(sign_bit, qw);
+        __m128 largest_abs = _mm_max_ps(_mm_max_ps(ax, ay), _mm_max_ps(az, aw));
+
+        // one mask per index of the largest, first one wins
+        __m128 is_x = _mm_cmpeq_ps(ax, largest_abs);
+        __m128 is_y = _mm_andnot_ps(is_x, _mm_cmpeq_ps(ay, largest_abs));
+        __m128 up_to_y = _mm_or_ps(is_x, is_y);
+        __m128 is_z = _mm_andnot_ps(up_to_y, _mm_cmpeq_ps(az, largest_abs));
+        __m128 up_to_z = _mm_or_ps(up_to_y, is_z);
+        __m128 is_w = _mm_andnot_ps(up_to_z, _mm_castsi128_ps(_mm_set1_epi32(-1)));
+
+        __m128 largest = Select4(is_x, qx, Select4(is_y, qy, Select4(is_z, qz, qw)));
+        __m128 flip = _mm_and_ps(_mm_cmplt_ps(largest, zero), sign_bit);
+
+        // the three left, in order
+        __m128 a = _mm_xor_ps(Select4(is_x, qy, qx), flip);
+        __m128 b = _mm_xor_ps(Select4(up_to_y, qz, qy), flip);
+        __m128 c = _mm_xor_ps(Select4(up_to_z, qw, qz), flip);
+
+        a = _mm_add_ps(_mm_mul_ps(_mm_add_ps(a, sqrt1_2), scale), half);
+        b = _mm_add_ps(_mm_mul_ps(_mm_add_ps(b, sqrt1_2), scale), half);
+        c = _mm_add_ps(_mm_mul_ps(_mm_add_ps(c, sqrt1_2), scale), half);
+        __m128i step_a = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(a, zero), max_steps));
+        __m128i step_b = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(b, zero), max_steps));
+        __m128i step_c = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(c, zero), max_steps));
+
+        __m128i index = _mm_or_si128(_mm_and_si128(_mm_castps_si128(is_y), _mm_set1_epi32(1)),
+                        _mm_or_si128(_mm_and_si128(_mm_castps_si128(is_z), _mm_set1_epi32(2)),
+                                     _mm_and_si128(_mm_castps_si128(is_w), _mm_set1_epi32(3))));
+        __m128i packed = _mm_or_si128(index, _mm_sll_epi32(step_a, shift_a));
+        packed = _mm_or_si128(packed, _mm_sll_epi32(step_b, shift_b));
+        packed = _mm_or_si128(packed, _mm_sll_epi32(step_c, shift_c));
+        _mm_storeu_si128((__m128i *)(out + i), packed);
+    }
+
+    for (; i < count; ++i)
+    {
+        quat value = { xs[i], ys[i], zs[i], ws[i] };
+        out[i] = QuantizeQuat(value, bits);
+    }
+}
+
+void
+DequantizeQuatBatch(const u32 * in, r32 * xs, r32 * ys, r32 * zs, r32 * ws, u32 count, u32 bits)
+{
+    Assert(bits <= QUAT_MAX_COMPONENT_BITS);
+
+    u32 mask_bits = (1u << bits) - 1;
+    __m128i mask = _mm_set1_epi32((i32)mask_bits);
+    __m128 inv_scale = _mm_set1_ps((2.0f * QUAT_SQRT1_2) / (r32)mask_bits);
+    __m128 sqrt1_2 = _mm_set1_ps(QUAT_SQRT1_2);
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 zero = _mm_setzero_ps();
+    __m128i shift_b = _mm_cvtsi32_si128(2 + bits);
+    __m128i shift_c = _mm_cvtsi32_si128(2 + 2 * bits);
+
+    u32 i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i packed = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i index = _mm_and_si128(packed, _mm_set1_epi32(3));
+
+        __m128 a = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(packed, 2), mask));
+        __m128 b = _mm_cvtepi32_ps(_mm_and_si128(_mm_srl_epi32(packed, shift_b), mask));
+        __m128 c = _mm_cvtepi32_ps(_mm_and_si128(_mm_srl_epi32(packed, shift_c), mask));
+        a = _mm_sub_ps(_mm_mul_ps(a, inv_scale), sqrt1_2);
+        b = _mm_sub_ps(_mm_mul_ps(b, inv_scale), sqrt1_2);
+        c = _mm_sub_ps(_mm_mul_ps(c, inv_scale), sqrt1_2);
+
+        // same order of operations as DequantizeQuat
+        __m128 rest = _mm_sub_ps(_mm_sub_ps(_mm_sub_ps(one, _mm_mul_ps(a, a)), _mm_mul_ps(b, b)), _mm_mul_ps(c, c));
+        __m128 l = _mm_sqrt_ps(Select4(_mm_cmpgt_ps(rest, zero), rest, zero));
+
+        __m128 is_x = _mm_castsi128_ps(_mm_cmpeq_epi32(index, _mm_setzero_si128()));
+        __m128 is_y = _mm_castsi128_ps(_mm_cmpeq_epi32(index, _mm_set1_epi32(1)));
+        __m128 is_z = _mm_castsi128_ps(_mm_cmpeq_epi32(index, _mm_set1_epi32(2)));
+        __m128 is_w = _mm_castsi128_ps(_mm_cmpeq_epi32(index, _mm_set1_epi32(3)));
+
+        _mm_storeu_ps(xs + i, Select4(is_x, l, a));
+        _mm_storeu_ps(ys + i, Select4(is_x, a, Select4(is_y, l, b)));
+        _mm_storeu_ps(zs + i, Select4(_mm_or_ps(is_x, is_y), b, Select4(is_z, l, c)));
+        _mm_storeu_ps(ws + i, Select4(is_w, l, c));
+    }
+
+    for (; i < count; ++i)
+    {
+        quat value = DequantizeQuat(in[i], bits);
+        xs[i] = value.x;
+        ys[i] = value.y;
+        zs[i] = value.z;
+        ws[i] = value.w;
+    }
+}
@@ -0,0 +1,217 @@
+#ifndef UDP_QUANTIZE_H
+#define UDP_QUANTIZE_H
+
+#include "platform.h"
+#include "bitstream.h"
+#include <emmintrin.h>
+
+/*
+ * Quantization of game state before it goes in a bit stream
+ *
+ *  - floats in a bounded range (positions, velocities) go fixed point:
+ *    steps of precision over [min, max], error at most precision / 2
+ *  - unit quaternions go smallest three: the largest component is dropped
+ *    (rebuilt from the unit length), its sign is folded in by negating the
+ *    quaternion and the other three, all within +-1/sqrt(2), take bits
+ *    each. 2 + 3 * bits in total, 32 with 10 bits per component.
+ *
+ * Batch versions work on arrays of components (x[], y[], ...) four at a time
+ * with SSE2, which every x64 cpu has. They give exactly the same values as
+ * the scalar ones.
+ */
+
+#define QUAT_SQRT1_2 0.70710678118654752f
+#define QUAT_MAX_COMPONENT_BITS 10
+
+struct v3
+{
+    r32 x, y, z;
+};
+
+struct quat
+{
+    r32 x, y, z, w;
+};
+
+struct float_quantizer
+{
+    r32 min;
+    r32 max;
+    r32 precision;
+    r32 inv_precision;
+    // quantized values are in [0, max_value]
+    u32 max_value;
+    u32 bits;
+};
+
+inline float_quantizer
+FloatQuantizer(r32 min, r32 max, r32 precision)
+{
+    float_quantizer q;
+    q.min = min;
+    q.max = max;
+    q.precision = precision;
+    q.inv_precision = 1.0f / precision;
+    q.max_value = (u32)((max - min) * q.inv_precision + 0.5f);
+    q.bits = BitsRequired(q.max_value);
+
+    return q;
+}
+
+inline r32
+ClampFloat(r32 value, r32 lo, r32 hi)
+{
+    // argument order matches minps/maxps, NaN goes to lo
+    r32 result = (value > lo) ? value : lo;
+    result = (result < hi) ? result : hi;
+
+    return result;
+}
+
+inline u32
+QuantizeFloat(const float_quantizer * q, r32 value)
+{
+    r32 scaled = (ClampFloat(value, q->min, q->max) - q->min) * q->inv_precision + 0.5f;
+    u32 result = (u32)ClampFloat(scaled, 0.0f, (r32)q->max_value);
+
+    return result;
+}
+
+inline r32
+DequantizeFloat(const float_quantizer * q, u32 value)
+{
+    r32 result = (r32)value * q->precision + q->min;
+
+    return result;
+}
+
+inline r32
+SqrtFloat(r32 value)
+{
+    r32 result = _mm_cvtss_f32(_mm_sqrt_ss(_mm_set_ss(value)));
+
+    return result;
+}
+
+/* smallest three, 2 + 3 * bits */
+inline u32
+QuantizeQuat(quat value, u32 bits)
+{
+    Assert(bits <= QUAT_MAX_COMPONENT_BITS);
+
+    r32 ax = value.x < 0.0f ? -value.x : value.x;
+    r32 ay = value.y < 0.0f ? -value.y : value.y;
+    r32 az = value.z < 0.0f ? -value.z : value.z;
+    r32 aw = value.w < 0.0f ? -value.w : value.w;
+    r32 largest_abs = max(max(ax, ay), max(az, aw));
+
+    // first of the largest on ties, same as the batch version
+    u32 largest = (ax == largest_abs) ? 0 : (ay == largest_abs) ? 1 : (az == largest_abs) ? 2 : 3;
+    r32 components[4] = { value.x, value.y, value.z, value.w };
+    r32 sign = (components[largest] < 0.0f) ? -1.0f : 1.0f;
+
+    r32 max_step = (r32)((1u << bits) - 1);
+    r32 scale = max_step / (2.0f * QUAT_SQRT1_2);
+
+    u32 packed = largest;
+    u32 shift = 2;
+    for (u32 i = 0; i < 4; ++i)
+    {
+        if (i == largest)
+        {
+            continue;
+        }
+
+        r32 scaled = (components[i] * sign + QUAT_SQRT1_2) * scale + 0.5f;
+        u32 step = (u32)ClampFloat(scaled, 0.0f, max_step);
+        packed |= step << shift;
+        shift += bits;
+    }
+
+    return packed;
+}
+
+inline quat
+DequantizeQuat(u32 packed, u32 bits)
+{
+    u32 largest = packed & 3;
+    u32 mask = (1u << bits) - 1;
+    r32 inv_scale = (2.0f * QUAT_SQRT1_2) / (r32)mask;
+
+    r32 a = (r32)((packed >> 2) & mask) * inv_scale - QUAT_SQRT1_2;
+    r32 b = (r32)((packed >> (2 + bits)) & mask) * inv_scale - QUAT_SQRT1_2;
+    r32 c = (r32)((packed >> (2 + 2 * bits)) & mask) * inv_scale - QUAT_SQRT1_2;
+    r32 rest = 1.0f - a * a - b * b - c * c;
+    r32 l = SqrtFloat(rest > 0.0f ? rest : 0.0f);
+
+    quat result;
+    result.x = (largest == 0) ? l : a;
+    result.y = (largest == 0) ? a : (largest == 1) ? l : b;
+    result.z = (largest <= 1) ? b : (largest == 2) ? l : c;
+    result.w = (largest == 3) ? l : c;
+
+    return result;
+}
+
+/* SERIALIZER */
+
+template <typename stream> void
+SerializeQuantizedFloat(stream & s, r32 & value, const float_quantizer & q)
+{
+    u32 quantized = 0;
+    if (stream::IsWriting)
+    {
+        quantized = QuantizeFloat(&q, value);
+    }
+
+    SerializeUnsigned(s, quantized, 0, q.max_value);
+
+    if (stream::IsReading)
+    {
+        value = DequantizeFloat(&q, quantized);
+    }
+}
+
+template <typename stream> void
+SerializeQuantizedV3(stream & s, v3 & value, const float_quantizer & q)
+{
+    SerializeQuantizedFloat(s, value.x, q);
+    SerializeQuantizedFloat(s, value.y, q);
+    SerializeQuantizedFloat(s, value.z, q);
+}
+
+/* already quantized smallest three */
+template <typename stream> void
+SerializeQuatPacked(stream & s, u32 & packed, u32 bits)
+{
+    u32 largest = packed & 3;
+    u32 a = (packed >> 2) & ((1u << bits) - 1);
+    u32 b = (packed >> (2 + bits)) & ((1u << bits) - 1);
+    u32 c = (packed >> (2 + 2 * bits)) & ((1u << bits) - 1);
+
+    s.SerializeBits(largest, 2);
+    s.SerializeBits(a, bits);
+    s.SerializeBits(b, bits);
+    s.SerializeBits(c, bits);
+
+    packed = largest | (a << 2) | (b << (2 + bits)) | (c << (2 + 2 * bits));
+}
+
+template <typename stream> void
+SerializeQuat(stream & s, quat & value, u32 bits)
+{
+    u32 packed = 0;
+    if (stream::IsWriting)
+    {
+        packed = QuantizeQuat(value, bits);
+    }
+
+    SerializeQuatPacked(s, packed, bits);
+
+    if (stream::IsReading)
+    {
+        value = DequantizeQuat(packed, bits);
+    }
+}
+
+#endif
@@ -0,0 +1,107 @@
+#include "range_coder.h"
+#include "range_model.h"
+
+// trained models every payload is coded with, RangeCoderInit
+static range_model range_packet_models[RANGE_MODEL_COUNT];
+
+void
+RangeCoderInit()
+{
+    for (u32 model_index = 0; model_index < RANGE_MODEL_COUNT; ++model_index)
+    {
+        RangeModelInit(range_packet_models + model_index, range_model_frequency[model_index]);
+    }
+}
+
+/*
+ * Payload of messages records into out.
+ * Returns bytes written, 0 if they don't fit in capacity or the records
+ * don't cover the payload exactly
+ */
+u32
+RangeEncodePayload(const range_model * models, const u8 * payload, u32 size, u32 messages,
+                   u8 * out, u32 capacity)
+{
+    range_encoder e;
+    RangeEncoderInit(&e, out, capacity);
+
+    u32 at = 0;
+    for (u32 msg_index = 0; msg_index < messages; ++msg_index)
+    {
+        if (at + sizeof(message_header) > size || e.overflow)
+        {
+            return 0;
+        }
+
+        const u8 * header = payload + at;
+        for (i32 i = 0; i < (i32)sizeof(message_header); ++i)
+        {
+            RangeEncode(&e, models + RangeModelIndex(0, i - (i32)sizeof(message_header)), header[i]);
+        }
+        at += sizeof(message_header);
+
+        const message_header * record = (const message_header *)header;
+        if (at + record->len > size)
+        {
+            return 0;
+        }
+
+        for (u32 i = 0; i < record->len; ++i)
+        {
+            RangeEncode(&e, models + RangeModelIndex(record->message_type, (i32)i), payload[at + i]);
+        }
+        at += record->len;
+    }
+
+    if (at != size)
+    {
+        return 0;
+    }
+
+    return RangeEncoderFlush(&e);
+}
+
+/*
+ * messages records from in, which comes off the network.
+ * False if they don't fit in capacity, a corrupt stream decodes to garbage
+ * within bounds
+ */
+b32
+RangeDecodePayload(const range_model * models, const u8 * in, u32 in_size, u32 messages,
+                   u8 * out, u32 capacity, u32 * out_size)
+{
+    range_decoder d;
+    RangeDecoderInit(&d, in, in_size);
+
+    u32 at = 0;
+    for (u32 msg_index = 0; msg_index < messages; ++msg_index)
+    {
+        if (at + sizeof(message_header) > capacity)
+        {
+            return false;
+        }
+
+        for (i32 i = 0; i < (i32)sizeof(message_header); ++i)
+        {
+            out[at + i] = (u8)RangeDecode(&d, models + RangeModelIndex(0, i - (i32)sizeof(message_header)));
+        }
+
+        message_header * record = (message_header *)(out + at);
+        at += sizeof(message_header);
+        if (at + record->len > capacity)
+        {
+            return false;
+        }
+
+        u32 message_type = record->message_type;
+        for (u32 i = 0; i < record->len; ++i)
+        {
+            out[at + i] = (u8)RangeDecode(&d, models + RangeModelIndex(message_type, (i32)i));
+        }
+        at += record->len;
+    }
+
+    *out_size = at;
+
+    return true;
+}
@@ -0,0 +1,263 @@
+#ifndef UDP_RANGE_CODER_H
+#define UDP_RANGE_CODER_H
+
+#include "protocol.h"
+#include <string.h>
+
+/*
+ * Range coder with static models for packet payloads
+ *
+ * Payloads are records (message_header + data), mostly bit packed. Every
+ * byte is coded with the frequencies of its context:
+ *   - the 4 bytes of message_header, one model each
+ *   - data bytes by package type and position in the record, the first
+ *     few positions have their own model and the rest share one
+ * Frequencies are trained offline on captured traffic (test_range train)
+ * and built into range_model.h, so nothing is sent or adapted at run time
+ * and every packet decodes on its own.
+ *
+ * The coder is the LZMA one: 32 bit range, carry through a cached byte,
+ * frequencies summing to 1 << RANGE_PROB_BITS so encoding needs no division.
+ * Decoding finds the symbol through a table indexed by cumulative frequency.
+ * The leading byte, always 0, isn't sent and the end is flushed with as few
+ * bytes as the final range allows, missing bytes read as 0.
+ */
+
+#define RANGE_PROB_BITS 12
+#define RANGE_PROB_TOTAL (1 << RANGE_PROB_BITS)
+#define RANGE_TOP (1u << 24)
+
+// models: the header bytes, then data by package type and position
+#define RANGE_HEADER_MODELS 4
+#define RANGE_MODEL_TYPES 8
+#define RANGE_POSITION_BUCKETS 4
+#define RANGE_MODEL_COUNT (RANGE_HEADER_MODELS + RANGE_MODEL_TYPES * RANGE_POSITION_BUCKETS)
+
+struct range_model
+{
+    u16 cumulative[257];
+    // symbol of every cumulative frequency
+    u8 symbol[RANGE_PROB_TOTAL];
+};
+
+struct range_encoder
+{
+    u64 low;
+    u32 range;
+    u8 cache;
+    u32 cache_size;
+    // the first byte out is always 0 and left out
+    b32 first;
+
+    u8 * out;
+    u32 at;
+    u32 capacity;
+    b32 overflow;
+};
+
+struct range_decoder
+{
+    u32 code;
+    u32 range;
+
+    const u8 * in;
+    u32 at;
+    u32 size;
+};
+
+/* ENCODER */
+
+inline void
+RangeEncoderInit(range_encoder * e, u8 * out, u32 capacity)
+{
+    e->low = 0;
+    e->range = 0xFFFFFFFF;
+    e->cache = 0;
+    e->cache_size = 1;
+    e->first = true;
+    e->out = out;
+    e->at = 0;
+    e->capacity = capacity;
+    e->overflow = false;
+}
+
+inline void
+RangeEncoderPut(range_encoder * e, u8 byte)
+{
+    if (e->first)
+    {
+        Assert(byte == 0);
+        e->first = false;
+        return;
+    }
+
+    if (e->at < e->capacity)
+    {
+        e->out[e->at] = byte;
+    }
+    else
+    {
+        e->overflow = true;
+    }
+    e->at += 1;
+}
+
+inline void
+RangeEncoderShiftLow(range_encoder * e)
+{
+    if ((u32)e->low < 0xFF000000 || (e->low >> 32) != 0)
+    {
+        u8 carry = (u8)(e->low >> 32);
+        u8 byte = e->cache;
+        do
+        {
+            RangeEncoderPut(e, (u8)(byte + carry));
+            byte = 0xFF;
+        } while (--e->cache_size != 0);
+
+        e->cache = (u8)(e->low >> 24);
+    }
+
+    e->cache_size += 1;
+    e->low = (e->low & 0x00FFFFFF) << 8;
+}
+
+inline void
+RangeEncode(range_encoder * e, const range_model * model, u32 symbol)
+{
+    u32 start = model->cumulative[symbol];
+    u32 frequency = model->cumulative[symbol + 1] - start;
+
+    e->range >>= RANGE_PROB_BITS;
+    e->low += (u64)start * e->range;
+    e->range *= frequency;
+
+    while (e->range < RANGE_TOP)
+    {
+        e->range <<= 8;
+        RangeEncoderShiftLow(e);
+    }
+}
+
+/* bytes written, 0 if they didn't fit */
+inline u32
+RangeEncoderFlush(range_encoder * e)
+{
+    // the value with the most trailing zero bits within [low, low + range)
+    for (u32 shift = 32; shift > 0; --shift)
+    {
+        u64 mask = ((u64)1 << (shift - 1)) - 1;
+        u64 rounded = (e->low + mask) & ~mask;
+        if (rounded < e->low + e->range)
+        {
+            e->low = rounded;
+            break;
+        }
+    }
+
+    for (u32 i = 0; i < 5; ++i)
+    {
+        RangeEncoderShiftLow(e);
+    }
+
+    if (e->overflow)
+    {
+        return 0;
+    }
+
+    // the decoder reads past the end as zeros
+    while (e->at > 0 && e->out[e->at - 1] == 0)
+    {
+        e->at -= 1;
+    }
+
+    return e->at;
+}
+
+/* DECODER */
+
+inline u8
+RangeDecoderGet(range_decoder * d)
+{
+    u8 byte = (d->at < d->size) ? d->in[d->at] : 0;
+    d->at += 1;
+
+    return byte;
+}
+
+inline void
+RangeDecoderInit(range_decoder * d, const u8 * in, u32 size)
+{
+    d->in = in;
+    d->size = size;
+    d->at = 0;
+    d->range = 0xFFFFFFFF;
+    d->code = 0;
+    for (u32 i = 0; i < 4; ++i)
+    {
+        d->code = (d->code << 8) | RangeDecoderGet(d);
+    }
+}
+
+inline u32
+RangeDecode(range_decoder * d, const range_model * model)
+{
+    d->range >>= RANGE_PROB_BITS;
+    u32 value = d->code / d->range;
+    // only a corrupt stream goes past the total
+    value = (value < RANGE_PROB_TOTAL) ? value : RANGE_PROB_TOTAL - 1;
+
+    u32 symbol = model->symbol[value];
+    u32 start = model->cumulative[symbol];
+    u32 frequency = model->cumulative[symbol + 1] - start;
+
+    d->code -= start * d->range;
+    d->range *= frequency;
+
+    while (d->range < RANGE_TOP)
+    {
+        d->code = (d->code << 8) | RangeDecoderGet(d);
+        d->range <<= 8;
+    }
+
+    return symbol;
+}
+
+/* MODELS */
+
+/* frequencies sum to RANGE_PROB_TOTAL, none of them 0 */
+inline void
+RangeModelInit(range_model * model, const u16 * frequency)
+{
+    u32 total = 0;
+    for (u32 symbol = 0; symbol < 256; ++symbol)
+    {
+        Assert(frequency[symbol] > 0);
+        model->cumulative[symbol] = (u16)total;
+        for (u32 i = 0; i < frequency[symbol]; ++i)
+        {
+            model->symbol[total + i] = (u8)symbol;
+        }
+        total += frequency[symbol];
+    }
+    Assert(total == RANGE_PROB_TOTAL);
+    model->cumulative[256] = (u16)total;
+}
+
+/* model of byte at position of a record of message_type, position < 0 is the header */
+inline u32
+RangeModelIndex(u32 message_type, i32 position)
+{
+    if (position < 0)
+    {
+        return (u32)(position + RANGE_HEADER_MODELS);
+    }
+
+    u32 type = message_type & MESSAGE_TYPE_MASK;
+    type = (type < RANGE_MODEL_TYPES) ? type : 0;
+    u32 bucket = ((u32)position < RANGE_POSITION_BUCKETS) ? (u32)position : RANGE_POSITION_BUCKETS - 1;
+
+    return RANGE_HEADER_MODELS + type * RANGE_POSITION_BUCKETS + bucket;
+}
+
+#endif
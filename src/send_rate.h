@@ -0,0 +1,80 @@
+#ifndef UDP_SEND_RATE_H
+#define UDP_SEND_RATE_H
+
+#include "platform.h"
+#include "math.h"
+
+/*
+ * Per client send rate over a fixed simulation tick
+ *
+ * The world steps tick_hz times a second whatever the network does. A
+ * client is sent the latest step every ticks_per_send ticks: at one of
+ * send_rate_tiers_hz, the fastest that divides tick_hz and is under both
+ * its class cap and what congestion control allows. Under the slowest tier
+ * congestion control goes on by itself, ticks_per_send is the tick count
+ * that keeps under its rate.
+ *
+ * Clients of a rate send on different ticks: tick + phase is a multiple of
+ * ticks_per_send on its send ticks, phase is handed out round robin when
+ * the client shows up. Pacing slots (pacing.h) spread them inside the tick.
+ */
+
+static const u32 send_rate_tiers_hz[] = { 60, 30, 20, 10 };
+
+struct send_schedule
+{
+    u32 phase;
+    u32 ticks_per_send;
+    // sends a second it works out to
+    r32 rate_hz;
+};
+
+inline void
+SendScheduleInit(send_schedule * schedule, u32 phase, u32 tick_hz)
+{
+    schedule->phase = phase;
+    schedule->ticks_per_send = 1;
+    schedule->rate_hz = (r32)tick_hz;
+}
+
+/* max_hz of the client class, congestion_hz of its congestion control */
+inline void
+SendScheduleUpdate(send_schedule * schedule, u32 tick_hz, r32 max_hz, r32 congestion_hz)
+{
+    r32 wanted_hz = min(max_hz, congestion_hz);
+    Assert(wanted_hz > 0.0f);
+
+    u32 ticks_per_send = 0;
+    for (u32 tier = 0; tier < ArrayCount(send_rate_tiers_hz); ++tier)
+    {
+        u32 tier_hz = send_rate_tiers_hz[tier];
+        if (tier_hz <= tick_hz && (tick_hz % tier_hz) == 0 && (r32)tier_hz <= wanted_hz)
+        {
+            ticks_per_send = tick_hz / tier_hz;
+            break;
+        }
+    }
+
+    if (ticks_per_send == 0)
+    {
+        // rounded up, the rate is at most wanted_hz
+        ticks_per_send = (u32)((r32)tick_hz / wanted_hz);
+        if ((r32)tick_hz > wanted_hz * (r32)ticks_per_send)
+        {
+            ticks_per_send += 1;
+        }
+    }
+
+    schedule->ticks_per_send = ticks_per_send;
+    schedule->rate_hz = (r32)tick_hz / (r32)ticks_per_send;
+}
+
+inline b32
+SendScheduleDue(send_schedule * schedule, u64 tick)
+{
+    b32 due = ((tick + schedule->phase) % schedule->ticks_per_send) == 0;
+
+    return due;
+}
+
+#endif
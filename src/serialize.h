@@ -0,0 +1,66 @@
+#ifndef UDP_SERIALIZE_H
+#define UDP_SERIALIZE_H
+
+#include "protocol.h"
+#include "bitstream.h"
+
+/* SCHEMAS OF THE PROTOCOL MESSAGES */
+
+template <typename stream> b32
+Serialize(stream & s, udp_auth & auth)
+{
+    SerializeString(s, auth.user, sizeof(auth.user));
+    SerializeString(s, auth.pwd, sizeof(auth.pwd));
+    SerializeUnsigned(s, auth.ciphers, 0, PACKET_CIPHERS_ALL);
+    SerializeUnsigned(s, auth.client_class, 0, client_class_count - 1);
+
+    return SerializeOk(s);
+}
+
+template <typename stream> b32
+Serialize(stream & s, udp_auth_reply & reply)
+{
+    SerializeString(s, reply.text, sizeof(reply.text));
+    SerializeUnsigned(s, reply.cipher, 0, packet_cipher_count - 1);
+    SerializeUnsigned(s, reply.tick_hz, 1, 1000);
+
+    return SerializeOk(s);
+}
+
+template <typename stream> b32
+Serialize(stream & s, udp_time_request & request)
+{
+    SerializeU64(s, request.client_time);
+
+    return SerializeOk(s);
+}
+
+template <typename stream> b32
+Serialize(stream & s, udp_time_reply & reply)
+{
+    SerializeU64(s, reply.client_time);
+    SerializeU64(s, reply.server_receive_time);
+    SerializeUnsigned(s, reply.server_hold_ns, 0, UINT_MAX);
+    SerializeUnsigned(s, reply.tick, 0, UINT_MAX);
+    SerializeUnsigned(s, reply.since_tick_ns, 0, UINT_MAX);
+
+    return SerializeOk(s);
+}
+
+template <typename stream> b32
+Serialize(stream & s, udp_buffer & buffer)
+{
+    SerializeUnsigned(s, buffer.size, 0, UDP_BUFFER_MAX_SIZE);
+
+    return SerializeOk(s);
+}
+
+template <typename stream> b32
+Serialize(stream & s, udp_pmtu_probe & probe)
+{
+    SerializeUnsigned(s, probe.size, 0, UDP_DATAGRAM_PMTU_MAX_SIZE);
+
+    return SerializeOk(s);
+}
+
+#endif
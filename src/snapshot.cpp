@@ -0,0 +1,490 @@
+#include "snapshot.h"
+#include "serialize.h"
+#include "quantize.cpp"
+#include "math.h"
+#include <string.h>
+
+// baseline of clients that have none acked, everything at its default
+static const world_snapshot snapshot_default = {};
+
+inline b32
+EntityStateEqual(const entity_state * a, const entity_state * b)
+{
+    b32 equal = (memcmp(a, b, sizeof(entity_state)) == 0);
+
+    return equal;
+}
+
+/* QUANTIZERS */
+
+static const float_quantizer entity_position_xy = 
+    FloatQuantizer(ENTITY_POSITION_XY_MIN, ENTITY_POSITION_XY_MAX, ENTITY_POSITION_PRECISION);
+static const float_quantizer entity_position_z = 
+    FloatQuantizer(ENTITY_POSITION_Z_MIN, ENTITY_POSITION_Z_MAX, ENTITY_POSITION_PRECISION);
+static const float_quantizer entity_velocity = 
+    FloatQuantizer(-ENTITY_VELOCITY_MAX, ENTITY_VELOCITY_MAX, ENTITY_VELOCITY_PRECISION);
+
+inline const float_quantizer *
+EntityPositionQuantizer(u32 axis)
+{
+    return (axis == 2) ? &entity_position_z : &entity_position_xy;
+}
+
+/* float state of every entity into world, health and flags are left as they are */
+void
+SnapshotQuantize(world_snapshot * world, const entity_arrays * state)
+{
+    u32 quantized[SNAPSHOT_MAX_ENTITIES];
+
+    for (u32 axis = 0; axis < 3; ++axis)
+    {
+        QuantizeFloatBatch(EntityPositionQuantizer(axis), state->position[axis], quantized, SNAPSHOT_MAX_ENTITIES);
+        for (u32 entity_index = 0; entity_index < SNAPSHOT_MAX_ENTITIES; ++entity_index)
+        {
+            world->entities[entity_index].position[axis] = quantized[entity_index];
+        }
+
+        QuantizeFloatBatch(&entity_velocity, state->velocity[axis], quantized, SNAPSHOT_MAX_ENTITIES);
+        for (u32 entity_index = 0; entity_index < SNAPSHOT_MAX_ENTITIES; ++entity_index)
+        {
+            world->entities[entity_index].velocity[axis] = quantized[entity_index];
+        }
+    }
+
+    QuantizeQuatBatch(state->orientation[0], state->orientation[1], state->orientation[2], state->orientation[3],
+                      quantized, SNAPSHOT_MAX_ENTITIES, ENTITY_ORIENTATION_BITS);
+    for (u32 entity_index = 0; entity_index < SNAPSHOT_MAX_ENTITIES; ++entity_index)
+    {
+        world->entities[entity_index].orientation = quantized[entity_index];
+    }
+}
+
+/* back to floats, what the client renders */
+void
+SnapshotDequantize(const world_snapshot * world, entity_arrays * state)
+{
+    u32 quantized[SNAPSHOT_MAX_ENTITIES];
+
+    for (u32 axis = 0; axis < 3; ++axis)
+    {
+        for (u32 entity_index = 0; entity_index < SNAPSHOT_MAX_ENTITIES; ++entity_index)
+        {
+            quantized[entity_index] = world->entities[entity_index].position[axis];
+        }
+        DequantizeFloatBatch(EntityPositionQuantizer(axis), quantized, state->position[axis], SNAPSHOT_MAX_ENTITIES);
+
+        for (u32 entity_index = 0; entity_index < SNAPSHOT_MAX_ENTITIES; ++entity_index)
+        {
+            quantized[entity_index] = world->entities[entity_index].velocity[axis];
+        }
+        DequantizeFloatBatch(&entity_velocity, quantized, state->velocity[axis], SNAPSHOT_MAX_ENTITIES);
+    }
+
+    for (u32 entity_index = 0; entity_index < SNAPSHOT_MAX_ENTITIES; ++entity_index)
+    {
+        quantized[entity_index] = world->entities[entity_index].orientation;
+    }
+    DequantizeQuatBatch(quantized, state->orientation[0], state->orientation[1], state->orientation[2], state->orientation[3],
+                        SNAPSHOT_MAX_ENTITIES, ENTITY_ORIENTATION_BITS);
+}
+
+/* SCHEMA */
+
+template <typename stream> void
+SerializePositionDelta(stream & s, u32 & value, u32 baseline, u32 max_value)
+{
+    b32 is_small = false;
+    i32 delta = 0;
+
+    if (stream::IsWriting)
+    {
+        delta = (i32)(value - baseline);
+        is_small = (delta >= -ENTITY_POSITION_SMALL_DELTA && delta <= ENTITY_POSITION_SMALL_DELTA);
+    }
+
+    SerializeBool(s, is_small);
+
+    if (is_small)
+    {
+        SerializeInt(s, delta, -ENTITY_POSITION_SMALL_DELTA, ENTITY_POSITION_SMALL_DELTA);
+        if (stream::IsReading)
+        {
+            // below 0 wraps past max_value
+            value = baseline + (u32)delta;
+            s.failed |= (value > max_value);
+        }
+    }
+    else
+    {
+        SerializeUnsigned(s, value, 0, max_value);
+    }
+}
+
+/* fields of state that differ from baseline, the others are baseline's when reading */
+template <typename stream> b32
+SerializeEntityDelta(stream & s, entity_state & state, const entity_state & baseline)
+{
+    b32 position_changed[3] = {};
+    b32 velocity_changed = false;
+    b32 orientation_changed = false;
+    b32 health_changed = false;
+    b32 flags_changed = false;
+
+    if (stream::IsWriting)
+    {
+        for (u32 axis = 0; axis < 3; ++axis)
+        {
+            position_changed[axis] = (state.position[axis] != baseline.position[axis]);
+        }
+        velocity_changed = (memcmp(state.velocity, baseline.velocity, sizeof(state.velocity)) != 0);
+        orientation_changed = (state.orientation != baseline.orientation);
+        health_changed = (state.health != baseline.health);
+        flags_changed = (state.flags != baseline.flags);
+    }
+
+    for (u32 axis = 0; axis < 3; ++axis)
+    {
+        SerializeBool(s, position_changed[axis]);
+    }
+    SerializeBool(s, velocity_changed);
+    SerializeBool(s, orientation_changed);
+    SerializeBool(s, health_changed);
+    SerializeBool(s, flags_changed);
+
+    if (stream::IsReading)
+    {
+        state = baseline;
+    }
+
+    for (u32 axis = 0; axis < 3; ++axis)
+    {
+        if (position_changed[axis])
+        {
+            SerializePositionDelta(s, state.position[axis], baseline.position[axis], 
+                                   EntityPositionQuantizer(axis)->max_value);
+        }
+    }
+    if (velocity_changed)
+    {
+        for (u32 axis = 0; axis < 3; ++axis)
+        {
+            SerializeUnsigned(s, state.velocity[axis], 0, entity_velocity.max_value);
+        }
+    }
+    if (orientation_changed)
+    {
+        SerializeQuatPacked(s, state.orientation, ENTITY_ORIENTATION_BITS);
+    }
+    if (health_changed)
+    {
+        u32 health = state.health;
+        SerializeUnsigned(s, health, 0, ENTITY_HEALTH_MAX);
+        state.health = (u16)health;
+    }
+    if (flags_changed)
+    {
+        u32 flags = state.flags;
+        SerializeUnsigned(s, flags, 0, (1 << ENTITY_FLAG_COUNT) - 1);
+        state.flags = (u16)flags;
+    }
+
+    return SerializeOk(s);
+}
+
+/* one changed entity within a record, more = false ends the record */
+template <typename stream> b32
+SerializeEntityEntry(stream & s, b32 & more, u32 & index, entity_state & state, const entity_state & baseline)
+{
+    SerializeBool(s, more);
+    if (!more)
+    {
+        return SerializeOk(s);
+    }
+
+    SerializeUnsigned(s, index, 0, SNAPSHOT_MAX_ENTITIES - 1);
+
+    return SerializeEntityDelta(s, state, baseline);
+}
+
+/* SENDER */
+
+void
+SnapshotSenderInit(snapshot_sender * sender)
+{
+    memset(sender, 0, sizeof(snapshot_sender));
+}
+
+/* newest snapshot sent before seq that the peer acked, 0 if none */
+const world_snapshot *
+SnapshotBaseline(snapshot_sender * sender, u32 seq, u32 acked_bit, u32 * baseline_seq)
+{
+    const world_snapshot * baseline = 0;
+    u32 best_distance = SNAPSHOT_MAX_BASELINE_DISTANCE + 1;
+
+    for (u32 slot = 0; slot < SNAPSHOT_HISTORY; ++slot)
+    {
+        if ((sender->valid_bit & ((u32)1 << slot)) == 0)
+        {
+            continue;
+        }
+
+        // ack bits cover the last 32 seqs, anything older is unknown
+        u32 distance = seq - sender->seq[slot];
+        b32 acked = (acked_bit >> (sender->seq[slot] & 31)) & 1;
+        if (distance > 0 && distance < best_distance && acked)
+        {
+            best_distance = distance;
+            baseline = sender->sent + slot;
+            *baseline_seq = sender->seq[slot];
+        }
+    }
+
+    return baseline;
+}
+
+/* would a snapshot in packet seq carry anything */
+b32
+SnapshotHasChanges(snapshot_sender * sender, const world_snapshot * world, u32 seq, u32 acked_bit)
+{
+    u32 baseline_seq = 0;
+    const world_snapshot * baseline = SnapshotBaseline(sender, seq, acked_bit, &baseline_seq);
+    if (!baseline)
+    {
+        baseline = &snapshot_default;
+    }
+
+    // a new tick alone is no news
+    b32 has_changes = (memcmp(world->entities, baseline->entities, sizeof(world->entities)) != 0);
+
+    return has_changes;
+}
+
+/*
+ * Snapshot records of world for packet seq into data, as many changed
+ * entities as capacity takes. acked_bit: peer acks by seq & 31.
+ * Returns bytes written, message_count goes up by the records written
+ */
+u32
+SnapshotWrite(snapshot_sender * sender, const world_snapshot * world, u32 seq, u32 acked_bit,
+              u8 * data, u32 capacity, u16 * message_count)
+{
+    u32 baseline_seq = 0;
+    const world_snapshot * baseline = SnapshotBaseline(sender, seq, acked_bit, &baseline_seq);
+    u32 baseline_distance = baseline ? (seq - baseline_seq) : 0;
+
+    // the history slot of seq can be the baseline's own
+    world_snapshot base = baseline ? *baseline : snapshot_default;
+    world_snapshot next = base;
+    next.tick = world->tick;
+    u32 tick = world->tick;
+
+    u32 used = 0;
+    u32 record_index = 0;
+    u32 entity_index = 0;
+
+    while (entity_index < SNAPSHOT_MAX_ENTITIES)
+    {
+        u32 room = capacity - used;
+        if (room < sizeof(message_header) + SNAPSHOT_MIN_RECORD_SIZE)
+        {
+            break;
+        }
+
+        message_header * header = (message_header *)(data + used);
+        u32 record_capacity = min(room - (u32)sizeof(message_header), (u32)SNAPSHOT_MAX_RECORD_SIZE);
+        write_stream s = WriteStream(data + used + sizeof(message_header), record_capacity);
+
+        SerializeUnsigned(s, baseline_distance, 0, SNAPSHOT_MAX_BASELINE_DISTANCE);
+        if (record_index == 0)
+        {
+            SerializeUnsigned(s, tick, 0, UINT_MAX);
+        }
+
+        u32 entities_in_record = 0;
+        for (; entity_index < SNAPSHOT_MAX_ENTITIES; ++entity_index)
+        {
+            entity_state state = world->entities[entity_index];
+            const entity_state * base_state = base.entities + entity_index;
+            if (EntityStateEqual(&state, base_state))
+            {
+                continue;
+            }
+
+            b32 more = true;
+            u32 index = entity_index;
+            measure_stream measure = {};
+            SerializeEntityEntry(measure, more, index, state, *base_state);
+
+            // room for the entity and the end of the record
+            if (s.bits_written + measure.bits + 1 > s.capacity_bits)
+            {
+                break;
+            }
+
+            SerializeEntityEntry(s, more, index, state, *base_state);
+            next.entities[entity_index] = state;
+            entities_in_record += 1;
+        }
+
+        if (entities_in_record == 0)
+        {
+            // not even one entity fits
+            break;
+        }
+
+        b32 more = false;
+        SerializeBool(s, more);
+        Assert(SerializeOk(s));
+        u32 record_size = s.Flush();
+
+        header->len = (u8)record_size;
+        header->message_type = (u8)(package_type_snapshot | (channel_unreliable << MESSAGE_CHANNEL_SHIFT));
+        header->id = (u8)record_index;
+        header->order = 0;
+
+        used += sizeof(message_header) + record_size;
+        record_index += 1;
+        *message_count += 1;
+        sender->entities_sent += entities_in_record;
+    }
+
+    if (record_index > 0)
+    {
+        u32 slot = seq & (SNAPSHOT_HISTORY - 1);
+        sender->seq[slot] = seq;
+        sender->valid_bit |= ((u32)1 << slot);
+        sender->sent[slot] = next;
+
+        sender->bytes_sent += used;
+        sender->full_sent += (baseline_distance == 0);
+        sender->delta_sent += (baseline_distance != 0);
+    }
+
+    return used;
+}
+
+/* RECEIVER */
+
+void
+SnapshotReceiverInit(snapshot_receiver * receiver)
+{
+    memset(receiver, 0, sizeof(snapshot_receiver));
+}
+
+/* snapshot record of packet seq, false if it can't be decoded and the snapshot of seq is dropped */
+b32
+SnapshotReceiveRecord(snapshot_receiver * receiver, u32 seq, message * record)
+{
+    u32 slot = seq & (SNAPSHOT_HISTORY - 1);
+    u32 slot_bit = ((u32)1 << slot);
+    world_snapshot * snapshot = receiver->received + slot;
+
+    read_stream s = ReadStream(record->data, record->header.len);
+
+    u32 baseline_distance = 0;
+    SerializeUnsigned(s, baseline_distance, 0, SNAPSHOT_MAX_BASELINE_DISTANCE);
+
+    if (record->header.id == 0)
+    {
+        u32 tick = 0;
+        SerializeUnsigned(s, tick, 0, UINT_MAX);
+
+        // first record, the snapshot starts from the baseline
+        u32 baseline_seq = seq - baseline_distance;
+        u32 baseline_slot = baseline_seq & (SNAPSHOT_HISTORY - 1);
+        b32 has_baseline = 
+            (baseline_distance == 0) ||
+            ((receiver->valid_bit & ((u32)1 << baseline_slot)) && receiver->seq[baseline_slot] == baseline_seq);
+
+        if (!SerializeOk(s) || !has_baseline)
+        {
+            receiver->valid_bit &= ~slot_bit;
+            receiver->records_dropped += 1;
+            return false;
+        }
+
+        if (baseline_distance == 0)
+        {
+            *snapshot = snapshot_default;
+        }
+        else if (baseline_slot != slot)
+        {
+            *snapshot = receiver->received[baseline_slot];
+        }
+
+        snapshot->tick = tick;
+        receiver->seq[slot] = seq;
+        receiver->valid_bit |= slot_bit;
+    }
+    else if ((receiver->valid_bit & slot_bit) == 0 || receiver->seq[slot] != seq)
+    {
+        // the first record of the packet didn't make it
+        receiver->records_dropped += 1;
+        return false;
+    }
+
+    b32 more = true;
+    while (more && SerializeOk(s))
+    {
+        u32 index = 0;
+        entity_state state = {};
+        // entity is still at the baseline, each one comes once per packet
+        entity_state baseline_state = {};
+        SerializeBool(s, more);
+        if (more)
+        {
+            SerializeUnsigned(s, index, 0, SNAPSHOT_MAX_ENTITIES - 1);
+            baseline_state = snapshot->entities[index];
+            SerializeEntityDelta(s, state, baseline_state);
+            if (SerializeOk(s))
+            {
+                snapshot->entities[index] = state;
+            }
+        }
+    }
+
+    if (!SerializeOk(s))
+    {
+        receiver->valid_bit &= ~slot_bit;
+        receiver->records_dropped += 1;
+        return false;
+    }
+
+    if (!receiver->has_latest || (i32)(seq - receiver->latest_seq) > 0)
+    {
+        receiver->has_latest = true;
+        receiver->latest_seq = seq;
+    }
+
+    return true;
+}
+
+/* snapshot packet seq carried, 0 if it had none or it couldn't be decoded */
+const world_snapshot *
+SnapshotReceived(snapshot_receiver * receiver, u32 seq)
+{
+    const world_snapshot * received = 0;
+    u32 slot = seq & (SNAPSHOT_HISTORY - 1);
+
+    if ((receiver->valid_bit & ((u32)1 << slot)) &&
+        receiver->seq[slot] == seq)
+    {
+        received = receiver->received + slot;
+    }
+
+    return received;
+}
+
+/* newest snapshot received, 0 if none yet */
+const world_snapshot *
+SnapshotLatest(snapshot_receiver * receiver)
+{
+    const world_snapshot * latest = 0;
+
+    if (receiver->has_latest)
+    {
+        latest = SnapshotReceived(receiver, receiver->latest_seq);
+    }
+
+    return latest;
+}
@@ -0,0 +1,127 @@
+#ifndef UDP_SNAPSHOT_H
+#define UDP_SNAPSHOT_H
+
+#include "protocol.h"
+#include "quantize.h"
+
+/*
+ * World state replication by delta snapshots
+ *
+ * Every data packet to a client can carry the world as the client should
+ * see it. The server remembers, per client, the last SNAPSHOT_HISTORY
+ * snapshots it sent by packet seq. The newest of them the client acked is
+ * the baseline and only what changed against it goes on the wire:
+ *  - entities equal to the baseline are left out
+ *  - every entity sent has a change bit per field, only changed fields follow
+ *  - positions close to the baseline go as a small delta
+ * Entity state is kept quantized (quantize.h), so what the server compares
+ * against the baseline is exactly what the client ends up with.
+ * Without an acked baseline (new client, everything lost for a while) the
+ * baseline is the default state, so a full snapshot is the same encoding.
+ * Bandwidth follows how much of the world changes, not how big it is.
+ *
+ * Snapshots go as package_type_snapshot records in the packet payload, on the
+ * unreliable channel and outside the send queue. A packet that can't fit
+ * every change leaves the rest at the baseline, the history keeps exactly
+ * what was sent so the next delta picks them up.
+ *
+ * Records are bit packed:
+ *   baseline     seq distance back to the baseline, 0 = default state
+ *   tick         first record only, world tick the snapshot was taken at
+ *   per entity   more bit, index, field change bits, changed fields
+ *   end          more bit = 0
+ * message_header.id is the record index within the packet, the first one
+ * starts the client copy of the snapshot from the baseline.
+ */
+
+#define SNAPSHOT_MAX_ENTITIES 64
+// power of 2, every baseline is within the 32 packets the ack bits cover
+#define SNAPSHOT_HISTORY 16
+#define SNAPSHOT_MAX_BASELINE_DISTANCE 31
+
+// snapshot record payload, fits message_header.len
+#define SNAPSHOT_MAX_RECORD_SIZE 255
+// smaller than this left in the packet isn't worth a record
+#define SNAPSHOT_MIN_RECORD_SIZE 8
+
+// world bounds, m, in 1 cm steps
+#define ENTITY_POSITION_XY_MIN -327.68f
+#define ENTITY_POSITION_XY_MAX 327.67f
+#define ENTITY_POSITION_Z_MIN -10.24f
+#define ENTITY_POSITION_Z_MAX 10.23f
+#define ENTITY_POSITION_PRECISION 0.01f
+// a move within this many steps of the baseline goes as a delta
+#define ENTITY_POSITION_SMALL_DELTA 127
+// m/s
+#define ENTITY_VELOCITY_MAX 20.0f
+#define ENTITY_VELOCITY_PRECISION 0.01f
+// smallest three, 32 bits
+#define ENTITY_ORIENTATION_BITS 10
+#define ENTITY_HEALTH_MAX 255
+
+#define ENTITY_FLAG_ALIVE 0x01
+#define ENTITY_FLAG_VISIBLE 0x02
+#define ENTITY_FLAG_COUNT 2
+
+/* as replicated, 32 bytes without padding so equal states compare equal */
+struct entity_state
+{
+    // quantizer steps, x y z
+    u32 position[3];
+    u32 velocity[3];
+    // smallest three
+    u32 orientation;
+    u16 health;
+    // ENTITY_FLAG_*
+    u16 flags;
+};
+
+/* the same unquantized, one array per component for the batch quantizers */
+struct entity_arrays
+{
+    // m
+    r32 position[3][SNAPSHOT_MAX_ENTITIES];
+    // m/s
+    r32 velocity[3][SNAPSHOT_MAX_ENTITIES];
+    // unit quaternion x y z w
+    r32 orientation[4][SNAPSHOT_MAX_ENTITIES];
+};
+
+struct world_snapshot
+{
+    entity_state entities[SNAPSHOT_MAX_ENTITIES];
+    // server world tick, maps to client time through clock_sync.h
+    u32 tick;
+};
+
+/* server side, one per client */
+struct snapshot_sender
+{
+    // what the client has if packet seq got there, by seq & (SNAPSHOT_HISTORY - 1)
+    u32 seq[SNAPSHOT_HISTORY];
+    u32 valid_bit;
+    world_snapshot sent[SNAPSHOT_HISTORY];
+
+    // stats
+    u32 full_sent;
+    u32 delta_sent;
+    u32 bytes_sent;
+    u32 entities_sent;
+};
+
+/* client side */
+struct snapshot_receiver
+{
+    u32 seq[SNAPSHOT_HISTORY];
+    u32 valid_bit;
+    world_snapshot received[SNAPSHOT_HISTORY];
+
+    // newest snapshot complete
+    b32 has_latest;
+    u32 latest_seq;
+
+    // stats
+    u32 records_dropped;
+};
+
+#endif
@@ -0,0 +1,159 @@
+/*
+ * Server clock estimate, clock_sync.h
+ *  - samples that can't be right are left out
+ *  - ticks map to client time, an older reply doesn't move the tick back
+ *  - a simulated server clock off the client one by an offset and a drift.
+ *    Requests go every CLOCK_SYNC_INTERVAL_NS, each way takes a delay and
+ *    the datagram waits in the socket for the other end's loop, both run
+ *    at 60 Hz. Stamped by the kernel when they get in, on loopback the
+ *    estimate is within a ms and the drift is found; stamped when the loop
+ *    reads them (no kernel stamps, win32) the socket wait is error min rtt
+ *    can only partly filter, within half a loop: about 4.4 ms on loopback
+ *    and 6 ms on the lan run
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "platform.h"
+#include "clock_sync.h"
+
+#define SIM_LOOP_NS (NS_PER_SECOND / 60)
+#define SIM_SAMPLES 400
+
+struct sim_clocks
+{
+    // server = client * (1 + drift) + offset
+    i64 offset_ns;
+    r64 drift;
+};
+
+real_time
+SimServerTime(sim_clocks * clocks, real_time client)
+{
+    return (real_time)((i64)client + clocks->offset_ns + (i64)(clocks->drift * (r64)client));
+}
+
+u64
+RandomNs(u64 max_ns)
+{
+    return (u64)(((r64)rand() / (r64)RAND_MAX) * (r64)max_ns);
+}
+
+/* worst error of the estimate over the last half of the run, ns */
+i64
+Simulate(const char * name, sim_clocks * clocks, u64 min_delay_ns, u64 max_delay_ns, b32 kernel_stamps)
+{
+    clock_sync sync;
+    ClockSyncInit(&sync);
+
+    real_time client = 10 * NS_PER_SECOND;
+    i64 worst_error = 0;
+    for (u32 sample = 0; sample < SIM_SAMPLES; ++sample)
+    {
+        real_time t0 = client;
+        // waits for the server loop to read it, the reply waits for the client loop
+        real_time server_arrival = t0 + min_delay_ns + RandomNs(max_delay_ns - min_delay_ns);
+        real_time server_read = server_arrival + RandomNs(SIM_LOOP_NS);
+        real_time server_send = server_read + RandomNs(SIM_LOOP_NS);
+        real_time client_arrival = server_send + min_delay_ns + RandomNs(max_delay_ns - min_delay_ns);
+        real_time client_read = client_arrival + RandomNs(SIM_LOOP_NS);
+
+        real_time t1 = SimServerTime(clocks, kernel_stamps ? server_arrival : server_read);
+        real_time t3 = kernel_stamps ? client_arrival : client_read;
+        ClockSyncAddSample(&sync, t0, t1, SimServerTime(clocks, server_send), t3);
+
+        if (sample >= SIM_SAMPLES / 2)
+        {
+            i64 error = (i64)(ClockSyncServerTime(&sync, t3) - SimServerTime(clocks, t3));
+            worst_error = max(worst_error, error < 0 ? -error : error);
+
+            // and back
+            i64 back = (i64)(ClockSyncLocalTime(&sync, SimServerTime(clocks, t3)) - t3);
+            Assert(back < 1000 + worst_error && back > -1000 - worst_error);
+        }
+
+        client += CLOCK_SYNC_INTERVAL_NS;
+    }
+
+    printf("%-30s offset %+8.3f ms drift %+6.1f ppm: estimate %+8.3f ms %+6.1f ppm, rtt %.3f ms, worst error %.3f ms\n",
+           name, (r64)clocks->offset_ns / NS_PER_MS, clocks->drift * 1e6,
+           (r64)sync.reference_offset_ns / NS_PER_MS, sync.drift * 1e6,
+           (r64)sync.rtt_ns / NS_PER_MS, (r64)worst_error / NS_PER_MS);
+
+    return worst_error;
+}
+
+void
+TestReject()
+{
+    clock_sync sync;
+    ClockSyncInit(&sync);
+
+    // held longer than the round trip: a reply to another request
+    Assert(!ClockSyncAddSample(&sync, 1000, 5000, 9000, 3000));
+    // reply before the request
+    Assert(!ClockSyncAddSample(&sync, 5000, 1000, 1200, 4000));
+    Assert(sync.samples_rejected == 2 && !sync.synced);
+
+    Assert(ClockSyncAddSample(&sync, 1000, 501000, 502000, 4000));
+    Assert(sync.synced);
+    Assert(sync.reference_offset_ns == 499000);
+    Assert(sync.rtt_ns == 2000);
+}
+
+void
+TestTicks()
+{
+    clock_sync sync;
+    ClockSyncInit(&sync);
+    sync.tick_ns = NS_PER_SECOND / 60;
+
+    // server 1 s ahead, tick 600 started 2 ms before the reply was sent
+    udp_time_reply reply;
+    reply.client_time = 100 * NS_PER_MS;
+    reply.server_receive_time = 1100 * NS_PER_MS + 100000;
+    reply.server_hold_ns = 1000000;
+    reply.tick = 600;
+    reply.since_tick_ns = 2000000;
+    ClockSyncOnReply(&sync, &reply, 100 * NS_PER_MS + 1200000);
+    Assert(sync.tick == 600);
+
+    // tick 600 started at server 1101.1 - 2 ms, 1099.1 ms server, 99.1 ms client
+    real_time tick_local = ClockSyncTickLocalTime(&sync, 600);
+    Assert(tick_local == 99100000);
+    Assert(ClockSyncTickLocalTime(&sync, 660) == tick_local + 60 * sync.tick_ns);
+    Assert(ClockSyncTickLocalTime(&sync, 540) == tick_local - 60 * sync.tick_ns);
+
+    // an older reply got in late, the tick doesn't go back
+    reply.tick = 590;
+    ClockSyncOnReply(&sync, &reply, 100 * NS_PER_MS + 1200000);
+    Assert(sync.tick == 600);
+
+    printf("ticks: tick 600 at %.1f ms client time\n", (r64)tick_local / NS_PER_MS);
+}
+
+int
+main()
+{
+    srand(7);
+
+    TestReject();
+    TestTicks();
+
+    sim_clocks loopback = { 0, 0.0 };
+    sim_clocks drifting = { -1234567890, 100e-6 };
+    sim_clocks lan = { 987654321, -50e-6 };
+
+    Assert(Simulate("loopback", &loopback, 30000, 30000, true) < (i64)NS_PER_MS);
+    Assert(Simulate("loopback, drifting", &drifting, 30000, 30000, true) < (i64)NS_PER_MS);
+    Assert(Simulate("lan 0.2-2 ms, drifting", &lan, 200000, 2000000, true) < 2 * (i64)NS_PER_MS);
+
+    // the loops' socket wait counts one way only. What peers without kernel stamps get
+    // (win32 always): min rtt filtering keeps it under half a loop, a few ms
+    i64 loopback_read = Simulate("loopback, stamped on read", &loopback, 30000, 30000, false);
+    i64 lan_read = Simulate("lan, stamped on read", &lan, 200000, 2000000, false);
+    Assert(loopback_read > (i64)NS_PER_MS && loopback_read < (i64)SIM_LOOP_NS / 2);
+    Assert(lan_read > 2 * (i64)NS_PER_MS && lan_read < (i64)SIM_LOOP_NS / 2);
+
+    return 0;
+}
@@ -0,0 +1,265 @@
+/*
+ * Payload compression benchmark and dictionary trainer.
+ * Server traffic comes from test_traffic.h. One capture trains
+ * dictionaries, another one with a different seed measures them:
+ *  - bytes saved without a dictionary, with trained ones of a few sizes and
+ *    with the one built in (compress_dictionary.h)
+ *  - ns per packet to compress and decompress
+ * "test_compress train" writes a new compress_dictionary.h to stdout.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "channel.cpp"
+#include "snapshot.cpp"
+#include "compress.cpp"
+#include "test_traffic.h"
+
+#define TRAIN_DICTIONARY_SIZE 1024
+#define TRAIN_DMER 8
+#define TRAIN_SEGMENT 32
+#define TRAIN_HASH_BITS 20
+
+#define BENCH_ROUNDS 20
+
+/* TRAINER */
+
+inline u32
+TrainHash(const u8 * at)
+{
+    u64 value;
+    memcpy(&value, at, sizeof(value));
+
+    return (u32)((value * 0x9E3779B97F4A7C15ull) >> (64 - TRAIN_HASH_BITS));
+}
+
+/*
+ * Cover style: segments of the samples are scored by how many times their
+ * dmers show up across all samples, the best goes in and its dmers stop
+ * counting. The best segments end up last, closest to the packets.
+ * Returns dictionary size
+ */
+u32
+TrainDictionary(capture * c, u8 * dictionary, u32 capacity)
+{
+    u32 * frequency = (u32 *)calloc((size_t)1 << TRAIN_HASH_BITS, sizeof(u32));
+
+    for (u32 packet_index = 0; packet_index < c->count; ++packet_index)
+    {
+        const u8 * sample = c->data + c->offset[packet_index];
+        for (u32 at = 0; at + TRAIN_DMER <= c->size[packet_index]; ++at)
+        {
+            frequency[TrainHash(sample + at)] += 1;
+        }
+    }
+
+    u32 size = 0;
+    while (size + TRAIN_SEGMENT <= capacity)
+    {
+        u32 best_score = 0;
+        const u8 * best = 0;
+
+        for (u32 packet_index = 0; packet_index < c->count; ++packet_index)
+        {
+            const u8 * sample = c->data + c->offset[packet_index];
+            u32 sample_size = c->size[packet_index];
+            for (u32 at = 0; at + TRAIN_SEGMENT <= sample_size; ++at)
+            {
+                u32 score = 0;
+                for (u32 dmer = 0; dmer + TRAIN_DMER <= TRAIN_SEGMENT; ++dmer)
+                {
+                    score += frequency[TrainHash(sample + at + dmer)];
+                }
+                if (score > best_score)
+                {
+                    best_score = score;
+                    best = sample + at;
+                }
+            }
+        }
+
+        if (!best)
+        {
+            break;
+        }
+
+        for (u32 dmer = 0; dmer + TRAIN_DMER <= TRAIN_SEGMENT; ++dmer)
+        {
+            frequency[TrainHash(best + dmer)] = 0;
+        }
+
+        size += TRAIN_SEGMENT;
+        memcpy(dictionary + capacity - size, best, TRAIN_SEGMENT);
+    }
+
+    free(frequency);
+
+    memmove(dictionary, dictionary + capacity - size, size);
+
+    return size;
+}
+
+/* BENCHMARK */
+
+struct bench_result
+{
+    u64 raw_bytes;
+    u64 wire_bytes;
+    u32 compressed;
+    r64 compress_ns;
+    r64 decompress_ns;
+};
+
+bench_result
+BenchDictionary(capture * c, const compress_dictionary * dict, real_time clock_freq)
+{
+    bench_result result = {};
+    static u8 compressed[CAPTURE_MAX_PACKETS][PACKET_PAYLOAD_SIZE];
+    static u32 compressed_size[CAPTURE_MAX_PACKETS];
+
+    real_time start = GetRealTime();
+    for (u32 round = 0; round < BENCH_ROUNDS; ++round)
+    {
+        for (u32 packet_index = 0; packet_index < c->count; ++packet_index)
+        {
+            u32 size = c->size[packet_index];
+            compressed_size[packet_index] =
+                (size >= COMPRESS_MIN_PAYLOAD_SIZE) ?
+                Compress(dict, c->data + c->offset[packet_index], size, compressed[packet_index], size - 1) : 0;
+        }
+    }
+    result.compress_ns = GetTimeDiff(GetRealTime(), start, clock_freq) * 1000000.0 / ((r64)BENCH_ROUNDS * c->count);
+
+    u8 decompressed[PACKET_MAX_PAYLOAD_SIZE];
+    u32 decompressed_count = 0;
+    start = GetRealTime();
+    for (u32 round = 0; round < BENCH_ROUNDS; ++round)
+    {
+        for (u32 packet_index = 0; packet_index < c->count; ++packet_index)
+        {
+            if (compressed_size[packet_index])
+            {
+                u32 size = 0;
+                b32 ok = Decompress(dict, compressed[packet_index], compressed_size[packet_index],
+                                    decompressed, sizeof(decompressed), &size);
+                Assert(ok && size == c->size[packet_index]);
+                decompressed_count += 1;
+            }
+        }
+    }
+    r64 decompress_ms = GetTimeDiff(GetRealTime(), start, clock_freq);
+    result.decompress_ns = decompressed_count ? decompress_ms * 1000000.0 / decompressed_count : 0.0;
+
+    for (u32 packet_index = 0; packet_index < c->count; ++packet_index)
+    {
+        u32 size = c->size[packet_index];
+        u32 on_wire = compressed_size[packet_index] ? compressed_size[packet_index] : size;
+        result.raw_bytes += size;
+        result.wire_bytes += on_wire;
+        result.compressed += (compressed_size[packet_index] != 0);
+
+        if (compressed_size[packet_index])
+        {
+            u32 decoded_size = 0;
+            Decompress(dict, compressed[packet_index], on_wire, decompressed, sizeof(decompressed), &decoded_size);
+            Assert(decoded_size == size && memcmp(decompressed, c->data + c->offset[packet_index], size) == 0);
+        }
+    }
+
+    return result;
+}
+
+void
+PrintResult(const char * name, u32 dictionary_size, capture * c, bench_result * r)
+{
+    r64 saved = 100.0 * (1.0 - (r64)r->wire_bytes / (r64)r->raw_bytes);
+    printf("%-10s %6u %9.1f %9.1f %7.1f%% %7.1f%% %10.0f %12.0f\n",
+           name, dictionary_size,
+           (r64)r->raw_bytes / c->count, (r64)r->wire_bytes / c->count,
+           100.0 * r->compressed / c->count, saved, r->compress_ns, r->decompress_ns);
+}
+
+/* a truncated or corrupted block never reads or writes out of bounds */
+void
+TestCorrupt(capture * c, const compress_dictionary * dict)
+{
+    u32 rejected = 0;
+    for (u32 packet_index = 0; packet_index < c->count && packet_index < 2000; ++packet_index)
+    {
+        u32 size = c->size[packet_index];
+        u8 compressed[PACKET_PAYLOAD_SIZE];
+        u32 compressed_size = (size >= COMPRESS_MIN_PAYLOAD_SIZE) ?
+            Compress(dict, c->data + c->offset[packet_index], size, compressed, size - 1) : 0;
+        if (!compressed_size)
+        {
+            continue;
+        }
+
+        compressed[rand() % compressed_size] ^= (u8)(1 + rand() % 255);
+        u8 out[PACKET_MAX_PAYLOAD_SIZE];
+        u32 out_size = 0;
+        rejected += !Decompress(dict, compressed, compressed_size, out, sizeof(out), &out_size);
+        rejected += !Decompress(dict, compressed, rand() % compressed_size, out, sizeof(out), &out_size);
+    }
+    printf("corrupted blocks: %u rejected, the rest decoded within bounds\n", rejected);
+}
+
+int
+main(int argc, char ** argv)
+{
+    TimeInit(false);
+    real_time clock_freq = GetClockResolution();
+
+    static capture train;
+    static capture test;
+    train.data = (u8 *)malloc((size_t)CAPTURE_MAX_PACKETS * PACKET_PAYLOAD_SIZE);
+    test.data = (u8 *)malloc((size_t)CAPTURE_MAX_PACKETS * PACKET_PAYLOAD_SIZE);
+    CaptureTraffic(&train, 1);
+    CaptureTraffic(&test, 2);
+
+    if (argc > 1 && strcmp(argv[1], "train") == 0)
+    {
+        static u8 dictionary[TRAIN_DICTIONARY_SIZE];
+        u32 size = TrainDictionary(&train, dictionary, sizeof(dictionary));
+
+        printf("#ifndef UDP_COMPRESS_DICTIONARY_H\n#define UDP_COMPRESS_DICTIONARY_H\n\n");
+        printf("#include \"platform.h\"\n\n");
+        printf("// generated by test_compress train, don't edit\n");
+        printf("static const u8 compress_dictionary_data[%u] = \n{", size);
+        for (u32 i = 0; i < size; ++i)
+        {
+            printf("%s0x%02x,", (i % 16) ? " " : "\n    ", dictionary[i]);
+        }
+        printf("\n};\n\n#endif\n");
+
+        return 0;
+    }
+
+    printf("%u packets, %.1f KB, %u sessions of the demo world at %.0f%% loss\n",
+           test.count, test.total_bytes / 1024.0, CAPTURE_SESSIONS, CAPTURE_LOSS_RATE * 100.0f);
+    printf("%-10s %6s %9s %9s %8s %8s %10s %12s\n",
+           "", "dict B", "raw B", "wire B", "packed", "saved", "comp ns", "decomp ns");
+
+    bench_result none = BenchDictionary(&test, 0, clock_freq);
+    PrintResult("none", 0, &test, &none);
+
+    u32 sizes[] = { 256, 1024, 4096 };
+    for (u32 size_index = 0; size_index < ArrayCount(sizes); ++size_index)
+    {
+        static u8 dictionary[4096];
+        static compress_dictionary trained;
+        u32 size = TrainDictionary(&train, dictionary, sizes[size_index]);
+        CompressDictionaryInit(&trained, dictionary, size);
+
+        bench_result r = BenchDictionary(&test, &trained, clock_freq);
+        PrintResult("trained", size, &test, &r);
+    }
+
+    CompressInit();
+    bench_result built_in = BenchDictionary(&test, &compress_packet_dictionary, clock_freq);
+    PrintResult("built in", compress_packet_dictionary.size, &test, &built_in);
+
+    TestCorrupt(&test, &compress_packet_dictionary);
+
+    return 0;
+}
@@ -0,0 +1,220 @@
+/*
+ * Congestion control, congestion.h
+ *  - loss from ack_bit gaps: lost once CONGESTION_LOSS_THRESHOLD newer
+ *    packets are acked, reordering under it is not a loss, a loss counts once
+ *    whether found by the gaps or when its slot is reused
+ *  - AIMD driven by acks and losses: clean rounds grow the byte rate by a
+ *    minimum packet, loss or queueing delay backs it off, the rate stays
+ *    between the min and max clamps and the packet rate only goes down
+ *    once packets are at their minimum size
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "platform.h"
+#include "congestion.h"
+
+#define TEST_MIN_PPS 2.0f
+#define TEST_MAX_PPS 60.0f
+#define TEST_MAX_BYTES_PER_SEND 500
+#define TEST_RTT_MS 20.0f
+
+struct sim_sender
+{
+    congestion_control cc;
+    u32 seq;
+    // bit per seq & 31, 1 once acked
+    u32 acked_bit;
+};
+
+void
+SimInit(sim_sender * sender)
+{
+    CongestionInit(&sender->cc, TEST_MIN_PPS, TEST_MAX_PPS, TEST_MAX_BYTES_PER_SEND);
+    sender->seq = 0;
+    // nothing sent yet, every slot counts as acked
+    sender->acked_bit = ~0u;
+}
+
+u32
+SimSend(sim_sender * sender)
+{
+    sender->seq += 1;
+    CongestionOnPacketSent(&sender->cc, sender->seq, sender->acked_bit);
+    sender->acked_bit &= ~((u32)1 << (sender->seq & 31));
+
+    return sender->seq;
+}
+
+/* ack of seq got in, returns losses it revealed */
+u32
+SimAck(sim_sender * sender, u32 seq, r32 rtt_ms)
+{
+    u32 slot_bit = (u32)1 << (seq & 31);
+    if (!(sender->acked_bit & slot_bit))
+    {
+        sender->acked_bit |= slot_bit;
+        CongestionOnPacketAcked(&sender->cc, rtt_ms);
+    }
+
+    return CongestionDetectLosses(&sender->cc, sender->seq, sender->acked_bit);
+}
+
+/* a round of CONGESTION_ROUND_EVENTS packets, the first lost_count never acked */
+void
+SimRound(sim_sender * sender, u32 lost_count, r32 rtt_ms)
+{
+    u32 first = sender->seq + 1;
+    for (u32 i = 0; i < CONGESTION_ROUND_EVENTS; ++i)
+    {
+        SimSend(sender);
+    }
+
+    u32 lost = 0;
+    for (u32 i = lost_count; i < CONGESTION_ROUND_EVENTS; ++i)
+    {
+        lost += SimAck(sender, first + i, rtt_ms);
+    }
+    Assert(lost == lost_count);
+
+    CongestionUpdate(&sender->cc);
+    Assert(sender->cc.round_acked == 0 && sender->cc.round_lost == 0);
+}
+
+void
+TestLossDetection()
+{
+    static sim_sender sender;
+    SimInit(&sender);
+    congestion_control * cc = &sender.cc;
+
+    for (u32 i = 0; i < 10; ++i)
+    {
+        SimSend(&sender);
+    }
+
+    // 5 missing, 2 newer acked is reordering
+    for (u32 seq = 1; seq <= 7; ++seq)
+    {
+        Assert(seq == 5 || SimAck(&sender, seq, TEST_RTT_MS) == 0);
+    }
+    Assert(cc->round_lost == 0);
+
+    // the 3rd newer one makes it a loss, once
+    Assert(SimAck(&sender, 8, TEST_RTT_MS) == 1);
+    Assert(SimAck(&sender, 9, TEST_RTT_MS) == 0);
+    Assert(cc->round_lost == 1 && cc->round_acked == 8);
+
+    // its ack late after all: was spurious, but nothing is taken back or counted again
+    Assert(SimAck(&sender, 5, TEST_RTT_MS) == 0);
+    Assert(cc->round_lost == 1);
+
+    // 12 and 13 lost, 14 acked: too few newer to tell yet
+    for (u32 seq = 11; seq <= 14; ++seq)
+    {
+        SimSend(&sender);
+    }
+    Assert(SimAck(&sender, 10, TEST_RTT_MS) == 0);
+    Assert(SimAck(&sender, 11, TEST_RTT_MS) == 0);
+    Assert(SimAck(&sender, 14, TEST_RTT_MS) == 0);
+    Assert(cc->round_lost == 1);
+
+    // the tail: nothing newer acked ever, found when the slots are reused.
+    // 12 and 13 by the gaps first, once the packets after them are acked
+    u32 lost_by_gaps = 0;
+    while (sender.seq < 12 + 32)
+    {
+        u32 seq = SimSend(&sender);
+        if (seq >= 15 && seq < 30)
+        {
+            lost_by_gaps += SimAck(&sender, seq, TEST_RTT_MS);
+        }
+    }
+    Assert(lost_by_gaps == 2);
+    Assert(cc->round_lost == 3);
+
+    // 30 to 43 never acked, reusing their slots finds them
+    u32 before_reuse = cc->round_lost;
+    while (sender.seq < 43 + 32)
+    {
+        SimSend(&sender);
+    }
+    Assert(cc->round_lost == before_reuse + (43 - 30 + 1));
+
+    printf("loss detection: lost after %u newer acks, once, tail losses at slot reuse\n", CONGESTION_LOSS_THRESHOLD);
+}
+
+void
+TestAimd()
+{
+    static sim_sender sender;
+    SimInit(&sender);
+    congestion_control * cc = &sender.cc;
+
+    r32 max_bytes_per_second = TEST_MAX_PPS * TEST_MAX_BYTES_PER_SEND;
+    r32 min_bytes_per_second = TEST_MIN_PPS * CONGESTION_MIN_BYTES_PER_SEND;
+
+    // starts at the max, clean rounds don't take it over
+    Assert(cc->bytes_per_second == max_bytes_per_second);
+    SimRound(&sender, 0, TEST_RTT_MS);
+    Assert(cc->bytes_per_second == max_bytes_per_second);
+    Assert(cc->packets_per_second == TEST_MAX_PPS && cc->bytes_per_send == TEST_MAX_BYTES_PER_SEND);
+
+    // a lost packet backs off multiplicatively
+    SimRound(&sender, 1, TEST_RTT_MS);
+    r32 backed_off = max_bytes_per_second * CONGESTION_BACKOFF;
+    Assert(cc->bytes_per_second == backed_off && cc->backoff_count == 1);
+    Assert(cc->loss_rate > 0.0f);
+    // packets get smaller first, the packet rate stays
+    Assert(cc->packets_per_second == TEST_MAX_PPS && cc->bytes_per_send < TEST_MAX_BYTES_PER_SEND);
+
+    // a clean round grows it by a minimum packet
+    SimRound(&sender, 0, TEST_RTT_MS);
+    Assert(cc->bytes_per_second == backed_off + CONGESTION_MIN_BYTES_PER_SEND);
+
+    // queueing delay over the threshold backs off without loss
+    r32 before_delay = cc->bytes_per_second;
+    SimRound(&sender, 0, TEST_RTT_MS + 2.0f * CONGESTION_DELAY_THRESHOLD_MS);
+    Assert(cc->bytes_per_second == before_delay * CONGESTION_BACKOFF && cc->backoff_count == 2);
+    Assert(cc->queue_delay_ms > CONGESTION_DELAY_THRESHOLD_MS);
+
+    // heavy loss, down to the min clamp. Packets hit their minimum size before the rate goes
+    b32 shrank_packets_first = true;
+    for (u32 round = 0; round < 64; ++round)
+    {
+        SimRound(&sender, 2, TEST_RTT_MS);
+        if (cc->packets_per_second < TEST_MAX_PPS)
+        {
+            shrank_packets_first = shrank_packets_first && (cc->bytes_per_send == CONGESTION_MIN_BYTES_PER_SEND);
+        }
+        Assert(cc->bytes_per_second >= min_bytes_per_second);
+    }
+    Assert(shrank_packets_first);
+    Assert(cc->bytes_per_second == min_bytes_per_second);
+    Assert(cc->packets_per_second == TEST_MIN_PPS && cc->bytes_per_send == CONGESTION_MIN_BYTES_PER_SEND);
+    Assert(cc->loss_rate > 0.2f);
+
+    // clean again, back up to the max clamp a minimum packet a round
+    u32 rounds = 0;
+    while (cc->bytes_per_second < max_bytes_per_second)
+    {
+        r32 before = cc->bytes_per_second;
+        SimRound(&sender, 0, TEST_RTT_MS);
+        Assert(cc->bytes_per_second == min(before + CONGESTION_MIN_BYTES_PER_SEND, max_bytes_per_second));
+        rounds += 1;
+    }
+    Assert(cc->packets_per_second == TEST_MAX_PPS && cc->bytes_per_send == TEST_MAX_BYTES_PER_SEND);
+    Assert(cc->loss_rate < 0.01f);
+
+    printf("aimd: backs off to %.0f b/s (%.0f pps x %u b) under loss, %u clean rounds back to %.0f b/s\n",
+           min_bytes_per_second, TEST_MIN_PPS, CONGESTION_MIN_BYTES_PER_SEND, rounds, max_bytes_per_second);
+}
+
+int
+main()
+{
+    TestLossDetection();
+    TestAimd();
+
+    return 0;
+}
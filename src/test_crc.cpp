@@ -0,0 +1,173 @@
+/*
+ * CRC32C and the datagram trailer, crc32c.cpp
+ *  - check value of the standard and SSE4.2 against the table version over
+ *    every size and alignment
+ *  - sealed datagrams: flipped bits, cuts and another salt never check
+ *  - ns per packet of both versions at a few packet sizes
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "platform.h"
+#include "crc32c.cpp"
+
+#define BENCH_ROUNDS 200000
+
+void
+TestCrc()
+{
+    const char * check = "123456789";
+    u32 software = Crc32cSoftware(0, (const u8 *)check, 9);
+    Assert(software == 0xE3069283);
+
+    b32 sse42 = GetCpuFeatures().sse42;
+    if (sse42)
+    {
+        Assert(Crc32cSSE42(0, (const u8 *)check, 9) == 0xE3069283);
+    }
+
+    static u8 data[2048];
+    for (u32 i = 0; i < sizeof(data); ++i)
+    {
+        data[i] = (u8)rand();
+    }
+
+    for (u32 offset = 0; offset < 8; ++offset)
+    {
+        for (u32 size = 0; size <= 600; ++size)
+        {
+            u32 expected = Crc32cSoftware(0, data + offset, size);
+            if (sse42)
+            {
+                Assert(Crc32cSSE42(0, data + offset, size) == expected);
+            }
+
+            // chained over any split, the same as in one go
+            u32 split = size / 3;
+            Assert(Crc32c(Crc32c(0, data + offset, split), data + offset + split, size - split) == expected);
+        }
+    }
+
+    printf("crc32c: check value ok, sse4.2 %s\n", sse42 ? "matches the table version" : "not available");
+}
+
+void
+TestSeal()
+{
+    u32 flips_caught = 0;
+    u32 cuts_caught = 0;
+    u32 salts_caught = 0;
+
+    for (u32 round = 0; round < 20000; ++round)
+    {
+        u8 datagram[UDP_DATAGRAM_PMTU_MAX_SIZE];
+        u32 size = 4 + rand() % 480;
+        for (u32 i = 0; i < size; ++i)
+        {
+            datagram[i] = (u8)rand();
+        }
+
+        u32 salt = (u32)rand() * 65599u + (u32)rand();
+        b32 with_salt = round & 1;
+        u32 sealed = PacketSeal(datagram, size, salt, with_salt);
+        Assert(sealed == size + (with_salt ? PACKET_SALT_SIZE : 0) + PACKET_CHECK_SIZE);
+
+        i32 checked = (i32)sealed;
+        u32 wire_salt = 0;
+        b32 ok = with_salt ? PacketCheckSalted(datagram, &checked, &wire_salt) : PacketCheck(datagram, &checked, salt);
+        Assert(ok && (u32)checked == size && (!with_salt || wire_salt == salt));
+
+        // a bit or two flipped anywhere
+        u8 corrupted[UDP_DATAGRAM_PMTU_MAX_SIZE];
+        memcpy(corrupted, datagram, sealed);
+        u32 bit = rand() % (sealed * 8);
+        corrupted[bit / 8] ^= (u8)(1 << (bit % 8));
+        if (round & 2)
+        {
+            bit = rand() % (sealed * 8);
+            corrupted[bit / 8] ^= (u8)(1 << (bit % 8));
+        }
+        checked = (i32)sealed;
+        if (memcmp(corrupted, datagram, sealed) != 0)
+        {
+            ok = with_salt ? PacketCheckSalted(corrupted, &checked, &wire_salt) : PacketCheck(corrupted, &checked, salt);
+            Assert(!ok);
+            flips_caught += 1;
+        }
+
+        // cut short
+        checked = (i32)(rand() % sealed);
+        ok = with_salt ? PacketCheckSalted(datagram, &checked, &wire_salt) : PacketCheck(datagram, &checked, salt);
+        Assert(!ok);
+        cuts_caught += 1;
+
+        // sealed for another session
+        if (!with_salt)
+        {
+            checked = (i32)sealed;
+            Assert(!PacketCheck(datagram, &checked, salt ^ (1u + (u32)rand())));
+            salts_caught += 1;
+        }
+    }
+
+    printf("trailer: %u bit flips, %u cuts and %u other salts rejected\n", flips_caught, cuts_caught, salts_caught);
+}
+
+void
+Bench(real_time clock_freq)
+{
+    static u8 data[UDP_DATAGRAM_PMTU_MAX_SIZE];
+    for (u32 i = 0; i < sizeof(data); ++i)
+    {
+        data[i] = (u8)rand();
+    }
+
+    b32 sse42 = GetCpuFeatures().sse42;
+    u32 sizes[] = { 16, 64, 128, 508, 1472 };
+    volatile u32 sink = 0;
+
+    printf("%-8s %12s %12s %10s\n", "bytes", "table ns", "sse4.2 ns", "GB/s");
+    for (u32 size_index = 0; size_index < ArrayCount(sizes); ++size_index)
+    {
+        u32 size = sizes[size_index];
+        u32 crc = 0;
+
+        real_time start = GetRealTime();
+        for (u32 round = 0; round < BENCH_ROUNDS; ++round)
+        {
+            crc = Crc32cSoftware(crc, data, size);
+        }
+        r64 software_ns = GetTimeDiff(GetRealTime(), start, clock_freq) * 1000000.0 / BENCH_ROUNDS;
+        sink += crc;
+
+        r64 sse42_ns = 0.0;
+        if (sse42)
+        {
+            start = GetRealTime();
+            for (u32 round = 0; round < BENCH_ROUNDS; ++round)
+            {
+                crc = Crc32cSSE42(crc, data, size);
+            }
+            sse42_ns = GetTimeDiff(GetRealTime(), start, clock_freq) * 1000000.0 / BENCH_ROUNDS;
+            sink += crc;
+        }
+
+        r64 best_ns = sse42 ? sse42_ns : software_ns;
+        printf("%-8u %12.1f %12.1f %10.2f\n", size, software_ns, sse42_ns, size / best_ns);
+    }
+}
+
+int
+main()
+{
+    TimeInit(false);
+    real_time clock_freq = GetClockResolution();
+
+    Crc32cInit();
+
+    TestCrc();
+    TestSeal();
+    Bench(clock_freq);
+
+    return 0;
+}
@@ -0,0 +1,605 @@
+/*
+ * Packet encryption, crypto.cpp
+ *  - RFC 8439 vectors: block function, Poly1305, AEAD
+ *  - GCM spec vectors for AES-256, table and AES-NI versions
+ *  - RFC 7748 X25519 vectors, both ends of an exchange get the same keys,
+ *    low order keys refused, key exchange datagrams never read as packets
+ *  - AVX2 and AES-NI against the portable code one packet at a time, every
+ *    batch size, ciphers mixed and packet sizes that don't fill a block
+ *  - a packet of either cipher opens when the other is tried first
+ *  - flipped bits in header, payload, counter and tag never open
+ *  - ns per packet sealed and opened with each cipher and version, at fixed
+ *    sizes and over the server's payload sizes (test_traffic.h), and how
+ *    many clients at 30 Hz both ways that leaves one core
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "channel.cpp"
+#include "snapshot.cpp"
+#include "crypto.cpp"
+#include "test_traffic.h"
+
+#define BENCH_PACKETS 4096
+#define BENCH_ROUNDS 40
+#define BENCH_TICK_HZ 30
+
+void
+FromHex(const char * hex, u8 * out)
+{
+    for (u32 i = 0; hex[2 * i]; ++i)
+    {
+        u32 byte;
+        sscanf(hex + 2 * i, "%2x", &byte);
+        out[i] = (u8)byte;
+    }
+}
+
+void
+TestVectors()
+{
+    // 2.3.2
+    u8 key[32];
+    u8 nonce[12];
+    u8 block[64];
+    u8 expected[64];
+    for (u32 i = 0; i < 32; ++i)
+    {
+        key[i] = (u8)i;
+    }
+    FromHex("000000090000004a00000000", nonce);
+    FromHex("10f1e7e4d13b5915500fdd1fa32071c4c7d1f4c733c068030422aa9ac3d46c4e"
+            "d2826446079faa0914c2d705d98b02a2b5129cd1de164eb9cbd083e8a2503c4e", expected);
+    ChaCha20Block(key, nonce, 1, block);
+    Assert(memcmp(block, expected, 64) == 0);
+
+    // 2.5.2
+    const char * text = "Cryptographic Forum Research Group";
+    u8 poly_key[32];
+    u8 tag[16];
+    FromHex("85d6be7857556d337f4452fe42d506a80103808afb0db2fd4abff6af4149f51b", poly_key);
+    FromHex("a8061dc1305136c6c22b8baf0c0127a9", expected);
+    poly1305 p;
+    Poly1305Init(&p, poly_key);
+    u32 text_size = (u32)strlen(text);
+    u32 whole = text_size & ~15u;
+    Poly1305Blocks(&p, (const u8 *)text, whole);
+    u8 last[16] = {};
+    memcpy(last, text + whole, text_size - whole);
+    last[text_size - whole] = 1;
+    Poly1305Blocks(&p, last, 16, 0);
+    Poly1305Finish(&p, tag);
+    Assert(memcmp(tag, expected, 16) == 0);
+
+    // 2.8.2
+    const char * plaintext = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, sunscreen would be it.";
+    u8 aad[12];
+    u8 data[128];
+    u32 size = (u32)strlen(plaintext);
+    for (u32 i = 0; i < 32; ++i)
+    {
+        key[i] = (u8)(0x80 + i);
+    }
+    FromHex("070000004041424344454647", nonce);
+    FromHex("50515253c0c1c2c3c4c5c6c7", aad);
+    memcpy(data, plaintext, size);
+
+    crypto_key session_key = {};
+    memcpy(session_key.chacha, key, sizeof(key));
+    crypto_job job = {};
+    job.key = &session_key;
+    job.cipher = packet_cipher_chacha20_poly1305;
+    memcpy(job.nonce, nonce, sizeof(nonce));
+    job.aad = aad;
+    job.aad_size = sizeof(aad);
+    job.data = data;
+    job.size = size;
+    job.tag = tag;
+    CryptoSealBatch(&job, 1);
+
+    FromHex("d31a8d34648e60db7b86afbc53ef7ec2a4aded51296e08fea9e2b5a736ee62d6", expected);
+    Assert(memcmp(data, expected, 32) == 0);
+    FromHex("1ae10b594f09e26a7e902ecbd0600691", expected);
+    Assert(memcmp(tag, expected, 16) == 0);
+
+    CryptoOpenBatch(&job, 1);
+    Assert(job.ok && memcmp(data, plaintext, size) == 0);
+
+    printf("rfc 8439: block, poly1305 and aead vectors ok\n");
+}
+
+/* RFC 7748 5.2 and 6.1, then sessions over fresh key pairs */
+void
+TestKeyExchange(real_time clock_freq)
+{
+    u8 scalar[32], point[32], out[32], expected[32];
+
+    FromHex("a546e36bf0527c9d3b16154b82465edd62144c0ac1fc5a18506a2244ba449ac4", scalar);
+    FromHex("e6db6867583030db3594c1a424b15f7c726624ec26b3353b10a903a6d0ab1c4c", point);
+    FromHex("c3da55379de9c6908e94ea4df28d084f32eccf03491c71f754b4075577a28552", expected);
+    X25519(out, scalar, point);
+    Assert(memcmp(out, expected, 32) == 0);
+
+    // top bit of the point set, ignored
+    FromHex("4b66e9d4d1b4673c5ad22691957d6af5c11b6421e0ea01d42ca4169e7918ba0d", scalar);
+    FromHex("e5210f12786811d3f4b7959d0538ae2c31dbe7106fc03c3efc4cd549c715a493", point);
+    FromHex("95cbde9476e8907d7aade45cb4b873f88b595a68799fa152e6f8f7647aac7957", expected);
+    X25519(out, scalar, point);
+    Assert(memcmp(out, expected, 32) == 0);
+
+    // k = X25519(k, u), u = old k, 1000 times
+    u8 k[32] = { 9 };
+    u8 u[32] = { 9 };
+    real_time start = GetRealTime();
+    for (u32 i = 1; i <= 1000; ++i)
+    {
+        X25519(out, k, u);
+        memcpy(u, k, 32);
+        memcpy(k, out, 32);
+        if (i == 1)
+        {
+            FromHex("422c8e7a6227d7bca1350b3e2bb7279f7897b87bb6854b783c60e80311ae3079", expected);
+            Assert(memcmp(k, expected, 32) == 0);
+        }
+    }
+    // ms for 1000 of them, us for one
+    r64 us_per_x25519 = GetTimeDiff(GetRealTime(), start, clock_freq);
+    FromHex("684cf59ba83309552800ef566f2f4d3c1c3887c49360e3875f2eb94d99532c51", expected);
+    Assert(memcmp(k, expected, 32) == 0);
+
+    crypto_key_pair alice, bob;
+    FromHex("77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a", alice.private_key);
+    FromHex("5dab087e624a8a4b79e17f8b83800ee66f3bb1292618b6fd1c2f8b27ff88e0eb", bob.private_key);
+    X25519(alice.public_key, alice.private_key, x25519_base_point);
+    X25519(bob.public_key, bob.private_key, x25519_base_point);
+    FromHex("8520f0098930a754748b7ddcb43ef75a0dbf3a0d26381af4eba4a98eaa9b4e6a", expected);
+    Assert(memcmp(alice.public_key, expected, 32) == 0);
+    FromHex("de9edb7d7b7dc1b4d35b61c2ece435373f8343c85b78674dadfc7e146f882b4f", expected);
+    Assert(memcmp(bob.public_key, expected, 32) == 0);
+    FromHex("4a5d9d5ba4ce2de1728e3bf480350f25e07e21c947d19e3376f09b3c1e161742", expected);
+    X25519(out, alice.private_key, bob.public_key);
+    Assert(memcmp(out, expected, 32) == 0);
+    X25519(out, bob.private_key, alice.public_key);
+    Assert(memcmp(out, expected, 32) == 0);
+
+    // fresh pairs: both ends agree, a pair from another session doesn't
+    static crypto_key client_key, server_key, other_key;
+    for (u32 round = 0; round < 20; ++round)
+    {
+        crypto_key_pair client, server, other;
+        Assert(CryptoNewKeyPair(&client) && CryptoNewKeyPair(&server) && CryptoNewKeyPair(&other));
+        Assert(memcmp(client.private_key, server.private_key, 32) != 0);
+
+        Assert(CryptoSessionKey(&client, server.public_key, true, &client_key));
+        Assert(CryptoSessionKey(&server, client.public_key, false, &server_key));
+        Assert(CryptoSessionKey(&other, client.public_key, false, &other_key));
+        Assert(memcmp(client_key.chacha, server_key.chacha, CRYPTO_KEY_SIZE) == 0);
+        Assert(memcmp(client_key.aes_round_keys, server_key.aes_round_keys, sizeof(client_key.aes_round_keys)) == 0);
+        Assert(memcmp(client_key.chacha, other_key.chacha, CRYPTO_KEY_SIZE) != 0);
+        Assert(memcmp(client_key.chacha, client_key.aes_round_keys, CRYPTO_KEY_SIZE) != 0);
+
+        // a packet sealed by the client opens on the server
+        packet_header header = {};
+        header.protocol = PROTOCOL_ID;
+        header.seq = round;
+        u8 datagram[UDP_DATAGRAM_PMTU_MAX_SIZE];
+        u32 header_size = PacketHeaderWrite(&header, 0, datagram);
+        u32 payload_size = 64;
+        for (u32 i = 0; i < payload_size; ++i)
+        {
+            datagram[header_size + i] = (u8)(i * 7 + round);
+        }
+        u32 counter = 0;
+        i32 size = (i32)PacketEncrypt(&client_key, packet_cipher_chacha20_poly1305, CRYPTO_CLIENT_TO_SERVER, &header,
+                                      datagram, header_size, payload_size, &counter);
+        i32 other_size = size;
+        u8 copy[UDP_DATAGRAM_PMTU_MAX_SIZE];
+        memcpy(copy, datagram, (u32)size);
+        Assert(PacketDecrypt(&server_key, packet_cipher_chacha20_poly1305, PACKET_CIPHERS_ALL, CRYPTO_CLIENT_TO_SERVER,
+                             datagram, header_size, &size, header.seq - 1, header.ack));
+        Assert((u32)size == header_size + payload_size && datagram[header_size + 1] == (u8)(7 + round));
+        Assert(!PacketDecrypt(&other_key, packet_cipher_chacha20_poly1305, PACKET_CIPHERS_ALL, CRYPTO_CLIENT_TO_SERVER,
+                              copy, header_size, &other_size, header.seq - 1, header.ack));
+    }
+
+    // low order points give an all zero secret
+    crypto_key_pair server;
+    Assert(CryptoNewKeyPair(&server));
+    u8 low_order[32] = {};
+    Assert(!CryptoSessionKey(&server, low_order, false, &server_key));
+    low_order[0] = 1;
+    Assert(!CryptoSessionKey(&server, low_order, false, &server_key));
+
+    // hello and reply read back, never as each other or as a packet header
+    u8 handshake[CRYPTO_HANDSHAKE_SIZE];
+    u8 read_key[CRYPTO_PUBLIC_KEY_SIZE];
+    u32 handshake_size = CryptoHandshakeWrite(handshake, CRYPTO_HANDSHAKE_HELLO, server.public_key);
+    Assert(CryptoHandshakeRead(handshake, handshake_size, CRYPTO_HANDSHAKE_HELLO, read_key));
+    Assert(memcmp(read_key, server.public_key, CRYPTO_PUBLIC_KEY_SIZE) == 0);
+    Assert(!CryptoHandshakeRead(handshake, handshake_size, CRYPTO_HANDSHAKE_REPLY, read_key));
+    Assert(!CryptoHandshakeRead(handshake, handshake_size - 1, CRYPTO_HANDSHAKE_HELLO, read_key));
+    Assert(PacketHeaderWireSize(handshake, handshake_size) == 0);
+
+    printf("x25519: rfc 7748 vectors ok, both ends agree, low order refused, %.1f us a scalar multiply\n",
+           us_per_x25519);
+}
+
+/* GCM spec test cases 13 to 16, the AES-256 ones */
+void
+TestAesGcmVectors()
+{
+    struct
+    {
+        const char * key;
+        const char * nonce;
+        const char * aad;
+        const char * plaintext;
+        const char * ciphertext;
+        const char * tag;
+    } cases[] =
+    {
+        { "0000000000000000000000000000000000000000000000000000000000000000", "000000000000000000000000",
+          "", "", "", "530f8afbc74536b9a963b4f1c4cb738b" },
+        { "0000000000000000000000000000000000000000000000000000000000000000", "000000000000000000000000",
+          "", "00000000000000000000000000000000", "cea7403d4d606b6e074ec5d3baf39d18",
+          "d0d1c8a799996bf0265b98b5d48ab919" },
+        { "feffe9928665731c6d6a8f9467308308feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888",
+          "",
+          "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+          "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b391aafd255",
+          "522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd2555d1aa"
+          "8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0abcc9f662898015ad",
+          "b094dac5d93471bdec1a502270e3cc6c" },
+        { "feffe9928665731c6d6a8f9467308308feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888",
+          "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+          "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+          "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+          "522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd2555d1aa"
+          "8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0abcc9f662",
+          "76fc6ece0f4e1768cddf8853bb2d551b" },
+    };
+
+    b32 aesni = crypto_use_aesni;
+    for (u32 version = 0; version < 2; ++version)
+    {
+        if (version == 1 && !aesni)
+        {
+            break;
+        }
+        crypto_use_aesni = version == 1;
+
+        for (u32 case_index = 0; case_index < ArrayCount(cases); ++case_index)
+        {
+            u8 secret[32];
+            u8 aad[32];
+            u8 data[64];
+            u8 expected[64];
+            u8 tag[16];
+            u32 aad_size = (u32)strlen(cases[case_index].aad) / 2;
+            u32 size = (u32)strlen(cases[case_index].plaintext) / 2;
+
+            crypto_key key;
+            FromHex(cases[case_index].key, secret);
+            AesGcmKeyInit(&key, secret);
+
+            crypto_job job = {};
+            job.key = &key;
+            job.cipher = packet_cipher_aes256_gcm;
+            FromHex(cases[case_index].nonce, job.nonce);
+            FromHex(cases[case_index].aad, aad);
+            FromHex(cases[case_index].plaintext, data);
+            job.aad = aad;
+            job.aad_size = aad_size;
+            job.data = data;
+            job.size = size;
+            job.tag = tag;
+            CryptoSealBatch(&job, 1);
+
+            FromHex(cases[case_index].ciphertext, expected);
+            Assert(memcmp(data, expected, size) == 0);
+            FromHex(cases[case_index].tag, expected);
+            Assert(memcmp(tag, expected, 16) == 0);
+
+            CryptoOpenBatch(&job, 1);
+            FromHex(cases[case_index].plaintext, expected);
+            Assert(job.ok && memcmp(data, expected, size) == 0);
+        }
+    }
+
+    crypto_use_aesni = aesni;
+    printf("gcm: aes-256 vectors ok, aes-ni %s\n", aesni ? "too" : "not available");
+}
+
+void
+RandomKey(crypto_key * key)
+{
+    u8 secret[CRYPTO_KEY_SIZE];
+    for (u32 i = 0; i < CRYPTO_KEY_SIZE; ++i)
+    {
+        key->chacha[i] = (u8)rand();
+        secret[i] = (u8)rand();
+    }
+    AesGcmKeyInit(key, secret);
+}
+
+/* jobs of count random packets in buffers, sizes up to max_size, ciphers at random */
+void
+RandomJobs(crypto_job * jobs, u8 (*buffers)[UDP_DATAGRAM_PMTU_MAX_SIZE], crypto_key * keys,
+           u32 count, u32 max_size)
+{
+    for (u32 job_index = 0; job_index < count; ++job_index)
+    {
+        u8 * buffer = buffers[job_index];
+        for (u32 i = 0; i < UDP_DATAGRAM_PMTU_MAX_SIZE; ++i)
+        {
+            buffer[i] = (u8)rand();
+        }
+        RandomKey(keys + job_index);
+
+        crypto_job * job = jobs + job_index;
+        job->key = keys + job_index;
+        job->cipher = rand() % packet_cipher_count;
+        job->fallback_ciphers = 0;
+        for (u32 i = 0; i < CRYPTO_NONCE_SIZE; ++i)
+        {
+            job->nonce[i] = (u8)rand();
+        }
+        job->aad = buffer;
+        job->aad_size = 1 + rand() % 14;
+        job->data = buffer + job->aad_size;
+        job->size = rand() % (max_size + 1);
+        job->tag = job->data + job->size;
+        job->ok = false;
+    }
+}
+
+void
+TestBatches()
+{
+    b32 avx2 = crypto_use_avx2;
+    b32 aesni = crypto_use_aesni;
+    static u8 buffers[CRYPTO_BATCH_SIZE * 2][UDP_DATAGRAM_PMTU_MAX_SIZE];
+    static u8 copies[CRYPTO_BATCH_SIZE * 2][UDP_DATAGRAM_PMTU_MAX_SIZE];
+    static crypto_key keys[CRYPTO_BATCH_SIZE * 2];
+    crypto_job jobs[CRYPTO_BATCH_SIZE * 2];
+    crypto_job single[CRYPTO_BATCH_SIZE * 2];
+
+    for (u32 round = 0; round < 2000; ++round)
+    {
+        u32 count = 1 + round % (CRYPTO_BATCH_SIZE * 2);
+        u32 max_size = (round & 1) ? 200 : 1300;
+        RandomJobs(jobs, buffers, keys, count, max_size);
+
+        // same packets one at a time
+        memcpy(copies, buffers, sizeof(copies));
+        for (u32 job_index = 0; job_index < count; ++job_index)
+        {
+            single[job_index] = jobs[job_index];
+            ptrdiff_t data_offset = jobs[job_index].data - buffers[job_index];
+            single[job_index].aad = copies[job_index];
+            single[job_index].data = copies[job_index] + data_offset;
+            single[job_index].tag = single[job_index].data + single[job_index].size;
+        }
+
+        crypto_use_avx2 = avx2;
+        crypto_use_aesni = aesni;
+        CryptoSealBatch(jobs, count);
+        crypto_use_avx2 = false;
+        crypto_use_aesni = false;
+        for (u32 job_index = 0; job_index < count; ++job_index)
+        {
+            CryptoSealBatch(single + job_index, 1);
+        }
+        Assert(memcmp(buffers, copies, sizeof(buffers)) == 0);
+
+        // half of them tried with the other cipher first
+        crypto_use_avx2 = avx2;
+        crypto_use_aesni = aesni;
+        u32 sealed_with[CRYPTO_BATCH_SIZE * 2];
+        for (u32 job_index = 0; job_index < count; ++job_index)
+        {
+            sealed_with[job_index] = jobs[job_index].cipher;
+            if (rand() & 1)
+            {
+                jobs[job_index].cipher ^= 1;
+            }
+            jobs[job_index].fallback_ciphers = PACKET_CIPHERS_ALL;
+        }
+        CryptoOpenBatch(jobs, count);
+        for (u32 job_index = 0; job_index < count; ++job_index)
+        {
+            Assert(jobs[job_index].ok && jobs[job_index].cipher == sealed_with[job_index]);
+        }
+        Assert(memcmp(copies, buffers, sizeof(buffers)) != 0);
+
+        // and back to plaintext with the portable code
+        crypto_use_avx2 = false;
+        crypto_use_aesni = false;
+        for (u32 job_index = 0; job_index < count; ++job_index)
+        {
+            single[job_index].fallback_ciphers = 0;
+            CryptoOpenBatch(single + job_index, 1);
+            Assert(single[job_index].ok);
+        }
+        Assert(memcmp(buffers, copies, sizeof(buffers)) == 0);
+    }
+
+    crypto_use_avx2 = avx2;
+    crypto_use_aesni = aesni;
+    printf("batches: avx2 %s, aes-ni %s\n",
+           avx2 ? "matches one packet at a time" : "not available",
+           aesni ? "matches the table version" : "not available");
+}
+
+void
+TestTamper()
+{
+    crypto_key key;
+    RandomKey(&key);
+
+    u32 flips_caught = 0;
+    u32 ciphers_caught = 0;
+    u32 counter = 0;
+    for (u32 round = 0; round < 20000; ++round)
+    {
+        packet_header header;
+        header.seq = (u32)rand();
+        header.ack = header.seq - (rand() % 32);
+        header.ack_bit = (u32)rand();
+        header.protocol = PROTOCOL_ID;
+        header.flags = (round & 1) ? PACKET_FLAG_ACK_ONLY : 0;
+        header.messages = 0;
+
+        u8 wire[UDP_DATAGRAM_PMTU_MAX_SIZE];
+        u32 header_size = PacketHeaderWrite(&header, header.seq - 1, wire);
+        u32 payload_size = rand() % 400;
+        for (u32 i = 0; i < payload_size; ++i)
+        {
+            wire[header_size + i] = (u8)rand();
+        }
+        u8 plain[UDP_DATAGRAM_PMTU_MAX_SIZE];
+        memcpy(plain, wire, header_size + payload_size);
+
+        u32 direction = round % 2 ? CRYPTO_SERVER_TO_CLIENT : CRYPTO_CLIENT_TO_SERVER;
+        u32 cipher = (round / 2) % packet_cipher_count;
+        u32 sealed_size = PacketEncrypt(&key, cipher, direction, &header, wire, header_size, payload_size, &counter);
+        Assert(sealed_size == header_size + payload_size + CRYPTO_TAG_SIZE + (header.flags ? CRYPTO_COUNTER_SIZE : 0));
+
+        u8 received[UDP_DATAGRAM_PMTU_MAX_SIZE];
+        memcpy(received, wire, sealed_size);
+        i32 size = (i32)sealed_size;
+        Assert(PacketDecrypt(&key, cipher ^ 1, PACKET_CIPHERS_ALL, direction, received, header_size, &size,
+                             header.seq - 1, header.ack));
+        Assert((u32)size == header_size + payload_size && memcmp(received, plain, size) == 0);
+
+        // the other direction has another nonce
+        memcpy(received, wire, sealed_size);
+        size = (i32)sealed_size;
+        Assert(!PacketDecrypt(&key, cipher, PACKET_CIPHERS_ALL, direction ^ 1, received, header_size, &size,
+                              header.seq - 1, header.ack));
+
+        // a cipher the session doesn't allow
+        size = (i32)sealed_size;
+        Assert(!PacketDecrypt(&key, cipher ^ 1, 0, direction, received, header_size, &size, header.seq - 1, header.ack));
+        ciphers_caught += 1;
+
+        // header, payload, counter or tag
+        memcpy(received, wire, sealed_size);
+        u32 bit = rand() % (sealed_size * 8);
+        received[bit / 8] ^= (u8)(1 << (bit % 8));
+        size = (i32)sealed_size;
+        if (PacketHeaderWireSize(received, sealed_size) == header_size)
+        {
+            Assert(!PacketDecrypt(&key, cipher, PACKET_CIPHERS_ALL, direction, received, header_size, &size,
+                                  header.seq - 1, header.ack));
+            flips_caught += 1;
+        }
+    }
+
+    printf("tamper: %u flipped bits, %u wrong directions and %u wrong ciphers rejected\n",
+           flips_caught, 20000, ciphers_caught);
+}
+
+/* ns per packet of seal then open, jobs as they are with one cipher and version */
+r64
+BenchPath(crypto_job * jobs, u32 cipher, b32 batched, b32 fast, real_time clock_freq)
+{
+    crypto_use_avx2 = batched && fast;
+    crypto_use_aesni = fast;
+    for (u32 job_index = 0; job_index < BENCH_PACKETS; ++job_index)
+    {
+        jobs[job_index].cipher = cipher;
+    }
+
+    u32 batch = batched ? CRYPTO_BATCH_SIZE : 1;
+    real_time start = GetRealTime();
+    for (u32 round = 0; round < BENCH_ROUNDS; ++round)
+    {
+        for (u32 job_index = 0; job_index < BENCH_PACKETS; job_index += batch)
+        {
+            CryptoSealBatch(jobs + job_index, batch);
+            CryptoOpenBatch(jobs + job_index, batch);
+        }
+    }
+
+    return GetTimeDiff(GetRealTime(), start, clock_freq) * 1000000.0 / ((r64)BENCH_ROUNDS * BENCH_PACKETS);
+}
+
+void
+Bench(real_time clock_freq)
+{
+    static u8 buffers[BENCH_PACKETS][UDP_DATAGRAM_PMTU_MAX_SIZE];
+    static crypto_key keys[BENCH_PACKETS];
+    static crypto_job jobs[BENCH_PACKETS];
+
+    static capture traffic;
+    traffic.data = (u8 *)malloc((size_t)CAPTURE_MAX_PACKETS * PACKET_PAYLOAD_SIZE);
+    CaptureTraffic(&traffic, 1);
+    srand(1);
+
+    b32 avx2 = crypto_use_avx2;
+    b32 aesni = crypto_use_aesni;
+    // 0 is the server's payloads
+    u32 sizes[] = { 32, 80, 200, 464, 1200, 0 };
+
+    printf("ns per packet sealed and opened, clients at %u Hz both ways on one core\n", BENCH_TICK_HZ);
+    printf("%-8s %10s %10s %10s %10s %12s %12s\n",
+           "bytes", "chacha", "chacha x8", "aes table", "aes-ni", "chacha x8", "aes-ni");
+    for (u32 size_index = 0; size_index < ArrayCount(sizes); ++size_index)
+    {
+        u32 size = sizes[size_index];
+        RandomJobs(jobs, buffers, keys, BENCH_PACKETS, UDP_DATAGRAM_PMTU_MAX_SIZE - 64);
+        u64 total_bytes = 0;
+        for (u32 job_index = 0; job_index < BENCH_PACKETS; ++job_index)
+        {
+            jobs[job_index].size = size ? size : traffic.size[job_index % traffic.count];
+            jobs[job_index].tag = jobs[job_index].data + jobs[job_index].size;
+            total_bytes += jobs[job_index].size;
+        }
+
+        // every other round of opens fails the tag and leaves the data, same work
+        r64 ns[4];
+        ns[0] = BenchPath(jobs, packet_cipher_chacha20_poly1305, false, false, clock_freq);
+        ns[1] = BenchPath(jobs, packet_cipher_chacha20_poly1305, true, avx2, clock_freq);
+        ns[2] = BenchPath(jobs, packet_cipher_aes256_gcm, false, false, clock_freq);
+        ns[3] = aesni ? BenchPath(jobs, packet_cipher_aes256_gcm, false, true, clock_freq) : 0.0;
+
+        // a client at 30 Hz: a packet sealed and one opened every tick
+        r64 chacha_clients = 1000000000.0 / (ns[1] * BENCH_TICK_HZ);
+        r64 aes_clients = aesni ? 1000000000.0 / (ns[3] * BENCH_TICK_HZ) : 0.0;
+        char label[16];
+        if (size)
+        {
+            sprintf(label, "%u", size);
+        }
+        else
+        {
+            sprintf(label, "mix %u", (u32)(total_bytes / BENCH_PACKETS));
+        }
+        printf("%-8s %10.1f %10.1f %10.1f %10.1f %12.0f %12.0f\n",
+               label, ns[0], ns[1], ns[2], ns[3], chacha_clients, aes_clients);
+    }
+
+    crypto_use_avx2 = avx2;
+    crypto_use_aesni = aesni;
+    free(traffic.data);
+}
+
+int
+main()
+{
+    TimeInit(false);
+    real_time clock_freq = GetClockResolution();
+
+    CryptoInit();
+    srand(1);
+
+    TestVectors();
+    TestAesGcmVectors();
+    TestKeyExchange(clock_freq);
+    TestBatches();
+    TestTamper();
+    Bench(clock_freq);
+
+    return 0;
+}
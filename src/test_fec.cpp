@@ -0,0 +1,284 @@
+/*
+ * Forward error correction, fec.cpp
+ *  - SSSE3 PSHUFB multiply against the scalar log/exp tables, every
+ *    coefficient over sizes and alignments around the 16 byte blocks
+ *  - groups of 8 with P + Q: every pair of lost packets rebuilt, every single
+ *    one rebuilt from Q alone when P is lost too
+ *  - a lost repair: two lost packets and only P, nothing is rebuilt and the
+ *    next group still is
+ *  - PMTU sized packets are protected, ones too big for a repair on the path
+ *    are sent unprotected and counted
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "platform.h"
+#include "fec.cpp"
+
+#define TEST_GROUP 8
+// path confirmed at 1500 by MTU discovery, what PmtuPayloadCapacity gives
+#define TEST_PMTU_CAPACITY (UDP_DATAGRAM_PMTU_MAX_SIZE - sizeof(packet_header) - PACKET_TRAILER_MAX_SIZE)
+// loss rate for groups of 8 with P and Q
+#define TEST_LOSS_RATE 0.1f
+
+struct test_packet
+{
+    u32 seq;
+    u16 messages;
+    u32 size;
+    u8 payload[PACKET_MAX_PAYLOAD_SIZE];
+};
+
+struct test_group
+{
+    test_packet packets[TEST_GROUP];
+    u32 repair_size[2];
+    u8 repairs[2][PACKET_MAX_PAYLOAD_SIZE];
+};
+
+/* records of random content adding up to about size */
+void
+MakePacket(test_packet * packet, u32 seq, u32 size)
+{
+    packet->seq = seq;
+    packet->messages = 0;
+    packet->size = 0;
+    while (packet->size + sizeof(message_header) + 1 <= size)
+    {
+        u32 len = 1 + rand() % 255;
+        len = min(len, size - packet->size - (u32)sizeof(message_header));
+        message_header * header = (message_header *)(packet->payload + packet->size);
+        header->len = (u8)len;
+        header->message_type = (u8)rand();
+        header->id = (u8)rand();
+        header->order = 0;
+        packet->size += sizeof(message_header);
+        for (u32 i = 0; i < len; ++i)
+        {
+            packet->payload[packet->size++] = (u8)rand();
+        }
+        packet->messages += 1;
+    }
+}
+
+/* sizes of the group packets are random up to max_size, the last one is max_size */
+void
+EncodeGroup(test_group * group, u32 base_seq, u32 max_size)
+{
+    static fec_encoder enc;
+    FecEncoderInit(&enc);
+
+    for (u32 i = 0; i < TEST_GROUP; ++i)
+    {
+        u32 size = (i == TEST_GROUP - 1) ? max_size : 8 + rand() % (max_size - 8);
+        test_packet * packet = group->packets + i;
+        MakePacket(packet, base_seq + i, size);
+        b32 closed = FecEncoderAddPacket(&enc, TEST_LOSS_RATE, TEST_PMTU_CAPACITY, packet->seq,
+                                         packet->messages, packet->payload, packet->size, true);
+        Assert(closed == (i == TEST_GROUP - 1));
+    }
+    Assert(enc.packets_unprotected == 0);
+    Assert(FecEncoderRepairCount(&enc) == 2);
+
+    for (u32 repair_index = 0; repair_index < 2; ++repair_index)
+    {
+        group->repair_size[repair_index] = FecEncoderWriteRepair(&enc, repair_index, group->repairs[repair_index]);
+        Assert(group->repair_size[repair_index] <= TEST_PMTU_CAPACITY);
+    }
+    FecEncoderCloseGroup(&enc);
+}
+
+/* the group but the lost packets into dec, then the repairs sent, returns packets rebuilt */
+u32
+DecodeGroup(fec_decoder * dec, test_group * group, u32 lost_bit, u32 repair_bit)
+{
+    for (u32 i = 0; i < TEST_GROUP; ++i)
+    {
+        test_packet * packet = group->packets + i;
+        if (!((lost_bit >> i) & 1))
+        {
+            FecDecoderAddPacket(dec, packet->seq, packet->messages, packet->payload, packet->size);
+        }
+    }
+
+    u32 rebuilt = 0;
+    for (u32 repair_index = 0; repair_index < 2; ++repair_index)
+    {
+        if (!((repair_bit >> repair_index) & 1))
+        {
+            continue;
+        }
+
+        fec_recovered recovered[2];
+        u32 count = FecDecoderAddRepair(dec, group->repairs[repair_index], group->repair_size[repair_index], recovered);
+        for (u32 recovered_index = 0; recovered_index < count; ++recovered_index)
+        {
+            fec_recovered * rec = recovered + recovered_index;
+            u32 i = rec->seq - group->packets[0].seq;
+            Assert(i < TEST_GROUP && ((lost_bit >> i) & 1));
+
+            test_packet * packet = group->packets + i;
+            Assert(rec->messages == packet->messages && rec->size == packet->size);
+            Assert(memcmp(rec->payload, packet->payload, packet->size) == 0);
+            Assert(FecDecoderHasPacket(dec, rec->seq));
+        }
+        rebuilt += count;
+    }
+
+    return rebuilt;
+}
+
+void
+TestMultiply()
+{
+    static u8 src[256 + 16];
+    static u8 dst[256 + 16];
+    static u8 expected[256 + 16];
+
+    // inverses from the tables, the Q path divides by them
+    for (u32 a = 1; a < 256; ++a)
+    {
+        Assert(GfMul((u8)a, GfInv((u8)a)) == 1);
+    }
+
+    b32 ssse3 = GetCpuFeatures().ssse3;
+    for (u32 c = 0; c < 256; ++c)
+    {
+        for (u32 size = 0; size <= 80; ++size)
+        {
+            u32 offset = rand() % 16;
+            for (u32 i = 0; i < size; ++i)
+            {
+                src[offset + i] = (u8)rand();
+                dst[offset + i] = (u8)rand();
+                expected[i] = dst[offset + i] ^ GfMul((u8)c, src[offset + i]);
+            }
+
+            if (ssse3)
+            {
+                u8 ssse3_dst[256 + 16];
+                memcpy(ssse3_dst, dst, sizeof(dst));
+                FecMulAddRegionSSSE3(ssse3_dst + offset, src + offset, (u8)c, size);
+                Assert(memcmp(ssse3_dst + offset, expected, size) == 0);
+            }
+
+            FecMulAddRegion(dst + offset, src + offset, (u8)c, size);
+            Assert(memcmp(dst + offset, expected, size) == 0);
+        }
+    }
+
+    printf("multiply: %s\n", ssse3 ? "ssse3 matches the tables for every coefficient" : "ssse3 not available, tables only");
+}
+
+void
+TestErasures()
+{
+    static test_group group;
+    static fec_decoder dec;
+    u32 base_seq = 1000;
+
+    // any 2 of the group, sizes up to a PMTU packet with room for its repair
+    u32 pairs = 0;
+    for (u32 first = 0; first < TEST_GROUP; ++first)
+    {
+        for (u32 second = first + 1; second < TEST_GROUP; ++second)
+        {
+            EncodeGroup(&group, base_seq, FecPayloadBudget(TEST_LOSS_RATE, TEST_PMTU_CAPACITY));
+            FecDecoderInit(&dec);
+            Assert(DecodeGroup(&dec, &group, (1 << first) | (1 << second), 0b11) == 2);
+            base_seq += TEST_GROUP;
+            pairs += 1;
+        }
+    }
+
+    // any 1 of the group from Q alone, the P repair lost as well
+    for (u32 first = 0; first < TEST_GROUP; ++first)
+    {
+        EncodeGroup(&group, base_seq, 200);
+        FecDecoderInit(&dec);
+        Assert(DecodeGroup(&dec, &group, 1 << first, 1 << FEC_REPAIR_Q) == 1);
+        base_seq += TEST_GROUP;
+    }
+
+    printf("erasures: %u pairs rebuilt from P + Q, %u singles from Q alone\n", pairs, TEST_GROUP);
+}
+
+void
+TestLostRepair()
+{
+    static test_group group;
+    static fec_decoder dec;
+    FecDecoderInit(&dec);
+
+    // 2 lost and Q lost with them, P can't tell them apart
+    EncodeGroup(&group, 5000, 300);
+    Assert(DecodeGroup(&dec, &group, 0b100100, 1 << FEC_REPAIR_P) == 0);
+    Assert(!FecDecoderHasPacket(&dec, 5002) && !FecDecoderHasPacket(&dec, 5005));
+    Assert(dec.packets_recovered == 0);
+
+    // nothing of it is left behind for the next group
+    EncodeGroup(&group, 5000 + TEST_GROUP, 300);
+    Assert(DecodeGroup(&dec, &group, 0b10, 1 << FEC_REPAIR_P) == 1);
+    Assert(dec.packets_recovered == 1);
+
+    // a repair with a symbol bigger than any packet can be is refused
+    test_group * bad = &group;
+    fec_repair_header header;
+    memcpy(&header, bad->repairs[FEC_REPAIR_P], sizeof(header));
+    header.symbol_size = FEC_MAX_SYMBOL_SIZE + 1;
+    memcpy(bad->repairs[FEC_REPAIR_P], &header, sizeof(header));
+    fec_recovered recovered[2];
+    Assert(FecDecoderAddRepair(&dec, bad->repairs[FEC_REPAIR_P], PACKET_MAX_PAYLOAD_SIZE, recovered) == 0);
+
+    printf("lost repair: 2 lost with P alone rebuild nothing, the next group does\n");
+}
+
+void
+TestUnprotected()
+{
+    static fec_encoder enc;
+    static test_packet packet;
+    FecEncoderInit(&enc);
+
+    u32 small_path = UDP_DATAGRAM_PAYLOAD_MAX_SIZE - sizeof(packet_header) - PACKET_TRAILER_MAX_SIZE;
+
+    // budgeted with FecPayloadBudget the whole packet fits a repair on either path
+    MakePacket(&packet, 1, FecPayloadBudget(TEST_LOSS_RATE, small_path));
+    FecEncoderAddPacket(&enc, TEST_LOSS_RATE, small_path, 1, packet.messages, packet.payload, packet.size, true);
+    Assert(enc.count == 1 && enc.packets_unprotected == 0);
+    MakePacket(&packet, 2, FecPayloadBudget(TEST_LOSS_RATE, TEST_PMTU_CAPACITY));
+    FecEncoderAddPacket(&enc, TEST_LOSS_RATE, TEST_PMTU_CAPACITY, 2, packet.messages, packet.payload, packet.size, true);
+    Assert(enc.count == 2 && enc.packets_unprotected == 0);
+
+    // a full packet has no room left, the group closes without it
+    MakePacket(&packet, 3, TEST_PMTU_CAPACITY);
+    Assert(FecEncoderAddPacket(&enc, TEST_LOSS_RATE, TEST_PMTU_CAPACITY, 3, packet.messages, packet.payload, packet.size, true));
+    Assert(enc.count == 2 && enc.packets_unprotected == 1);
+    FecEncoderCloseGroup(&enc);
+
+    // PMTU sized, but the path went back to 508
+    MakePacket(&packet, 4, 1000);
+    Assert(!FecEncoderAddPacket(&enc, TEST_LOSS_RATE, small_path, 4, packet.messages, packet.payload, packet.size, true));
+    Assert(enc.count == 0 && enc.packets_unprotected == 2);
+
+    // nothing is counted while fec is off
+    Assert(FecPayloadBudget(0.0f, TEST_PMTU_CAPACITY) == TEST_PMTU_CAPACITY);
+    Assert(!FecEncoderAddPacket(&enc, 0.0f, small_path, 5, packet.messages, packet.payload, packet.size, true));
+    Assert(enc.packets_unprotected == 2);
+
+    printf("unprotected: budgeted packets fit, %u too big for the path counted\n", enc.packets_unprotected);
+}
+
+int
+main()
+{
+    srand(31);
+    FecInit();
+
+    TestMultiply();
+    TestErasures();
+    TestLostRepair();
+    TestUnprotected();
+
+    return 0;
+}
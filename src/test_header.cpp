@@ -0,0 +1,229 @@
+/*
+ * Packet header benchmark.
+ * A client and the server send to each other at the same rate over a link
+ * with fixed latency and random loss. Every header is encoded compact,
+ * decoded with what the receiver knows at that point and checked against
+ * the original. Reports header bytes per client against the fixed 16 bytes.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "packet_header.h"
+
+#define BENCH_SECONDS 600
+#define BENCH_ONE_WAY_MS 50
+// packets in flight on one direction of the link
+#define BENCH_LINK_SLOTS 64
+
+struct bench_peer
+{
+    u32 seq;
+    u32 acked;
+    u32 remote_seq;
+    u32 remote_seq_bit;
+};
+
+struct bench_in_flight
+{
+    u32 arrival_ms;
+    b32 lost;
+    u32 wire_size;
+    u8 wire[PACKET_HEADER_MAX_WIRE_SIZE];
+    packet_header sent;
+};
+
+struct bench_link
+{
+    bench_in_flight slots[BENCH_LINK_SLOTS];
+    u32 first;
+    u32 count;
+};
+
+struct bench_totals
+{
+    u64 packets;
+    u64 wire_bytes;
+};
+
+inline i32
+IsSeqGreaterThan(u32 a, u32 b)
+{
+    return (i32)(a - b) > 0;
+}
+
+void
+BenchInitPeer(bench_peer * peer)
+{
+    peer->seq = UINT_MAX;
+    peer->acked = UINT_MAX;
+    peer->remote_seq = UINT_MAX;
+    peer->remote_seq_bit = ~0;
+}
+
+void
+BenchMarkReceived(bench_peer * peer, u32 seq)
+{
+    if (IsSeqGreaterThan(seq, peer->remote_seq))
+    {
+        for (u32 missing_seq = peer->remote_seq + 1; missing_seq != seq; ++missing_seq)
+        {
+            peer->remote_seq_bit &= ~((u32)1 << (missing_seq & 31));
+        }
+        peer->remote_seq = seq;
+    }
+    peer->remote_seq_bit |= ((u32)1 << (seq & 31));
+}
+
+void
+BenchSend(bench_peer * from, bench_link * link, u32 now_ms, r32 loss_rate, b32 ack_only, bench_totals * totals)
+{
+    packet_header header;
+    header.protocol = PROTOCOL_ID;
+    header.flags = ack_only ? PACKET_FLAG_ACK_ONLY : 0;
+    header.seq = ack_only ? from->seq : ++from->seq;
+    header.ack = from->remote_seq;
+    header.ack_bit = from->remote_seq_bit;
+    // now and then a big snapshot split in many messages
+    header.messages = ack_only ? 0 : (u16)((rand() % 16 == 0) ? 7 + rand() % 200 : 1 + rand() % 4);
+
+    Assert(link->count < BENCH_LINK_SLOTS);
+    bench_in_flight * in_flight = link->slots + ((link->first + link->count++) % BENCH_LINK_SLOTS);
+    in_flight->arrival_ms = now_ms + BENCH_ONE_WAY_MS;
+    in_flight->lost = ((r32)rand() / (r32)RAND_MAX) < loss_rate;
+    in_flight->sent = header;
+
+    in_flight->wire_size = PacketHeaderWrite(&header, from->acked, in_flight->wire);
+
+    totals->packets += 1;
+    totals->wire_bytes += in_flight->wire_size;
+}
+
+void
+BenchDeliver(bench_link * link, bench_peer * to, u32 now_ms)
+{
+    while (link->count && link->slots[link->first].arrival_ms <= now_ms)
+    {
+        bench_in_flight * in_flight = link->slots + link->first;
+        link->first = (link->first + 1) % BENCH_LINK_SLOTS;
+        link->count -= 1;
+
+        if (in_flight->lost)
+        {
+            continue;
+        }
+
+        packet_header header;
+        u32 header_size = PacketHeaderWireSize(in_flight->wire, in_flight->wire_size);
+        PacketHeaderRead(in_flight->wire, to->remote_seq, to->seq, &header);
+
+        packet_header * sent = &in_flight->sent;
+        Assert(header_size == in_flight->wire_size);
+        Assert(header.flags == sent->flags && header.messages == sent->messages);
+        Assert(header.ack == sent->ack && header.ack_bit == sent->ack_bit);
+        Assert(header.flags || header.seq == sent->seq);
+
+        if (header.flags == 0)
+        {
+            BenchMarkReceived(to, header.seq);
+        }
+        if (IsSeqGreaterThan(header.ack, to->acked))
+        {
+            to->acked = header.ack;
+        }
+    }
+}
+
+void
+RunRate(u32 hz, r32 loss_rate)
+{
+    bench_peer server, client;
+    BenchInitPeer(&server);
+    BenchInitPeer(&client);
+
+    bench_link to_client = {};
+    bench_link to_server = {};
+    bench_totals totals = {};
+
+    u32 interval_ms = 1000 / hz;
+    for (u32 now_ms = 0; now_ms < BENCH_SECONDS * 1000; ++now_ms)
+    {
+        if ((now_ms % interval_ms) == 0)
+        {
+            BenchSend(&server, &to_client, now_ms, loss_rate, false, &totals);
+            // one in four client sends has nothing but the ack
+            BenchSend(&client, &to_server, now_ms, loss_rate, (rand() % 4) == 0, &totals);
+        }
+
+        BenchDeliver(&to_client, &client, now_ms);
+        BenchDeliver(&to_server, &server, now_ms);
+    }
+
+    r64 avg_size = (r64)totals.wire_bytes / (r64)totals.packets;
+    r64 fixed_bps = (r64)(sizeof(packet_header) * totals.packets) / BENCH_SECONDS;
+    r64 compact_bps = (r64)totals.wire_bytes / BENCH_SECONDS;
+    printf("%4u Hz %5.1f%% %10.2f %12.0f %12.0f %12.0f\n",
+            hz, loss_rate * 100.0f, avg_size, fixed_bps, compact_bps, fixed_bps - compact_bps);
+}
+
+#define BENCH_CODEC_HEADERS 1024
+#define BENCH_CODEC_ROUNDS 2000
+
+/* ns to write and read back one header */
+r64
+TimeCodec(real_time clock_freq)
+{
+    packet_header headers[BENCH_CODEC_HEADERS];
+    for (u32 i = 0; i < BENCH_CODEC_HEADERS; ++i)
+    {
+        packet_header * header = headers + i;
+        header->protocol = PROTOCOL_ID;
+        header->flags = (rand() % 4 == 0) ? PACKET_FLAG_ACK_ONLY : 0;
+        header->seq = 1000 + i;
+        header->ack = 500 + i;
+        header->ack_bit = (rand() % 8 == 0) ? ~((u32)1 << (rand() % 32)) : ~0u;
+        header->messages = (u16)(rand() % 9);
+    }
+
+    u8 wire[PACKET_HEADER_MAX_WIRE_SIZE];
+    packet_header decoded;
+    // keep the compiler from dropping the loop
+    volatile u32 sink = 0;
+
+    real_time start = GetRealTime();
+    for (u32 round = 0; round < BENCH_CODEC_ROUNDS; ++round)
+    {
+        for (u32 i = 0; i < BENCH_CODEC_HEADERS; ++i)
+        {
+            u32 size = PacketHeaderWrite(headers + i, 995 + i, wire);
+            size = PacketHeaderWireSize(wire, size);
+            PacketHeaderRead(wire, 999 + i, 510 + i, &decoded);
+            sink += size + decoded.seq;
+        }
+    }
+    r64 elapsed_ms = GetTimeDiff(GetRealTime(), start, clock_freq);
+
+    return elapsed_ms * 1000000.0 / ((r64)BENCH_CODEC_ROUNDS * BENCH_CODEC_HEADERS);
+}
+
+int
+main()
+{
+    TimeInit(false);
+    real_time clock_freq = GetClockResolution();
+
+    u32 rates[] = { 20, 30, 60 };
+    r32 losses[] = { 0.0f, 0.02f, 0.10f };
+
+    printf("%u s per run, %u ms one way, both directions\n", BENCH_SECONDS, BENCH_ONE_WAY_MS);
+    printf("%-14s %10s %12s %12s %12s\n", "", "header B", "fixed B/s", "compact B/s", "saved B/s");
+    for (u32 rate_index = 0; rate_index < ArrayCount(rates); ++rate_index)
+    {
+        for (u32 loss_index = 0; loss_index < ArrayCount(losses); ++loss_index)
+        {
+            RunRate(rates[rate_index], losses[loss_index]);
+        }
+    }
+
+    printf("write + read: %.1f ns per header\n", TimeCodec(clock_freq));
+
+    return 0;
+}
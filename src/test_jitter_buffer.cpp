@@ -0,0 +1,210 @@
+/*
+ * Snapshot jitter buffer, jitter_buffer.h
+ *  - reordered ticks play in tick order, late ones and duplicates are dropped
+ *  - 60 Hz snapshots over a path with jitter and some loss to a client
+ *    drawing at 60 Hz: how many frames show no new tick or more than one,
+ *    applied as they get in against played out of the buffer, how many get
+ *    in too late and the delay it takes
+ *  - the jitter goes away: the delay comes back down
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "platform.h"
+#include "jitter_buffer.h"
+
+#define SIM_TICK_NS (NS_PER_SECOND / 60)
+#define SIM_SECONDS 20
+#define SIM_TICKS (60 * SIM_SECONDS)
+#define SIM_WARM_UP_TICKS 120
+// the client clock is this far off the server one
+#define SIM_CLOCK_OFFSET_NS (123 * NS_PER_SECOND + 4567891)
+
+struct sim_arrival
+{
+    u32 tick;
+    real_time arrival;
+};
+
+struct sim_result
+{
+    u32 frames;
+    u32 uneven_immediate;
+    u32 uneven_buffered;
+    u32 late;
+    u64 delay_ns;
+};
+
+u64
+RandomNs(u64 max_ns)
+{
+    return (u64)(((r64)rand() / (r64)RAND_MAX) * (r64)max_ns);
+}
+
+int
+CompareArrival(const void * a, const void * b)
+{
+    const sim_arrival * arrival_a = (const sim_arrival *)a;
+    const sim_arrival * arrival_b = (const sim_arrival *)b;
+
+    return arrival_a->arrival < arrival_b->arrival ? -1 : arrival_a->arrival > arrival_b->arrival;
+}
+
+void
+TestOrder()
+{
+    static jitter_buffer buffer;
+    JitterBufferInit(&buffer, SIM_TICK_NS);
+
+    world_snapshot snapshot = {};
+    real_time start = 10 * NS_PER_SECOND;
+    u32 ticks[] = { 1, 3, 2, 2 };
+    for (u32 i = 0; i < ArrayCount(ticks); ++i)
+    {
+        snapshot.tick = ticks[i];
+        JitterBufferPush(&buffer, ticks[i], &snapshot, start + ticks[i] * SIM_TICK_NS);
+    }
+    Assert(buffer.reordered == 1 && buffer.duplicates == 1);
+    Assert(JitterBufferCount(&buffer) == 3);
+
+    // no jitter, the delay is the margin
+    JitterBufferUpdate(&buffer, start);
+    Assert(JitterBufferDelayNs(&buffer) == JITTER_BUFFER_MARGIN_NS);
+
+    // tick 1 got in at start + 1 tick, it plays a margin later
+    Assert(JitterBufferPop(&buffer, start + SIM_TICK_NS) == 0);
+    real_time now = start + 3 * SIM_TICK_NS + JITTER_BUFFER_MARGIN_NS;
+    for (u32 tick = 1; tick <= 3; ++tick)
+    {
+        const jitter_buffer_entry * entry = JitterBufferPop(&buffer, now);
+        Assert(entry && entry->tick == tick && entry->snapshot.tick == tick);
+    }
+    Assert(JitterBufferPop(&buffer, now) == 0);
+
+    // after tick 3 played 2 is late, 3 again a duplicate
+    snapshot.tick = 2;
+    Assert(!JitterBufferPush(&buffer, 2, &snapshot, now));
+    snapshot.tick = 3;
+    Assert(!JitterBufferPush(&buffer, 3, &snapshot, now));
+    Assert(buffer.late == 1 && buffer.duplicates == 2);
+
+    // a tick far from playout is a new server
+    snapshot.tick = 100000;
+    Assert(JitterBufferPush(&buffer, 100000, &snapshot, now));
+    Assert(buffer.resets == 1 && !buffer.playing);
+
+    printf("order: reordered played in order, late and duplicates dropped\n");
+}
+
+/* jitter up to jitter_ns, the first second_jitter_tick ticks, then up to second_jitter_ns */
+sim_result
+Simulate(const char * name, u64 jitter_ns, u32 second_jitter_tick, u64 second_jitter_ns)
+{
+    static sim_arrival arrivals[SIM_TICKS];
+    static jitter_buffer buffer;
+    JitterBufferInit(&buffer, SIM_TICK_NS);
+
+    u32 arrival_count = 0;
+    for (u32 tick = 0; tick < SIM_TICKS; ++tick)
+    {
+        // 1% lost
+        if (rand() % 100 == 0)
+        {
+            continue;
+        }
+        // mostly a little, now and then a lot
+        u64 max_jitter_ns = tick < second_jitter_tick ? jitter_ns : second_jitter_ns;
+        u64 jitter = (rand() % 10) ? RandomNs(max_jitter_ns / 4) : RandomNs(max_jitter_ns);
+        arrivals[arrival_count].tick = tick;
+        arrivals[arrival_count].arrival = SIM_CLOCK_OFFSET_NS + tick * SIM_TICK_NS + 20 * NS_PER_MS + jitter;
+        arrival_count += 1;
+    }
+    qsort(arrivals, arrival_count, sizeof(sim_arrival), CompareArrival);
+
+    sim_result result = {};
+    world_snapshot snapshot = {};
+    u32 next_arrival = 0;
+    b32 has_shown = false;
+    u32 shown_tick = 0;
+    u64 delay_at_switch = 0;
+    for (u32 frame = 0; frame < SIM_TICKS; ++frame)
+    {
+        real_time now = SIM_CLOCK_OFFSET_NS + frame * SIM_TICK_NS + 7 * NS_PER_MS;
+
+        // as they get in, the newest shows
+        u32 new_immediate = 0;
+        for (; next_arrival < arrival_count && arrivals[next_arrival].arrival <= now; ++next_arrival)
+        {
+            sim_arrival * arrival = arrivals + next_arrival;
+            if (!has_shown || (i32)(arrival->tick - shown_tick) > 0)
+            {
+                has_shown = true;
+                shown_tick = arrival->tick;
+                new_immediate += 1;
+            }
+            snapshot.tick = arrival->tick;
+            JitterBufferPush(&buffer, arrival->tick, &snapshot, arrival->arrival);
+        }
+
+        JitterBufferUpdate(&buffer, now);
+        u32 new_buffered = 0;
+        u32 last_played = 0;
+        for (const jitter_buffer_entry * entry = JitterBufferPop(&buffer, now); entry; entry = JitterBufferPop(&buffer, now))
+        {
+            Assert(new_buffered == 0 || (i32)(entry->tick - last_played) > 0);
+            last_played = entry->tick;
+            new_buffered += 1;
+        }
+
+        if (frame == second_jitter_tick)
+        {
+            delay_at_switch = JitterBufferDelayNs(&buffer);
+        }
+
+        if (frame >= SIM_WARM_UP_TICKS)
+        {
+            result.frames += 1;
+            result.uneven_immediate += (new_immediate != 1);
+            result.uneven_buffered += (new_buffered != 1);
+        }
+    }
+    result.late = buffer.late;
+    result.delay_ns = JitterBufferDelayNs(&buffer);
+
+    printf("%-22s %u frames, no new tick or more than one: as they come %4u, buffered %4u; "
+           "%u reordered, %u late of %u, delay %.1f ms (p95 jitter %.1f ms)",
+           name, result.frames, result.uneven_immediate, result.uneven_buffered,
+           buffer.reordered, buffer.late, buffer.pushed,
+           NsToMs(result.delay_ns), NsToMs(buffer.jitter_p95_ns));
+    if (second_jitter_tick < SIM_TICKS)
+    {
+        printf(", %.1f ms when the jitter went", NsToMs(delay_at_switch));
+    }
+    printf("\n");
+
+    return result;
+}
+
+int
+main()
+{
+    srand(11);
+
+    TestOrder();
+
+    sim_result lan = Simulate("jitter up to 5 ms", 5 * NS_PER_MS, SIM_TICKS, 0);
+    sim_result wifi = Simulate("jitter up to 40 ms", 40 * NS_PER_MS, SIM_TICKS, 0);
+    // under the frame time the jitter barely shows, what's left is lost packets and it costs a few ms
+    Assert(lan.uneven_buffered <= lan.uneven_immediate);
+    Assert(lan.delay_ns < 5 * NS_PER_MS);
+    Assert(wifi.uneven_buffered * 4 < wifi.uneven_immediate);
+    // sized to the 95th percentile, a few percent at most play too late
+    Assert(wifi.late * 100 < SIM_TICKS * 5);
+    Assert(wifi.delay_ns > 5 * NS_PER_MS && wifi.delay_ns < 45 * NS_PER_MS);
+
+    // 40 ms of jitter for 10 s then 1 ms
+    sim_result calmer = Simulate("40 ms, then 1 ms", 40 * NS_PER_MS, SIM_TICKS / 2, 1 * NS_PER_MS);
+    Assert(calmer.delay_ns < 3 * NS_PER_MS);
+
+    return 0;
+}
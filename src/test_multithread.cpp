@@ -0,0 +1,158 @@
+/*
+ * Work queue, linux_multithread.cpp
+ *  - every job runs exactly once, batch after batch, with the pool created
+ *    and cleaned up in between
+ *  - jobs a second through AddWorkToQueue and CompleteWorkQueue in batches
+ *    of BENCH_BATCH, what a frame would hand out. Empty jobs for what the
+ *    queue itself costs, small jobs (a few hundred ns) for what the workers
+ *    add. Called inline, the calling thread alone, one worker and a worker
+ *    per core
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "platform.h"
+#include "linux_multithread.cpp"
+
+#define BENCH_BATCH 200
+#define BENCH_JOBS (1000 * 1000)
+#define SMALL_JOB_ROUNDS 256
+
+struct bench_job
+{
+    u32 runs;
+    u32 seed;
+    u64 result;
+};
+
+static bench_job jobs[BENCH_BATCH];
+
+THREAD_WORK_HANDLER(EmptyJob)
+{
+    bench_job * Job = (bench_job *)Data;
+    Job->runs += 1;
+}
+
+THREAD_WORK_HANDLER(SmallJob)
+{
+    bench_job * Job = (bench_job *)Data;
+    u64 x = Job->seed | 1;
+    for (u32 round = 0; round < SMALL_JOB_ROUNDS; ++round)
+    {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+    }
+    Job->result = x;
+    Job->runs += 1;
+}
+
+/* ns a job, queue 0 calls them inline */
+r64
+Bench(const char * name, thread_work_queue * Queue, thread_work_handler * Handler)
+{
+    memset(jobs, 0, sizeof(jobs));
+    for (u32 job = 0; job < BENCH_BATCH; ++job)
+    {
+        jobs[job].seed = job;
+    }
+
+    u32 batches = BENCH_JOBS / BENCH_BATCH;
+    real_time start = GetRealTime();
+    for (u32 batch = 0; batch < batches; ++batch)
+    {
+        for (u32 job = 0; job < BENCH_BATCH; ++job)
+        {
+            if (Queue)
+            {
+                AddWorkToQueue(Queue, Handler, jobs + job);
+            }
+            else
+            {
+                Handler(0, jobs + job);
+            }
+        }
+        if (Queue)
+        {
+            CompleteWorkQueue(Queue);
+        }
+    }
+    u64 elapsed = GetRealTime() - start;
+
+    // each one exactly once a batch, and done by the time CompleteWorkQueue returned
+    for (u32 job = 0; job < BENCH_BATCH; ++job)
+    {
+        Assert(jobs[job].runs == batches);
+    }
+
+    r64 ns_per_job = (r64)elapsed / (r64)(batches * BENCH_BATCH);
+    printf("%-34s %6.2f M jobs/s, %7.1f ns a job, %6.1f us a batch\n",
+           name, 1000.0 / ns_per_job, ns_per_job, ns_per_job * BENCH_BATCH / 1000.0);
+
+    return ns_per_job;
+}
+
+void
+TestCreateClean()
+{
+    static thread_work_queue Queue;
+    for (u32 round = 0; round < 20; ++round)
+    {
+        CreateWorkQueue(&Queue, 1 + round % 4);
+        Assert(Queue.ThreadCount == 1 + round % 4);
+
+        memset(jobs, 0, sizeof(jobs));
+        for (u32 job = 0; job < BENCH_BATCH; ++job)
+        {
+            AddWorkToQueue(&Queue, EmptyJob, jobs + job);
+        }
+        CompleteWorkQueue(&Queue);
+        for (u32 job = 0; job < BENCH_BATCH; ++job)
+        {
+            Assert(jobs[job].runs == 1);
+        }
+
+        CleanWorkQueue(&Queue);
+        Assert(Queue.ThreadCount == 0);
+    }
+
+    printf("create and clean: workers joined, every job once\n");
+}
+
+int
+main()
+{
+    TimeInit(true);
+
+    TestCreateClean();
+
+    static thread_work_queue Queue;
+    u32 cores = GetCoreCount();
+    printf("%u cores, batches of %u, %u jobs\n", cores, BENCH_BATCH, BENCH_JOBS);
+
+    for (u32 handler = 0; handler < 2; ++handler)
+    {
+        thread_work_handler * Handler = handler ? SmallJob : EmptyJob;
+        const char * kind = handler ? "small" : "empty";
+        char name[64];
+
+        sprintf(name, "%s, inline", kind);
+        Bench(name, 0, Handler);
+
+        // no workers, CompleteWorkQueue runs them all
+        CleanWorkQueue(&Queue);
+        sprintf(name, "%s, calling thread alone", kind);
+        Bench(name, &Queue, Handler);
+
+        CreateWorkQueue(&Queue, 1);
+        sprintf(name, "%s, 1 worker", kind);
+        Bench(name, &Queue, Handler);
+
+        CreateWorkQueue(&Queue, 0);
+        sprintf(name, "%s, %u workers (a core each)", kind, Queue.ThreadCount);
+        Bench(name, &Queue, Handler);
+        CleanWorkQueue(&Queue);
+    }
+
+    return 0;
+}
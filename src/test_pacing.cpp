@@ -0,0 +1,102 @@
+/*
+ * Simulates the server send loop with 10k clients against a bounded
+ * socket/nic queue drained at link rate, with and without pacing slots.
+ * Every client sends one full datagram per frame.
+ * A burst is considered instantaneous (back to back sendto calls),
+ * the queue drains between slots.
+ * The server's slot count has to lose nothing.
+ */
+#include <stdio.h>
+#include "pacing.h"
+
+#define SIM_CLIENTS 10000
+#define SIM_FRAMES 20
+#define SIM_FRAME_MS 50.0
+// 508 udp payload + 8 udp + 20 ip
+#define SIM_DATAGRAM_BYTES (508 + 28)
+// default linux wmem
+#define SIM_QUEUE_BYTES 212992.0
+// 1 Gbit/s in bytes per ms
+#define SIM_LINK_BYTES_PER_MS 125000.0
+// SERVER_PACING_SLOTS, udp_server.cpp
+#define SIM_SERVER_SLOTS 32
+
+struct sim_result
+{
+    u32 max_burst;
+    r64 max_queue_bytes;
+    u32 sent;
+    u32 lost;
+};
+
+sim_result
+SimulatePacing(u32 slot_count)
+{
+    sim_result result = {};
+
+    pacing_scheduler pacing;
+    PacingInit(&pacing, slot_count);
+
+    for (u32 client_index = 0; client_index < SIM_CLIENTS; ++client_index)
+    {
+        PacingAssignSlot(&pacing);
+    }
+
+    r64 queue_bytes = 0.0;
+    r64 last_time_ms = 0.0;
+
+    for (u32 frame = 0; frame < SIM_FRAMES; ++frame)
+    {
+        for (u32 slot = 0; slot < slot_count; ++slot)
+        {
+            r64 now_ms = frame * SIM_FRAME_MS + PacingSlotOffsetMs(&pacing, slot, (r32)SIM_FRAME_MS);
+
+            queue_bytes -= (now_ms - last_time_ms) * SIM_LINK_BYTES_PER_MS;
+            queue_bytes = queue_bytes < 0.0 ? 0.0 : queue_bytes;
+            last_time_ms = now_ms;
+
+            u32 burst = pacing.clients_in_slot[slot];
+            result.max_burst = burst > result.max_burst ? burst : result.max_burst;
+
+            for (u32 i = 0; i < burst; ++i)
+            {
+                result.sent += 1;
+                if (queue_bytes + SIM_DATAGRAM_BYTES > SIM_QUEUE_BYTES)
+                {
+                    result.lost += 1;
+                }
+                else
+                {
+                    queue_bytes += SIM_DATAGRAM_BYTES;
+                }
+            }
+
+            result.max_queue_bytes = queue_bytes > result.max_queue_bytes ? queue_bytes : result.max_queue_bytes;
+        }
+    }
+
+    return result;
+}
+
+int
+main()
+{
+    printf("%u clients, %.0f ms frame, %u b datagram, %.0f b queue, %.0f Mbit/s link\n",
+            SIM_CLIENTS, SIM_FRAME_MS, SIM_DATAGRAM_BYTES, SIM_QUEUE_BYTES, SIM_LINK_BYTES_PER_MS * 8.0 / 1000.0);
+    printf("%8s %10s %12s %10s\n", "slots", "max burst", "max queue", "loss %");
+
+    u32 slot_counts[] = { 1, 8, 16, 32, 64 };
+    for (u32 i = 0; i < ArrayCount(slot_counts); ++i)
+    {
+        sim_result result = SimulatePacing(slot_counts[i]);
+        printf("%8u %10u %12.0f %10.2f\n",
+                slot_counts[i], result.max_burst, result.max_queue_bytes,
+                100.0 * (r64)result.lost / (r64)result.sent);
+    }
+
+    // what the server runs with loses nothing
+    sim_result server = SimulatePacing(SIM_SERVER_SLOTS);
+    Assert(server.lost == 0);
+
+    return 0;
+}
@@ -0,0 +1,388 @@
+/*
+ * Packet packing benchmark.
+ * Every tick a realistic mix of messages is queued and sent in datagrams of
+ * PACKET_PAYLOAD_SIZE until none is left:
+ *  - fifo next fit, one header per message (what the send loop used to do)
+ *  - ChannelsPackPacket once a datagram, merged runs in priority order
+ * A fragment never starts a merged run, its order is on the wire.
+ * And on receive, a packet with more messages than delivered holds and a
+ * merged run claiming more members than its length can hold.
+ * A slot taken by a new message forgets the copies of the old one, and
+ * acks free pending messages only when they timed out in that packet.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "channel.cpp"
+
+#define BENCH_TICKS 20000
+#define BENCH_MAX_DATAGRAMS 8
+
+enum bench_type
+{
+    bench_type_position = 3,
+    bench_type_input = 4,
+    bench_type_event = 5,
+    bench_type_chat = 6
+};
+
+struct bench_mix
+{
+    const char * name;
+    u32 positions_min, positions_max;
+    u32 inputs_max;
+    u32 events_max;
+    u32 event_size_max;
+    // one in n ticks
+    u32 chat_every;
+};
+
+struct bench_msg
+{
+    channel_id channel;
+    package_type type;
+    u32 size;
+};
+
+inline u32
+RandomBetween(u32 lo, u32 hi)
+{
+    u32 value = lo + (u32)rand() % (hi - lo + 1);
+
+    return value;
+}
+
+u32
+GenerateTick(bench_mix * mix, bench_msg * out)
+{
+    u32 count = 0;
+
+    // entity positions, quantized
+    u32 positions = RandomBetween(mix->positions_min, mix->positions_max);
+    for (u32 i = 0; i < positions; ++i)
+    {
+        out[count++] = { channel_unreliable, (package_type)bench_type_position, RandomBetween(10, 18) };
+    }
+
+    // inputs and gameplay events interleaved on the same channel
+    u32 inputs = RandomBetween(1, mix->inputs_max);
+    u32 events = RandomBetween(0, mix->events_max);
+    for (u32 i = 0; i < inputs + events; ++i)
+    {
+        b32 is_input = (i < inputs);
+        out[count++] = { channel_reliable_unordered,
+                         (package_type)(is_input ? bench_type_input : bench_type_event),
+                         is_input ? RandomBetween(4, 8) : RandomBetween(24, mix->event_size_max) };
+    }
+
+    if (RandomBetween(0, mix->chat_every - 1) == 0)
+    {
+        out[count++] = { channel_reliable_ordered, (package_type)bench_type_chat, RandomBetween(20, 96) };
+    }
+
+    // shuffle so the queue order isn't already sorted by channel
+    for (u32 i = count - 1; i > 0; --i)
+    {
+        u32 j = RandomBetween(0, i);
+        bench_msg tmp = out[i];
+        out[i] = out[j];
+        out[j] = tmp;
+    }
+
+    return count;
+}
+
+void
+RunMix(bench_mix * mix, real_time clock_freq)
+{
+    srand(1234);
+
+    message_channels channels;
+    ChannelsInit(&channels);
+
+    u8 datagram[PACKET_PAYLOAD_SIZE];
+    u8 payload[96] = {};
+
+    u32 fifo_datagrams = 0, fifo_bytes = 0;
+    u32 merged_datagrams = 0, merged_bytes = 0;
+    u32 payload_bytes = 0;
+    u32 message_count = 0;
+    u32 pack_calls = 0;
+    r64 pack_ms = 0.0;
+    u32 seq = 0;
+
+    for (u32 tick = 0; tick < BENCH_TICKS; ++tick)
+    {
+        bench_msg tick_msgs[64];
+        u32 count = GenerateTick(mix, tick_msgs);
+
+        /* FIFO NEXT FIT */
+        u32 bin_used = 0;
+        u32 bins_used = 1;
+        for (u32 i = 0; i < count; ++i)
+        {
+            u32 msg_size = sizeof(message_header) + tick_msgs[i].size;
+            if (bin_used + msg_size > PACKET_PAYLOAD_SIZE)
+            {
+                bins_used += 1;
+                bin_used = 0;
+            }
+            bin_used += msg_size;
+            fifo_bytes += msg_size;
+            payload_bytes += tick_msgs[i].size;
+        }
+        fifo_datagrams += bins_used;
+        message_count += count;
+
+        /* MERGED, A DATAGRAM AT A TIME */
+        for (u32 i = 0; i < count; ++i)
+        {
+            b32 queued = CreatePackages(&channels, tick_msgs[i].channel, tick_msgs[i].type,
+                                        payload, tick_msgs[i].size, MESSAGE_PRIORITY_NORMAL);
+            Assert(queued);
+        }
+
+        for (u32 datagram_index = 0; ChannelsHasPending(&channels); ++datagram_index)
+        {
+            Assert(datagram_index < BENCH_MAX_DATAGRAMS);
+            u16 packed = 0;
+            b32 has_reliable = false;
+
+            real_time start = GetRealTime();
+            u32 used = ChannelsPackPacket(&channels, seq, datagram, sizeof(datagram), &packed, &has_reliable);
+            pack_ms += GetTimeDiff(GetRealTime(), start, clock_freq);
+            pack_calls += 1;
+
+            // peer got everything
+            ChannelsOnPacketAcked(&channels, seq++);
+            merged_datagrams += 1;
+            merged_bytes += used;
+        }
+
+        for (u32 channel = 0; channel < channel_count; ++channel)
+        {
+            Assert(CountFreeMessages(channels.send_queue + channel) == 32);
+        }
+    }
+
+    printf("\n%s: %.1f messages/tick, %.1f payload bytes/tick, %u bytes per datagram, %u ticks\n",
+            mix->name, (r64)message_count / BENCH_TICKS, (r64)payload_bytes / BENCH_TICKS, 
+            (u32)(PACKET_PAYLOAD_SIZE), BENCH_TICKS);
+    printf("%-22s %12s %12s\n", "", "datagrams/t", "bytes/t");
+    printf("%-22s %12.2f %12.1f\n", "fifo next fit",
+            (r64)fifo_datagrams / BENCH_TICKS, (r64)fifo_bytes / BENCH_TICKS);
+    printf("%-22s %12.2f %12.1f\n", "merged, by priority",
+            (r64)merged_datagrams / BENCH_TICKS, (r64)merged_bytes / BENCH_TICKS);
+    printf("pack: %.0f ns per call\n", pack_ms * 1000000.0 / (r64)pack_calls);
+
+    // fewer headers on the wire and never more datagrams for it
+    Assert(merged_bytes < fifo_bytes);
+    Assert(merged_datagrams <= fifo_datagrams);
+}
+
+/* a fragment followed by the next id of its type: both keep their own header */
+void
+TestFragmentSeed()
+{
+    message_channels channels;
+    ChannelsInit(&channels);
+
+    u8 payload[400] = {};
+    u32 msg_data_size = sizeof(channels.send_queue[0].messages[0].data);
+    Assert(sizeof(payload) > msg_data_size);
+    b32 queued = 
+        CreatePackages(&channels, channel_reliable_ordered, (package_type)bench_type_chat, payload, sizeof(payload), MESSAGE_PRIORITY_NORMAL) &&
+        CreatePackages(&channels, channel_reliable_ordered, (package_type)bench_type_chat, payload, 8, MESSAGE_PRIORITY_NORMAL);
+    Assert(queued);
+
+    u8 datagram[PACKET_MAX_PAYLOAD_SIZE];
+    u16 packed = 0;
+    b32 has_reliable = false;
+    u32 used = ChannelsPackPacket(&channels, 0, datagram, sizeof(datagram), &packed, &has_reliable);
+    Assert(!ChannelsHasPending(&channels) && has_reliable);
+
+    // buffer header, the fragments in order, then the small one
+    u32 fragments = (sizeof(payload) + msg_data_size - 1) / msg_data_size;
+    Assert(packed == fragments + 2);
+    u32 at = 0;
+    for (u32 record = 0; record < packed; ++record)
+    {
+        message_header * header = (message_header *)(datagram + at);
+        Assert((header->message_type & MESSAGE_MERGED_FLAG) == 0);
+        Assert(header->order == (record <= fragments ? record : 0));
+        at += sizeof(message_header) + header->len;
+    }
+    Assert(at == used);
+
+    printf("fragments: %u records, none merged, orders kept\n", (u32)packed);
+}
+
+/* more messages in a packet than CHANNEL_MAX_DELIVERED: refused, not written past the end */
+void
+TestReceiveBounds()
+{
+    message_channels channels;
+    ChannelsInit(&channels);
+
+    message delivered[CHANNEL_MAX_DELIVERED];
+    u32 delivered_count = 0;
+    message msg = {};
+
+    // 200 empty unreliable messages fit in a datagram, 4 bytes each
+    u32 accepted = 0;
+    for (u32 i = 0; i < 200; ++i)
+    {
+        msg.header.message_type = (u8)(bench_type_position | (channel_unreliable << MESSAGE_CHANNEL_SHIFT));
+        msg.header.id = (u8)i;
+        if (!ChannelReceiveRecord(&channels, &msg, delivered, &delivered_count))
+        {
+            break;
+        }
+        accepted += 1;
+    }
+    Assert(accepted == CHANNEL_MAX_DELIVERED && delivered_count == CHANNEL_MAX_DELIVERED);
+    Assert(channels.delivered_full == 1);
+
+    // ordered ones that don't fit stay in the reorder buffer, the next packet gets them out
+    for (u32 i = 0; i < 4; ++i)
+    {
+        msg.header.message_type = (u8)(bench_type_chat | (channel_reliable_ordered << MESSAGE_CHANNEL_SHIFT));
+        msg.header.id = (u8)i;
+        Assert(!ChannelReceiveRecord(&channels, &msg, delivered, &delivered_count));
+    }
+    Assert(delivered_count == CHANNEL_MAX_DELIVERED && channels.delivered_full == 5);
+
+    delivered_count = 0;
+    msg.header.id = 4;
+    Assert(ChannelReceiveRecord(&channels, &msg, delivered, &delivered_count));
+    Assert(delivered_count == 5 && channels.receive[channel_reliable_ordered].next_id == 5);
+    for (u32 i = 0; i < delivered_count; ++i)
+    {
+        Assert(delivered[i].header.id == i);
+    }
+
+    // a merged run of 255 in 10 bytes
+    msg.header.message_type = (u8)(bench_type_position | MESSAGE_MERGED_FLAG | (channel_unreliable << MESSAGE_CHANNEL_SHIFT));
+    msg.header.order = 255;
+    msg.header.len = 10;
+    Assert(!ChannelReceiveRecord(&channels, &msg, delivered, &delivered_count));
+    Assert(channels.records_malformed == 1 && delivered_count == 5);
+
+    // 10 members of 0 bytes but room for 3
+    msg.header.order = 10;
+    delivered_count = CHANNEL_MAX_DELIVERED - 3;
+    Assert(!ChannelReceiveRecord(&channels, &msg, delivered, &delivered_count));
+    Assert(delivered_count == CHANNEL_MAX_DELIVERED && channels.delivered_full == 6);
+
+    // a channel that doesn't exist
+    msg.header.order = 0;
+    msg.header.len = 0;
+    msg.header.message_type = (u8)(bench_type_chat | (channel_count << MESSAGE_CHANNEL_SHIFT));
+    Assert(!ChannelReceiveRecord(&channels, &msg, delivered, &delivered_count));
+    Assert(channels.records_malformed == 2);
+
+    printf("receive: %u of 200 messages taken, the packet refused\n", accepted);
+}
+
+/* a late ack of a copy of the last message in a slot leaves the new one queued */
+void
+TestSlotReuse()
+{
+    message_channels channels;
+    ChannelsInit(&channels);
+    queue_message * queue = channels.send_queue + channel_reliable_ordered;
+
+    u8 payload[8] = {};
+    u8 datagram[PACKET_MAX_PAYLOAD_SIZE];
+    u16 packed = 0;
+    b32 has_reliable = false;
+
+    // sent in 10, a copy in 11, 10 acked first
+    Assert(CreatePackages(&channels, channel_reliable_ordered, (package_type)bench_type_chat, payload, sizeof(payload), MESSAGE_PRIORITY_HIGH));
+    ChannelsPackPacket(&channels, 10, datagram, sizeof(datagram), &packed, &has_reliable);
+    Assert(ChannelsPackRedundant(&channels, 11, datagram, sizeof(datagram), 1, &packed) > 0);
+    ChannelsOnPacketAcked(&channels, 10);
+    Assert(queue->state[0] == message_state_free);
+
+    // slot 0 comes around again
+    for (u32 i = 0; i < QUEUE_SIZE(queue); ++i)
+    {
+        Assert(CreatePackages(&channels, channel_reliable_ordered, (package_type)bench_type_chat, payload, sizeof(payload), MESSAGE_PRIORITY_HIGH));
+    }
+    Assert(queue->state[0] == message_state_pending && queue->copies[0] == 0);
+
+    ChannelsOnPacketAcked(&channels, 11);
+    for (u32 i = 0; i < QUEUE_SIZE(queue); ++i)
+    {
+        Assert(queue->state[i] == message_state_pending);
+    }
+    Assert(channels.retransmits_avoided == 0);
+
+    printf("slot reuse: a late ack of the copy of the old message leaves the new one queued\n");
+}
+
+/* an ack frees a pending message only if it was sent in that packet and timed out */
+void
+TestAckTimedOut()
+{
+    message_channels channels;
+    ChannelsInit(&channels);
+    queue_message * unreliable = channels.send_queue + channel_unreliable;
+    queue_message * reliable = channels.send_queue + channel_reliable_unordered;
+
+    u8 payload[8] = {};
+    u8 datagram[PACKET_MAX_PAYLOAD_SIZE];
+    u16 packed = 0;
+    b32 has_reliable = false;
+
+    // never sent, sent_in_seq is 0 in both
+    Assert(CreatePackages(&channels, channel_unreliable, (package_type)bench_type_position, payload, sizeof(payload), MESSAGE_PRIORITY_NORMAL));
+    Assert(CreatePackages(&channels, channel_reliable_unordered, (package_type)bench_type_event, payload, sizeof(payload), MESSAGE_PRIORITY_NORMAL));
+    ChannelsOnPacketAcked(&channels, 0);
+    Assert(unreliable->state[0] == message_state_pending && reliable->state[0] == message_state_pending);
+
+    // sent in 0 and taken as lost: pending again, the late ack of 0 frees it
+    ChannelsPackPacket(&channels, 0, datagram, sizeof(datagram), &packed, &has_reliable);
+    Assert(reliable->state[0] == message_state_in_flight && unreliable->state[0] == message_state_free);
+    Assert(ChannelsOnPacketLost(&channels, 0) == 1);
+    Assert(reliable->state[0] == message_state_pending && reliable->timed_out[0]);
+    ChannelsOnPacketAcked(&channels, 0);
+    Assert(reliable->state[0] == message_state_free);
+
+    // resent in 5 after timing out in 4: the ack of 4 is too late to matter
+    Assert(CreatePackages(&channels, channel_reliable_unordered, (package_type)bench_type_event, payload, sizeof(payload), MESSAGE_PRIORITY_NORMAL));
+    ChannelsPackPacket(&channels, 4, datagram, sizeof(datagram), &packed, &has_reliable);
+    Assert(ChannelsOnPacketLost(&channels, 4) == 1);
+    ChannelsPackPacket(&channels, 5, datagram, sizeof(datagram), &packed, &has_reliable);
+    Assert(reliable->state[1] == message_state_in_flight && !reliable->timed_out[1]);
+    ChannelsOnPacketAcked(&channels, 4);
+    Assert(reliable->state[1] == message_state_in_flight);
+    ChannelsOnPacketAcked(&channels, 5);
+    Assert(reliable->state[1] == message_state_free);
+
+    printf("timed out: acks free only messages that timed out in that packet\n");
+}
+
+int
+main()
+{
+    TimeInit(false);
+    real_time clock_freq = GetClockResolution();
+
+    TestFragmentSeed();
+    TestReceiveBounds();
+    TestSlotReuse();
+    TestAckTimedOut();
+
+    bench_mix mixes[] = 
+    {
+        { "light (few entities)",   8, 20, 4, 3, 60, 10 },
+        { "heavy (crowded area)",  24, 32, 8, 12, 90, 3 },
+    };
+
+    for (u32 i = 0; i < ArrayCount(mixes); ++i)
+    {
+        RunMix(mixes + i, clock_freq);
+    }
+
+    return 0;
+}
@@ -0,0 +1,191 @@
+/*
+ * Received payload parsing, message_iterator.h
+ * Walks server traffic from test_traffic.h:
+ *  - every packet walks whole and ends at its last byte
+ *  - cut short at every size or with a record made overlong, no record
+ *    handed out reaches past the bytes received
+ *  - ns per packet to walk the records, against the same walk with no checks
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "channel.cpp"
+#include "snapshot.cpp"
+#include "message_iterator.h"
+#include "test_traffic.h"
+
+#define BENCH_ROUNDS 50
+
+/* record bytes the checks see, so the walks can't be left out */
+inline u32
+RecordSum(message * record)
+{
+    u32 sum = record->header.len + record->header.message_type;
+    if (record->header.len)
+    {
+        sum += record->data[record->header.len - 1];
+    }
+
+    return sum;
+}
+
+/* records in bounds, the number of them */
+u32
+WalkChecked(u8 * payload, u32 size, u32 messages, b32 * ok)
+{
+    u32 count = 0;
+    message_iterator it = MessageIterator(payload, size, messages);
+    for (message * record = MessageNext(&it); record; record = MessageNext(&it))
+    {
+        u8 * begin = (u8 *)record;
+        u8 * end = begin + sizeof(message_header) + record->header.len;
+        Assert(begin >= payload && end <= payload + size);
+        count += 1;
+    }
+    *ok = MessageIteratorOk(&it);
+
+    return count;
+}
+
+void
+TestCapture(capture * c)
+{
+    for (u32 packet_index = 0; packet_index < c->count; ++packet_index)
+    {
+        u8 * payload = c->data + c->offset[packet_index];
+        u32 size = c->size[packet_index];
+
+        message_iterator it = MessageIterator(payload, size, c->messages[packet_index]);
+        u32 count = 0;
+        for (message * record = MessageNext(&it); record; record = MessageNext(&it))
+        {
+            count += 1;
+        }
+        Assert(MessageIteratorOk(&it) && count == c->messages[packet_index]);
+        Assert(it.at == payload + size);
+    }
+    printf("capture: %u packets walk whole\n", c->count);
+}
+
+void
+TestMalformed(capture * c)
+{
+    u32 cut_rejected = 0;
+    u32 overlong_rejected = 0;
+    u32 tested = 0;
+    static u8 payload[PACKET_MAX_PAYLOAD_SIZE];
+
+    for (u32 packet_index = 0; packet_index < c->count && packet_index < 2000; ++packet_index)
+    {
+        u32 size = c->size[packet_index];
+        u32 messages = c->messages[packet_index];
+        if (messages == 0)
+        {
+            continue;
+        }
+        tested += 1;
+
+        // cut short at every size, in a buffer of its own so reads past it show
+        for (u32 cut = 0; cut < size; ++cut)
+        {
+            u8 * cut_payload = (u8 *)malloc(cut ? cut : 1);
+            memcpy(cut_payload, c->data + c->offset[packet_index], cut);
+            b32 ok = true;
+            WalkChecked(cut_payload, cut, messages, &ok);
+            Assert(!ok);
+            cut_rejected += 1;
+            free(cut_payload);
+        }
+
+        // one record says it is longer than what is left
+        memcpy(payload, c->data + c->offset[packet_index], size);
+        u32 target = rand() % messages;
+        message_iterator it = MessageIterator(payload, size, messages);
+        message * record = MessageNext(&it);
+        for (u32 i = 0; i < target; ++i)
+        {
+            record = MessageNext(&it);
+        }
+        u32 left = (u32)(payload + size - (u8 *)record) - sizeof(message_header);
+        if (left < 255)
+        {
+            record->header.len = (u8)(left + 1 + rand() % (255 - left));
+            b32 ok = true;
+            u32 count = WalkChecked(payload, size, messages, &ok);
+            Assert(!ok && count == target);
+            overlong_rejected += 1;
+        }
+    }
+    printf("malformed: %u packets, %u cut short and %u overlong rejected\n", tested, cut_rejected, overlong_rejected);
+}
+
+void
+Bench(capture * c, real_time clock_freq)
+{
+    u32 records = 0;
+    for (u32 packet_index = 0; packet_index < c->count; ++packet_index)
+    {
+        records += c->messages[packet_index];
+    }
+
+    volatile u32 sink = 0;
+    u32 sum = 0;
+
+    // walk as the receive loops did, offsets summed with nothing checked
+    real_time start = GetRealTime();
+    for (u32 round = 0; round < BENCH_ROUNDS; ++round)
+    {
+        for (u32 packet_index = 0; packet_index < c->count; ++packet_index)
+        {
+            u8 * payload = c->data + c->offset[packet_index];
+            u32 offset = 0;
+            for (u32 msg_index = 0; msg_index < c->messages[packet_index]; ++msg_index)
+            {
+                message * record = (message *)(payload + offset);
+                sum += RecordSum(record);
+                offset += sizeof(message_header) + record->header.len;
+            }
+        }
+    }
+    r64 unchecked_ns = GetTimeDiff(GetRealTime(), start, clock_freq) * 1000000.0 / ((r64)BENCH_ROUNDS * c->count);
+    sink += sum;
+
+    start = GetRealTime();
+    for (u32 round = 0; round < BENCH_ROUNDS; ++round)
+    {
+        for (u32 packet_index = 0; packet_index < c->count; ++packet_index)
+        {
+            message_iterator it = MessageIterator(c->data + c->offset[packet_index], c->size[packet_index],
+                                                  c->messages[packet_index]);
+            for (message * record = MessageNext(&it); record; record = MessageNext(&it))
+            {
+                sum += RecordSum(record);
+            }
+            sum += MessageIteratorOk(&it);
+        }
+    }
+    r64 checked_ns = GetTimeDiff(GetRealTime(), start, clock_freq) * 1000000.0 / ((r64)BENCH_ROUNDS * c->count);
+    sink += sum;
+
+    printf("%u packets, %.2f records per packet\n", c->count, (r64)records / c->count);
+    printf("%-12s %10s %10s\n", "", "ns/pkt", "ns/record");
+    printf("%-12s %10.1f %10.2f\n", "unchecked", unchecked_ns, unchecked_ns * c->count / records);
+    printf("%-12s %10.1f %10.2f\n", "iterator", checked_ns, checked_ns * c->count / records);
+}
+
+int
+main()
+{
+    TimeInit(false);
+    real_time clock_freq = GetClockResolution();
+
+    static capture c;
+    c.data = (u8 *)malloc((size_t)CAPTURE_MAX_PACKETS * PACKET_PAYLOAD_SIZE);
+    CaptureTraffic(&c, 2);
+
+    TestCapture(&c);
+    TestMalformed(&c);
+    Bench(&c, clock_freq);
+
+    return 0;
+}
@@ -0,0 +1,293 @@
+/*
+ * Quantization test and benchmark.
+ *  - accuracy: worst error of positions, velocities and smallest three
+ *    quaternions over random values, asserted against the precision asked
+ *  - the SSE2 batches give bit for bit what the scalar versions give
+ *  - throughput of scalar against batch encode and decode, entities per
+ *    second for a position and an orientation each
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "quantize.cpp"
+
+#define TEST_VALUES 100003
+#define BENCH_ENTITIES 4096
+#define BENCH_ROUNDS 2000
+
+// 1 cm over a 655 m wide world, as snapshots use
+#define TEST_POSITION_MIN -327.68f
+#define TEST_POSITION_MAX 327.67f
+#define TEST_POSITION_PRECISION 0.01f
+
+inline r32
+RandomRange(r32 lo, r32 hi)
+{
+    r32 result = lo + (hi - lo) * ((r32)rand() / (r32)RAND_MAX);
+
+    return result;
+}
+
+quat
+RandomQuat()
+{
+    // uniform in the 4d ball, then on the sphere
+    for (;;)
+    {
+        quat q = { RandomRange(-1, 1), RandomRange(-1, 1), RandomRange(-1, 1), RandomRange(-1, 1) };
+        r32 length_sq = q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w;
+        if (length_sq > 0.01f && length_sq <= 1.0f)
+        {
+            r32 inv_length = 1.0f / sqrtf(length_sq);
+            q.x *= inv_length;
+            q.y *= inv_length;
+            q.z *= inv_length;
+            q.w *= inv_length;
+
+            return q;
+        }
+    }
+}
+
+/* degrees between the rotations, q and -q are the same one */
+r64
+QuatAngleDegrees(quat a, quat b)
+{
+    r64 dot = fabs((r64)a.x * b.x + (r64)a.y * b.y + (r64)a.z * b.z + (r64)a.w * b.w);
+    dot = (dot > 1.0) ? 1.0 : dot;
+
+    return 2.0 * acos(dot) * (180.0 / 3.14159265358979);
+}
+
+void
+TestFloat(const char * name, r32 min, r32 max, r32 precision)
+{
+    float_quantizer q = FloatQuantizer(min, max, precision);
+
+    static r32 values[TEST_VALUES];
+    static u32 scalar[TEST_VALUES];
+    static u32 batch[TEST_VALUES];
+    static r32 decoded[TEST_VALUES];
+
+    for (u32 i = 0; i < TEST_VALUES; ++i)
+    {
+        values[i] = RandomRange(min, max);
+        scalar[i] = QuantizeFloat(&q, values[i]);
+    }
+    // the ends and past them clamp
+    values[0] = min;
+    values[1] = max;
+    values[2] = min - 100.0f;
+    values[3] = max + 100.0f;
+    for (u32 i = 0; i < 4; ++i)
+    {
+        scalar[i] = QuantizeFloat(&q, values[i]);
+    }
+    Assert(scalar[0] == 0 && scalar[1] == q.max_value);
+    Assert(scalar[2] == 0 && scalar[3] == q.max_value);
+
+    QuantizeFloatBatch(&q, values, batch, TEST_VALUES);
+    DequantizeFloatBatch(&q, batch, decoded, TEST_VALUES);
+
+    r64 max_error = 0.0;
+    for (u32 i = 0; i < TEST_VALUES; ++i)
+    {
+        Assert(batch[i] == scalar[i]);
+        Assert(decoded[i] == DequantizeFloat(&q, scalar[i]));
+
+        r32 clamped = ClampFloat(values[i], min, max);
+        r64 error = fabs((r64)decoded[i] - (r64)clamped);
+        max_error = (error > max_error) ? error : max_error;
+    }
+
+    // half a step plus float rounding at the far end of the range
+    Assert(max_error <= precision * 0.5 + (max - min) * 1e-6);
+
+    printf("%-12s %9.3f %9.3f %9.4f %6u %12.6f\n", name, min, max, precision, q.bits, max_error);
+}
+
+void
+TestQuat(u32 bits)
+{
+    static r32 xs[TEST_VALUES], ys[TEST_VALUES], zs[TEST_VALUES], ws[TEST_VALUES];
+    static r32 dxs[TEST_VALUES], dys[TEST_VALUES], dzs[TEST_VALUES], dws[TEST_VALUES];
+    static u32 batch[TEST_VALUES];
+
+    for (u32 i = 0; i < TEST_VALUES; ++i)
+    {
+        quat q = RandomQuat();
+        xs[i] = q.x;
+        ys[i] = q.y;
+        zs[i] = q.z;
+        ws[i] = q.w;
+    }
+    // identity and ties between largest components
+    xs[0] = 0.0f; ys[0] = 0.0f; zs[0] = 0.0f; ws[0] = 1.0f;
+    xs[1] = 0.5f; ys[1] = -0.5f; zs[1] = 0.5f; ws[1] = -0.5f;
+    xs[2] = 0.0f; ys[2] = -QUAT_SQRT1_2; zs[2] = QUAT_SQRT1_2; ws[2] = 0.0f;
+
+    QuantizeQuatBatch(xs, ys, zs, ws, batch, TEST_VALUES, bits);
+    DequantizeQuatBatch(batch, dxs, dys, dzs, dws, TEST_VALUES, bits);
+
+    r64 max_angle = 0.0;
+    r64 sum_angle = 0.0;
+    r64 max_length_error = 0.0;
+    for (u32 i = 0; i < TEST_VALUES; ++i)
+    {
+        quat q = { xs[i], ys[i], zs[i], ws[i] };
+        u32 packed = QuantizeQuat(q, bits);
+        quat decoded = DequantizeQuat(packed, bits);
+        Assert(batch[i] == packed);
+        Assert(dxs[i] == decoded.x && dys[i] == decoded.y && dzs[i] == decoded.z && dws[i] == decoded.w);
+
+        r64 angle = QuatAngleDegrees(q, decoded);
+        max_angle = (angle > max_angle) ? angle : max_angle;
+        sum_angle += angle;
+
+        r64 length = sqrt((r64)decoded.x * decoded.x + (r64)decoded.y * decoded.y +
+                          (r64)decoded.z * decoded.z + (r64)decoded.w * decoded.w);
+        r64 length_error = fabs(length - 1.0);
+        max_length_error = (length_error > max_length_error) ? length_error : max_length_error;
+    }
+
+    // each component is off by at most half a step of sqrt(2) / (2^bits - 1)
+    r64 step = 1.41421356 / (r64)((1u << bits) - 1);
+    Assert(max_angle < 4.0 * step * (180.0 / 3.14159265358979));
+
+    printf("%6u %6u %12.4f %12.4f %14.6f\n",
+           bits, 2 + 3 * bits, sum_angle / TEST_VALUES, max_angle, max_length_error);
+}
+
+/* one position and one orientation per entity, arrays per component */
+struct bench_entities
+{
+    r32 position[3][BENCH_ENTITIES];
+    r32 orientation[4][BENCH_ENTITIES];
+    u32 quantized_position[3][BENCH_ENTITIES];
+    u32 quantized_orientation[BENCH_ENTITIES];
+};
+
+// keep the compiler from dropping the loops
+static volatile u32 sink;
+
+void
+BenchThroughput(real_time clock_freq)
+{
+    static bench_entities entities;
+    float_quantizer q = FloatQuantizer(TEST_POSITION_MIN, TEST_POSITION_MAX, TEST_POSITION_PRECISION);
+    u32 bits = 10;
+
+    for (u32 i = 0; i < BENCH_ENTITIES; ++i)
+    {
+        for (u32 axis = 0; axis < 3; ++axis)
+        {
+            entities.position[axis][i] = RandomRange(TEST_POSITION_MIN, TEST_POSITION_MAX);
+        }
+        quat o = RandomQuat();
+        entities.orientation[0][i] = o.x;
+        entities.orientation[1][i] = o.y;
+        entities.orientation[2][i] = o.z;
+        entities.orientation[3][i] = o.w;
+    }
+
+    r64 total_entities = (r64)BENCH_ENTITIES * BENCH_ROUNDS;
+    r64 ms[4];
+
+    // scalar encode
+    real_time start = GetRealTime();
+    for (u32 round = 0; round < BENCH_ROUNDS; ++round)
+    {
+        for (u32 i = 0; i < BENCH_ENTITIES; ++i)
+        {
+            for (u32 axis = 0; axis < 3; ++axis)
+            {
+                entities.quantized_position[axis][i] = QuantizeFloat(&q, entities.position[axis][i]);
+            }
+            quat o = { entities.orientation[0][i], entities.orientation[1][i],
+                       entities.orientation[2][i], entities.orientation[3][i] };
+            entities.quantized_orientation[i] = QuantizeQuat(o, bits);
+        }
+        sink += entities.quantized_orientation[round % BENCH_ENTITIES];
+    }
+    ms[0] = GetTimeDiff(GetRealTime(), start, clock_freq);
+
+    // batch encode
+    start = GetRealTime();
+    for (u32 round = 0; round < BENCH_ROUNDS; ++round)
+    {
+        for (u32 axis = 0; axis < 3; ++axis)
+        {
+            QuantizeFloatBatch(&q, entities.position[axis], entities.quantized_position[axis], BENCH_ENTITIES);
+        }
+        QuantizeQuatBatch(entities.orientation[0], entities.orientation[1], entities.orientation[2],
+                          entities.orientation[3], entities.quantized_orientation, BENCH_ENTITIES, bits);
+        sink += entities.quantized_orientation[round % BENCH_ENTITIES];
+    }
+    ms[1] = GetTimeDiff(GetRealTime(), start, clock_freq);
+
+    // scalar decode
+    start = GetRealTime();
+    for (u32 round = 0; round < BENCH_ROUNDS; ++round)
+    {
+        for (u32 i = 0; i < BENCH_ENTITIES; ++i)
+        {
+            for (u32 axis = 0; axis < 3; ++axis)
+            {
+                entities.position[axis][i] = DequantizeFloat(&q, entities.quantized_position[axis][i]);
+            }
+            quat o = DequantizeQuat(entities.quantized_orientation[i], bits);
+            entities.orientation[0][i] = o.x;
+            entities.orientation[1][i] = o.y;
+            entities.orientation[2][i] = o.z;
+            entities.orientation[3][i] = o.w;
+        }
+        sink += (u32)entities.position[0][round % BENCH_ENTITIES];
+    }
+    ms[2] = GetTimeDiff(GetRealTime(), start, clock_freq);
+
+    // batch decode
+    start = GetRealTime();
+    for (u32 round = 0; round < BENCH_ROUNDS; ++round)
+    {
+        for (u32 axis = 0; axis < 3; ++axis)
+        {
+            DequantizeFloatBatch(&q, entities.quantized_position[axis], entities.position[axis], BENCH_ENTITIES);
+        }
+        DequantizeQuatBatch(entities.quantized_orientation, entities.orientation[0], entities.orientation[1],
+                            entities.orientation[2], entities.orientation[3], BENCH_ENTITIES, bits);
+        sink += (u32)entities.position[0][round % BENCH_ENTITIES];
+    }
+    ms[3] = GetTimeDiff(GetRealTime(), start, clock_freq);
+
+    printf("%-10s %14s %14s %10s\n", "", "scalar M/s", "sse2 M/s", "speedup");
+    printf("%-10s %14.1f %14.1f %9.1fx\n", "encode",
+           total_entities / (ms[0] * 1000.0), total_entities / (ms[1] * 1000.0), ms[0] / ms[1]);
+    printf("%-10s %14.1f %14.1f %9.1fx\n", "decode",
+           total_entities / (ms[2] * 1000.0), total_entities / (ms[3] * 1000.0), ms[2] / ms[3]);
+}
+
+int
+main()
+{
+    TimeInit(false);
+    real_time clock_freq = GetClockResolution();
+
+    printf("floats, %u values\n", TEST_VALUES);
+    printf("%-12s %9s %9s %9s %6s %12s\n", "", "min", "max", "precision", "bits", "max error");
+    TestFloat("position xy", TEST_POSITION_MIN, TEST_POSITION_MAX, TEST_POSITION_PRECISION);
+    TestFloat("position z", -10.24f, 10.23f, TEST_POSITION_PRECISION);
+    TestFloat("velocity", -20.0f, 20.0f, 0.01f);
+    TestFloat("coarse", -1000.0f, 1000.0f, 0.5f);
+
+    printf("\nsmallest three, %u random unit quaternions\n", TEST_VALUES);
+    printf("%6s %6s %12s %12s %14s\n", "bits", "total", "avg deg", "max deg", "length error");
+    for (u32 bits = 6; bits <= QUAT_MAX_COMPONENT_BITS; bits += 2)
+    {
+        TestQuat(bits);
+    }
+
+    printf("\n%u entities x %u rounds, position + orientation each\n", BENCH_ENTITIES, BENCH_ROUNDS);
+    BenchThroughput(clock_freq);
+
+    return 0;
+}
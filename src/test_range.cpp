@@ -0,0 +1,283 @@
+/*
+ * Range coder benchmark and model trainer.
+ * Server traffic comes from test_traffic.h, one capture trains the models
+ * and another one with a different seed measures them:
+ *  - bits per packet raw, with the LZ stage, with the range coder and with
+ *    the packet stage that sends the smallest of them
+ *  - ns per packet to encode and decode, against a copy for the raw path
+ * Every packet is decoded back and compared.
+ * "test_range train" writes a new range_model.h to stdout.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "channel.cpp"
+#include "snapshot.cpp"
+#include "compress.cpp"
+#include "test_traffic.h"
+
+#define BENCH_ROUNDS 20
+
+/* TRAINER */
+
+/* counts of every byte in its model over the capture */
+void
+CountSymbols(capture * c, u64 counts[RANGE_MODEL_COUNT][256])
+{
+    for (u32 packet_index = 0; packet_index < c->count; ++packet_index)
+    {
+        const u8 * payload = c->data + c->offset[packet_index];
+        u32 at = 0;
+        for (u32 msg_index = 0; msg_index < c->messages[packet_index]; ++msg_index)
+        {
+            const message_header * record = (const message_header *)(payload + at);
+            for (i32 i = 0; i < (i32)sizeof(message_header); ++i)
+            {
+                counts[RangeModelIndex(0, i - (i32)sizeof(message_header))][payload[at + i]] += 1;
+            }
+            at += sizeof(message_header);
+
+            for (u32 i = 0; i < record->len; ++i)
+            {
+                counts[RangeModelIndex(record->message_type, (i32)i)][payload[at + i]] += 1;
+            }
+            at += record->len;
+        }
+        Assert(at == c->size[packet_index]);
+    }
+}
+
+/* counts scaled to RANGE_PROB_TOTAL, every symbol keeps at least 1 */
+void
+NormalizeFrequencies(const u64 * counts, u16 * frequency)
+{
+    u64 total = 0;
+    u32 most_seen = 0;
+    for (u32 symbol = 0; symbol < 256; ++symbol)
+    {
+        total += counts[symbol];
+        most_seen = (counts[symbol] > counts[most_seen]) ? symbol : most_seen;
+    }
+
+    if (total == 0)
+    {
+        for (u32 symbol = 0; symbol < 256; ++symbol)
+        {
+            frequency[symbol] = RANGE_PROB_TOTAL / 256;
+        }
+        return;
+    }
+
+    u32 budget = RANGE_PROB_TOTAL - 256;
+    u32 sum = 0;
+    for (u32 symbol = 0; symbol < 256; ++symbol)
+    {
+        frequency[symbol] = (u16)(1 + (counts[symbol] * budget) / total);
+        sum += frequency[symbol];
+    }
+    frequency[most_seen] += (u16)(RANGE_PROB_TOTAL - sum);
+}
+
+/* BENCHMARK */
+
+struct bench_totals
+{
+    u64 raw_bytes;
+    u64 lz_bytes;
+    u64 range_bytes;
+    u64 stage_bytes;
+    u32 stage_range;
+    u32 stage_lz;
+};
+
+void
+Bench(capture * c, const range_model * models, real_time clock_freq)
+{
+    static u8 encoded[CAPTURE_MAX_PACKETS][PACKET_PAYLOAD_SIZE];
+    static u32 encoded_size[CAPTURE_MAX_PACKETS];
+    static u8 copy[PACKET_PAYLOAD_SIZE];
+    volatile u32 sink = 0;
+
+    // raw path, the payload is copied to the wire buffer
+    real_time start = GetRealTime();
+    for (u32 round = 0; round < BENCH_ROUNDS; ++round)
+    {
+        for (u32 packet_index = 0; packet_index < c->count; ++packet_index)
+        {
+            memcpy(copy, c->data + c->offset[packet_index], c->size[packet_index]);
+            sink += copy[packet_index & 15];
+        }
+    }
+    r64 copy_ns = GetTimeDiff(GetRealTime(), start, clock_freq) * 1000000.0 / ((r64)BENCH_ROUNDS * c->count);
+
+    start = GetRealTime();
+    for (u32 round = 0; round < BENCH_ROUNDS; ++round)
+    {
+        for (u32 packet_index = 0; packet_index < c->count; ++packet_index)
+        {
+            encoded_size[packet_index] =
+                RangeEncodePayload(models, c->data + c->offset[packet_index], c->size[packet_index],
+                                   c->messages[packet_index], encoded[packet_index], PACKET_PAYLOAD_SIZE);
+        }
+    }
+    r64 encode_ns = GetTimeDiff(GetRealTime(), start, clock_freq) * 1000000.0 / ((r64)BENCH_ROUNDS * c->count);
+
+    u8 decoded[PACKET_MAX_PAYLOAD_SIZE];
+    start = GetRealTime();
+    for (u32 round = 0; round < BENCH_ROUNDS; ++round)
+    {
+        for (u32 packet_index = 0; packet_index < c->count; ++packet_index)
+        {
+            u32 size = 0;
+            RangeDecodePayload(models, encoded[packet_index], encoded_size[packet_index], c->messages[packet_index],
+                               decoded, sizeof(decoded), &size);
+            sink += size;
+        }
+    }
+    r64 decode_ns = GetTimeDiff(GetRealTime(), start, clock_freq) * 1000000.0 / ((r64)BENCH_ROUNDS * c->count);
+
+    bench_totals totals = {};
+    for (u32 packet_index = 0; packet_index < c->count; ++packet_index)
+    {
+        const u8 * payload = c->data + c->offset[packet_index];
+        u32 size = c->size[packet_index];
+
+        // 0 when it comes out bigger than the payload, those go raw
+        if (encoded_size[packet_index])
+        {
+            u32 decoded_size = 0;
+            b32 ok = RangeDecodePayload(models, encoded[packet_index], encoded_size[packet_index],
+                                        c->messages[packet_index], decoded, sizeof(decoded), &decoded_size);
+            Assert(ok && decoded_size == size && memcmp(decoded, payload, size) == 0);
+        }
+
+        u8 lz[PACKET_PAYLOAD_SIZE];
+        u32 lz_size = Compress(&compress_packet_dictionary, payload, size, lz, sizeof(lz));
+
+        // what goes on the wire through PacketToWireCompressed
+        packet p;
+        p.header.protocol = PROTOCOL_ID;
+        p.header.flags = 0;
+        p.header.messages = c->messages[packet_index];
+        p.header.seq = packet_index;
+        p.header.ack = 0;
+        p.header.ack_bit = ~0u;
+        memcpy(p.data, payload, size);
+        u8 wire_buffer[PACKET_WIRE_BUFFER_SIZE];
+        u32 datagram_size = 0;
+        compress_stats stats = {};
+        u8 * wire = PacketToWireCompressed(&p, size, packet_index, wire_buffer, &datagram_size, &stats);
+
+        u32 header_size = PacketHeaderWireSize(wire, datagram_size);
+        if (wire[1] & PACKET_HEADER_COMPRESSED)
+        {
+            totals.stage_range += (wire[header_size] == compress_codec_range);
+            totals.stage_lz += (wire[header_size] == compress_codec_lz);
+
+            // and back
+            u8 received[PACKET_WIRE_BUFFER_SIZE];
+            i32 received_size = (i32)datagram_size;
+            memcpy(received, wire, datagram_size);
+            compress_stats received_stats = {};
+            Assert(PacketDecompressWire(received, header_size, &received_size, &received_stats));
+            Assert((u32)received_size == header_size + size && memcmp(received + header_size, payload, size) == 0);
+        }
+
+        totals.raw_bytes += size;
+        totals.lz_bytes += lz_size ? min(lz_size, size) : size;
+        totals.range_bytes += encoded_size[packet_index] ? encoded_size[packet_index] : size;
+        totals.stage_bytes += stats.wire_bytes;
+    }
+
+    r64 packets = (r64)c->count;
+    printf("%-16s %10s %8s %10s %10s\n", "", "bits/pkt", "saved", "encode ns", "decode ns");
+    printf("%-16s %10.1f %7.1f%% %10.1f %10.1f\n", "raw (copy)", 8.0 * totals.raw_bytes / packets, 0.0, copy_ns, copy_ns);
+    printf("%-16s %10.1f %7.1f%%\n", "lz + dictionary", 8.0 * totals.lz_bytes / packets,
+           100.0 * (1.0 - (r64)totals.lz_bytes / totals.raw_bytes));
+    printf("%-16s %10.1f %7.1f%% %10.1f %10.1f\n", "range coder", 8.0 * totals.range_bytes / packets,
+           100.0 * (1.0 - (r64)totals.range_bytes / totals.raw_bytes), encode_ns, decode_ns);
+    printf("%-16s %10.1f %7.1f%%   range %u, lz %u, raw %u packets\n", "packet stage", 8.0 * totals.stage_bytes / packets,
+           100.0 * (1.0 - (r64)totals.stage_bytes / totals.raw_bytes),
+           totals.stage_range, totals.stage_lz, c->count - totals.stage_range - totals.stage_lz);
+}
+
+/* a truncated or corrupted block never reads or writes out of bounds */
+void
+TestCorrupt(capture * c, const range_model * models)
+{
+    u32 rejected = 0;
+    for (u32 packet_index = 0; packet_index < c->count && packet_index < 2000; ++packet_index)
+    {
+        u8 encoded[PACKET_PAYLOAD_SIZE];
+        u32 encoded_size = RangeEncodePayload(models, c->data + c->offset[packet_index], c->size[packet_index],
+                                              c->messages[packet_index], encoded, sizeof(encoded));
+        if (!encoded_size)
+        {
+            continue;
+        }
+
+        encoded[rand() % encoded_size] ^= (u8)(1 + rand() % 255);
+        u8 out[PACKET_MAX_PAYLOAD_SIZE];
+        u32 out_size = 0;
+        rejected += !RangeDecodePayload(models, encoded, encoded_size, c->messages[packet_index],
+                                        out, sizeof(out), &out_size);
+        rejected += !RangeDecodePayload(models, encoded, rand() % encoded_size, c->messages[packet_index] + 8,
+                                        out, sizeof(out), &out_size);
+    }
+    printf("corrupted blocks: %u rejected, the rest decoded within bounds\n", rejected);
+}
+
+int
+main(int argc, char ** argv)
+{
+    TimeInit(false);
+    real_time clock_freq = GetClockResolution();
+
+    static capture train;
+    static capture test;
+    train.data = (u8 *)malloc((size_t)CAPTURE_MAX_PACKETS * PACKET_PAYLOAD_SIZE);
+    test.data = (u8 *)malloc((size_t)CAPTURE_MAX_PACKETS * PACKET_PAYLOAD_SIZE);
+    CaptureTraffic(&train, 1);
+    CaptureTraffic(&test, 2);
+
+    static u64 counts[RANGE_MODEL_COUNT][256];
+    CountSymbols(&train, counts);
+
+    static u16 frequency[RANGE_MODEL_COUNT][256];
+    for (u32 model_index = 0; model_index < RANGE_MODEL_COUNT; ++model_index)
+    {
+        NormalizeFrequencies(counts[model_index], frequency[model_index]);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "train") == 0)
+    {
+        printf("#ifndef UDP_RANGE_MODEL_H\n#define UDP_RANGE_MODEL_H\n\n");
+        printf("#include \"range_coder.h\"\n\n");
+        printf("// generated by test_range train, don't edit\n");
+        printf("static const u16 range_model_frequency[RANGE_MODEL_COUNT][256] = \n{\n");
+        for (u32 model_index = 0; model_index < RANGE_MODEL_COUNT; ++model_index)
+        {
+            printf("    {");
+            for (u32 symbol = 0; symbol < 256; ++symbol)
+            {
+                printf("%s%u,", (symbol % 16) ? " " : "\n        ", frequency[model_index][symbol]);
+            }
+            printf("\n    },\n");
+        }
+        printf("};\n\n#endif\n");
+
+        return 0;
+    }
+
+    CompressInit();
+
+    printf("%u packets, %.1f B per packet, %u sessions of the demo world at %.0f%% loss\n",
+           test.count, (r64)test.total_bytes / test.count, CAPTURE_SESSIONS, CAPTURE_LOSS_RATE * 100.0f);
+
+    printf("%u B of models, trained on another capture (range_model.h)\n", (u32)sizeof(range_model_frequency));
+    Bench(&test, range_packet_models, clock_freq);
+
+    TestCorrupt(&test, range_packet_models);
+
+    return 0;
+}
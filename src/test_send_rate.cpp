@@ -0,0 +1,103 @@
+/*
+ * Per client send rates over a fixed simulation tick, send_rate.h
+ *  - the tier picked for a class cap and a congestion control rate
+ *  - a client sends exactly rate_hz times a second of ticks
+ *  - 10k clients of mixed classes on a 60 Hz tick: sends a second against
+ *    everyone at the tick rate, and the most sends in one tick with and
+ *    without phases
+ */
+#include <stdio.h>
+#include "send_rate.h"
+
+#define SIM_TICK_HZ 60
+#define SIM_CLIENTS 10000
+#define SIM_SECONDS 10
+
+struct tier_case
+{
+    r32 max_hz;
+    r32 congestion_hz;
+    u32 ticks_per_send;
+};
+
+void
+TestTiers()
+{
+    tier_case cases[] =
+    {
+        { 60.0f, 60.0f, 1 },
+        { 60.0f, 45.0f, 2 },
+        { 60.0f, 25.0f, 3 },
+        { 10.0f, 60.0f, 6 },
+        { 20.0f, 12.0f, 6 },
+        // under the slowest tier congestion control is followed, rounded down
+        { 60.0f,  7.0f, 9 },
+        { 60.0f,  2.0f, 30 },
+    };
+
+    for (u32 i = 0; i < ArrayCount(cases); ++i)
+    {
+        send_schedule schedule;
+        SendScheduleInit(&schedule, 0, SIM_TICK_HZ);
+        SendScheduleUpdate(&schedule, SIM_TICK_HZ, cases[i].max_hz, cases[i].congestion_hz);
+
+        Assert(schedule.ticks_per_send == cases[i].ticks_per_send);
+        Assert(schedule.rate_hz <= min(cases[i].max_hz, cases[i].congestion_hz));
+
+        u32 sends = 0;
+        for (u64 tick = 0; tick < SIM_TICK_HZ * SIM_SECONDS; ++tick)
+        {
+            sends += SendScheduleDue(&schedule, tick);
+        }
+        Assert(sends == (u32)(schedule.rate_hz * SIM_SECONDS + 0.5f));
+
+        printf("cap %4.1f congestion %4.1f: every %2u ticks, %4.1f Hz\n",
+               cases[i].max_hz, cases[i].congestion_hz, schedule.ticks_per_send, schedule.rate_hz);
+    }
+}
+
+void
+Simulate(b32 phased)
+{
+    static send_schedule schedules[SIM_CLIENTS];
+    for (u32 client = 0; client < SIM_CLIENTS; ++client)
+    {
+        // 70% players, 20% spectators, 10% on a slow link
+        u32 kind = client % 10;
+        r32 max_hz = kind < 7 ? 60.0f : kind < 9 ? 10.0f : 20.0f;
+
+        SendScheduleInit(schedules + client, phased ? client : 0, SIM_TICK_HZ);
+        SendScheduleUpdate(schedules + client, SIM_TICK_HZ, max_hz, 60.0f);
+    }
+
+    u64 sends = 0;
+    u32 max_tick_sends = 0;
+    for (u64 tick = 0; tick < SIM_TICK_HZ * SIM_SECONDS; ++tick)
+    {
+        u32 tick_sends = 0;
+        for (u32 client = 0; client < SIM_CLIENTS; ++client)
+        {
+            tick_sends += SendScheduleDue(schedules + client, tick);
+        }
+        sends += tick_sends;
+        max_tick_sends = max(max_tick_sends, tick_sends);
+    }
+
+    u32 all_at_tick_rate = SIM_CLIENTS * SIM_TICK_HZ;
+    printf("%s: %llu sends a second (%u all at %u Hz), most in a tick %u\n",
+           phased ? "phased" : "no phase", (unsigned long long)(sends / SIM_SECONDS),
+           all_at_tick_rate, SIM_TICK_HZ, max_tick_sends);
+
+    // 7000 * 60 + 2000 * 10 + 1000 * 20
+    Assert(sends / SIM_SECONDS == 460000);
+}
+
+int
+main()
+{
+    TestTiers();
+    Simulate(false);
+    Simulate(true);
+
+    return 0;
+}
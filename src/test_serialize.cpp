@@ -0,0 +1,157 @@
+/*
+ * Serializer benchmark.
+ * Bytes on the wire and time per message for the protocol messages and a
+ * synthetic entity update:
+ *  - memcpy of the struct, what the messages used to carry
+ *  - bit packed through serialize.h, write then read back
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "serialize.h"
+
+#define BENCH_ITERATIONS 1000000
+
+struct bench_item
+{
+    u32 id;
+};
+
+/* what a game would send per entity every tick */
+struct bench_entity
+{
+    u32 entity_id;
+    b32 visible;
+    i32 x, y, z;
+    r32 yaw;
+    i32 health;
+    u32 item_count;
+    bench_item items[8];
+};
+
+template <typename stream> b32
+Serialize(stream & s, bench_item & item)
+{
+    SerializeUnsigned(s, item.id, 0, 1023);
+
+    return SerializeOk(s);
+}
+
+template <typename stream> b32
+Serialize(stream & s, bench_entity & e)
+{
+    SerializeUnsigned(s, e.entity_id, 0, 4095);
+    SerializeBool(s, e.visible);
+    // world is 64m, positions in cm
+    SerializeInt(s, e.x, -3200, 3200);
+    SerializeInt(s, e.y, -3200, 3200);
+    SerializeInt(s, e.z, -512, 512);
+    SerializeFloat(s, e.yaw);
+    SerializeInt(s, e.health, 0, 100);
+    SerializeArray(s, e.items, e.item_count, ArrayCount(e.items));
+
+    return SerializeOk(s);
+}
+
+inline i32
+RandomBetween(i32 lo, i32 hi)
+{
+    i32 value = lo + (i32)((u32)rand() % (u32)(hi - lo + 1));
+
+    return value;
+}
+
+template <typename T> void
+RunMessage(const char * name, T * samples, u32 sample_count, real_time clock_freq)
+{
+    u8 wire[UDP_BUFFER_MAX_SIZE];
+    T copy;
+
+    u32 packed_bytes = 0;
+    for (u32 i = 0; i < sample_count; ++i)
+    {
+        u32 size = WriteMessage(samples[i], wire, sizeof(wire));
+        Assert(size > 0 && size == MeasureMessage(samples[i]));
+        Assert(ReadMessage(copy, wire, size));
+        Assert(WriteMessage(copy, wire + size, sizeof(wire) - size) == size);
+        Assert(memcmp(wire, wire + size, size) == 0);
+        packed_bytes += size;
+    }
+
+    // keep the compiler from dropping the loops
+    volatile u32 sink = 0;
+
+    real_time start = GetRealTime();
+    for (u32 i = 0; i < BENCH_ITERATIONS; ++i)
+    {
+        T * sample = samples + (i % sample_count);
+        memcpy(wire, sample, sizeof(T));
+        memcpy(&copy, wire, sizeof(T));
+        sink += wire[i % sizeof(T)];
+    }
+    r64 memcpy_ms = GetTimeDiff(GetRealTime(), start, clock_freq);
+
+    start = GetRealTime();
+    for (u32 i = 0; i < BENCH_ITERATIONS; ++i)
+    {
+        sink += WriteMessage(samples[i % sample_count], wire, sizeof(wire));
+    }
+    r64 write_ms = GetTimeDiff(GetRealTime(), start, clock_freq);
+
+    u32 size = WriteMessage(samples[0], wire, sizeof(wire));
+    start = GetRealTime();
+    for (u32 i = 0; i < BENCH_ITERATIONS; ++i)
+    {
+        sink += ReadMessage(copy, wire, size);
+    }
+    r64 read_ms = GetTimeDiff(GetRealTime(), start, clock_freq);
+
+    printf("%-16s %10u %10.1f %12.1f %12.1f %12.1f\n",
+            name, (u32)sizeof(T), (r64)packed_bytes / sample_count,
+            memcpy_ms * 1000000.0 / BENCH_ITERATIONS,
+            write_ms * 1000000.0 / BENCH_ITERATIONS,
+            read_ms * 1000000.0 / BENCH_ITERATIONS);
+}
+
+int
+main()
+{
+    TimeInit(false);
+    real_time clock_freq = GetClockResolution();
+
+    udp_auth auth[1] = {};
+    strcpy(auth[0].user, "anonymous");
+    strcpy(auth[0].pwd, "1234");
+    auth[0].ciphers = PACKET_CIPHERS_ALL;
+    auth[0].client_class = client_class_player;
+
+    udp_auth_reply reply[1] = {};
+    strcpy(reply[0].text, "Checking credentials");
+    reply[0].tick_hz = 60;
+
+    bench_entity entities[64];
+    for (u32 i = 0; i < ArrayCount(entities); ++i)
+    {
+        bench_entity * e = entities + i;
+        *e = {};
+        e->entity_id = (u32)RandomBetween(0, 4095);
+        e->visible = RandomBetween(0, 3) != 0;
+        e->x = RandomBetween(-3200, 3200);
+        e->y = RandomBetween(-3200, 3200);
+        e->z = RandomBetween(-512, 512);
+        e->yaw = (r32)RandomBetween(0, 359);
+        e->health = RandomBetween(0, 100);
+        e->item_count = (u32)RandomBetween(0, 3);
+        for (u32 item = 0; item < e->item_count; ++item)
+        {
+            e->items[item].id = (u32)RandomBetween(0, 1023);
+        }
+    }
+
+    printf("%u iterations, ns per message\n", BENCH_ITERATIONS);
+    printf("%-16s %10s %10s %12s %12s %12s\n", "", "struct B", "packed B", "memcpy ns", "write ns", "read ns");
+    RunMessage("auth", auth, ArrayCount(auth), clock_freq);
+    RunMessage("auth reply", reply, ArrayCount(reply), clock_freq);
+    RunMessage("entity update", entities, ArrayCount(entities), clock_freq);
+
+    return 0;
+}
@@ -0,0 +1,185 @@
+/*
+ * Delta snapshots, snapshot.cpp
+ *  - a clean link: every packet decodes to the server world, deltas against
+ *    the newest acked baseline
+ *  - a lost baseline: a packet late by SNAPSHOT_HISTORY clears the history
+ *    slot of a baseline the server saw acked. Packets whose snapshot can't be
+ *    decoded are left unacked, as the client does, and replication recovers
+ *    once the server gives up on the baseline. Acked anyway, every later
+ *    delta is against a snapshot the client doesn't have and it never does
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "channel.cpp"
+#include "snapshot.cpp"
+#include "message_iterator.h"
+
+#define TEST_PACKETS 128
+#define TEST_MOVERS 8
+// delivered late, after the packet SNAPSHOT_HISTORY newer that reuses its slot
+#define TEST_LATE_SEQ 24
+
+struct test_link
+{
+    snapshot_sender sender;
+    snapshot_receiver receiver;
+    world_snapshot world;
+    // bit per seq & 31, 1 once acked
+    u32 acked_bit;
+
+    u16 messages[TEST_PACKETS];
+    u32 size[TEST_PACKETS];
+    u8 payload[TEST_PACKETS][PACKET_MAX_PAYLOAD_SIZE];
+};
+
+void
+LinkInit(test_link * link)
+{
+    SnapshotSenderInit(&link->sender);
+    SnapshotReceiverInit(&link->receiver);
+    link->world = snapshot_default;
+    link->acked_bit = 0;
+    for (u32 entity_index = 0; entity_index < SNAPSHOT_MAX_ENTITIES; ++entity_index)
+    {
+        link->world.entities[entity_index].health = 100;
+        link->world.entities[entity_index].flags = ENTITY_FLAG_ALIVE | ENTITY_FLAG_VISIBLE;
+    }
+}
+
+/* world moves a step and the snapshot of seq is written */
+void
+LinkSend(test_link * link, u32 seq)
+{
+    link->world.tick = seq;
+    for (u32 entity_index = 0; entity_index < TEST_MOVERS; ++entity_index)
+    {
+        link->world.entities[entity_index].position[0] += 1 + entity_index;
+    }
+
+    link->messages[seq] = 0;
+    link->size[seq] = SnapshotWrite(&link->sender, &link->world, seq, link->acked_bit,
+                                    link->payload[seq], PACKET_MAX_PAYLOAD_SIZE, link->messages + seq);
+    Assert(link->messages[seq] > 0);
+    link->acked_bit &= ~((u32)1 << (seq & 31));
+}
+
+/* seq got to the client, returns whether every record of it decoded.
+ * The ack is sent if it did, or always with ack_undecoded */
+b32
+LinkReceive(test_link * link, u32 seq, b32 ack_undecoded)
+{
+    b32 decoded = true;
+    message_iterator it = MessageIterator(link->payload[seq], link->size[seq], link->messages[seq]);
+    for (message * record = MessageNext(&it); record; record = MessageNext(&it))
+    {
+        Assert(GetMessageType(record) == package_type_snapshot);
+        if (!SnapshotReceiveRecord(&link->receiver, seq, record))
+        {
+            decoded = false;
+        }
+    }
+    Assert(!it.malformed);
+
+    if (decoded || ack_undecoded)
+    {
+        link->acked_bit |= ((u32)1 << (seq & 31));
+    }
+
+    return decoded;
+}
+
+b32
+SnapshotMatches(test_link * link, u32 seq)
+{
+    const world_snapshot * received = SnapshotReceived(&link->receiver, seq);
+    return received && memcmp(received, &link->world, sizeof(link->world)) == 0;
+}
+
+void
+TestCleanLink()
+{
+    static test_link link;
+    LinkInit(&link);
+
+    for (u32 seq = 1; seq < TEST_PACKETS; ++seq)
+    {
+        LinkSend(&link, seq);
+        Assert(LinkReceive(&link, seq, false));
+        Assert(SnapshotMatches(&link, seq));
+    }
+    Assert(link.sender.full_sent == 1 && link.sender.delta_sent == TEST_PACKETS - 2);
+    Assert(link.receiver.records_dropped == 0);
+
+    printf("clean link: %u deltas, all decoded\n", link.sender.delta_sent);
+}
+
+/* returns the packet the client decodes a snapshot again from, 0 if none does */
+u32
+LostBaseline(b32 ack_undecoded)
+{
+    static test_link link;
+    LinkInit(&link);
+
+    u32 late_until = TEST_LATE_SEQ + SNAPSHOT_HISTORY;
+    u32 recovered_seq = 0;
+    for (u32 seq = 1; seq < TEST_PACKETS; ++seq)
+    {
+        LinkSend(&link, seq);
+        if (seq == TEST_LATE_SEQ)
+        {
+            continue;
+        }
+
+        b32 decoded = LinkReceive(&link, seq, ack_undecoded);
+        if (seq < late_until)
+        {
+            Assert(decoded && SnapshotMatches(&link, seq));
+        }
+        else if (seq == late_until)
+        {
+            Assert(decoded);
+            // its baseline slot was reused long ago, it clears late_until, acked already
+            Assert(!LinkReceive(&link, TEST_LATE_SEQ, ack_undecoded));
+            Assert(!SnapshotReceived(&link.receiver, late_until));
+        }
+        else if (decoded && !recovered_seq)
+        {
+            recovered_seq = seq;
+        }
+
+        if (recovered_seq)
+        {
+            Assert(decoded && SnapshotMatches(&link, seq));
+        }
+    }
+
+    return recovered_seq;
+}
+
+void
+TestLostBaseline()
+{
+    u32 late_until = TEST_LATE_SEQ + SNAPSHOT_HISTORY;
+
+    // acked anyway: the server moves its baseline on to packets the client
+    // couldn't decode either
+    Assert(LostBaseline(true) == 0);
+
+    // unacked: deltas against late_until up to the packet that reuses its
+    // history slot, nothing newer is acked so the one after is a full snapshot
+    u32 recovered_seq = LostBaseline(false);
+    Assert(recovered_seq == late_until + SNAPSHOT_HISTORY + 1);
+
+    printf("lost baseline: acked anyway never decodes again, unacked recovers %u packets later\n",
+           recovered_seq - late_until);
+}
+
+int
+main()
+{
+    TestCleanLink();
+    TestLostBaseline();
+
+    return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * Tick scheduler, tick.h
+ *  - how late ticks start with TickWait against the relative msleep loop
+ *    it replaced, same period and tick count
+ *  - ticks stay on start + n * period, no drift over the run
+ *  - overruns: skip drops the missed deadlines, catch up runs them back to
+ *    back up to TICK_MAX_CATCH_UP
+ *  - SleepUntil never wakes before its deadline
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "platform.h"
+#include "tick.h"
+
+#define TEST_PERIOD_NS (2 * NS_PER_MS)
+#define TEST_TICKS 300
+
+void
+BusyFor(u64 ns)
+{
+    real_time end = GetRealTime() + ns;
+    while (GetRealTime() < end)
+    {
+        _mm_pause();
+    }
+}
+
+void
+TestSleepUntil()
+{
+    for (u32 i = 0; i < 50; ++i)
+    {
+        real_time deadline = GetRealTime() + (u64)(rand() % 3000) * 1000;
+        SleepUntil(deadline);
+        Assert(GetRealTime() >= deadline);
+    }
+
+    // a deadline already gone returns right away
+    real_time before = GetRealTime();
+    SleepUntil(before - NS_PER_MS);
+    Assert(GetRealTime() - before < NS_PER_MS);
+
+    printf("SleepUntil: never early\n");
+}
+
+void
+RecordInterval(tick_scheduler * intervals, real_time * last, real_time now)
+{
+    if (*last)
+    {
+        u64 interval = now - *last;
+        TickRecordJitter(intervals, interval > TEST_PERIOD_NS ? interval - TEST_PERIOD_NS : TEST_PERIOD_NS - interval);
+    }
+    *last = now;
+}
+
+void
+TestJitter()
+{
+    // how far each tick to tick interval is off the period, either way
+    tick_scheduler old_intervals;
+    tick_scheduler tick_intervals;
+    TickInit(&old_intervals, TEST_PERIOD_NS, tick_overrun_skip, 0);
+    TickInit(&tick_intervals, TEST_PERIOD_NS, tick_overrun_skip, 0);
+
+    // the loop as it was: sleep whole ms for what's left of the frame
+    real_time start = GetRealTime();
+    real_time last = 0;
+    for (u32 tick = 0; tick < TEST_TICKS; ++tick)
+    {
+        real_time starting_time = GetRealTime();
+        RecordInterval(&old_intervals, &last, starting_time);
+
+        BusyFor(200 * 1000);
+
+        u64 frame_elapsed_ns = GetRealTime() - starting_time;
+        while (TEST_PERIOD_NS > frame_elapsed_ns + NS_PER_MS)
+        {
+            msleep((u32)((TEST_PERIOD_NS - frame_elapsed_ns) / NS_PER_MS));
+            frame_elapsed_ns = GetRealTime() - starting_time;
+        }
+    }
+    u64 old_elapsed = GetRealTime() - start;
+
+    tick_scheduler ticks;
+    start = GetRealTime();
+    last = 0;
+    TickInit(&ticks, TEST_PERIOD_NS, tick_overrun_skip, start);
+    for (u32 tick = 0; tick < TEST_TICKS; ++tick)
+    {
+        RecordInterval(&tick_intervals, &last, TickWait(&ticks));
+        BusyFor(200 * 1000);
+    }
+    u64 tick_elapsed = GetRealTime() - start;
+
+    printf("%u ticks of %llu us, %.1f ms of them\n", TEST_TICKS, (unsigned long long)(TEST_PERIOD_NS / 1000),
+           NsToMs((u64)TEST_TICKS * TEST_PERIOD_NS));
+    printf("relative msleep loop: %.1f ms, interval off the period by\n", NsToMs(old_elapsed));
+    TickJitterPrint(&old_intervals, stdout);
+    printf("TickWait: %.1f ms, interval off the period by\n", NsToMs(tick_elapsed));
+    TickJitterPrint(&tick_intervals, stdout);
+    printf("TickWait: spin %llu us, tick start late by\n", (unsigned long long)(ticks.spin_ns / 1000));
+    TickJitterPrint(&ticks, stdout);
+
+    // absolute deadlines: the last tick starts a period after TEST_TICKS - 1 of them, no drift
+    Assert(ticks.ticks == TEST_TICKS);
+    Assert(tick_elapsed >= (u64)(TEST_TICKS - 1) * TEST_PERIOD_NS);
+    Assert(tick_elapsed < (u64)(TEST_TICKS - 1) * TEST_PERIOD_NS + 4 * TEST_PERIOD_NS);
+}
+
+void
+TestOverrun(tick_overrun overrun)
+{
+    tick_scheduler ticks;
+    real_time start = GetRealTime();
+    TickInit(&ticks, TEST_PERIOD_NS, overrun, start);
+
+    // tick 10 takes a bit over 7 periods
+    u32 long_tick = 10;
+    u64 tick_starts[40];
+    for (u32 tick = 0; tick < 40; ++tick)
+    {
+        tick_starts[tick] = TickWait(&ticks) - start;
+        if (tick == long_tick)
+        {
+            BusyFor(7 * TEST_PERIOD_NS + TEST_PERIOD_NS / 4);
+        }
+    }
+
+    if (overrun == tick_overrun_skip)
+    {
+        // 6 deadlines dropped, the 7th still runs late, then back on time
+        Assert(ticks.ticks_skipped == 6);
+        Assert(ticks.ticks_caught_up == 0);
+        Assert(tick_starts[long_tick + 2] >= (u64)(long_tick + 8) * TEST_PERIOD_NS);
+    }
+    else
+    {
+        // the first TICK_MAX_CATCH_UP run late back to back, the rest are dropped
+        Assert(ticks.ticks_caught_up == TICK_MAX_CATCH_UP);
+        Assert(ticks.ticks_skipped == 6 - TICK_MAX_CATCH_UP);
+        Assert(tick_starts[long_tick + TICK_MAX_CATCH_UP] - tick_starts[long_tick + 1] < TEST_PERIOD_NS);
+    }
+
+    // back on the grid afterwards
+    u64 last = tick_starts[39];
+    Assert(last % TEST_PERIOD_NS < TEST_PERIOD_NS / 2);
+
+    printf("%s: %llu skipped, %llu caught up\n", overrun == tick_overrun_skip ? "skip" : "catch up",
+           (unsigned long long)ticks.ticks_skipped, (unsigned long long)ticks.ticks_caught_up);
+}
+
+int
+main()
+{
+    TimeInit(true);
+
+    TestSleepUntil();
+    TestOverrun(tick_overrun_skip);
+    TestOverrun(tick_overrun_catch_up);
+    TestJitter();
+
+    return 0;
+}
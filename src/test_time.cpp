@@ -0,0 +1,161 @@
+/*
+ * Monotonic clock, linux_time.cpp
+ *  - never goes back, read after read, with and without the TSC
+ *  - the TSC clock keeps up with CLOCK_MONOTONIC
+ *  - GetTimeDiff of an end before its start is negative
+ *  - ns per read of each clock, and a retransmit scan over many clients
+ *    with float ms deltas against integer ns ones
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "platform.h"
+#include "cpu.h"
+
+#define BENCH_READS 2000000
+#define BENCH_CLIENTS 4096
+#define BENCH_ROUNDS 200
+
+u64
+ClockMonotonicNs()
+{
+    timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return (u64)time.tv_sec * NS_PER_SECOND + (u64)time.tv_nsec;
+}
+
+void
+TestMonotonic(b32 allow_tsc)
+{
+    TimeInit(allow_tsc);
+
+    real_time last = GetRealTime();
+    for (u32 read = 0; read < 1000000; ++read)
+    {
+        real_time now = GetRealTime();
+        Assert(now >= last);
+        last = now;
+    }
+
+    // same rate as CLOCK_MONOTONIC, a few us either way over 200 ms
+    real_time start = GetRealTime();
+    u64 reference_start = ClockMonotonicNs();
+    msleep(200);
+    real_time end = GetRealTime();
+    u64 reference_end = ClockMonotonicNs();
+    i64 drift = (i64)(end - start) - (i64)(reference_end - reference_start);
+    Assert(drift < 20000 && drift > -20000);
+
+    Assert(GetTimeDiff(start, end, GetClockResolution()) < 0.0f);
+
+    printf("%s: monotonic, %lld ns off CLOCK_MONOTONIC over 200 ms\n",
+           TimeUsesTsc() ? "tsc" : "clock_gettime", (long long)drift);
+}
+
+r64
+BenchReads(real_time clock_freq)
+{
+    volatile u64 sink = 0;
+    real_time start = GetRealTime();
+    for (u32 read = 0; read < BENCH_READS; ++read)
+    {
+        sink += GetRealTime();
+    }
+
+    return GetTimeDiff(GetRealTime(), start, clock_freq) * 1000000.0 / BENCH_READS;
+}
+
+void
+Bench(real_time clock_freq)
+{
+    b32 tsc = GetCpuFeatures().invariant_tsc;
+
+    TimeInit(false);
+    r64 monotonic_ns = BenchReads(clock_freq);
+    r64 tsc_ns = 0.0;
+    if (tsc)
+    {
+        TimeInit(true);
+        tsc_ns = BenchReads(clock_freq);
+    }
+
+    volatile u64 sink = 0;
+    real_time start = GetRealTime();
+    for (u32 read = 0; read < BENCH_READS; ++read)
+    {
+        timespec time;
+        clock_gettime(CLOCK_REALTIME, &time);
+        sink += (u64)time.tv_nsec;
+    }
+    r64 realtime_ns = GetTimeDiff(GetRealTime(), start, clock_freq) * 1000000.0 / BENCH_READS;
+
+    printf("%-24s %10s\n", "clock", "ns/read");
+    printf("%-24s %10.1f\n", "CLOCK_REALTIME", realtime_ns);
+    printf("%-24s %10.1f\n", "CLOCK_MONOTONIC", monotonic_ns);
+    printf("%-24s %10.1f\n", "tsc", tsc_ns);
+
+    // the send loop's retransmit scan: 32 sent times a client against the timeout
+    static real_time sent[BENCH_CLIENTS][32];
+    real_time now = GetRealTime();
+    for (u32 client = 0; client < BENCH_CLIENTS; ++client)
+    {
+        for (u32 bit = 0; bit < 32; ++bit)
+        {
+            sent[client][bit] = now - (u64)(rand() % 400) * NS_PER_MS;
+        }
+    }
+
+    r32 rto_ms = 200.0f;
+    u64 rto_ns = MsToNs(rto_ms);
+    u32 expired = 0;
+
+    start = GetRealTime();
+    for (u32 round = 0; round < BENCH_ROUNDS; ++round)
+    {
+        for (u32 client = 0; client < BENCH_CLIENTS; ++client)
+        {
+            // a fresh read and a float delta per client, as it was
+            real_time client_now = GetRealTime();
+            for (u32 bit = 0; bit < 32; ++bit)
+            {
+                expired += GetTimeDiff(client_now, sent[client][bit], clock_freq) > rto_ms;
+            }
+        }
+    }
+    r64 float_ns = GetTimeDiff(GetRealTime(), start, clock_freq) * 1000000.0 / ((r64)BENCH_ROUNDS * BENCH_CLIENTS);
+
+    start = GetRealTime();
+    for (u32 round = 0; round < BENCH_ROUNDS; ++round)
+    {
+        // one read shared by every client
+        real_time tick_now = GetRealTime();
+        for (u32 client = 0; client < BENCH_CLIENTS; ++client)
+        {
+            for (u32 bit = 0; bit < 32; ++bit)
+            {
+                expired += tick_now - sent[client][bit] > rto_ns;
+            }
+        }
+    }
+    r64 integer_ns = GetTimeDiff(GetRealTime(), start, clock_freq) * 1000000.0 / ((r64)BENCH_ROUNDS * BENCH_CLIENTS);
+
+    sink += expired;
+    printf("retransmit scan, ns per client: float ms %.1f, integer ns %.1f\n", float_ns, integer_ns);
+}
+
+int
+main()
+{
+    TimeInit(false);
+    real_time clock_freq = GetClockResolution();
+
+    TestMonotonic(false);
+    if (GetCpuFeatures().invariant_tsc)
+    {
+        TestMonotonic(true);
+    }
+    Bench(clock_freq);
+
+    return 0;
+}
@@ -0,0 +1,158 @@
+#ifndef UDP_TEST_TRAFFIC_H
+#define UDP_TEST_TRAFFIC_H
+
+/*
+ * Server payloads for the benchmarks, made with the encoders the server
+ * uses: a demo world replicated by delta snapshots, auth replies through the
+ * channels and their redundant copies, over a link with loss.
+ * Include after channel.cpp and snapshot.cpp
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#define CAPTURE_SESSIONS 40
+#define CAPTURE_PACKETS_PER_SESSION 300
+#define CAPTURE_MAX_PACKETS (CAPTURE_SESSIONS * CAPTURE_PACKETS_PER_SESSION)
+#define CAPTURE_LOSS_RATE 0.02f
+// packets sent before the ack of one gets back
+#define CAPTURE_ACK_DELAY 3
+#define CAPTURE_MOVERS 16
+
+struct capture
+{
+    u32 count;
+    u32 total_bytes;
+    u16 size[CAPTURE_MAX_PACKETS];
+    // records in the payload, packet_header.messages
+    u16 messages[CAPTURE_MAX_PACKETS];
+    u32 offset[CAPTURE_MAX_PACKETS];
+    u8 * data;
+};
+
+inline r32
+RandomRange(r32 lo, r32 hi)
+{
+    return lo + (hi - lo) * ((r32)rand() / (r32)RAND_MAX);
+}
+
+/* TRAFFIC */
+
+void
+CaptureAdd(capture * c, const u8 * payload, u32 size, u16 messages)
+{
+    Assert(c->count < CAPTURE_MAX_PACKETS);
+    c->size[c->count] = (u16)size;
+    c->messages[c->count] = messages;
+    c->offset[c->count] = c->total_bytes;
+    memcpy(c->data + c->total_bytes, payload, size);
+    c->total_bytes += size;
+    c->count += 1;
+}
+
+void
+CaptureSession(capture * c)
+{
+    static entity_arrays state;
+    static world_snapshot world;
+    static snapshot_sender sender;
+    static message_channels channels;
+
+    memset(&world, 0, sizeof(world));
+    SnapshotSenderInit(&sender);
+    ChannelsInit(&channels);
+
+    for (u32 entity_index = 0; entity_index < SNAPSHOT_MAX_ENTITIES; ++entity_index)
+    {
+        b32 is_mover = (entity_index < CAPTURE_MOVERS);
+        for (u32 axis = 0; axis < 3; ++axis)
+        {
+            state.position[axis][entity_index] = (axis < 2) ? RandomRange(-20.0f, 20.0f) : 0.0f;
+            state.velocity[axis][entity_index] = (axis < 2 && is_mover) ? RandomRange(-4.0f, 4.0f) : 0.0f;
+        }
+        r32 half_yaw = RandomRange(-1.0f, 1.0f);
+        state.orientation[0][entity_index] = 0.0f;
+        state.orientation[1][entity_index] = 0.0f;
+        state.orientation[2][entity_index] = half_yaw;
+        state.orientation[3][entity_index] = SqrtFloat(1.0f - half_yaw * half_yaw);
+        world.entities[entity_index].health = 100;
+        world.entities[entity_index].flags = ENTITY_FLAG_ALIVE | ENTITY_FLAG_VISIBLE;
+    }
+
+    struct udp_auth_reply reply = {};
+    sprintf_s(reply.text, ArrayCount(reply.text), "Checking credentials");
+    reply.tick_hz = 60;
+    u8 reply_data[sizeof(reply)];
+    u32 reply_size = WriteMessage(reply, reply_data, sizeof(reply_data));
+    CreatePackages(&channels, channel_reliable_ordered, package_type_auth,
+                   (const void *)reply_data, reply_size, MESSAGE_PRIORITY_HIGH);
+
+    b32 delivered[CAPTURE_PACKETS_PER_SESSION] = {};
+    u32 acked_bit = 0;
+
+    for (u32 seq = 0; seq < CAPTURE_PACKETS_PER_SESSION; ++seq)
+    {
+        // the acks of CAPTURE_ACK_DELAY packets ago get here
+        if (seq >= CAPTURE_ACK_DELAY)
+        {
+            u32 acked_seq = seq - CAPTURE_ACK_DELAY;
+            acked_bit &= ~((u32)1 << (acked_seq & 31));
+            if (delivered[acked_seq])
+            {
+                acked_bit |= ((u32)1 << (acked_seq & 31));
+                ChannelsOnPacketAcked(&channels, acked_seq);
+            }
+            else
+            {
+                ChannelsOnPacketLost(&channels, acked_seq);
+            }
+        }
+
+        // world moves at 20 Hz
+        for (u32 entity_index = 0; entity_index < CAPTURE_MOVERS; ++entity_index)
+        {
+            for (u32 axis = 0; axis < 2; ++axis)
+            {
+                r32 * position = state.position[axis] + entity_index;
+                r32 * velocity = state.velocity[axis] + entity_index;
+                *position += *velocity * 0.05f;
+                if (*position < -20.0f || *position > 20.0f)
+                {
+                    *velocity = -*velocity;
+                }
+            }
+        }
+        if ((rand() % 10) == 0)
+        {
+            world.entities[rand() % SNAPSHOT_MAX_ENTITIES].health = (u16)(rand() % 101);
+        }
+        SnapshotQuantize(&world, &state);
+
+        u8 payload[PACKET_PAYLOAD_SIZE];
+        u16 messages = 0;
+        b32 is_critical = false;
+        u32 used = ChannelsPackPacket(&channels, seq, payload, PACKET_PAYLOAD_SIZE, &messages, &is_critical);
+        used += SnapshotWrite(&sender, &world, seq, acked_bit, payload + used, PACKET_PAYLOAD_SIZE - used, &messages);
+        used += ChannelsPackRedundant(&channels, seq, payload + used, PACKET_PAYLOAD_SIZE - used,
+                                      RedundancyDepth(CAPTURE_LOSS_RATE), &messages);
+
+        if (used)
+        {
+            CaptureAdd(c, payload, used, messages);
+        }
+        delivered[seq] = ((r32)rand() / (r32)RAND_MAX) >= CAPTURE_LOSS_RATE;
+    }
+}
+
+void
+CaptureTraffic(capture * c, u32 seed)
+{
+    srand(seed);
+    c->count = 0;
+    c->total_bytes = 0;
+    for (u32 session = 0; session < CAPTURE_SESSIONS; ++session)
+    {
+        CaptureSession(c);
+    }
+}
+
+#endif
@@ -0,0 +1,186 @@
+#ifndef UDP_TICK_H
+#define UDP_TICK_H
+
+#include "platform.h"
+#include "math.h"
+#include "cpu.h"
+
+/*
+ * Fixed rate main loop ticks on absolute deadlines
+ *
+ * Tick n is due at start + n * period, so a late wake up doesn't push the
+ * ticks after it back. TickWait sleeps with SleepUntil until spin_ns before
+ * the deadline and spins the rest. spin_ns follows how late the OS wakes
+ * us up: twice the worst of the last few sleeps, within
+ * TICK_SPIN_MIN_NS and TICK_SPIN_MAX_NS or half the period.
+ *
+ * A tick whose work runs past the next deadline is an overrun:
+ *  - tick_overrun_skip: the missed deadlines are dropped, the next tick is
+ *    the first deadline still ahead
+ *  - tick_overrun_catch_up: missed ticks run back to back without waiting,
+ *    at most TICK_MAX_CATCH_UP of them, the rest are skipped
+ *
+ * How late every tick starts goes into a histogram of power of two
+ * microsecond buckets, TickJitterPercentile and TickJitterPrint read it.
+ */
+
+#define TICK_SPIN_MIN_NS (50 * 1000ull)
+#define TICK_SPIN_MAX_NS (2 * NS_PER_MS)
+#define TICK_MAX_CATCH_UP 4
+// bucket b counts lateness in [2^(b-1), 2^b) us, bucket 0 under 1 us
+#define TICK_JITTER_BUCKETS 20
+
+enum tick_overrun
+{
+    tick_overrun_skip,
+    tick_overrun_catch_up
+};
+
+struct tick_scheduler
+{
+    u64 period_ns;
+    tick_overrun overrun;
+    // deadline of the next tick
+    real_time next_tick;
+    u64 spin_ns;
+    // worst oversleep lately, decays by 1/16 a tick
+    u64 oversleep_ns;
+    u32 catching_up;
+
+    u64 ticks;
+    u64 ticks_skipped;
+    u64 ticks_caught_up;
+    u32 jitter[TICK_JITTER_BUCKETS];
+    u64 max_jitter_ns;
+};
+
+inline void
+TickInit(tick_scheduler * scheduler, u64 period_ns, tick_overrun overrun, real_time now)
+{
+    Assert(period_ns > 0);
+
+    *scheduler = {};
+    scheduler->period_ns = period_ns;
+    scheduler->overrun = overrun;
+    scheduler->next_tick = now;
+    scheduler->spin_ns = TICK_SPIN_MIN_NS;
+}
+
+inline void
+TickRecordJitter(tick_scheduler * scheduler, u64 late_ns)
+{
+    u64 late_us = late_ns / 1000;
+    u32 bucket = 0;
+    while (late_us && bucket < TICK_JITTER_BUCKETS - 1)
+    {
+        late_us >>= 1;
+        bucket += 1;
+    }
+
+    scheduler->jitter[bucket] += 1;
+    scheduler->max_jitter_ns = max(scheduler->max_jitter_ns, late_ns);
+}
+
+/* waits for the next tick, returns its now */
+inline real_time
+TickWait(tick_scheduler * scheduler)
+{
+    real_time deadline = scheduler->next_tick;
+    real_time now = GetRealTime();
+
+    if (now < deadline)
+    {
+        scheduler->catching_up = 0;
+
+        if (deadline - now > scheduler->spin_ns)
+        {
+            real_time wake_target = deadline - scheduler->spin_ns;
+            SleepUntil(wake_target);
+            now = GetRealTime();
+
+            u64 oversleep_ns = now > wake_target ? now - wake_target : 0;
+            scheduler->oversleep_ns = max(oversleep_ns, scheduler->oversleep_ns - scheduler->oversleep_ns / 16);
+            // spinning most of a short period is no sleep at all
+            u64 max_spin_ns = min(TICK_SPIN_MAX_NS, scheduler->period_ns / 2);
+            scheduler->spin_ns = min(max(2 * scheduler->oversleep_ns, TICK_SPIN_MIN_NS), max_spin_ns);
+        }
+
+        while (now < deadline)
+        {
+            _mm_pause();
+            now = GetRealTime();
+        }
+
+        scheduler->next_tick = deadline + scheduler->period_ns;
+    }
+    else if (now - deadline < scheduler->period_ns)
+    {
+        // late but this tick's deadline is still the latest one
+        scheduler->catching_up = 0;
+        scheduler->next_tick = deadline + scheduler->period_ns;
+    }
+    else
+    {
+        // whole ticks missed
+        u64 missed = (now - deadline) / scheduler->period_ns;
+        if (scheduler->overrun == tick_overrun_catch_up && scheduler->catching_up < TICK_MAX_CATCH_UP)
+        {
+            scheduler->catching_up += 1;
+            scheduler->ticks_caught_up += 1;
+            scheduler->next_tick = deadline + scheduler->period_ns;
+        }
+        else
+        {
+            scheduler->catching_up = 0;
+            scheduler->ticks_skipped += missed;
+            deadline += missed * scheduler->period_ns;
+            scheduler->next_tick = deadline + scheduler->period_ns;
+        }
+    }
+
+    TickRecordJitter(scheduler, now - deadline);
+    scheduler->ticks += 1;
+
+    return now;
+}
+
+/* lateness under which percent of the ticks started, upper end of its bucket */
+inline u64
+TickJitterPercentile(tick_scheduler * scheduler, r32 percent)
+{
+    u64 total = 0;
+    for (u32 bucket = 0; bucket < TICK_JITTER_BUCKETS; ++bucket)
+    {
+        total += scheduler->jitter[bucket];
+    }
+
+    u64 wanted = (u64)((r64)total * percent / 100.0);
+    u64 seen = 0;
+    for (u32 bucket = 0; bucket < TICK_JITTER_BUCKETS; ++bucket)
+    {
+        seen += scheduler->jitter[bucket];
+        if (seen >= wanted && seen > 0)
+        {
+            return ((u64)1 << bucket) * 1000;
+        }
+    }
+
+    return scheduler->max_jitter_ns;
+}
+
+inline void
+TickJitterPrint(tick_scheduler * scheduler, FILE * out)
+{
+    fprintf(out, "ticks %llu skipped %llu caught up %llu, max late %.1f us\n",
+            (unsigned long long)scheduler->ticks, (unsigned long long)scheduler->ticks_skipped,
+            (unsigned long long)scheduler->ticks_caught_up, (r64)scheduler->max_jitter_ns / 1000.0);
+    for (u32 bucket = 0; bucket < TICK_JITTER_BUCKETS; ++bucket)
+    {
+        if (scheduler->jitter[bucket])
+        {
+            fprintf(out, "  < %7u us %10u\n", 1u << bucket, scheduler->jitter[bucket]);
+        }
+    }
+}
+
+#endif
@@ -19,8 +19,20 @@
 #include <string.h>
 #include "atomic.h"
 #include "protocol.h"
+#include "channel.cpp"
+#include "fec.cpp"
 #include "console_sequences.cpp"
 #include "math.h"
+#include "tick.h"
+#include "congestion.h"
+#include "packet_header.h"
+#include "snapshot.cpp"
+#include "message_iterator.h"
+#include "compress.cpp"
+#include "crc32c.cpp"
+#include "crypto.cpp"
+#include "clock_sync.h"
+#include "jitter_buffer.h"
 
 #define QUAD_TO_MS(Q) Q.QuadPart * (1.0f / 1000.0f)
 
@@ -66,6 +78,34 @@ IsSeqGreaterThan(u16 a, u16 b)
     return result;
 }
 
+/* packet seq got to us some other way than the wire, i.e. rebuilt by fec */
+void
+MarkSeqReceived(u32 * remote_seq, u32 * remote_seq_bit, u32 seq)
+{
+    if (IsSeqGreaterThan(seq, *remote_seq))
+    {
+        if ((seq - *remote_seq) >= 32)
+        {
+            *remote_seq_bit = 0;
+        }
+        else
+        {
+            for (u32 missing_seq = *remote_seq + 1; missing_seq != seq; ++missing_seq)
+            {
+                *remote_seq_bit &= ~((u32)1 << (missing_seq & 31));
+            }
+        }
+        *remote_seq = seq;
+    }
+    else if ((*remote_seq - seq) >= 32)
+    {
+        // out of the ack window
+        return;
+    }
+
+    *remote_seq_bit |= ((u32)1 << (seq & 31));
+}
+
 
 #if _WIN32
 BOOL WINAPI 
@@ -179,113 +219,6 @@ GetEnvIPAddr()
     return ip_addr;
 }
 
-inline package_type
-GetMessageType(message * msg)
-{
-    package_type result = (package_type)((int)msg->header.message_type & ~(1 << 7));
-
-    return result;
-}
-
-i32
-IsCriticalMessage(message * msg)
-{
-    i32 is_critical = 
-        (msg->header.message_type & (1 << 7)) == (1 << 7);
-
-    return is_critical;
-}
-
-b32
-IsAckMessage(const u32 * packet_seq_bit, queue_message * queue, i32 index)
-{
-    i32 pck_bit_index = queue->msg_sent_in_package_bit_index[index];
-    u32 bit_mask = ((u32)1 << pck_bit_index);
-
-    i32 is_ack_msg = (*packet_seq_bit & bit_mask) == bit_mask;
-
-    return is_ack_msg;
-}
-
-struct message *
-GetNextAvailableMessageInQueue(struct queue_message * queue, const u32 * packet_seq_bit)
-{
-    struct message * msg = 0;
-    b32 MessageIsAck = 0;
-
-    i32 index = (queue->next++ & (ArrayCount(queue->messages) - 1));
-
-    // this may happen if all packages are critical and none is ack
-    Assert(queue->next != queue->begin);
-
-    msg = queue->messages + index;
-    MessageIsAck = IsAckMessage(packet_seq_bit, queue, index);
-
-    if (IsCriticalMessage(msg) && !MessageIsAck)
-    {
-        struct message * first_ack_msg = 0;
-        u32 index = queue->next;
-        do
-        {
-            first_ack_msg = queue->messages + index;
-            if (IsAckMessage(packet_seq_bit, queue, index))
-            {
-                memcpy(first_ack_msg, msg, sizeof(struct message));
-                msg->header.message_type = 0;
-                break;
-            }
-            index = (index + 1) & (ArrayCount(queue->messages) - 1);
-        } while (index != queue->begin);
-
-        Assert(index != queue->begin);
-    }
-
-    Assert(!IsCriticalMessage(msg) || MessageIsAck);
-
-    return msg;
-}
-
-void
-CreatePackages(const u32 * packet_seq_bit, struct queue_message * queue, enum package_type packet_type, const void * data, u32 size, b32 is_critical)
-{
-    i32 order = 0;
-    i32 id = (queue->last_id++ & ((1 << 8) - 1));
-    u8 critical_mask = ((u8)(is_critical ? 1 : 0) << 7);
-
-    // create a header package so peer knows needs to create buffer
-    if (size > ArrayCount(queue->messages[0].data))
-    {
-        struct message * msg = GetNextAvailableMessageInQueue(queue, packet_seq_bit);
-        msg->header.id = id;
-        msg->header.order = order;
-        msg->header.message_type = package_type_buffer | critical_mask;
-        msg->header.len = sizeof(struct udp_buffer);
-
-        udp_buffer buffer_msg = { size };
-        memcpy(msg->data, &buffer_msg, sizeof(udp_buffer) );
-
-        order += 1;
-    }
-
-    while (size > 0)
-    {
-        u32 used_size = min(size, sizeof(queue->messages[0].data));
-
-        struct message * msg = GetNextAvailableMessageInQueue(queue, packet_seq_bit);
-
-        msg->header.id = id;
-        msg->header.order = order;
-        msg->header.message_type = packet_type | critical_mask;
-        msg->header.len = used_size;
-
-        memcpy(msg->data, data, used_size);
-
-        size -= used_size;
-        order += 1;
-    }
-}
-
-
 struct console con;
 
 void
@@ -422,10 +355,19 @@ main(int argc, char * argv[])
     setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, (const char *)&opt_val, opt_len);
     SOCKET_RETURN_ON_ERROR(BindSocket(handle, 0));
     SOCKET_RETURN_ON_ERROR(SetSocketNonBlocking(handle));
+    // server clock samples are better with, the socket queue doesn't count towards them.
+    // Without, replies are stamped when read and the estimate is within a few ms (test_clock_sync)
+    if (SetSocketReceiveTimestamps(handle) == SOCKET_ERROR)
+    {
+        logn("Socket error: \n%s\n%s (server replies stamped when read, server clock within a few ms)", 
+             "SetSocketReceiveTimestamps", GetLastSocketErrorMessage());
+    }
 
 #if 1
     u32 packet_seq = UINT_MAX;
     u32 packet_seq_bit = ~0; // signal pcks as received, corner case initialization
+    // newest seq the server acked, how many seq bytes go on the wire
+    u32 packet_acked = packet_seq;
     u32 remote_seq = UINT_MAX;
     u32 remote_seq_bit = ~0;
     real_time packet_seq_realtime[32];
@@ -439,11 +381,12 @@ main(int argc, char * argv[])
 #else
     u32 packet_seq = UINT_MAX - 640;
     u32 packet_seq_bit = ~0; // signal pcks as received, corner case initialization
+    u32 packet_acked = packet_seq;
     u32 remote_seq = UINT_MAX - 350;
     u32 remote_seq_bit = ~0;
 #endif
 
-    real_time perf_freq = GetClockResolution();
+    TimeInit(true);
 
 #define PACKAGES_PER_SECOND 32
 #if 0
@@ -451,7 +394,21 @@ main(int argc, char * argv[])
 #else
     u32 packages_per_second = 2;
 #endif
-    r32 expected_ms_per_package = (1.0f / (r32)packages_per_second) * 1000.0f;
+    // the loop reads the socket and stamps server packets at this rate, sends go at packages_per_second
+#define CLIENT_TICK_RATE 60
+#define CLIENT_RECV_BATCH 16
+    u64 frame_ns = NS_PER_SECOND / CLIENT_TICK_RATE;
+
+    // a frame that ran late is not made up for, the next one is on time
+    tick_scheduler ticks;
+    TickInit(&ticks, frame_ns, tick_overrun_skip, GetRealTime());
+    real_time last_tick_time = GetRealTime();
+
+    // loop runs at max rate, congestion control decides when we actually send
+    congestion_control cc;
+    CongestionInit(&cc, 1.0f, (r32)packages_per_second, PACKET_PAYLOAD_SIZE);
+    real_time last_send_time;
+    ZeroTime(last_send_time);
 
     HighDefinitionTimeBegin();
 
@@ -459,18 +416,59 @@ main(int argc, char * argv[])
 
     client_status my_status_with_server = client_status_none;
 
-    queue_message queue_msg_to_send;
-    memset(&queue_msg_to_send, 0, sizeof(queue_message));
-    for (u32 i  = 0; i < ArrayCount(queue_msg_to_send.msg_sent_in_package_bit_index); ++i)
+    message_channels channels;
+    ChannelsInit(&channels);
+
+    // rebuilds server packets lost from their repairs
+    FecInit();
+    CompressInit();
+    Crc32cInit();
+    CryptoInit();
+    fec_decoder fec;
+    FecDecoderInit(&fec);
+
+    // world state from the server
+    snapshot_receiver snapshots;
+    SnapshotReceiverInit(&snapshots);
+
+    // payload compression stage, both ways
+    compress_stats compress_sent = {};
+    compress_stats compress_received = {};
+
+    // new every run, the server tells this session from an earlier one on the same port
+    u32 session_salt = 0;
+    // ephemeral, hello sends the public half until the server's comes back (crypto.h)
+    crypto_key_pair key_pair;
+    if (!PacketNewSalt(&session_salt) || !CryptoNewKeyPair(&key_pair))
     {
-        queue_msg_to_send.msg_sent_in_package_bit_index[i] = 32;
+        logn("No random bytes from the OS, can't start a session");
+        return 1;
     }
+    // both ways, from the key exchange
+    crypto_key session_key;
+    b32 session_keyed = false;
+    u32 crypto_counter = 0;
+    // ChaCha20-Poly1305 until the server picks one at auth
+    u32 cipher = packet_cipher_chacha20_poly1305;
+
+    // server time and world ticks in our time (clock_sync.h)
+    clock_sync clock;
+    ClockSyncInit(&clock);
+
+    // snapshots wait here to play in tick order, the tick rate comes with the auth reply
+    jitter_buffer * jitter = PushStruct(&Arena, jitter_buffer);
+    JitterBufferInit(jitter, 0);
+    world_snapshot played_snapshot;
+    b32 has_played = false;
 
     while ( keep_alive )
     {
+        // the frame's now, receives and sends all take it
         real_time starting_time;
 
-        starting_time = GetRealTime();
+        starting_time = TickWait(&ticks);
+        u64 tick_interval_ns = max(starting_time - last_tick_time, (u64)1);
+        last_tick_time = starting_time;
 
         char c = GetChar();
 
@@ -479,76 +477,24 @@ main(int argc, char * argv[])
             keep_alive = false;
         }
 
-        u32 packet_index_to_check = (packet_seq + 1) & (32 - 1);
-        u32 packet_bit_index_to_check = (1 << packet_index_to_check);
-        i32 is_packet_ack = (packet_seq_bit & packet_bit_index_to_check) == packet_bit_index_to_check;
-        i32 is_packet_critical = (packet_seq_critical & packet_bit_index_to_check) == packet_bit_index_to_check;
-
-        if (!is_packet_ack)
-        {
-            //ConsoleAddMessage("Package was lost! %u (critical?%s)", (packet_seq - 31), is_packet_critical ? "True" : "False");
-            ConsoleIncrCL(&con, true);
-            ConsoleAppendAt(&con, con.current_line,0,"Package was lost! %u (critical?%s)", (packet_seq - 31), is_packet_critical ? "True" : "False");
-            if (is_packet_critical)
-            {
-                queue_message * queue = &queue_msg_to_send;
-                struct message * msg = queue->messages + queue->next;
-                u32 packet_index = queue->msg_sent_in_package_bit_index[queue->next];
-
-                Assert(BetweenIn(packet_index,0,32));
-
-                if (
-                        (packet_index == packet_index_to_check)
-                        &&
-                        IsCriticalMessage(msg)
-                    )
-                {
-                    // msg at next index needs to be re-sent. simply adv pointer
-                    queue->next = ( (++queue->next) & (ArrayCount(queue->messages) - 1));
-                }
-
-                int next_index = (queue->next == queue->begin) ? queue->next + 1 : queue->next;
-                next_index &= (ArrayCount(queue->messages) - 1);
-
-                // corner case begin == next
-                for (u32 i = next_index; 
-                         i != queue->begin; 
-                         i = ( (++i) & (ArrayCount(queue->messages) - 1)))
-                {
-                    struct message * msg = queue->messages + i;
-                    u32 packet_index = queue->msg_sent_in_package_bit_index[i];
-                    if (
-                            (packet_index == packet_index_to_check)
-                            &&
-                            IsCriticalMessage(msg)
-                        )
-                    {
-                        // we need to send it again. swap if necessary and incr next
-                        if (queue->next != i)
-                        {
-                            struct message * next_msg = (queue->messages + queue->next);
-                            memcpy(next_msg,msg, sizeof(struct message));
-                            memset(msg, 0, sizeof(struct message));
-                        }
-                        queue->next = ( (++queue->next) & (ArrayCount(queue->messages) - 1));
-                    }
-                }
-
-            }
-        }
-
-
+        // the socket is drained, every datagram is stamped when it is read
+        for (u32 received_count = 0; received_count < CLIENT_RECV_BATCH; ++received_count)
         {
             struct packet recv_datagram;
-            u32 max_packet_size = sizeof( struct packet);
+            u8 server_public_key[CRYPTO_PUBLIC_KEY_SIZE];
+            u32 max_packet_size = PACKET_WIRE_BUFFER_SIZE;
+            u32 wire_header_size = 0;
 
             sockaddr_in from;
             socklen_t fromLength = sizeof( from );
 
             int bytes = recvfrom( handle, 
-                    (char *)&recv_datagram, max_packet_size, 
+                    (char *)PacketWireBuffer(&recv_datagram), max_packet_size, 
                     0, 
                     (sockaddr*)&from, &fromLength );
+            real_time received_time = bytes > 0 ? GetSocketReceiveTime(handle, GetRealTime()) : 0;
+            // as it came, probes are checked against it
+            i32 datagram_size = bytes;
 
             if ( bytes == SOCKET_ERROR )
             {
@@ -571,10 +517,43 @@ main(int argc, char * argv[])
                     // do nothing
 #endif
                 }
+                break;
             }
             else if ( bytes == 0 )
             {
                 logn("No more data. Closing.");
+                break;
+            }
+            else if ( !PacketCheck(PacketWireBuffer(&recv_datagram), &bytes, session_salt) )
+            {
+                // corrupted, not ours or meant for an earlier session
+            }
+            else if ( CryptoHandshakeRead(PacketWireBuffer(&recv_datagram), (u32)bytes, CRYPTO_HANDSHAKE_REPLY, server_public_key) )
+            {
+                // once keyed a repeated reply carries the same key
+                if (!session_keyed && CryptoSessionKey(&key_pair, server_public_key, true, &session_key))
+                {
+                    session_keyed = true;
+                    CryptoWipe(&key_pair, sizeof(key_pair));
+                    ConsoleClientStatus("Key exchanged");
+                }
+            }
+            else if ( !session_keyed )
+            {
+                // nothing to open it with yet
+            }
+            else if ( (wire_header_size = PacketHeaderWireSize(PacketWireBuffer(&recv_datagram), (u32)bytes)) == 0 )
+            {
+                // not ours or cut short
+            }
+            else if ( !PacketDecrypt(&session_key, cipher, PACKET_CIPHERS_ALL, CRYPTO_SERVER_TO_CLIENT,
+                                     PacketWireBuffer(&recv_datagram), wire_header_size, &bytes, remote_seq, packet_seq) )
+            {
+                // tampered with or sealed with another key
+            }
+            else if ( !PacketDecompressWire(PacketWireBuffer(&recv_datagram), wire_header_size, &bytes, &compress_received) )
+            {
+                // compressed payload that doesn't decode
             }
             else
             {
@@ -589,50 +568,165 @@ main(int argc, char * argv[])
                     ntohs( from.sin_port );
 #endif
 
+                u32 recv_payload_size = PacketFromWire(&recv_datagram, (u32)bytes, wire_header_size, remote_seq, packet_seq);
+
                 u32 recv_packet_seq     = recv_datagram.header.seq;
                 u32 recv_packet_ack     = recv_datagram.header.ack;
                 u32 recv_packet_ack_bit = recv_datagram.header.ack_bit;
 
                 Assert( (packet_seq == recv_packet_ack) || IsSeqGreaterThan(packet_seq, recv_packet_ack));
 
-                struct message * messages[8];
                 i32 msg_count = recv_datagram.header.messages;
-                // datagram with 492b max payload can have at most
-                // 7.6 messages given that each msg has 32b header + 32b data
-                Assert(recv_datagram.header.messages <= sizeof(messages));
-
-                i32 inc_package_has_any_critical_msg = 0;
-                u32 begin_data_offset = 0;
-                for (i32 msg_index = 0;
-                        msg_index < msg_count;
-                        ++msg_index)
+
+                b32 is_fec_repair = (recv_datagram.header.flags & PACKET_FLAG_FEC_REPAIR);
+                // repairs and ack only packets reuse the last seq sent
+                b32 is_sequenced = 
+                    (recv_datagram.header.flags & (PACKET_FLAG_FEC_REPAIR | PACKET_FLAG_ACK_ONLY | PACKET_FLAG_PMTU_PROBE)) == 0;
+
+                // debug drop incoming packages
+                i32 lost_on_purpose = 0;
+                if (!lost_on_purpose)
                 {
-                    struct message ** msg = messages + msg_index;
-                    *msg = (struct message *)recv_datagram.data + begin_data_offset;
-                    inc_package_has_any_critical_msg = 
-                        inc_package_has_any_critical_msg || IsCriticalMessage(*msg);
+                    message delivered[CHANNEL_MAX_DELIVERED];
+                    u32 delivered_count = 0;
+                    // malformed, more messages than delivered holds or a snapshot that can't be
+                    // decoded: not acked, as if lost
+                    b32 packet_dropped = false;
+
+                    // channel messages plus the snapshot records, read in place
+                    message_iterator it = MessageIterator(recv_datagram.data, recv_payload_size, (u32)msg_count);
+                    for (message * record = MessageNext(&it); record; record = MessageNext(&it))
+                    {
+                        udp_time_reply time_reply;
+                        if (GetMessageType(record) == package_type_snapshot)
+                        {
+                            // acked the server would take it as a baseline we don't have
+                            if (!SnapshotReceiveRecord(&snapshots, recv_packet_seq, record))
+                            {
+                                packet_dropped = true;
+                            }
+                        }
+                        else if (GetMessageType(record) == package_type_time_sync)
+                        {
+                            if (ReadMessage(time_reply, record->data, record->header.len))
+                            {
+                                ClockSyncOnReply(&clock, &time_reply, received_time);
+                            }
+                        }
+                        else if (!ChannelReceiveRecord(&channels, record, delivered, &delivered_count))
+                        {
+                            packet_dropped = true;
+                            break;
+                        }
+                    }
 
-                    // strip critical flag
-                    (*msg)->header.message_type = GetMessageType(*msg);
+                    const world_snapshot * received_snapshot = SnapshotReceived(&snapshots, recv_packet_seq);
+                    if (is_sequenced && received_snapshot && jitter->tick_ns)
+                    {
+                        JitterBufferPush(jitter, received_snapshot->tick, received_snapshot, received_time);
+                    }
 
-                    begin_data_offset += (sizeof((*msg)->header) + (*msg)->header.len);
-                }
+                    if (recv_datagram.header.flags & PACKET_FLAG_PMTU_PROBE)
+                    {
+                        /* PATH MTU PROBE */
+                        // echo the size it had when it got here, server confirms its path MTU with it
+                        udp_pmtu_probe probe;
+                        memcpy(&probe, recv_datagram.data, sizeof(probe));
+                        if (probe.size == (u32)datagram_size)
+                        {
+                            u8 probe_data[sizeof(probe)];
+                            u32 probe_data_size = WriteMessage(probe, probe_data, sizeof(probe_data));
+                            CreatePackages(&channels, channel_unreliable, package_type_pmtu_probe, 
+                                           (const void *)probe_data, probe_data_size, MESSAGE_PRIORITY_HIGH);
+                        }
+                    }
+                    else if (is_fec_repair)
+                    {
+                        /* REBUILD LOST PACKAGES FROM REPAIR */
+                        fec_recovered recovered[2];
+                        u32 recovered_count = FecDecoderAddRepair(&fec, (u8 *)recv_datagram.data, recv_payload_size, recovered);
+                        for (u32 recovered_index = 0;
+                                recovered_index < recovered_count;
+                                ++recovered_index)
+                        {
+                            fec_recovered * rec = recovered + recovered_index;
+                            b32 recovered_dropped = false;
 
-#if 0
-                if (inc_package_has_any_critical_msg)
-                {
-                    ConsoleAddMessage("Critical msg from server");
-                }
-#endif
+                            message_iterator rec_it = MessageIterator(rec->payload, rec->size, rec->messages);
+                            for (message * record = MessageNext(&rec_it); record; record = MessageNext(&rec_it))
+                            {
+                                if (GetMessageType(record) == package_type_snapshot)
+                                {
+                                    if (!SnapshotReceiveRecord(&snapshots, rec->seq, record))
+                                    {
+                                        recovered_dropped = true;
+                                    }
+                                }
+                                else if (GetMessageType(record) == package_type_time_sync)
+                                {
+                                    // when a rebuilt packet would have got here is unknown, no sample
+                                }
+                                else if (!ChannelReceiveRecord(&channels, record, delivered, &delivered_count))
+                                {
+                                    recovered_dropped = true;
+                                    break;
+                                }
+                            }
+                            if (!recovered_dropped)
+                            {
+                                MarkSeqReceived(&remote_seq, &remote_seq_bit, rec->seq);
+                            }
 
-                // debug lose all critical
-                inc_package_has_any_critical_msg = 0;
-                if (!inc_package_has_any_critical_msg)
-                {
+                            // late by the time it took to rebuild, the jitter buffer may still play it
+                            const world_snapshot * recovered_snapshot = SnapshotReceived(&snapshots, rec->seq);
+                            if (recovered_snapshot && jitter->tick_ns)
+                            {
+                                JitterBufferPush(jitter, recovered_snapshot->tick, recovered_snapshot, received_time);
+                            }
+                        }
+                    }
+                    else if (is_sequenced)
+                    {
+                        // the walk above already measured the records
+                        if (MessageIteratorOk(&it))
+                        {
+                            u32 records_size = (u32)(it.at - (u8 *)recv_datagram.data);
+                            FecDecoderAddPacket(&fec, recv_packet_seq, (u16)msg_count, (u8 *)recv_datagram.data, records_size);
+                        }
+                    }
+
+                    for (u32 msg_index = 0;
+                            msg_index < delivered_count;
+                            ++msg_index)
+                    {
+                        struct message * msg = delivered + msg_index;
+                        struct udp_auth_reply reply;
+                        if (GetMessageType(msg) == package_type_auth &&
+                            ReadMessage(reply, msg->data, msg->header.len))
+                        {
+                            ConsoleIncrCL(&con, true);
+                            ConsoleAppendAt(&con, con.current_line, 0, "Server: %s", reply.text);
+                            cipher = reply.cipher;
+                            clock.tick_ns = NS_PER_SECOND / reply.tick_hz;
+                            jitter->tick_ns = clock.tick_ns;
+                            ConsoleIncrCL(&con, true);
+                            ConsoleAppendAt(&con, con.current_line, 0, "Cipher: %s",
+                                            cipher == packet_cipher_aes256_gcm ? "AES-256-GCM" : "ChaCha20-Poly1305");
+                        }
+                    }
+
+                    if (packet_dropped)
+                    {
+                        // left unacked, the server sends what didn't get through again
+                    }
+                    else if (is_sequenced && !IsSeqGreaterThan(recv_packet_seq, remote_seq))
+                    {
+                        // reordered or duplicated on the way, only its ack bit is news
+                        MarkSeqReceived(&remote_seq, &remote_seq_bit, recv_packet_seq);
+                    }
+                    else if (is_sequenced)
                     {
                         /* SYNC INCOMING PACKAGE SEQ WITH OUR RECORDS */
-                        // unless crafted package, recv package should always be higher than our record
-                        Assert(IsSeqGreaterThan(recv_packet_seq,remote_seq));
 
                         // TODO: what if we lose all packages for 1 > s?
                         // should we simply reset to 0 all bits and move on
@@ -702,14 +796,48 @@ main(int argc, char * argv[])
                         }
 
                         bit_mask = bit_mask ^ ((u32)1 << lo);
-                        packet_seq_deltatime[remote_bit_index] = GetTimeDiff(GetRealTime(), packet_seq_realtime[remote_bit_index], perf_freq);
+                        packet_seq_deltatime[remote_bit_index] = NsToMs(starting_time - packet_seq_realtime[remote_bit_index]);
+                    }
+
+                    u32 new_packet_seq_bit = (recv_packet_ack_bit & bit_mask);
+                    if (IsSeqGreaterThan(packet_acked, recv_packet_ack))
+                    {
+                        // sent before one already here, its acks add to what that one told
+                        new_packet_seq_bit |= packet_seq_bit;
+                    }
+
+                    // rtt samples for congestion control
+                    u32 newly_ack_bits = new_packet_seq_bit & ~packet_seq_bit;
+                    for (u32 bit_index = 0; newly_ack_bits; ++bit_index, newly_ack_bits >>= 1)
+                    {
+                        if (newly_ack_bits & 1)
+                        {
+                            CongestionOnPacketAcked(&cc, NsToMs(starting_time - packet_seq_realtime[bit_index]));
+                            ChannelsOnPacketAcked(&channels, SeqFromBitIndex(packet_seq, bit_index));
+                        }
                     }
 
-                    packet_seq_bit = (recv_packet_ack_bit & bit_mask);
+                    packet_seq_bit = new_packet_seq_bit;
+                    CongestionDetectLosses(&cc, packet_seq, packet_seq_bit);
+                    if (IsSeqGreaterThan(recv_packet_ack, packet_acked))
+                    {
+                        packet_acked = recv_packet_ack;
+                    }
                 }
             }
         }
 
+        /* PLAY OUT SNAPSHOTS */
+        JitterBufferUpdate(jitter, starting_time);
+        for (const jitter_buffer_entry * entry = JitterBufferPop(jitter, starting_time);
+                entry;
+                entry = JitterBufferPop(jitter, starting_time))
+        {
+            // every tick due plays in order, the newest is what shows
+            played_snapshot = entry->snapshot;
+            has_played = true;
+        }
+
         switch (my_status_with_server)
         {
             case client_status_in_game:
@@ -726,10 +854,14 @@ main(int argc, char * argv[])
                 struct udp_auth login_data;
                 sprintf_s(login_data.user,"%s","anonymous");
                 sprintf_s(login_data.pwd,"%s","1234");
+                login_data.ciphers = PACKET_CIPHERS_ALL;
+                login_data.client_class = client_class_player;
 
                 my_status_with_server = client_status_trying_auth;
 
-                CreatePackages(&packet_seq_bit,&queue_msg_to_send, package_type_auth, (const void *)&login_data, sizeof(udp_auth), true);
+                u8 login_payload[sizeof(udp_auth)];
+                u32 login_size = WriteMessage(login_data, login_payload, sizeof(login_payload));
+                CreatePackages(&channels, channel_reliable_ordered, package_type_auth, (const void *)login_payload, login_size, MESSAGE_PRIORITY_HIGH);
 
             } break;
             default:
@@ -750,65 +882,129 @@ main(int argc, char * argv[])
         }
         r32 avg_roundtrips = aggr_roundtrips / (r32)(max(count_pkgs_received, 1));
 
-        // set current seq as not received
-        packet_seq += 1;
-        u32 new_package_bit_index = (packet_seq & 31);
-        packet_seq_bit = (packet_seq_bit & ~((u32)1 << new_package_bit_index));
-
-        struct packet packet;
-        packet.header.seq       = packet_seq;
-        packet.header.ack       = remote_seq;
-        packet.header.ack_bit   = remote_seq_bit;
-        packet.header.protocol  = PROTOCOL_ID;
-        packet.header.messages  = 0;
-
-        i32 is_critical = 0;
-        u32 current_size = 0;
-        queue_message * queue = &queue_msg_to_send;
-        for (u32 i = queue->begin; 
-                 i != queue->next; 
-                 i = ( (++i) & (ArrayCount(queue->messages) - 1)))
+        b32 send_due = (starting_time - last_send_time + frame_ns / 2 > MsToNs(cc.send_interval_ms));
+        if (!session_keyed)
         {
-            struct message * msg = queue->messages + i;
-            u32 msg_size = msg ->header.len + sizeof(message_header);
-            u32 size_after_msg = (current_size + msg_size);
-
-            if ( size_after_msg <= sizeof(packet.data) )
+            // hello at the send rate until the reply gets in
+            if (send_due)
             {
-                memcpy(packet.data + current_size, msg, msg_size);
-
-                is_critical = is_critical | IsCriticalMessage(msg);
-
-                // keep track in which pck was sent
-                queue->msg_sent_in_package_bit_index[i] = new_package_bit_index;
+                u8 hello[CRYPTO_HANDSHAKE_SIZE + PACKET_SALT_SIZE + PACKET_CHECK_SIZE];
+                u32 hello_size = CryptoHandshakeWrite(hello, CRYPTO_HANDSHAKE_HELLO, key_pair.public_key);
+                hello_size = PacketSeal(hello, hello_size, session_salt, true);
+                SendPackage(handle, server_addr, (void *)hello, hello_size);
+                last_send_time = starting_time;
+            }
+        }
+        // due if less than half a frame is left to the send interval
+        else if (send_due)
+        {
+            // set current seq as not received
+            packet_seq += 1;
+            u32 new_package_bit_index = (packet_seq & 31);
+
+            // slot is reused, package sent 32 seq ago never got ack
+            u32 new_package_bit = ((u32)1 << new_package_bit_index);
+            CongestionOnPacketSent(&cc, packet_seq, packet_seq_bit);
+            if ((packet_seq_bit & new_package_bit) == 0)
+            {
+                u32 lost_seq = packet_seq - 32;
+                u32 resend_count = ChannelsOnPacketLost(&channels, lost_seq);
 
-                current_size = size_after_msg;
-                queue->begin = (++queue->begin) & (ArrayCount(queue->messages) - 1);
-                packet.header.messages += 1;
-                if (current_size >= sizeof(packet.data))
+                ConsoleIncrCL(&con, true);
+                ConsoleAppendAt(&con, con.current_line,0,"Package was lost! %u (critical?%s, %u msgs to resend)", 
+                                lost_seq, (packet_seq_critical & new_package_bit) ? "True" : "False", resend_count);
+            }
+            CongestionUpdate(&cc);
+            packet_seq_bit = (packet_seq_bit & ~((u32)1 << new_package_bit_index));
+
+            struct packet packet;
+            packet.header.seq       = packet_seq;
+            packet.header.ack       = remote_seq;
+            packet.header.ack_bit   = remote_seq_bit;
+            packet.header.protocol  = PROTOCOL_ID;
+            packet.header.flags     = 0;
+            packet.header.messages  = 0;
+
+            b32 is_critical = 0;
+            // no path MTU discovery towards the server, client packets are small
+            u32 payload_budget = min((u32)(PACKET_PAYLOAD_SIZE), cc.bytes_per_send);
+            u32 payload_used = 
+                ChannelsPackPacket(&channels, packet_seq,
+                                   (u8 *)packet.data, payload_budget,
+                                   &packet.header.messages, &is_critical);
+            // server clock sample, stamped as late as it can be
+            if (ClockSyncRequestDue(&clock, starting_time))
+            {
+                udp_time_request time_request;
+                time_request.client_time = GetRealTime();
+                u32 request_size = 
+                    ClockSyncWriteRecord(time_request, (u8 *)packet.data + payload_used, payload_budget - payload_used,
+                                         &packet.header.messages);
+                if (request_size)
                 {
-                    break;
+                    payload_used += request_size;
+                    ClockSyncRequestSent(&clock, starting_time);
                 }
             }
+            // leftover space carries copies of inputs not acked yet
+            payload_used += 
+                ChannelsPackRedundant(&channels, packet_seq,
+                                      (u8 *)packet.data + payload_used, payload_budget - payload_used,
+                                      RedundancyDepth(cc.loss_rate), &packet.header.messages);
+
+            packet_seq_critical = (packet_seq_critical & (~((u32)1 << new_package_bit_index)));
+            packet_seq_critical = packet_seq_critical | ( (is_critical ? 1 : 0) << new_package_bit_index );
+            packet_seq_realtime[new_package_bit_index] = starting_time;
+            last_send_time = packet_seq_realtime[new_package_bit_index];
+            u8 wire_buffer[PACKET_WIRE_BUFFER_SIZE];
+            u32 datagram_size = 0;
+            u8 * wire = PacketToWireCompressed(&packet, payload_used, packet_acked, wire_buffer, &datagram_size, &compress_sent);
+            u32 wire_header_size = PacketHeaderWireSize(wire, datagram_size);
+            datagram_size = PacketEncrypt(&session_key, cipher, CRYPTO_CLIENT_TO_SERVER, &packet.header,
+                                          wire, wire_header_size, datagram_size - wire_header_size, &crypto_counter);
+            datagram_size = PacketSeal(wire, datagram_size, session_salt, true);
+            if (SendPackage(handle,server_addr, (void *)wire, datagram_size) == SOCKET_ERROR)
+            {
+                //logn("Error sending package %i. %s", packet.header.seq , GetLastSocketErrorMessage());
+                //keep_alive = 0;
+            }
+            else
+            {
+#if 0
+                ConsoleIncrCL(&con, true);
+                ConsoleAppendAt(&con, con.current_line,0,"Sending package %i.",  packet.header.seq);
+#endif
+            }
         }
 
-        packet_seq_critical = (packet_seq_critical & (~((u32)1 << new_package_bit_index)));
-        packet_seq_critical = packet_seq_critical | ( (is_critical ? 1 : 0) << new_package_bit_index );
-        packet_seq_realtime[new_package_bit_index] = GetRealTime();
-        if (SendPackage(handle,server_addr, (void *)&packet, sizeof(packet)) == SOCKET_ERROR)
+        ConsoleAppendAt(&con, 6, 40, "Last: %u",packet_seq);
+        if (has_played)
         {
-            //logn("Error sending package %i. %s", packet.header.seq , GetLastSocketErrorMessage());
-            //keep_alive = 0;
+            entity_arrays played_state;
+            SnapshotDequantize(&played_snapshot, &played_state);
+            ConsoleAppendAt(&con, 8, 40, "Snapshot %u (%u records dropped) entity 0 at %.2f %.2f", 
+                            snapshots.latest_seq, snapshots.records_dropped,
+                            played_state.position[0][0], played_state.position[1][0]);
+            if (clock.synced && clock.tick_ns)
+            {
+                // how long ago the server took what shows, our clock
+                i64 snapshot_age_ns = (i64)(starting_time - ClockSyncTickLocalTime(&clock, played_snapshot.tick));
+                ConsoleAppendAt(&con, 8, 110, "tick %u, %.1f ms old", played_snapshot.tick, (r64)snapshot_age_ns / NS_PER_MS);
+            }
+            ConsoleAppendAt(&con, 13, 40, "Playout delay %.1f ms (jitter p50 %.1f p95 %.1f p99 %.1f ms), %u held, %u late, %u reordered",
+                            NsToMs(JitterBufferDelayNs(jitter)), NsToMs(jitter->jitter_p50_ns),
+                            NsToMs(jitter->jitter_p95_ns), NsToMs(jitter->jitter_p99_ns),
+                            JitterBufferCount(jitter), jitter->late, jitter->reordered);
         }
-        else
+        if (clock.synced)
         {
-#if 0
-            ConsoleIncrCL(&con, true);
-            ConsoleAppendAt(&con, con.current_line,0,"Sending package %i.",  packet.header.seq);
-#endif
+            ConsoleAppendAt(&con, 12, 40, "Server clock %+.3f ms, rtt %.3f ms, drift %+.1f ppm, %u samples", 
+                            (r64)clock.reference_offset_ns / NS_PER_MS, (r64)clock.rtt_ns / NS_PER_MS,
+                            clock.drift * 1e6, clock.samples);
         }
-
-        ConsoleAppendAt(&con, 6, 40, "Last: %u",packet_seq);
+        ConsoleAppendAt(&con, 9, 40, "Compressed %u/%u received, %llu b saved", 
+                        compress_received.packets_compressed, compress_received.packets,
+                        (unsigned long long)(compress_received.raw_bytes - compress_received.wire_bytes));
         for (i32 i = 31; i >= 0; --i)
         {
             b32 is_set = (packet_seq_bit >> i) & 0x01;
@@ -817,29 +1013,14 @@ main(int argc, char * argv[])
         //remote_seq = UINT_MAX;
         //remote_seq_bit = ~0;
 
-        // sleep expected time
-        delta_time time_frame_elapsed = 
-            GetTimeDiff(GetRealTime(), starting_time, perf_freq);
-        r32 remaining_ms = expected_ms_per_package - time_frame_elapsed;
-
-        if (remaining_ms > 1.0f)
-        {
-            time_frame_elapsed = GetTimeDiff(GetRealTime(), starting_time, perf_freq);
-            remaining_ms = expected_ms_per_package - time_frame_elapsed;
-            while (remaining_ms > 1.0f)
-            {
-                Sleep((DWORD)remaining_ms);
-                time_frame_elapsed = GetTimeDiff(GetRealTime(), starting_time, perf_freq);
-                remaining_ms = expected_ms_per_package - time_frame_elapsed;
-            }
-        }
-
-        ConsoleUpdateMetrics(time_frame_elapsed,avg_roundtrips);
+        ConsoleUpdateMetrics(NsToMs(tick_interval_ns),avg_roundtrips);
         ConsoleSwapBuffer(&con);
     }
 
     DestroyConsole(&con);
 
+    TickJitterPrint(&ticks, stdout);
+
     HighDefinitionTimeEnd();
 
     CloseSocket(handle);
@@ -5,11 +5,51 @@
 #include "MurmurHash3.h"
 #include "protocol.h"
 #include "math.h"
+#include "channel.cpp"
+#include "fec.cpp"
+#include "congestion.h"
+#include "pacing.h"
+#include "tick.h"
+#include "send_rate.h"
+#include "clock_sync.h"
+#include "pmtu.h"
+#include "packet_header.h"
+#include "snapshot.cpp"
+#include "compress.cpp"
+#include "crc32c.cpp"
+#include "crypto.cpp"
+#include "message_iterator.h"
 #include "console_sequences.cpp"
 
-#define QUAD_TO_MS(Q) Q.QuadPart * (1.0f / 1000.0f)
+// the world steps this many times a second, sends go out on its ticks
+#define SERVER_TICK_RATE 60
+// congestion control moves every client send rate between this and its class cap
+#define SERVER_MIN_PACKAGES_PER_SECOND 2
+// sends are spread across the frame in this many slots. test_pacing: 10k clients
+// overflow the default socket queue with 8 (68% lost) and 16, not with 32 or more
+#define SERVER_PACING_SLOTS 32
+// copies of unacked high priority messages in leftover packet space
+#define SERVER_REDUNDANT_RELIABLE 1
+// without payload acks wait for this many packets or this long
+#define SERVER_ACK_COALESCE_PACKETS 4
+#define SERVER_ACK_DELAY_NS (100 * NS_PER_MS)
+// idle clients get at least a header this often, they time out after the other
+#define SERVER_KEEPALIVE_NS (1000 * NS_PER_MS)
+#define SERVER_CLIENT_TIMEOUT_NS (5000 * NS_PER_MS)
+// time from the TSC when it runs at a constant rate, CLOCK_MONOTONIC otherwise
+#define SERVER_TSC_CLOCK 1
+// entities of the demo world that walk around, the rest stand still
+#define SERVER_WORLD_MOVERS 16
+// m and m/s
+#define SERVER_WORLD_HALF_SIZE 20.0f
+#define SERVER_WORLD_MAX_SPEED 4.0f
+// datagrams read off the socket a frame and sends sealed together, one crypto batch
+#define SERVER_RECV_BATCH CRYPTO_BATCH_SIZE
+#define SERVER_SEND_BATCH CRYPTO_BATCH_SIZE
 
 /* ---------------------------- BEGIN STATIC VARIABLES ----------------------------- */
+// send rate cap by client_class: players, spectators, low bandwidth
+static const r32 server_class_max_hz[client_class_count] = { 60.0f, 10.0f, 20.0f };
 static volatile int * keep_alive = 0;
 static struct console con = {};
 /* ---------------------------- END STATIC VARIABLES ----------------------------- */
@@ -19,9 +59,20 @@ struct client_info
     u32 addr;
     u32 port;
     sockaddr_in addr_ip;
+    // salt of the session the client came in with, seals every datagram (crc32c.h)
+    u32 session_salt;
+    // encrypts both ways, from the key exchange (crypto.h). Counter of packets sent without a seq
+    crypto_key session_key;
+    // our half of the exchange, a repeated hello gets it again
+    u8 server_public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    u32 crypto_counter;
+    // packet_cipher, picked at auth
+    u32 cipher;
     client_status status;
     real_time last_update;
+    // last packet with a seq of its own, last packet of any kind
     real_time last_message_from_server;
+    real_time last_packet_sent;
     struct client_info * next;
     FILE * fd;
     u32 fd_entry_count;
@@ -29,13 +80,33 @@ struct client_info
 
     // this are the packages the server sent to client
     u32 server_packet_seq;
+    // newest seq the client acked, how many seq bytes go on the wire
+    u32 server_packet_acked;
     u32 server_packet_seq_bit;
     u32 server_packet_seq_critical;
+    real_time server_packet_sent_time[32];
+    u16 server_packet_sent_size[32];
+    congestion_control cc;
+    u32 client_class;
+    send_schedule send;
+    u32 pacing_slot;
+    fec_encoder fec;
+    pmtu_discovery pmtu;
+    real_time pmtu_probe_time;
+
+    // time request waiting for a data packet to answer in (clock_sync.h)
+    b32 time_request_pending;
+    u64 time_request_client_time;
+    real_time time_request_received;
 
     // this monitor client packages received
     u32 client_remote_seq;
     u32 client_remote_seq_bit;
-    queue_message queue_msg_to_send;
+    // packets received since our last ack
+    u32 client_packets_unacked;
+    real_time client_first_unacked_time;
+    message_channels channels;
+    snapshot_sender snapshots;
 };
 
 struct hash_map
@@ -102,8 +173,23 @@ CreateClientLog(struct client_info * client)
 }
 
 
+/* client at addr:port, 0 if there is none */
 struct client_info *
-Client(u32 addr, u32 port, struct hash_map * client_map)
+FindClient(u32 addr, u32 port, struct hash_map * client_map)
+{
+    u32 hashkey = ClientHashKey(addr, port, client_map);
+    struct client_info * client = *((struct client_info **)client_map->table + hashkey);
+
+    while ( client && (client->addr != addr || client->port != port) )
+    {
+        client = client->next;
+    }
+
+    return client;
+}
+
+struct client_info *
+Client(u32 addr, u32 port, u32 session_salt, real_time now, struct hash_map * client_map)
 {
     struct client_info ** ptr_client = 0;
     struct client_info * client = 0;
@@ -144,34 +230,52 @@ Client(u32 addr, u32 port, struct hash_map * client_map)
         // new client
         client->addr = addr;
         client->port = port;
+        client->session_salt = session_salt;
+        client->crypto_counter = 0;
+        client->cipher = packet_cipher_chacha20_poly1305;
         client->next = 0;
         client->status = client_status_none;
-        client->last_update = GetRealTime();
+        client->last_update = now;
         client->addr_ip = CreateSocketAddress( addr , port);
-        ZeroTime(client->last_message_from_server);
-        client->last_message_from_server = GetRealTime();
+        client->last_message_from_server = now;
+        client->last_packet_sent = client->last_message_from_server;
+        client->client_packets_unacked = 0;
+        client->time_request_pending = false;
 #if 1
         client->server_packet_seq = UINT_MAX;
+        client->server_packet_acked = UINT_MAX;
         client->server_packet_seq_bit = ~0;
         // none are critical
         client->server_packet_seq_critical = 0;
 
         client->client_remote_seq = UINT_MAX;
         client->client_remote_seq_bit = ~0;
+
+        for (u32 i = 0; i < ArrayCount(client->server_packet_sent_time); ++i)
+        {
+            ZeroTime(client->server_packet_sent_time[i]);
+            client->server_packet_sent_size[i] = 0;
+        }
+        // a player until auth says otherwise
+        client->client_class = client_class_player;
+        CongestionInit(&client->cc, 
+                       SERVER_MIN_PACKAGES_PER_SECOND, server_class_max_hz[client->client_class], 
+                       PACKET_PAYLOAD_SIZE);
+        SendScheduleInit(&client->send, client_map->entries_count, SERVER_TICK_RATE);
+        // assigned by the send loop
+        client->pacing_slot = PACING_NO_SLOT;
+        FecEncoderInit(&client->fec);
+        PmtuInit(&client->pmtu);
+        ZeroTime(client->pmtu_probe_time);
 #else
         client->server_packet_seq = UINT_MAX - 345;
+        client->server_packet_acked = UINT_MAX - 345;
         client->server_packet_seq_bit = ~0;
         client->client_remote_seq = UINT_MAX - 650;
         client->client_remote_seq_bit = ~0;
 #endif
-        memset(&(client->queue_msg_to_send), 0, sizeof(client->queue_msg_to_send));
-        // range should fall between 0-31, 32 signal as not set
-        for (u32 i = 0; 
-                 i < ArrayCount(client->queue_msg_to_send.msg_sent_in_package_bit_index); 
-                 ++i)
-        {
-            client->queue_msg_to_send.msg_sent_in_package_bit_index[i] = 32;
-        }
+        ChannelsInit(&client->channels);
+        SnapshotSenderInit(&client->snapshots);
 
         Assert(client_map->entries_begin);
         Assert(client_map->bucket_count >= (client_map->entries_count + 1));
@@ -257,6 +361,32 @@ RemoveClient(struct client_info * client, struct hash_map * client_map)
 }
 
 
+/* datagram drained from the socket, waiting for the batch to be opened */
+struct server_received
+{
+    struct packet datagram;
+    u32 addr;
+    u32 port;
+    u32 session_salt;
+    u32 wire_header_size;
+    // without trailers
+    i32 bytes;
+    // read off the socket, time requests are stamped with it
+    real_time received_time;
+};
+
+/* datagrams of a pacing slot, sealed together before they go out */
+struct server_outbox
+{
+    u32 count;
+    struct client_info * clients[SERVER_SEND_BATCH];
+    crypto_job jobs[SERVER_SEND_BATCH];
+    u32 sizes[SERVER_SEND_BATCH];
+    // too big for the interface is expected of probes
+    b32 may_fail[SERVER_SEND_BATCH];
+    u8 wire[SERVER_SEND_BATCH][UDP_DATAGRAM_PMTU_MAX_SIZE];
+};
+
 struct server_handler
 {
     memory_arena permanent_arena;
@@ -268,11 +398,219 @@ struct server_handler
 
     // connections
     hash_map client_map;
+    pacing_scheduler pacing;
+    // DF could be set on the socket
+    b32 pmtu_probing;
+    // the kernel stamps datagrams, else time requests are stamped when read
+    b32 receive_timestamps;
 
     i32 keep_alive;
     u32 seed;
+
+    // simulated in floats, quantized into the world replicated by delta snapshots
+    entity_arrays world_state;
+    world_snapshot world;
+
+    // payload compression stage, both ways
+    compress_stats compress_sent;
+    compress_stats compress_received;
+
+    server_outbox outbox;
 };
 
+/* DEMO WORLD */
+
+inline r32
+RandomUnit()
+{
+    r32 result = 2.0f * ((r32)rand() / (r32)RAND_MAX) - 1.0f;
+
+    return result;
+}
+
+/* rotation about z that turns +x to (dx, dy), half angle formulas so no trig */
+void
+WorldFace(entity_arrays * state, u32 entity_index, r32 dx, r32 dy)
+{
+    r32 length = SqrtFloat(dx * dx + dy * dy);
+    r32 cos_yaw = (length > 0.0f) ? (dx / length) : 1.0f;
+    r32 half_cos = SqrtFloat(max(0.0f, (1.0f + cos_yaw) * 0.5f));
+    r32 half_sin = SqrtFloat(max(0.0f, (1.0f - cos_yaw) * 0.5f));
+
+    state->orientation[0][entity_index] = 0.0f;
+    state->orientation[1][entity_index] = 0.0f;
+    state->orientation[2][entity_index] = (dy < 0.0f) ? -half_sin : half_sin;
+    state->orientation[3][entity_index] = half_cos;
+}
+
+void
+WorldInit(struct server_handler * server)
+{
+    entity_arrays * state = &server->world_state;
+
+    for (u32 entity_index = 0; entity_index < SNAPSHOT_MAX_ENTITIES; ++entity_index)
+    {
+        b32 is_mover = (entity_index < SERVER_WORLD_MOVERS);
+
+        state->position[0][entity_index] = RandomUnit() * SERVER_WORLD_HALF_SIZE;
+        state->position[1][entity_index] = RandomUnit() * SERVER_WORLD_HALF_SIZE;
+        state->position[2][entity_index] = 0.0f;
+        state->velocity[0][entity_index] = is_mover ? RandomUnit() * SERVER_WORLD_MAX_SPEED : 0.0f;
+        state->velocity[1][entity_index] = is_mover ? RandomUnit() * SERVER_WORLD_MAX_SPEED : 0.0f;
+        state->velocity[2][entity_index] = 0.0f;
+        WorldFace(state, entity_index, RandomUnit(), RandomUnit());
+
+        entity_state * entity = server->world.entities + entity_index;
+        entity->health = 100;
+        entity->flags = ENTITY_FLAG_ALIVE | ENTITY_FLAG_VISIBLE;
+    }
+
+    SnapshotQuantize(&server->world, state);
+}
+
+void
+WorldUpdate(struct server_handler * server, r32 dt)
+{
+    entity_arrays * state = &server->world_state;
+
+    for (u32 entity_index = 0; entity_index < SERVER_WORLD_MOVERS; ++entity_index)
+    {
+        for (u32 axis = 0; axis < 2; ++axis)
+        {
+            r32 * position = state->position[axis] + entity_index;
+            r32 * velocity = state->velocity[axis] + entity_index;
+
+            *position += *velocity * dt;
+            if (*position < -SERVER_WORLD_HALF_SIZE || *position > SERVER_WORLD_HALF_SIZE)
+            {
+                *velocity = -*velocity;
+            }
+        }
+
+        // walkers look where they go
+        WorldFace(state, entity_index, state->velocity[0][entity_index], state->velocity[1][entity_index]);
+    }
+
+    // now and then someone gets hurt or heals
+    if ((rand() % 10) == 0)
+    {
+        entity_state * entity = server->world.entities + (rand() % SNAPSHOT_MAX_ENTITIES);
+        entity->health = (u16)(rand() % 101);
+    }
+
+    SnapshotQuantize(&server->world, state);
+}
+
+
+/* SEND */
+
+/*
+ * Key exchange hello from item's addr:port, client 0 if it isn't one yet.
+ * A new one comes in with the session key, a repeated hello (the reply was
+ * lost) is answered with the same key.
+ */
+void
+ServerHandshake(struct server_handler * server, struct client_info * client, server_received * item,
+                const u8 * client_public_key, real_time now)
+{
+    if (!client)
+    {
+        crypto_key_pair pair;
+        crypto_key session_key;
+        if (!CryptoNewKeyPair(&pair) || !CryptoSessionKey(&pair, client_public_key, false, &session_key))
+        {
+            CryptoWipe(&pair, sizeof(pair));
+            return;
+        }
+        client = Client(item->addr, item->port, item->session_salt, now, &server->client_map);
+        client->session_key = session_key;
+        memcpy(client->server_public_key, pair.public_key, CRYPTO_PUBLIC_KEY_SIZE);
+        CryptoWipe(&pair, sizeof(pair));
+        CryptoWipe(&session_key, sizeof(session_key));
+    }
+
+    u8 reply[CRYPTO_HANDSHAKE_SIZE + PACKET_CHECK_SIZE];
+    u32 reply_size = CryptoHandshakeWrite(reply, CRYPTO_HANDSHAKE_REPLY, client->server_public_key);
+    reply_size = PacketSeal(reply, reply_size, client->session_salt, false);
+    // lost, the client says hello again
+    SendPackage(server->handle, client->addr_ip, (void *)reply, reply_size);
+}
+
+/* seals the datagrams waiting in the outbox and sends them */
+void
+OutboxFlush(struct server_handler * server)
+{
+    server_outbox * outbox = &server->outbox;
+    CryptoSealBatch(outbox->jobs, outbox->count);
+
+    for (u32 index = 0; index < outbox->count; ++index)
+    {
+        struct client_info * client = outbox->clients[index];
+        u8 * wire = outbox->wire[index];
+        u32 datagram_size = PacketSeal(wire, outbox->sizes[index], client->session_salt, false);
+        if (SendPackage(server->handle,client->addr_ip, (void *)wire, datagram_size) == SOCKET_ERROR &&
+            !outbox->may_fail[index])
+        {
+            server->keep_alive = 0;
+        }
+    }
+
+    outbox->count = 0;
+}
+
+/*
+ * Queues a datagram to client: header_size bytes of wire header (header
+ * decoded), then payload_size of payload. Returns its size on the wire
+ */
+u32
+OutboxPush(struct server_handler * server, struct client_info * client, const packet_header * header,
+           const u8 * wire, u32 header_size, u32 payload_size)
+{
+    server_outbox * outbox = &server->outbox;
+    if (outbox->count == SERVER_SEND_BATCH)
+    {
+        OutboxFlush(server);
+    }
+
+    // no salt this way
+    Assert(header_size + payload_size + CRYPTO_COUNTER_SIZE + CRYPTO_TAG_SIZE + PACKET_CHECK_SIZE <= UDP_DATAGRAM_PMTU_MAX_SIZE);
+
+    u32 index = outbox->count++;
+    u8 * datagram = outbox->wire[index];
+    memcpy(datagram, wire, header_size + payload_size);
+    outbox->clients[index] = client;
+    outbox->may_fail[index] = (header->flags & PACKET_FLAG_PMTU_PROBE) != 0;
+    outbox->sizes[index] = PacketSealJob(outbox->jobs + index, &client->session_key, client->cipher, CRYPTO_SERVER_TO_CLIENT, header,
+                                         datagram, header_size, payload_size, &client->crypto_counter);
+
+    return outbox->sizes[index] + PACKET_CHECK_SIZE;
+}
+
+/* repairs of the open fec group, same seq/ack as header. Returns packets sent */
+u32
+SendFecRepairs(struct server_handler * server, struct client_info * client, packet_header * header, u32 * bytes_sent)
+{
+    u32 repair_count = FecEncoderRepairCount(&client->fec);
+    for (u32 repair_index = 0; repair_index < repair_count; ++repair_index)
+    {
+        struct packet repair;
+        repair.header = *header;
+        repair.header.flags = PACKET_FLAG_FEC_REPAIR;
+        repair.header.messages = 0;
+
+        u32 repair_payload = FecEncoderWriteRepair(&client->fec, repair_index, (u8 *)repair.data);
+        u32 header_size = 0;
+        u8 * wire = PacketToWire(&repair, client->server_packet_acked, &header_size);
+        *bytes_sent += OutboxPush(server, client, &repair.header, wire, header_size, repair_payload);
+    }
+
+    if (client->fec.count > 0)
+    {
+        FecEncoderCloseGroup(&client->fec);
+    }
+
+    return repair_count;
+}
 
 struct server_handler *
 CreateServer(memory_arena * server_arena, u32 PermanentMemorySize, u32 TransientMemorySize, i32 port)
@@ -332,7 +670,22 @@ CreateServer(memory_arena * server_arena, u32 PermanentMemorySize, u32 Transient
 
     server->handle = handle;
     server->port = port;
+
+    server->pmtu_probing = (SetSocketDontFragment(handle) != SOCKET_ERROR);
+    if (!server->pmtu_probing)
+    {
+        logn("Socket error: \n%s\n%s (path MTU discovery disabled)", "SetSocketDontFragment", GetLastSocketErrorMessage());
+    }
+    // without them time requests are stamped when the loop reads them, the wait in the socket
+    // goes into client clock samples: within a few ms (test_clock_sync) instead of well under one
+    server->receive_timestamps = (SetSocketReceiveTimestamps(handle) != SOCKET_ERROR);
+    if (!server->receive_timestamps)
+    {
+        logn("Socket error: \n%s\n%s (time requests stamped when read, client clocks within a few ms)", 
+             "SetSocketReceiveTimestamps", GetLastSocketErrorMessage());
+    }
     server->keep_alive = 1;
+    server->outbox.count = 0;
 
     // must be power of 2 (x & (256 - 1)) lookup
     server->client_map.table_size = 256;
@@ -350,6 +703,8 @@ CreateServer(memory_arena * server_arena, u32 PermanentMemorySize, u32 Transient
 
     // this is an array of pointers to entries in use
     server->client_map.entries_begin = PushArray(&server->permanent_arena, server->client_map.bucket_count, struct client_info *);
+
+    PacingInit(&server->pacing, SERVER_PACING_SLOTS);
     
     return server;
 }
@@ -385,104 +740,6 @@ IsSeqGreaterThan(u16 a, u16 b)
     return result;
 }
 
-b32
-IsAckMessage(const u32 * packet_seq_bit, queue_message * queue, i32 index)
-{
-    u32 pck_bit_index = queue->msg_sent_in_package_bit_index[index];
-    u32 bit_mask = ((u32)1 << pck_bit_index);
-
-    i32 is_ack_msg = (i32)((*packet_seq_bit & bit_mask) == bit_mask);
-
-    return is_ack_msg;
-}
-
-i32
-IsCriticalMessage(message * msg)
-{
-    i32 is_critical = 
-        (msg->header.message_type & (1 << 7)) == (1 << 7);
-
-    return is_critical;
-}
-
-struct message *
-GetNextAvailableMessageInQueue(struct queue_message * queue, const u32 * packet_seq_bit)
-{
-    struct message * msg = 0;
-    b32 MessageIsAck = 0;
-
-    i32 index = (queue->next++ & (ArrayCount(queue->messages) - 1));
-
-    // this may happen if all packages are critical and none is ack
-    Assert(queue->next != queue->begin);
-
-    msg = queue->messages + index;
-    MessageIsAck = IsAckMessage(packet_seq_bit, queue, index);
-
-    if (IsCriticalMessage(msg) && !MessageIsAck)
-    {
-        struct message * first_ack_msg = 0;
-        u32 index_next = queue->next;
-        do
-        {
-            first_ack_msg = queue->messages + index_next;
-            if (IsAckMessage(packet_seq_bit, queue, index_next))
-            {
-                memcpy(first_ack_msg, msg, sizeof(struct message));
-                msg->header.message_type = 0;
-                break;
-            }
-            index_next = (index_next + 1) & (ArrayCount(queue->messages) - 1);
-        } while (index_next != queue->begin);
-
-        Assert(index_next != queue->begin);
-    }
-
-    Assert(!IsCriticalMessage(msg) || MessageIsAck);
-
-    return msg;
-}
-
-void
-CreatePackages(const u32 * packet_seq_bit, struct queue_message * queue, enum package_type packet_type, const void * data, u32 size, b32 is_critical)
-{
-    i32 order = 0;
-    i32 id = (queue->last_id++ & ((1 << 8) - 1));
-    u8 critical_mask = ((u8)(is_critical ? 1 : 0) << 7);
-
-    // create a header package so peer knows needs to create buffer
-    if (size > ArrayCount(queue->messages[0].data))
-    {
-        struct message * msg = GetNextAvailableMessageInQueue(queue, packet_seq_bit);
-        msg->header.id = id;
-        msg->header.order = order;
-        msg->header.message_type = package_type_buffer | critical_mask;
-        msg->header.len = sizeof(struct udp_buffer);
-
-        udp_buffer buffer_msg = { size };
-        memcpy(msg->data, &buffer_msg, sizeof(udp_buffer) );
-
-        order += 1;
-    }
-
-    while (size > 0)
-    {
-        u32 used_size = min(size, sizeof(queue->messages[0].data));
-
-        struct message * msg = GetNextAvailableMessageInQueue(queue, packet_seq_bit);
-
-        msg->header.id = id;
-        msg->header.order = order;
-        msg->header.message_type = packet_type | critical_mask;
-        msg->header.len = used_size;
-
-        memcpy(msg->data, data, used_size);
-
-        size -= used_size;
-        order += 1;
-    }
-}
-
 void 
 printBits(size_t const size, void const * const ptr)
 {
@@ -548,14 +805,6 @@ InitializeTerminateSignalHandler()
 #endif
 }
 
-inline package_type
-GetMessageType(message * msg)
-{
-    package_type result = (package_type)((int)msg->header.message_type & ~(1 << 7));
-
-    return result;
-}
-
 int
 main()
 {
@@ -596,11 +845,11 @@ main()
     int port = 30000;
 
     memory_arena server_arena;
-    server_arena.max_size = Megabytes(32);
+    server_arena.max_size = Megabytes(40);
     server_arena.base = malloc(server_arena.max_size);
     server_arena.size = 0;
 
-    struct server_handler * server = CreateServer(&server_arena, Megabytes(8), Megabytes(24), port);
+    struct server_handler * server = CreateServer(&server_arena, Megabytes(16), Megabytes(24), port);
     /* END SOCKETS */
 
     // TODO: debug ctrl-c stop server gracefully
@@ -612,22 +861,33 @@ main()
         return 1;
     }
 
-    real_time clock_freq = GetClockResolution();
+    TimeInit(SERVER_TSC_CLOCK);
     //mkdir(".\\clients\\");
 
     server->seed = 12312312;
     srand(server->seed);
+    WorldInit(server);
 
-    u32 packages_per_second = 20;
-    r32 expected_ms_per_package = (1.0f / (r32)packages_per_second) * 1000.0f;
+    // the world steps a fixed dt a tick, ticks that ran late are caught up
+    r32 tick_ms = 1000.0f / (r32)SERVER_TICK_RATE;
+    u64 frame_ns = NS_PER_SECOND / SERVER_TICK_RATE;
+    u64 world_tick = 0;
+    tick_scheduler ticks;
+    TickInit(&ticks, frame_ns, tick_overrun_catch_up, GetRealTime());
 
     HighDefinitionTimeBegin();
 
+    FecInit();
+    CompressInit();
+    Crc32cInit();
+    CryptoInit();
+
     // main loop - ml
     while ( server->keep_alive )
     {
+        // the tick's now, everything up to the send slots compares against it
         real_time starting_time;
-        starting_time = GetRealTime();
+        starting_time = TickWait(&ticks);
 
 
         char c = GetChar();
@@ -638,297 +898,362 @@ main()
         }
 
 
-        for (int entry_index = 0;
-                 entry_index < server->client_map.entries_count;
-                 ++entry_index)
+        /* RECEIVE */
         {
-            struct client_info ** client_entry = (struct client_info **)server->client_map.entries_begin + entry_index;
-            struct client_info * client = (*client_entry);
-
-            u32 packet_index_to_check = ((client->server_packet_seq + 1) & (32 - 1));
-            u32 bit_to_check = (1 << packet_index_to_check);
-            i32 is_packet_ack = (client->server_packet_seq_bit & bit_to_check) == bit_to_check;
-            i32 is_packet_critical = (client->server_packet_seq_critical & bit_to_check) == bit_to_check;
+            // the socket is drained up to a batch a frame, the batch is opened together
+            server_received received[SERVER_RECV_BATCH];
+            crypto_job open_jobs[SERVER_RECV_BATCH];
+            u32 received_count = 0;
 
-            if (!is_packet_ack)
+            while (received_count < SERVER_RECV_BATCH)
             {
-                if (is_packet_critical)
+                server_received * item = received + received_count;
+                u8 * wire = PacketWireBuffer(&item->datagram);
+                u32 max_packet_size = PACKET_WIRE_BUFFER_SIZE;
+
+                sockaddr_in from;
+                socklen_t fromLength = sizeof( from );
+
+                // lock
+                int bytes = recvfrom( server->handle, 
+                        (char *)wire, max_packet_size, 
+                        0, 
+                        (sockaddr*)&from, &fromLength );
+                // before socket_errno is looked at, the stamp is a syscall of its own
+                item->received_time = bytes > 0 ? GetSocketReceiveTime(server->handle, GetRealTime()) : 0;
+
+                item->addr = ntohl( from.sin_addr.s_addr );
+                item->port = ntohs( from.sin_port );
+                struct client_info * known_client = 0;
+                u8 client_public_key[CRYPTO_PUBLIC_KEY_SIZE];
+
+                if ( bytes == SOCKET_ERROR )
                 {
-                    
-                    ConsoleAppendAt(&con,10,0,
-                                "%s Package was lost! %u (critical?%s)",
-                                FormatIP(client->addr, client->port).ip ,
-                                (client->server_packet_seq - 31), 
-                                is_packet_critical ? "True" : "False");
-
-                    queue_message * queue = &client->queue_msg_to_send;
-                    struct message * msg = queue->messages + queue->next;
-                    u32 packet_index = queue->msg_sent_in_package_bit_index[queue->next];
-
-                    Assert(BetweenIn(packet_index,0,32));
-
-                    if (
-                            (packet_index == packet_index_to_check)
-                            &&
-                            IsCriticalMessage(msg)
-                       )
+                    i32 err = socket_errno;
+                    if (err != EWOULDBLOCK && err != WSAECONNRESET)
                     {
-                        // msg at next index needs to be re-sent. simply adv pointer
-                        queue->next += 1;
-                        queue->next &= (ArrayCount(queue->messages) - 1);
+                        logn("Error recvfrom(). %s", GetLastSocketErrorMessage());
+                        return 1;
                     }
 
-                    int next_index = (queue->next == queue->begin) ? queue->next + 1 : queue->next;
-                    next_index &= (ArrayCount(queue->messages) - 1);
-
-                    // corner case begin == next
-                    for (u32 i  = next_index; 
-                             i != queue->begin; 
-                            /* in loop code */)
+                    if (err == EWOULDBLOCK)
                     {
-                        msg = queue->messages + i;
-                        packet_index = queue->msg_sent_in_package_bit_index[i];
-                        if (
-                                (packet_index == packet_index_to_check)
-                                &&
-                                IsCriticalMessage(msg)
-                           )
-                        {
-                            // we need to send it again. swap if necessary and incr next
-                            if (queue->next != i)
-                            {
-                                struct message * next_msg = (queue->messages + queue->next);
-                                memcpy(next_msg,msg, sizeof(struct message));
-                                memset(msg, 0, sizeof(struct message));
-                            }
-                            queue->next += 1; 
-                            queue->next &= (ArrayCount(queue->messages) - 1);
-                        }
-                        i += 1;
-                        i &= (ArrayCount(queue->messages) - 1);
+                        // nothing to read
+                        break;
+                    }
+                    else if (err == WSAECONNRESET)
+                    {
+                        // conn reset in win32
+                        // handle it via time out
                     }
 
                 }
-            }
-        }
-
-        {
-            struct packet recv_datagram;
-            u32 max_packet_size = sizeof( recv_datagram );
-
-            sockaddr_in from;
-            socklen_t fromLength = sizeof( from );
-
-            // lock
-            int bytes = recvfrom( server->handle, 
-                    (char *)&recv_datagram, max_packet_size, 
-                    0, 
-                    (sockaddr*)&from, &fromLength );
-
-            u32 from_address = ntohl( from.sin_addr.s_addr );
-            u32 from_port = ntohs( from.sin_port );
-
-            if ( bytes == SOCKET_ERROR )
-            {
-                i32 err = socket_errno;
-                if (err != EWOULDBLOCK && err != WSAECONNRESET)
+                else if ( bytes == 0 )
                 {
-                    logn("Error recvfrom(). %s", GetLastSocketErrorMessage());
-                    return 1;
+                    Assert(0);
+                    logn("No more data. Closing.");
+                    //break;
                 }
-
-                if (err == EWOULDBLOCK)
+                else if ( !PacketCheckSalted(wire, &bytes, &item->session_salt) )
                 {
-                    // nothing to read
+                    // corrupted or not ours
                 }
-                else if (err == WSAECONNRESET)
+                else if ( (known_client = FindClient(item->addr, item->port, &server->client_map)) &&
+                          known_client->session_salt != item->session_salt )
                 {
-                    // conn reset in win32
-                    // handle it via time out
+                    // late datagram of an earlier session from this addr:port
+                }
+                else if ( CryptoHandshakeRead(wire, (u32)bytes, CRYPTO_HANDSHAKE_HELLO, client_public_key) )
+                {
+                    ServerHandshake(server, known_client, item, client_public_key, starting_time);
+                }
+                else if ( !known_client )
+                {
+                    // no key exchange yet, nothing to open it with
+                }
+                else if ( (item->wire_header_size = PacketHeaderWireSize(wire, (u32)bytes)) == 0 )
+                {
+                    // not ours or cut short
+                }
+                else
+                {
+                    // nonce takes the full seq
+                    packet_header header;
+                    PacketHeaderRead(wire, known_client->client_remote_seq, known_client->server_packet_seq, &header);
+
+                    // the client sends ChaCha20 until it has the auth reply
+                    u32 cipher = known_client->cipher;
+                    u32 fallback_ciphers = (1u << packet_cipher_chacha20_poly1305) | (1u << cipher);
+                    if (PacketOpenJob(open_jobs + received_count, &known_client->session_key, cipher, fallback_ciphers, CRYPTO_CLIENT_TO_SERVER,
+                                      &header, wire, item->wire_header_size, &bytes))
+                    {
+                        item->bytes = bytes;
+                        received_count += 1;
+                    }
                 }
-
-            }
-            else if ( bytes == 0 )
-            {
-                Assert(0);
-                logn("No more data. Closing.");
-                //break;
             }
-            else
-            {
-                struct client_info * client = Client(from_address, from_port, &server->client_map);
 
-                u32 recv_packet_seq = recv_datagram.header.seq;
-                u32 recv_packet_ack     = recv_datagram.header.ack;
-                u32 recv_packet_ack_bit = recv_datagram.header.ack_bit;
+            CryptoOpenBatch(open_jobs, received_count);
 
-                Assert( (client->server_packet_seq == recv_packet_ack) || IsSeqGreaterThan(client->server_packet_seq, recv_packet_ack));
+            for (u32 received_index = 0; received_index < received_count; ++received_index)
+            {
+                server_received * item = received + received_index;
+                struct packet * recv_datagram = &item->datagram;
 
-                struct message * messages[8];
-                i32 msg_count = recv_datagram.header.messages;
-                // datagram with 492b max payload can have at most
-                // 7.6 messages given that each msg has 32b header + 32b data
-                Assert(recv_datagram.header.messages <= sizeof(messages));
+                if ( !open_jobs[received_index].ok )
+                {
+                    // tampered with or sealed with another key
+                }
+                else if ( !PacketDecompressWire(PacketWireBuffer(recv_datagram), item->wire_header_size, &item->bytes, &server->compress_received) )
+                {
+                    // compressed payload that doesn't decode
+                }
+                else
+                {
+                    struct client_info * client = Client(item->addr, item->port, item->session_salt, starting_time, &server->client_map);
 
-                i32 lost_on_purpose = (rand() % 20) == 0;
-                //i32 lost_on_purpose = 0;
+                    u32 recv_payload_size = PacketFromWire(recv_datagram, (u32)item->bytes, item->wire_header_size,
+                                                           client->client_remote_seq, client->server_packet_seq);
 
-                u32 begin_data_offset = 0;
-                for (i32 msg_index = 0;
-                        msg_index < msg_count;
-                        ++msg_index)
-                {
-                    struct message ** msg = messages + msg_index;
-                    *msg = (struct message *)recv_datagram.data + begin_data_offset;
+                    u32 recv_packet_seq = recv_datagram->header.seq;
+                    u32 recv_packet_ack     = recv_datagram->header.ack;
+                    u32 recv_packet_ack_bit = recv_datagram->header.ack_bit;
 
-                    // strip critical flag
-                    (*msg)->header.message_type = GetMessageType(*msg);
+                    Assert( (client->server_packet_seq == recv_packet_ack) || IsSeqGreaterThan(client->server_packet_seq, recv_packet_ack));
 
-                    begin_data_offset += (sizeof((*msg)->header) + (*msg)->header.len);
-                }
+                    message delivered[CHANNEL_MAX_DELIVERED];
+                    u32 delivered_count = 0;
 
-                if (!lost_on_purpose)
-                {
+                    i32 lost_on_purpose = (rand() % 20) == 0;
+                    //i32 lost_on_purpose = 0;
+                    // malformed, or more messages than delivered holds: not acked, as if lost
+                    b32 packet_dropped = false;
 
-#if 0
-                    logn("[%i.%i.%i.%i] Message (%u) received %s", 
-                            (from_address >> 24),
-                            (from_address >> 16)  & 0xFF0000,
-                            (from_address >> 8)   & 0xFF00,
-                            (from_address >> 0)   & 0xFF,
-                            recv_datagram.header.seq, 
-                            (char *)((u8 *)recv_datagram.data + sizeof(message_header))); 
-#endif
-                    switch (client->status)
+                    if (!lost_on_purpose)
                     {
-                        case client_status_in_game:
+                        // records are read in place, a truncated one ends the packet
+                        message_iterator it = MessageIterator(recv_datagram->data, recv_payload_size, recv_datagram->header.messages);
+                        for (message * record = MessageNext(&it); record; record = MessageNext(&it))
+                        {
+                            udp_time_request time_request;
+                            if (GetMessageType(record) != package_type_time_sync)
                             {
-                            } break;
-                        case client_status_auth:
+                                if (!ChannelReceiveRecord(&client->channels, record, delivered, &delivered_count))
+                                {
+                                    packet_dropped = true;
+                                    break;
+                                }
+                            }
+                            else if (ReadMessage(time_request, record->data, record->header.len))
                             {
-                            } break;
-                        case client_status_none:
+                                // answered in the next data packet, a newer request replaces it
+                                client->time_request_pending = true;
+                                client->time_request_client_time = time_request.client_time;
+                                client->time_request_received = item->received_time;
+                            }
+                        }
+
+    #if 0
+                        logn("[%i.%i.%i.%i] Message (%u) received %s", 
+                                (item->addr >> 24),
+                                (item->addr >> 16)  & 0xFF0000,
+                                (item->addr >> 8)   & 0xFF00,
+                                (item->addr >> 0)   & 0xFF,
+                                recv_datagram->header.seq, 
+                                (char *)((u8 *)recv_datagram->data + sizeof(message_header))); 
+    #endif
+                        for (u32 msg_index = 0;
+                                msg_index < delivered_count;
+                                ++msg_index)
+                        {
+                            struct message * msg = delivered + msg_index;
+                            udp_pmtu_probe probe;
+                            if (GetMessageType(msg) == package_type_pmtu_probe && 
+                                ReadMessage(probe, msg->data, msg->header.len))
                             {
-                                const char reply[] = "Checking credentials";
+                                if (PmtuOnProbeAck(&client->pmtu, probe.size))
+                                {
+                                    CongestionSetMaxBytesPerSend(&client->cc, PmtuPayloadCapacity(&client->pmtu));
+                                }
+                            }
+                        }
 
-                                for (int msg_index = 0;
-                                        msg_index < msg_count;
-                                        ++msg_index)
+                        switch (client->status)
+                        {
+                            case client_status_in_game:
+                                {
+                                } break;
+                            case client_status_auth:
+                                {
+                                } break;
+                            case client_status_none:
                                 {
-                                    struct message * msg = messages[msg_index];
-                                    if (msg->header.message_type == package_type_auth)
+
+                                    for (u32 msg_index = 0;
+                                            msg_index < delivered_count;
+                                            ++msg_index)
                                     {
-                                        Assert(msg->header.len == sizeof(udp_auth));
-                                        struct udp_auth * login_data = (udp_auth *)msg->data;
+                                        struct message * msg = delivered + msg_index;
+                                        struct udp_auth login_data;
+                                        if (GetMessageType(msg) == package_type_auth &&
+                                            ReadMessage(login_data, msg->data, msg->header.len))
+                                        {
+                                            log_entry entry;
+                                            sprintf_s(entry.msg, ArrayCount(entry.msg),"user:%s, pwd:%s\n",login_data.user, login_data.pwd);
+                                            AddClientLogEntry(client,&entry);
+
+                                            client->status = client_status_trying_auth;
+
+                                            // sends with it from here on, the client follows on the reply
+                                            client->cipher = CryptoPickCipher(login_data.ciphers);
+
+                                            client->client_class = login_data.client_class;
+                                            CongestionSetMaxPacketsPerSecond(&client->cc, server_class_max_hz[client->client_class]);
+
+                                            struct udp_auth_reply reply = {};
+                                            sprintf_s(reply.text, ArrayCount(reply.text), "Checking credentials");
+                                            reply.cipher = client->cipher;
+                                            reply.tick_hz = SERVER_TICK_RATE;
+
+                                            u8 reply_data[sizeof(reply)];
+                                            u32 reply_size = WriteMessage(reply, reply_data, sizeof(reply_data));
+                                            CreatePackages(&client->channels,
+                                                           channel_reliable_ordered,
+                                                           package_type_auth, 
+                                                           (const void *)reply_data, reply_size,
+                                                           MESSAGE_PRIORITY_HIGH);
+
+                                            break;
+                                        }
+                                    }
+                                } break;
+                            case client_status_trying_auth:
+                                {
+                                };
+                            default:
+                                {
+                                } break;
+                        }
 
-                                        log_entry entry;
-                                        sprintf_s(entry.msg, ArrayCount(entry.msg),"user:%s, pwd:%s\n",login_data->user, login_data->pwd);
-                                        AddClientLogEntry(client,&entry);
+                        // ack only packets don't carry a seq of their own
+                        if ((recv_datagram->header.flags & PACKET_FLAG_ACK_ONLY) == 0 && !packet_dropped)
+                        {
+                            /* SYNC INCOMING PACKAGE SEQ WITH OUR RECORDS */
+                            // unless crafted package, recv package should always be higher than our record
+                            Assert(IsSeqGreaterThan(recv_packet_seq,client->client_remote_seq));
+
+                            // TODO: what if we lose all packages for 1 > s?
+                            // should we simply reset to 0 all bits and move on
+                            // TEST THIS
+                            // int on purpose check abs (to look at no branching method)
+                            // https://graphics.stanford.edu/~seander/bithacks.html#IntegerAbs
+                            i32 delta_local_remote_seq = abs((i32)(recv_packet_seq - client->client_remote_seq));
+                            Assert(delta_local_remote_seq < 32);
+
+                            u32 bit_mask = 0;
+                            u32 remote_bit_index = (recv_packet_seq & 31);
+
+                            // if delay is beyond 1 s we nullify our bit array
+                            if (delta_local_remote_seq < 32)
+                            {
+                                u32 local_bit_index = (client->client_remote_seq & 31);
 
-                                        client->status = client_status_trying_auth;
+                                u32 lo = min(remote_bit_index, local_bit_index);
+                                u32 hi = max(remote_bit_index, local_bit_index);
+                                u32 max_minus_hi = (31 - hi);
 
-//#pragma GCC diagnostic ignored "-Wcast-qual"
-                                        CreatePackages(&client->server_packet_seq_bit,
-                                                       &client->queue_msg_to_send, 
-                                                       package_type_auth, 
-                                                       (const void *)reply, sizeof(reply), 
-                                                       true);
+                                bit_mask = ((u32)~0 << (lo + max_minus_hi)) >> max_minus_hi;
 
-                                        break;
-                                    }
+                                //     hi        low 
+                                //      v         v
+                                // 00000111111111110000
+                                if (remote_bit_index >= local_bit_index)
+                                {
+                                    //     hi        low 
+                                    //      v         v
+                                    // 11111000000000001111
+                                    bit_mask = ~bit_mask; 
                                 }
-                            } break;
-                        case client_status_trying_auth:
-                            {
-                            };
-                        default:
-                            {
-                            } break;
-                    }
 
-                    /* SYNC INCOMING PACKAGE SEQ WITH OUR RECORDS */
-                    // unless crafted package, recv package should always be higher than our record
-                    Assert(IsSeqGreaterThan(recv_packet_seq,client->client_remote_seq));
+                                bit_mask = bit_mask ^ ((u32)1 << lo);
+                            }
+
+                            client->client_remote_seq_bit = (client->client_remote_seq_bit & bit_mask) | ((u32)1 << remote_bit_index);
+                            client->client_remote_seq = recv_packet_seq;
 
-                    // TODO: what if we lose all packages for 1 > s?
-                    // should we simply reset to 0 all bits and move on
-                    // TEST THIS
-                    // int on purpose check abs (to look at no branching method)
-                    // https://graphics.stanford.edu/~seander/bithacks.html#IntegerAbs
-                    i32 delta_local_remote_seq = abs((i32)(recv_packet_seq - client->client_remote_seq));
-                    Assert(delta_local_remote_seq < 32);
+                            // delayed ack
+                            if (client->client_packets_unacked++ == 0)
+                            {
+                                client->client_first_unacked_time = starting_time;
+                            }
+                        }
+                    }
 
-                    u32 bit_mask = 0;
-                    u32 remote_bit_index = (recv_packet_seq & 31);
+                    /* UPDATE OUR BIT ARRAY OF PACKAGES SENT CONFIRMED BY PEER */
 
-                    // if delay is beyond 1 s we nullify our bit array
-                    if (delta_local_remote_seq < 32)
                     {
-                        u32 local_bit_index = (client->client_remote_seq & 31);
+                        // unless crafted package, ack package should refer to lower
+                        Assert(
+                                (client->server_packet_seq == recv_packet_ack) || 
+                                IsSeqGreaterThan(client->server_packet_seq,recv_packet_ack)
+                                );
+                        u32 delta_seq_and_ack = (client->server_packet_seq - recv_packet_ack);
+                        u32 bit_mask = 0;
+
+                        if (delta_seq_and_ack < 32)
+                        {
+                            u32 remote_bit_index = (recv_packet_ack & 31);
+                            u32 local_bit_index = (client->server_packet_seq & 31);
 
-                        u32 lo = min(remote_bit_index, local_bit_index);
-                        u32 hi = max(remote_bit_index, local_bit_index);
-                        u32 max_minus_hi = (31 - hi);
+                            u32 lo = min(remote_bit_index, local_bit_index);
+                            u32 hi = max(remote_bit_index, local_bit_index);
+                            u32 max_minus_hi = (31 - hi);
 
-                        bit_mask = ((u32)~0 << (lo + max_minus_hi)) >> max_minus_hi;
+                            bit_mask = ((u32)~0 << (lo + max_minus_hi)) >> max_minus_hi;
 
-                        //     hi        low 
-                        //      v         v
-                        // 00000111111111110000
-                        if (remote_bit_index >= local_bit_index)
-                        {
                             //     hi        low 
                             //      v         v
-                            // 11111000000000001111
-                            bit_mask = ~bit_mask; 
-                        }
-
-                        bit_mask = bit_mask ^ ((u32)1 << lo);
-                    }
-
-                    client->client_remote_seq_bit = (client->client_remote_seq_bit & bit_mask) | ((u32)1 << remote_bit_index);
-                    client->client_remote_seq = recv_packet_seq;
-                }
-
-                /* UPDATE OUR BIT ARRAY OF PACKAGES SENT CONFIRMED BY PEER */
+                            // 00000111111111110000
+                            if (local_bit_index >= remote_bit_index)
+                            {
+                                //     hi        low 
+                                //      v         v
+                                // 11111000000000001111
+                                bit_mask = ~bit_mask; 
+                            }
 
-                {
-                    // unless crafted package, ack package should refer to lower
-                    Assert(
-                            (client->server_packet_seq == recv_packet_ack) || 
-                            IsSeqGreaterThan(client->server_packet_seq,recv_packet_ack)
-                            );
-                    u32 delta_seq_and_ack = (client->server_packet_seq - recv_packet_ack);
-                    u32 bit_mask = 0;
-
-                    if (delta_seq_and_ack < 32)
-                    {
-                        u32 remote_bit_index = (recv_packet_ack & 31);
-                        u32 local_bit_index = (client->server_packet_seq & 31);
+                            bit_mask = bit_mask ^ ((u32)1 << lo);
+                        }
 
-                        u32 lo = min(remote_bit_index, local_bit_index);
-                        u32 hi = max(remote_bit_index, local_bit_index);
-                        u32 max_minus_hi = (31 - hi);
+                        u32 new_packet_seq_bit = (recv_packet_ack_bit & bit_mask);
+                        if (IsSeqGreaterThan(client->server_packet_acked, recv_packet_ack))
+                        {
+                            // sent before one already here, its acks add to what that one told
+                            new_packet_seq_bit |= client->server_packet_seq_bit;
+                        }
 
-                        bit_mask = ((u32)~0 << (lo + max_minus_hi)) >> max_minus_hi;
+                        // rtt samples for congestion control
+                        u32 newly_ack_bits = new_packet_seq_bit & ~client->server_packet_seq_bit;
+                        for (u32 bit_index = 0; newly_ack_bits; ++bit_index, newly_ack_bits >>= 1)
+                        {
+                            if (newly_ack_bits & 1)
+                            {
+                                u64 rtt_ns = starting_time - client->server_packet_sent_time[bit_index];
+                                CongestionOnPacketAcked(&client->cc, NsToMs(rtt_ns));
+                                PmtuOnPacketAcked(&client->pmtu, client->server_packet_sent_size[bit_index]);
+                                ChannelsOnPacketAcked(&client->channels, SeqFromBitIndex(client->server_packet_seq, bit_index));
+                            }
+                        }
 
-                        //     hi        low 
-                        //      v         v
-                        // 00000111111111110000
-                        if (local_bit_index >= remote_bit_index)
+                        client->server_packet_seq_bit = new_packet_seq_bit;
+                        CongestionDetectLosses(&client->cc, client->server_packet_seq, client->server_packet_seq_bit);
+                        if (IsSeqGreaterThan(recv_packet_ack, client->server_packet_acked))
                         {
-                            //     hi        low 
-                            //      v         v
-                            // 11111000000000001111
-                            bit_mask = ~bit_mask; 
+                            client->server_packet_acked = recv_packet_ack;
                         }
 
-                        bit_mask = bit_mask ^ ((u32)1 << lo);
+                        client->last_update = starting_time;
                     }
-
-                    client->server_packet_seq_bit = (recv_packet_ack_bit & bit_mask);
-
-                    client->last_update = GetRealTime();
                 }
             }
         }
@@ -943,10 +1268,18 @@ main()
             if (*client_entry)
             {
                 int start_line = 1 + entry_index;
+                congestion_control * cc = &(*client_entry)->cc;
                 ConsoleAppendAt(&con,start_line,0,
-                             "[%i] Client %s", 
+                             "[%i] Client %s %4.1fpps %2.0fHz %3ub mtu %u rtt %5.1f loss %4.1f%% fec %u/%u unprotected copies %ub/%u saved snap %u/%u %ub", 
                              entry_index,
-                             FormatIP((*client_entry)->addr, (*client_entry)->port).ip);
+                             FormatIP((*client_entry)->addr, (*client_entry)->port).ip,
+                             cc->packets_per_second, (*client_entry)->send.rate_hz, cc->bytes_per_send, 
+                             (*client_entry)->pmtu.confirmed_size, cc->srtt_ms,
+                             cc->loss_rate * 100.0f, (*client_entry)->fec.groups_sent, (*client_entry)->fec.packets_unprotected,
+                             (*client_entry)->channels.redundant_bytes_sent,
+                             (*client_entry)->channels.retransmits_avoided,
+                             (*client_entry)->snapshots.delta_sent, (*client_entry)->snapshots.full_sent,
+                             (*client_entry)->snapshots.bytes_sent);
             }
         }
 #endif
@@ -958,104 +1291,353 @@ main()
             struct client_info ** client_entry = (struct client_info **)server->client_map.entries_begin + entry_index;
             struct client_info * client = (*client_entry);
 
-            delta_time dt_time = GetTimeDiff(GetRealTime(),client->last_update,clock_freq);
-
-            //logn("Time since client send msg %f", dt_time);
-
-            if (dt_time > 5000)
+            if (starting_time - client->last_update > SERVER_CLIENT_TIMEOUT_NS)
             {
+                if (client->pacing_slot != PACING_NO_SLOT)
+                {
+                    PacingReleaseSlot(&server->pacing, client->pacing_slot);
+                }
                 RemoveClient(client, &server->client_map);
                 entry_index -= 1;
+                continue;
+            }
+
+            if (client->pacing_slot == PACING_NO_SLOT)
+            {
+                client->pacing_slot = PacingAssignSlot(&server->pacing);
+            }
+        }
+
+        // what every send of this tick carries, whatever rate the client is at
+        WorldUpdate(server, tick_ms / 1000.0f);
+        world_tick += 1;
+        server->world.tick = (u32)world_tick;
+
+        /* BUCKET CLIENTS BY PACING SLOT */
+        server->transient_arena.size = 0;
+        i32 entries_count = server->client_map.entries_count;
+        struct client_info ** slot_clients = PushArray(&server->transient_arena, entries_count + 1, struct client_info *);
+        u32 slot_first[PACING_MAX_SLOTS + 1] = {};
+
+        for (int entry_index = 0; entry_index < entries_count; ++entry_index)
+        {
+            struct client_info * client = *((struct client_info **)server->client_map.entries_begin + entry_index);
+            slot_first[client->pacing_slot + 1] += 1;
+        }
+        for (u32 slot = 0; slot < server->pacing.slot_count; ++slot)
+        {
+            slot_first[slot + 1] += slot_first[slot];
+        }
+        {
+            u32 slot_fill[PACING_MAX_SLOTS];
+            memcpy(slot_fill, slot_first, sizeof(slot_fill));
+            for (int entry_index = 0; entry_index < entries_count; ++entry_index)
+            {
+                struct client_info * client = *((struct client_info **)server->client_map.entries_begin + entry_index);
+                slot_clients[slot_fill[client->pacing_slot]++] = client;
             }
+        }
 
-            //logn("Diff client last msg (%f - %f) = %f",QUAD_TO_MS(GetRealTime()),QUAD_TO_MS(client->last_message_from_server),GetTimeDiff(GetRealTime(), client->last_message_from_server,clock_freq));
+        u32 max_burst = 0;
+        // payload utilization of packets carrying messages
+        u32 tick_payload_used = 0;
+        u32 tick_payload_budget = 0;
+        u32 tick_packets_sent = 0;
+        u32 tick_bytes_sent = 0;
+        for (u32 slot = 0; slot < server->pacing.slot_count; ++slot)
+        {
+            if (slot_first[slot] == slot_first[slot + 1])
+            {
+                continue;
+            }
 
-            if (GetTimeDiff(GetRealTime(), client->last_message_from_server,clock_freq) > expected_ms_per_package)
+            // release this slot at its offset in the frame
+            // one now for every client of the slot, they go out together
+            u64 slot_offset_ns = MsToNs(PacingSlotOffsetMs(&server->pacing, slot, tick_ms));
+            real_time now = GetRealTime();
+            if (starting_time + slot_offset_ns > now)
             {
+                SleepUntil(starting_time + slot_offset_ns);
+                now = GetRealTime();
+            }
 
-                // signal next seq package as not received
-                client->server_packet_seq += 1;
-                u32 new_package_bit_index = (client->server_packet_seq & 31);
-                client->server_packet_seq_bit = 
-                    (client->server_packet_seq_bit & ~(1 << new_package_bit_index));
-
-                struct packet packet;
-                packet.header.seq       = client->server_packet_seq;
-                packet.header.ack       = client->client_remote_seq;
-                packet.header.ack_bit   = client->client_remote_seq_bit;
-                packet.header.protocol  = PROTOCOL_ID;
-                packet.header.messages  = 0;
-
-                i32 is_critical = 0;
-                u32 current_size = 0;
-                queue_message * queue = &client->queue_msg_to_send;
-                for (u32 i = queue->begin; 
-                        i != queue->next; 
-                        /* in loop code */)
+            u32 burst = 0;
+            for (u32 slot_index = slot_first[slot]; 
+                     slot_index < slot_first[slot + 1]; 
+                     ++slot_index)
+            {
+                struct client_info * client = slot_clients[slot_index];
+
+                /* RETRANSMIT TIMEOUT */
+                // nothing is sent to idle clients so seq slots can take long to be reused,
+                // messages of packets unacked for too long go back to pending right away
+                u64 rto_ns = MsToNs(CongestionRetransmitTimeoutMs(&client->cc));
+                u32 unacked_critical = client->server_packet_seq_critical & ~client->server_packet_seq_bit;
+                for (u32 bit_index = 0; unacked_critical; ++bit_index, unacked_critical >>= 1)
                 {
-                    struct message * msg = queue->messages + i;
-                    u32 msg_size = msg ->header.len + sizeof(message_header);
-                    u32 size_after_msg = (current_size + msg_size);
-
-                    if ( size_after_msg <= sizeof(packet.data) )
+                    if ((unacked_critical & 1) &&
+                        now - client->server_packet_sent_time[bit_index] > rto_ns)
                     {
-                        memcpy(packet.data + current_size, msg, msg_size);
+                        u32 lost_seq = SeqFromBitIndex(client->server_packet_seq, bit_index);
+                        u32 resend_count = ChannelsOnPacketLost(&client->channels, lost_seq);
+                        client->server_packet_seq_critical &= ~((u32)1 << bit_index);
+
+                        ConsoleAppendAt(&con,10,0,
+                                    "%s Package was lost! %u (%u msgs to resend)",
+                                    FormatIP(client->addr, client->port).ip ,
+                                    lost_seq, resend_count);
+                    }
+                }
+
+                // each client is sent the latest world tick at a rate of its own,
+                // capped by its class and by congestion control
+                SendScheduleUpdate(&client->send, SERVER_TICK_RATE,
+                                   server_class_max_hz[client->client_class], client->cc.packets_per_second);
+                b32 send_due = SendScheduleDue(&client->send, world_tick);
+
+                // world state goes to everyone past the first contact, as long as there is news for them
+                b32 snapshot_due = 
+                    send_due && 
+                    client->status != client_status_none &&
+                    SnapshotHasChanges(&client->snapshots, &server->world, 
+                                       client->server_packet_seq + 1, client->server_packet_seq_bit);
 
-                        is_critical = is_critical | IsCriticalMessage(msg);
-                        queue->msg_sent_in_package_bit_index[i] = new_package_bit_index;
+                if (send_due && (ChannelsHasPending(&client->channels) || snapshot_due))
+                {
+                    // signal next seq package as not received
+                    client->server_packet_seq += 1;
+                    u32 new_package_bit_index = (client->server_packet_seq & 31);
+
+                    // slot is reused, package sent 32 seq ago never got ack
+                    u32 new_package_bit = ((u32)1 << new_package_bit_index);
+                    CongestionOnPacketSent(&client->cc, client->server_packet_seq, client->server_packet_seq_bit);
+                    if ((client->server_packet_seq_bit & new_package_bit) == 0)
+                    {
+                        u32 lost_seq = client->server_packet_seq - 32;
+                        u32 resend_count = ChannelsOnPacketLost(&client->channels, lost_seq);
 
-                        current_size = size_after_msg;
-                        queue->begin += 1; 
-                        queue->begin &= (ArrayCount(queue->messages) - 1);
-                        packet.header.messages += 1;
-                        if (current_size >= sizeof(packet.data))
+                        if (PmtuOnPacketLost(&client->pmtu, client->server_packet_sent_size[new_package_bit_index]))
                         {
-                            break;
+                            CongestionSetMaxBytesPerSend(&client->cc, PmtuPayloadCapacity(&client->pmtu));
+                            client->pmtu_probe_time = now;
+                            ConsoleAppendAt(&con,11,0,
+                                        "%s Path MTU black hole, back to %u b",
+                                        FormatIP(client->addr, client->port).ip,
+                                        client->pmtu.confirmed_size);
                         }
+
+                        // retransmit timeout already took care of messages still in flight
+                        Assert(resend_count == 0 || (client->server_packet_seq_critical & new_package_bit));
+                    }
+                    CongestionUpdate(&client->cc);
+                    client->server_packet_seq_bit = 
+                        (client->server_packet_seq_bit & ~(1 << new_package_bit_index));
+
+                    struct packet packet;
+                    packet.header.seq       = client->server_packet_seq;
+                    packet.header.ack       = client->client_remote_seq;
+                    packet.header.ack_bit   = client->client_remote_seq_bit;
+                    packet.header.protocol  = PROTOCOL_ID;
+                    packet.header.flags     = 0;
+                    packet.header.messages  = 0;
+
+                    b32 is_critical = 0;
+                    u32 payload_budget = min(FecPayloadBudget(client->cc.loss_rate, PmtuPayloadCapacity(&client->pmtu)),
+                                             client->cc.bytes_per_send);
+                    u32 payload_used = 
+                        ChannelsPackPacket(&client->channels, client->server_packet_seq,
+                                           (u8 *)packet.data, payload_budget,
+                                           &packet.header.messages, &is_critical);
+                    if (snapshot_due)
+                    {
+                        // acks of the current slot were just cleared, it can't be a baseline
+                        payload_used += 
+                            SnapshotWrite(&client->snapshots, &server->world, 
+                                          client->server_packet_seq, client->server_packet_seq_bit,
+                                          (u8 *)packet.data + payload_used, payload_budget - payload_used,
+                                          &packet.header.messages);
+                    }
+                    /* TIME SYNC */
+                    if (client->time_request_pending &&
+                        now - client->time_request_received < CLOCK_SYNC_MAX_HOLD_NS)
+                    {
+                        udp_time_reply time_reply;
+                        time_reply.client_time = client->time_request_client_time;
+                        time_reply.server_receive_time = client->time_request_received;
+                        time_reply.tick = (u32)world_tick;
+                        // stamped as late as it can be, sealing and sendto are all that's left
+                        real_time server_send_time = GetRealTime();
+                        time_reply.server_hold_ns = (u32)(server_send_time - client->time_request_received);
+                        time_reply.since_tick_ns = (u32)(server_send_time - starting_time);
+                        u32 reply_size = 
+                            ClockSyncWriteRecord(time_reply, (u8 *)packet.data + payload_used, payload_budget - payload_used,
+                                                 &packet.header.messages);
+                        payload_used += reply_size;
+                        client->time_request_pending = (reply_size == 0);
+                    }
+                    else
+                    {
+                        client->time_request_pending = false;
                     }
 
-                    i += 1;
-                    i &= (ArrayCount(queue->messages) - 1);
-                }
+#if SERVER_REDUNDANT_RELIABLE
+                    payload_used += 
+                        ChannelsPackRedundant(&client->channels, client->server_packet_seq,
+                                              (u8 *)packet.data + payload_used, payload_budget - payload_used,
+                                              RedundancyDepth(client->cc.loss_rate), &packet.header.messages);
+#endif
 
-                client->server_packet_seq_critical = (client->server_packet_seq_critical & (~((u32)1 << new_package_bit_index)));
-                client->server_packet_seq_critical = 
-                    client->server_packet_seq_critical | 
-                    ( (is_critical ? 1 : 0) << new_package_bit_index );
+                    if (packet.header.messages)
+                    {
+                        tick_payload_used += payload_used;
+                        tick_payload_budget += payload_budget;
+                    }
 
-                if (SendPackage(server->handle,client->addr_ip, (void *)&packet, sizeof(packet)) == SOCKET_ERROR)
+                    client->server_packet_seq_critical = (client->server_packet_seq_critical & (~((u32)1 << new_package_bit_index)));
+                    client->server_packet_seq_critical = 
+                        client->server_packet_seq_critical | 
+                        ( (is_critical ? 1 : 0) << new_package_bit_index );
+
+                    u8 wire_buffer[PACKET_WIRE_BUFFER_SIZE];
+                    u32 datagram_size = 0;
+                    u8 * wire = PacketToWireCompressed(&packet, payload_used, client->server_packet_acked,
+                                                       wire_buffer, &datagram_size, &server->compress_sent);
+                    u32 wire_header_size = PacketHeaderWireSize(wire, datagram_size);
+                    datagram_size = OutboxPush(server, client, &packet.header,
+                                               wire, wire_header_size, datagram_size - wire_header_size);
+
+                    client->server_packet_sent_time[new_package_bit_index] = now;
+                    client->server_packet_sent_size[new_package_bit_index] = (u16)datagram_size;
+            
+                    client->last_message_from_server = now;
+                    client->last_packet_sent = now;
+                    client->client_packets_unacked = 0;
+                    tick_bytes_sent += datagram_size;
+                    tick_packets_sent += 1;
+                    burst += 1;
+
+                    /* FEC REPAIR */
+                    // repairs go right after the last packet of the group
+                    if (FecEncoderAddPacket(&client->fec, client->cc.loss_rate, PmtuPayloadCapacity(&client->pmtu),
+                                            client->server_packet_seq,
+                                            packet.header.messages, (u8 *)packet.data, payload_used, is_critical))
+                    {
+                        u32 sent = SendFecRepairs(server, client, &packet.header, &tick_bytes_sent);
+                        tick_packets_sent += sent;
+                        burst += sent;
+                    }
+                }
+                else
                 {
-                    //logn("Error sending ack package %u. %s", packet.header.seq, GetLastSocketErrorMessage());
-                    server->keep_alive = 0;
+                    /* ACK ONLY */
+                    // without payload acks are coalesced, sent once enough packets wait for one
+                    // or the oldest waited too long. Idle clients still hear from us every keepalive
+                    b32 ack_due = 
+                        (client->client_packets_unacked >= SERVER_ACK_COALESCE_PACKETS) ||
+                        (client->client_packets_unacked > 0 && 
+                         now - client->client_first_unacked_time >= SERVER_ACK_DELAY_NS);
+                    b32 keepalive_due = 
+                        now - client->last_packet_sent >= SERVER_KEEPALIVE_NS;
+
+                    if (ack_due || keepalive_due)
+                    {
+                        struct packet_header header;
+                        header.seq       = client->server_packet_seq;
+                        header.ack       = client->client_remote_seq;
+                        header.ack_bit   = client->client_remote_seq_bit;
+                        header.protocol  = PROTOCOL_ID;
+                        header.flags     = PACKET_FLAG_ACK_ONLY;
+                        header.messages  = 0;
+
+                        // nothing more coming for a while, repairs of the open group carry the ack
+                        u32 sent = SendFecRepairs(server, client, &header, &tick_bytes_sent);
+                        tick_packets_sent += sent;
+                        if (sent == 0)
+                        {
+                            u8 wire[PACKET_HEADER_MAX_WIRE_SIZE];
+                            u32 header_size = PacketHeaderWrite(&header, client->server_packet_acked, wire);
+                            tick_bytes_sent += OutboxPush(server, client, &header, wire, header_size, 0);
+                            tick_packets_sent += 1;
+                            sent = 1;
+                        }
+
+                        client->last_packet_sent = now;
+                        client->client_packets_unacked = 0;
+                        burst += sent;
+                    }
                 }
-                
-                client->last_message_from_server = GetRealTime();
-            }
-        }
 
-        // sleep expected time
-        delta_time time_frame_elapsed = 
-            GetTimeDiff(GetRealTime(), starting_time, clock_freq);
-        r32 remaining_ms = expected_ms_per_package - time_frame_elapsed;
+                /* PATH MTU PROBE */
+                if (server->pmtu_probing)
+                {
+                    pmtu_discovery * pmtu = &client->pmtu;
+                    u64 since_probe_ns = now - client->pmtu_probe_time;
 
-        ConsoleAppendAt(&con,0,0,"expected_ms_per_package: %f", expected_ms_per_package);
-        ConsoleAppendAt(&con,1,0,"time_frame_elapsed: %f", time_frame_elapsed);
-        ConsoleAppendAt(&con,2,0,"remaining_ms: %f", remaining_ms);
+                    if (pmtu->probe_size && since_probe_ns > MsToNs(PMTU_PROBE_TIMEOUT_MS))
+                    {
+                        PmtuOnProbeTimeout(pmtu);
+                    }
 
-        if (remaining_ms > 1.0f)
-        {
-            time_frame_elapsed = GetTimeDiff(GetRealTime(), starting_time, clock_freq);
-            remaining_ms = expected_ms_per_package - time_frame_elapsed;
-            while (remaining_ms > 1.0f)
-            {
-                msleep(remaining_ms);
-                time_frame_elapsed = GetTimeDiff(GetRealTime(), starting_time, clock_freq);
-                remaining_ms = expected_ms_per_package - time_frame_elapsed;
+                    if (pmtu->search_done && since_probe_ns > MsToNs(PMTU_REPROBE_MS))
+                    {
+                        PmtuStartSearch(pmtu);
+                    }
+
+                    u32 probe_size = PmtuNextProbeSize(pmtu);
+                    if (probe_size && (pmtu->probe_tries == 0 || since_probe_ns > MsToNs(PMTU_PROBE_TIMEOUT_MS)))
+                    {
+                        struct packet probe;
+                        probe.header.seq       = client->server_packet_seq;
+                        probe.header.ack       = client->client_remote_seq;
+                        probe.header.ack_bit   = client->client_remote_seq_bit;
+                        probe.header.protocol  = PROTOCOL_ID;
+                        probe.header.flags     = PACKET_FLAG_PMTU_PROBE;
+                        probe.header.messages  = 0;
+
+                        // the datagram is probe_size, whatever the header and trailer take comes off the padding
+                        u32 header_size = 0;
+                        u8 * wire = PacketToWire(&probe, client->server_packet_acked, &header_size);
+
+                        u32 padding = probe_size - header_size - CRYPTO_COUNTER_SIZE - CRYPTO_TAG_SIZE - PACKET_CHECK_SIZE;
+                        udp_pmtu_probe probe_msg = { probe_size };
+                        memset(probe.data, 0, padding);
+                        memcpy(probe.data, &probe_msg, sizeof(probe_msg));
+
+                        // too big for the interface fails when sent, same as lost
+                        u32 sealed_size = OutboxPush(server, client, &probe.header, wire, header_size, padding);
+                        Assert(sealed_size == probe_size);
+
+                        PmtuOnProbeSent(pmtu);
+                        client->pmtu_probe_time = now;
+                        tick_bytes_sent += probe_size;
+                        tick_packets_sent += 1;
+                        burst += 1;
+                    }
+                }
             }
-        }
 
+            OutboxFlush(server);
+            max_burst = max(max_burst, burst);
+        }
 
-        ConsoleAppendAt(&con,3,0,"Time Elapsed: %f", time_frame_elapsed);
+        // TickWait waits for the next one
+        u64 frame_elapsed_ns = GetRealTime() - starting_time;
+
+        ConsoleAppendAt(&con,0,0,"tick %u Hz, %f ms, world tick %llu", 
+                        SERVER_TICK_RATE, tick_ms, (unsigned long long)world_tick);
+        ConsoleAppendAt(&con,1,0,"time_frame_elapsed: %f", NsToMs(frame_elapsed_ns));
+        ConsoleAppendAt(&con,2,0,"tick late p50 < %llu us p99 < %llu us max %.1f us, %llu skipped %llu caught up",
+                        (unsigned long long)(TickJitterPercentile(&ticks, 50.0f) / 1000),
+                        (unsigned long long)(TickJitterPercentile(&ticks, 99.0f) / 1000),
+                        (r64)ticks.max_jitter_ns / 1000.0,
+                        (unsigned long long)ticks.ticks_skipped, (unsigned long long)ticks.ticks_caught_up);
+        ConsoleAppendAt(&con,4,0,"Max burst: %u (%u pacing slots) payload use: %3.0f%% sent: %u packets %u b", 
+                        max_burst, server->pacing.slot_count,
+                        100.0f * (r32)tick_payload_used / (r32)max(tick_payload_budget, 1),
+                        tick_packets_sent, tick_bytes_sent);
+        ConsoleAppendAt(&con,3,40,"Compressed %u/%u, %llu b saved", 
+                        server->compress_sent.packets_compressed, server->compress_sent.packets,
+                        (unsigned long long)(server->compress_sent.raw_bytes - server->compress_sent.wire_bytes));
 
         ConsoleSwapBuffer(&con);
 
@@ -1065,6 +1647,8 @@ main()
 
     DestroyConsole(&con);
 
+    TickJitterPrint(&ticks, stdout);
+
     ShutdownServer(server);
 
     ShutdownSockets();
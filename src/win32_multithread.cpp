@@ -1,5 +1,6 @@
 
 #include "multithread.h"
+#include "math.h"
     
 inline b32
 CompareAndExchangeIfMatches(volatile u32 * This, u32 UpdateTo, u32 IfMatchesThis)
@@ -80,6 +81,14 @@ WorkQueueThreadLoop(void * Parameter)
     }
 }
 
+THREAD_CORE_COUNT(GetCoreCount)
+{
+    SYSTEM_INFO Info;
+    GetSystemInfo(&Info);
+
+    return max((u32)Info.dwNumberOfProcessors, (u32)1);
+}
+
 void
 CleanWorkQueue(thread_work_queue * Queue)
 {
@@ -95,6 +104,7 @@ CleanWorkQueue(thread_work_queue * Queue)
     Queue->ThingsToDo = 0;
 }
 
+/* CountThreads 0 is a worker per core but the one calling CompleteWorkQueue */
 void
 CreateWorkQueue(thread_work_queue * Queue, u32 CountThreads)
 {
@@ -108,6 +118,12 @@ CreateWorkQueue(thread_work_queue * Queue, u32 CountThreads)
     CleanWorkQueue(Queue);
     void * ThreadParam = (void *)Queue;
 
+    if (CountThreads == 0)
+    {
+        CountThreads = max(GetCoreCount() - 1, (u32)1);
+    }
+    CountThreads = min(CountThreads, (u32)THREAD_MAX_WORKERS);
+
     DWORD DesiredAccess = SEMAPHORE_ALL_ACCESS; 
     HANDLE Semaphore = CreateSemaphoreExA( NullSecAttrib, 0, CountThreads, NullName, NullReservedFlags, DesiredAccess);
     Queue->Semaphore = Semaphore;
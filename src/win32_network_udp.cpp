@@ -29,6 +29,27 @@ SET_SOCKET_NON_BLOCKING(SetSocketNonBlocking)
     return result;
 }
 
+SET_SOCKET_DONT_FRAGMENT(SetSocketDontFragment)
+{
+    DWORD dont_fragment = TRUE;
+
+    int result = setsockopt( handle, IPPROTO_IP, IP_DONTFRAGMENT, (const char *)&dont_fragment, sizeof(dont_fragment) );
+
+    return result;
+}
+
+SET_SOCKET_RECEIVE_TIMESTAMPS(SetSocketReceiveTimestamps)
+{
+    // no receive timestamps through this api, GetSocketReceiveTime gives the time read
+    WSASetLastError(WSAEOPNOTSUPP);
+    return SOCKET_ERROR;
+}
+
+GET_SOCKET_RECEIVE_TIME(GetSocketReceiveTime)
+{
+    return now;
+}
+
 CREATE_SOCKET_UDP(CreateSocketUdp)
 {
     *handle = socket( AF_INET, SOCK_DGRAM, IPPROTO_UDP );
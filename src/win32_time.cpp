@@ -1,35 +1,46 @@
 #include "platform.h"
     
 #pragma comment( lib, "Winmm.lib" )
+#pragma comment( lib, "bcrypt.lib" )
+#include <bcrypt.h>
+
+static u64 time_counter_freq;
+
+/* QueryPerformanceCounter is the TSC already where it can be */
+TIME_INIT(TimeInit)
+{
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    time_counter_freq = (u64)freq.QuadPart;
+}
+
+TIME_USES_TSC(TimeUsesTsc)
+{
+    return false;
+}
 
 GET_REAL_TIME(GetRealTime)
 {
-    real_time time;
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
 
-    QueryPerformanceCounter(&time);
+    // counter * 10^9 overflows after a while, whole seconds apart
+    u64 ticks = (u64)counter.QuadPart;
+    u64 seconds = ticks / time_counter_freq;
+    u64 rest = ticks % time_counter_freq;
 
-    return time;
+    return seconds * NS_PER_SECOND + rest * NS_PER_SECOND / time_counter_freq;
 }
 
 GET_CLOCK_RESOLUTION(GetClockResolution)
 {
-    real_time perf_freq;
-    QueryPerformanceFrequency(&perf_freq); 
-    return perf_freq;
+    return NS_PER_SECOND;
 }
 
-/* Returns us milliseconds  */
 GET_TIME_DIFF(GetTimeDiff)
 {
-    real_time time;
-
-    time.QuadPart = TimeEnd.QuadPart - TimeStart.QuadPart;
-    time.QuadPart *= 1000000; // microseconds 10^-6
-    time.QuadPart /= ClockFreq.QuadPart;
-
-    delta_time time_diff = (r32)((r64)time.QuadPart * (1.0 / 1000.0));
-
-    return time_diff;
+    // end before start comes out negative
+    return (delta_time)((r64)(i64)(TimeEnd - TimeStart) * 1000.0 / (r64)ClockFreq);
 }
 
 MS_SLEEP(msleep)
@@ -38,6 +49,16 @@ MS_SLEEP(msleep)
     return 0;
 }
 
+/* whole ms at 1 ms granularity with HighDefinitionTimeBegin, callers spin the rest */
+SLEEP_UNTIL(SleepUntil)
+{
+    real_time now = GetRealTime();
+    if (deadline >= now + NS_PER_MS)
+    {
+        Sleep((DWORD)((deadline - now) / NS_PER_MS));
+    }
+}
+
 HIGH_DEFINITION_TIME_BEGIN(HighDefinitionTimeBegin) 
 {
     // http://www.geisswerks.com/ryan/FAQS/timing.html
@@ -48,3 +69,10 @@ HIGH_DEFINITION_TIME_END(HighDefinitionTimeEnd)
 {
     timeEndPeriod(1);
 };
+
+GET_OS_RANDOM(GetOsRandom)
+{
+    NTSTATUS status = BCryptGenRandom(0, (PUCHAR)out, size, BCRYPT_USE_SYSTEM_PREFERRED_RNG);
+
+    return BCRYPT_SUCCESS(status);
+}
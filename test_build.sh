@@ -0,0 +1,28 @@
+if [[ ! -d build ]]; then
+ mkdir build
+ mkdir build/debug
+ mkdir build/release
+fi
+
+serious_c_flags="-m64 -pedantic -Wshadow -Wpointer-arith -Wcast-qual"
+
+echo "Building tests"
+gcc $serious_c_flags -Wall -O2 -ggdb src/test_pacing.cpp -o build/release/test_pacing.exe
+gcc $serious_c_flags -Wall -O2 -ggdb src/test_send_rate.cpp -o build/release/test_send_rate.exe
+gcc $serious_c_flags -Wall -O2 -ggdb src/test_congestion.cpp -o build/release/test_congestion.exe
+gcc $serious_c_flags -Wall -O2 -ggdb src/test_packing.cpp src/linux_time.cpp -o build/release/test_packing.exe
+gcc $serious_c_flags -Wall -O2 -ggdb src/test_serialize.cpp src/linux_time.cpp -o build/release/test_serialize.exe
+gcc $serious_c_flags -Wall -O2 -ggdb src/test_header.cpp src/linux_time.cpp -o build/release/test_header.exe
+gcc $serious_c_flags -Wall -O2 -ggdb src/test_quantize.cpp src/linux_time.cpp -lm -o build/release/test_quantize.exe
+gcc $serious_c_flags -Wall -O2 -ggdb src/test_compress.cpp src/linux_time.cpp -o build/release/test_compress.exe
+gcc $serious_c_flags -Wall -O2 -ggdb src/test_range.cpp src/linux_time.cpp -o build/release/test_range.exe
+gcc $serious_c_flags -Wall -O2 -ggdb src/test_parse.cpp src/linux_time.cpp -o build/release/test_parse.exe
+gcc $serious_c_flags -Wall -O2 -ggdb src/test_snapshot.cpp src/linux_time.cpp -o build/release/test_snapshot.exe
+gcc $serious_c_flags -Wall -O2 -ggdb src/test_crc.cpp src/linux_time.cpp -o build/release/test_crc.exe
+gcc $serious_c_flags -Wall -O2 -ggdb src/test_fec.cpp -o build/release/test_fec.exe
+gcc $serious_c_flags -Wall -O2 -ggdb src/test_crypto.cpp src/linux_time.cpp -o build/release/test_crypto.exe
+gcc $serious_c_flags -Wall -O2 -ggdb src/test_time.cpp src/linux_time.cpp -o build/release/test_time.exe
+gcc $serious_c_flags -Wall -O2 -ggdb src/test_tick.cpp src/linux_time.cpp -o build/release/test_tick.exe
+gcc $serious_c_flags -Wall -O2 -ggdb src/test_clock_sync.cpp -o build/release/test_clock_sync.exe
+gcc $serious_c_flags -Wall -O2 -ggdb src/test_jitter_buffer.cpp -o build/release/test_jitter_buffer.exe
+gcc $serious_c_flags -Wall -O2 -ggdb src/test_multithread.cpp src/linux_time.cpp -lpthread -o build/release/test_multithread.exe